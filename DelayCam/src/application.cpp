@@ -1,49 +1,104 @@
 #include "application.h"
 #include "progresswidget.h"
-#include "cam/image.h"
 #include "cam/viewfinder.h"
+#include "cam/renderwindow.h"
 #include "cam/framepool.h"
+#include "cam/sharedpool.h"
+#include "cam/memorybudget.h"
+#include "cam/libcamerasession.h"
+#include "cam/syntheticsession.h"
+#include "cam/clipwriter.h"
+#include "net/streamserver.h"
+#include "net/controlserver.h"
+#include "audio/audiodelay.h"
 #include "util/logger.h"
-#include "wiringPi.h"
+#include "util/realtime.h"
+#include "input/gpiobutton.h"
+#include "input/simulatedbutton.h"
 
-#include <assert.h>
-#include <iomanip>
+#include <algorithm>
 #include <string>
 
 #include <QCoreApplication>
 #include <QCommandLineParser>
-#include <QMutexLocker>
 #include <QStringList>
+#include <QHBoxLayout>
 #include <QSettings>
 #include <QPixmap>
 #include <QCursor>
 #include <QScreen>
 #include <QDir>
+#include <QTimer>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
 
 using namespace libcamera;
 
-class CaptureEvent : public QEvent
-{
-public:
-    CaptureEvent() :
-        QEvent(type()) {
-    }
-
-    static Type type() {
-        static int type = QEvent::registerEventType();
-        return static_cast<Type>(type);
-    }
+// Keys applied while running, all others are only read at startup
+static const QStringList LiveSettings{
+    "framerate", "delay", "autofocus", "storage", "storagesize", "decimation", "buffers", "playback",
+    "droppedframes", "dropwarning", "loglevel", "streamframerate", "streamquality", "hud", "audiooffset"
 };
 
+// Control socket in the private runtime directory of the user, /tmp only without one
+static QString defaultControlSocket()
+{
+    const QString runtimeDir = qEnvironmentVariable("XDG_RUNTIME_DIR");
+    return (runtimeDir.isEmpty() ? QString("/tmp") : runtimeDir) + "/delaycam.sock";
+}
+
 Application::Application(int &argc, char **argv) :
     QApplication{argc, argv},
-    isCapturing_(false),
+    window_(nullptr),
     frameRate_(30.0),
     delaySeconds_(30.0),
     buttonPin_(17),
     alwaysAutoFocus_(false),
-    poolWasFull_(false)
+    renderThread_(false),
+    precompileShaders_(true),
+    hud_(false),
+    buttonMode_("gpio"),
+    buttonDebounce_(20),
+    buttonInterval_(10000),
+    realtimePriority_(0),
+    captureCpu_(-1),
+    renderCpu_(-1),
+    lockMemory_(false),
+    latencyProbe_(0),
+    maxCameras_(1),
+    syntheticCameras_(0),
+    separateScreens_(false),
+    streamServer_(nullptr),
+    streamAddress_("0.0.0.0"),
+    streamPort_(0),
+    streamFrameRate_(10.0),
+    streamQuality_(75),
+    streamRealtime_(false),
+    audioEnabled_(false),
+    audioCapture_("default"),
+    audioPlayback_("default"),
+    audioRate_(48000),
+    audioChannels_(1),
+    audioOffset_(0),
+    controlServer_(nullptr),
+    controlSocket_(defaultControlSocket()),
+    persistentPool_(false),
+    prefault_(true),
+    cachedBuffers_(true),
+    memoryBudget_(nullptr),
+    memoryReserve_(128),
+    storageScale_(0),
+    bufferCount_(0),
+    decimation_(0),
+    crossFade_(false),
+    concealDrops_(true),
+    dropWarning_(30),
+    configPath_(QDir::homePath() + "/.config/delaycam.cfg"),
+    settingsWatcher_(nullptr),
+    lastStartupMark_(0)
 {
+    startupTimer_.start();
+
     // Set app info
     setOrganizationName("chrizbee");
     setOrganizationDomain("chrizbee.github.io");
@@ -61,137 +116,686 @@ Application::Application(int &argc, char **argv) :
     parseSettings();
     parseCommandline();
     dcInfo(QString("Using GPIO %1 and %2s delay @ %3fps, autofocus: %4").arg(buttonPin_).arg(delaySeconds_).arg(frameRate_).arg(alwaysAutoFocus_));
+    markStartup("settings");
+
+    // Lock memory and start the latency probe before the first thread applies the profile
+    RealtimeProfile::Config realtime;
+    realtime.priority = realtimePriority_;
+    realtime.captureCpu = captureCpu_;
+    realtime.renderCpu = renderCpu_;
+    realtime.lockMemory = lockMemory_;
+    realtime.probeInterval = latencyProbe_;
+    RealtimeProfile::instance()->configure(realtime);
+
+    // A persistent pool needs a shared memory name
+    if (persistentPool_ && sharedMemoryName_.isEmpty())
+        sharedMemoryName_ = SharedPool::DefaultName;
+
+    // Start stream server in its own thread if a port is set
+    if (streamPort_ > 0) {
+        streamServer_ = new StreamServer;
+        streamServer_->setFrameRate(streamFrameRate_);
+        streamServer_->setQuality(streamQuality_);
+        streamServer_->setRealtimeEnabled(streamRealtime_);
+        streamServer_->moveToThread(&streamThread_);
+        connect(&streamThread_, &QThread::finished, streamServer_, &QObject::deleteLater);
+        streamThread_.setObjectName("StreamServer");
+        streamThread_.start();
+        QMetaObject::invokeMethod(streamServer_, "listen", Qt::QueuedConnection,
+            Q_ARG(QString, streamAddress_), Q_ARG(quint16, streamPort_));
+    }
 
-    // Create widgets
-    QString title = QString("Stream Delay = %1s").arg(delaySeconds_);
-    window_ = new QStackedWidget(nullptr);
-    progressWidget_ = new ProgressWidget(title, nullptr);
-    viewFinder_ = new ViewFinder(nullptr);
-
-    // Add viewfinder and progress widget to window
-    window_->addWidget(progressWidget_);
-    window_->addWidget(viewFinder_);
-
-    // Initialize and start camera
-    if (!initCamera())
-        progressWidget_->setTitle("No supported Camera connected!");
-    else if (!startCamera())
-        progressWidget_->setTitle("Failed to start Camera!");
-
-    // Initialize WiringPi and debounce timer
-    wiringPiSetupGpio();
-    pinMode(buttonPin_, INPUT);
-    pullUpDnControl(buttonPin_, PUD_UP);
-    autoFocusTimer_.setSingleShot(true);
-    autoFocusTimer_.setInterval(3000); // 3s
-
-    // Show fullscreen
-    // Simply showFullScreen is not working properly so we have to set geometry first
-    window_->setGeometry(QGuiApplication::primaryScreen()->geometry());
-    window_->showFullScreen();
+    // Create the button, a press shows the latest frame of every camera right away
+    if (buttonMode_ == "gpio")
+        button_ = std::make_unique<GpioButton>(buttonPin_);
+    else if (buttonMode_ == "simulated")
+        button_ = std::make_unique<SimulatedButton>(buttonInterval_, 500);
+    if (button_) {
+        button_->setDebounce(buttonDebounce_);
+        button_->setPressCallback([this]() {
+            for (CameraView &view : views_)
+                QMetaObject::invokeMethod(view.session.get(), &CameraSession::showRealtime, Qt::QueuedConnection);
+        });
+    }
+
+    // Shrink the pools under memory pressure instead of getting killed
+    memoryBudget_ = new MemoryBudget(static_cast<size_t>(memoryReserve_) * 1048576, this);
+    connect(memoryBudget_, &MemoryBudget::shrinkRequested, this, [this]() {
+        for (CameraView &view : views_)
+            QMetaObject::invokeMethod(view.session.get(), &CameraSession::shrinkPool, Qt::QueuedConnection);
+    });
+
+    // Initialize cameras and create their widgets
+    bool camerasFound = initCameras();
+    if (button_ && !button_->start()) {
+        for (CameraView &view : views_)
+            view.session->setButton(nullptr);
+        button_.reset();
+    }
+
+    // Serve the control socket in its own thread, it talks to the sessions directly
+    if (!controlSocket_.isEmpty()) {
+        std::vector<CameraSession *> sessions;
+        for (CameraView &view : views_)
+            sessions.push_back(view.session.get());
+        controlServer_ = new ControlServer(sessions);
+        connect(controlServer_, &ControlServer::delayRequested, this, &Application::setDelay);
+        connect(controlServer_, &ControlServer::saveRequested, this, &Application::saveClip);
+        connect(controlServer_, &ControlServer::hudRequested, this, &Application::setHud);
+        controlServer_->moveToThread(&controlThread_);
+        connect(&controlThread_, &QThread::finished, controlServer_, &QObject::deleteLater);
+        controlThread_.setObjectName("ControlServer");
+        controlThread_.start();
+        QMetaObject::invokeMethod(controlServer_, "listen", Qt::QueuedConnection, Q_ARG(QString, controlSocket_));
+    }
+    markStartup("cameras");
+    createWindows();
+    markStartup("windows");
+
+    // Start cameras once the event loop runs, so the progress screen is shown right away
+    QTimer::singleShot(0, this, [this, camerasFound]() {
+        if (!camerasFound)
+            views_.front().progressWidget->setTitle("No supported Camera connected!");
+        else if (!startCameras())
+            views_.front().progressWidget->setTitle("Failed to start Camera!");
+        else {
+            memoryBudget_->startMonitoring();
+            startAudio();
+            watchSettings();
+        }
+        markStartup("start");
+
+        // The pool takes seconds to fill, the first frame then links the programs from the cache
+        if (camerasFound && precompileShaders_) {
+            precompileShaders();
+            markStartup("shaders");
+        }
+    });
+}
+
+void Application::precompileShaders()
+{
+    // One program per format, cameras of the same model share it
+    QList<libcamera::PixelFormat> formats;
+    for (CameraView &view : views_)
+        if (view.session->format().isValid() && !formats.contains(view.session->format()))
+            formats << view.session->format();
+    for (const libcamera::PixelFormat &format : formats) {
+        double time = FrameRenderer::precompile(format);
+        if (time >= 0)
+            dcInfo(QString("Shader programs for %1 precompiled in %2ms").arg(format.toString().c_str()).arg(time, 0, 'f', 1));
+    }
 }
 
 Application::~Application()
 {
-    // Release camera resources
-    if (camera_) {
-        stopCamera();
-        camera_->release();
-        camera_.reset();
+    // Stop taking requests, they refer to the sessions
+    if (controlServer_) {
+        QMetaObject::invokeMethod(controlServer_, "close", Qt::BlockingQueuedConnection);
+        controlThread_.quit();
+        controlThread_.wait();
+    }
+
+    // The audio asks the first session for its delay
+    audio_.reset();
+
+    // Stop the button and capturing, then end the capture threads and release the cameras
+    if (button_)
+        button_->stop();
+    stopCameras();
+    for (CameraView &view : views_) {
+        if (!view.thread)
+            continue;
+        view.thread->quit();
+        view.thread->wait();
+        view.session.reset();
     }
 
     // Stop camera manager
     if (cm_)
         cm_->stop();
 
-    // Delete the window
+    // Stop stream server, it is deleted in its own thread
+    if (streamServer_) {
+        QMetaObject::invokeMethod(streamServer_, "close", Qt::BlockingQueuedConnection);
+        streamThread_.quit();
+        streamThread_.wait();
+    }
+
+    // Delete the windows
+    for (CameraView &view : views_)
+        if (view.stack->parentWidget() == nullptr)
+            delete view.stack;
     delete window_;
+    RealtimeProfile::instance()->stopProbe();
 }
 
-bool Application::initCamera()
+bool Application::initCameras()
 {
     // Create and start camera manager
     cm_ = std::make_unique<CameraManager>();
     if (cm_->start()) {
         dcError("Failed to start camera manager!");
-        return false;
+        cm_.reset();
     }
 
-    // Get camera from manager
-    if (cm_->cameras().empty()) {
-        dcWarning("No camera found!");
-        return false;
+    // Acquire cameras, skip those in use by someone else
+    if (cm_) {
+        for (const std::shared_ptr<Camera> &camera : cm_->cameras()) {
+            if (maxCameras_ > 0 && static_cast<int>(views_.size()) >= maxCameras_)
+                break;
+            if (camera->acquire()) {
+                dcWarning("Failed to acquire camera " + QString::fromStdString(camera->id()));
+                continue;
+            }
+            addSession(std::make_unique<LibcameraSession>(camera));
+            dcInfo("Using camera: " + views_.back().session->name());
+        }
+        if (views_.empty())
+            dcWarning("No camera found!");
     }
 
-    // Acquire camera
-    // Reset camera pointer if failed, so camera == nullptr
-    camera_ = cm_->cameras().front();
-    if (camera_->acquire()) {
-        dcWarning("Failed to acquire camera!");
-        camera_.reset();
-        return false;
+    // Add synthetic sources
+    for (int i = 0; i < syntheticCameras_; i++)
+        addSession(std::make_unique<SyntheticSession>(i));
+    return !views_.empty();
+}
+
+void Application::addSession(std::unique_ptr<CameraSession> session)
+{
+    // Every session processes its frames in its own thread
+    CameraView view;
+    view.thread = std::make_unique<QThread>();
+    view.thread->setObjectName("Capture " + QString::number(views_.size()));
+    session->moveToThread(view.thread.get());
+    session->setButton(button_.get());
+    view.thread->start();
+    QMetaObject::invokeMethod(session.get(), [name = view.thread->objectName()]() {
+        RealtimeProfile::instance()->applyToCurrentThread(RealtimeProfile::Role::Capture, name);
+    }, Qt::QueuedConnection);
+
+    // Only the first camera is streamed
+    if (streamServer_ && views_.empty())
+        session->setStreamServer(streamServer_, streamRealtime_);
+    view.session = std::move(session);
+    views_.push_back(std::move(view));
+}
+
+void Application::createWindows()
+{
+    // Every camera gets a progress widget and a viewfinder
+    // Keep one progress widget to show errors if there is no camera at all
+    QString title = QString("Stream Delay = %1s").arg(delaySeconds_);
+    if (views_.empty())
+        views_.emplace_back();
+    if (renderThread_ && !RenderWindow::isSupported()) {
+        dcWarning("Threaded OpenGL is not supported by this platform, rendering in the GUI thread");
+        renderThread_ = false;
+    }
+    for (CameraView &view : views_) {
+        view.stack = new QStackedWidget(nullptr);
+        view.progressWidget = new ProgressWidget(title, nullptr);
+        view.stack->addWidget(view.progressWidget);
+        if (renderThread_) {
+            view.renderWindow = new RenderWindow;
+            view.renderWindow->setObjectName(QString::number(&view - &views_.front()));
+            view.stack->addWidget(QWidget::createWindowContainer(view.renderWindow, nullptr));
+        } else {
+            view.viewFinder = new ViewFinder(nullptr);
+            view.stack->addWidget(view.viewFinder);
+        }
+        if (!view.session)
+            continue;
+
+        // The overlay reads the statistics the capture thread publishes, from the rendering thread
+        CameraSession *session = view.session.get();
+        HudOverlay::Source hudSource = [session](HudOverlay::Status &status) {
+            const CameraSession::Stats stats = session->stats();
+            status.delay = stats.delay;
+            status.delayTarget = stats.delayTarget;
+            status.frameRate = stats.frameRate;
+            status.drops = stats.drops;
+            status.dropsPerMinute = stats.dropsPerMinute;
+            status.poolSize = stats.poolSize;
+            status.poolCapacity = stats.poolCapacity;
+            status.realtime = stats.realtime;
+            status.frozen = stats.frozen;
+            status.replaying = stats.replaying;
+            status.scrubbing = stats.scrubbing;
+        };
+        if (view.renderWindow)
+            view.renderWindow->setHudSource(hudSource);
+        else view.viewFinder->setHudSource(hudSource);
+
+        // The scrub timeline reads the thumbnails of the pool the session currently has
+        ThumbnailStrip::Source scrubSource = [session](ThumbnailStrip::Position &position) {
+            const CameraSession::ScrubState state = session->scrubState();
+            position.pool = session->pool();
+            position.timestamp = state.timestamp;
+            position.settled = state.settled;
+        };
+        if (view.renderWindow)
+            view.renderWindow->setScrubSource(scrubSource);
+        else view.viewFinder->setScrubSource(scrubSource);
+
+        // Frames go from the capture thread straight into the mailbox of the viewfinder or render window
+        CameraView *viewPtr = &view;
+        connect(view.session.get(), &CameraSession::frameReady, view.stack,
+            [viewPtr](const std::shared_ptr<const FramePool> &pool, const PooledFrame *frame, quint64 sequence,
+                      const PooledFrame *next, quint64 nextSequence, float blend) {
+                if (viewPtr->renderWindow)
+                    viewPtr->renderWindow->post(pool, frame, sequence, next, nextSequence, blend);
+                else viewPtr->viewFinder->post(pool, frame, sequence, next, nextSequence, blend);
+            }, Qt::DirectConnection);
+
+        // Switch to the frames once the pool is full
+        connect(view.session.get(), &CameraSession::frameReady, view.stack, [this, viewPtr]() {
+            viewPtr->stack->setCurrentIndex(1);
+            if (viewPtr == &views_.front())
+                markStartup("fill");
+        }, Qt::SingleShotConnection);
+
+        // The first frame on screen includes creating the context and the shader programs of the view
+        if (&view == &views_.front()) {
+            auto shown = [this]() {
+                markStartup("shown");
+                dcInfo("Startup breakdown: " + startupPhases_.join(", ") +
+                    QString(", total %1ms").arg(startupTimer_.elapsed()));
+            };
+            if (view.renderWindow)
+                connect(view.renderWindow, &RenderWindow::firstFramePresented, this, shown, Qt::SingleShotConnection);
+            else connect(view.viewFinder, &ViewFinder::firstFramePresented, this, shown, Qt::SingleShotConnection);
+        }
+
+        connect(view.session.get(), &CameraSession::fillProgress, view.progressWidget,
+            [this, viewPtr](quint64 size, quint64 capacity) {
+                if (size == 1 && viewPtr == &views_.front())
+                    markStartup("first frame");
+                viewPtr->progressWidget->setProgress(size, capacity);
+            });
+    }
+
+    // Show all cameras side by side on the primary screen or each on its own screen
+    // Simply showFullScreen is not working properly so we have to set geometry first
+    QList<QScreen *> screens = QGuiApplication::screens();
+    if (separateScreens_ && views_.size() > 1) {
+        for (size_t i = 0; i < views_.size(); i++) {
+            QScreen *screen = screens.at(i % screens.size());
+            views_[i].stack->setGeometry(screen->geometry());
+            views_[i].stack->showFullScreen();
+        }
     } else {
-        QString name = QString::fromStdString(*camera_->properties().get(libcamera::properties::Model));
-        dcInfo("Using camera: " + name);
+        window_ = new QWidget(nullptr);
+        QHBoxLayout *layout = new QHBoxLayout(window_);
+        layout->setContentsMargins(0, 0, 0, 0);
+        layout->setSpacing(0);
+        for (CameraView &view : views_)
+            layout->addWidget(view.stack);
+        window_->setGeometry(QGuiApplication::primaryScreen()->geometry());
+        window_->showFullScreen();
     }
-    return true;
+    showHud();
 }
 
-bool Application::startCamera()
+bool Application::startCameras()
 {
-    stopCamera();
-    return configureCamera();
+    // Each camera gets an equal share of the RAM budget
+    size_t memoryLimit = memoryBudget_->available() / views_.size();
+    dcInfo(QString("Memory budget: %1MB per camera, cgroup limit: %2MB")
+        .arg(memoryLimit / 1048576).arg(MemoryBudget::cgroupLimit() / 1048576));
+
+    // Start all sessions, the first failure is reported
+    bool success = true;
+    for (CameraView &view : views_) {
+        if (!view.session->start(sessionConfig(view, memoryLimit))) {
+            success = false;
+            continue;
+        }
+        if (view.renderWindow)
+            view.renderWindow->setFormat(view.session->format(), view.session->size(), view.session->stride());
+        else view.viewFinder->setFormat(view.session->format(), view.session->size(), view.session->stride());
+    }
+    return success;
 }
 
-void Application::stopCamera()
+CameraSession::Config Application::sessionConfig(const CameraView &view, size_t memoryLimit) const
 {
-    // Stop camera if capturing
-    if (!isCapturing_)
-        return;
-    isCapturing_ = false;
-    camera_->stop();
-    camera_->requestCompleted.disconnect(this);
-
-    // Clear buffers and queues
-    mappedBuffers_.clear();
-    requests_.clear();
-    allocator_.reset();
-    config_.reset();
-    freeBuffers_.clear();
-    doneQueue_.clear();
+    // Frames are requested at the size of the area they are shown in
+    QSize screenSize = QGuiApplication::primaryScreen()->size();
+    if (!separateScreens_)
+        screenSize.setWidth(screenSize.width() / views_.size());
+
+    CameraSession::Config config;
+    config.frameRate = frameRate_;
+    config.delaySeconds = delaySeconds_;
+    config.size = separateScreens_ ? view.stack->screen()->size() : screenSize;
+    config.alwaysAutoFocus = alwaysAutoFocus_;
+    config.memoryLimit = memoryLimit;
+    config.persistentPool = persistentPool_;
+    config.prefault = prefault_;
+    config.cachedBuffers = cachedBuffers_;
+    config.storageScale = storageScale_;
+    config.bufferCount = bufferCount_;
+    config.storageSize = storageSize_;
+    config.decimation = decimation_;
+    config.crossFade = crossFade_;
+    config.concealDrops = concealDrops_;
+    config.dropWarning = dropWarning_;
+
+    // Only one pool can be exported under the configured name
+    if (!sharedMemoryName_.isEmpty())
+        config.sharedMemoryName = &view == &views_.front() ? sharedMemoryName_ : sharedMemoryName_ + QString::number(&view - &views_.front());
+    return config;
 }
 
-void Application::releaseCamera()
+void Application::markStartup(const QString &phase)
 {
-    stopCamera();
+    // Remember the time since the previous phase
+    qint64 now = startupTimer_.elapsed();
+    startupPhases_ << QString("%1 %2ms").arg(phase).arg(now - lastStartupMark_);
+    lastStartupMark_ = now;
 }
 
-bool Application::event(QEvent *e)
+void Application::stopCameras()
 {
-    // Handle capture events
-    if (e->type() == CaptureEvent::type()) {
-        processCaptureEvent();
-        return true;
-    } else return QApplication::event(e);
+    memoryBudget_->stopMonitoring();
+    for (CameraView &view : views_)
+        if (view.session)
+            view.session->stop();
 }
 
 void Application::parseSettings()
 {
-    // Get the config file path
-    QString configPath = QDir::homePath() + "/.config/delaycam.cfg";
-
     // Check if config file exists
-    if (!QFile::exists(configPath)) {
+    if (!QFile::exists(configPath_)) {
         dcInfo("Config file not found");
         return;
     }
 
+    // Keep the values of the file to find changes later
+    QSettings settings(configPath_, QSettings::IniFormat);
+    for (const QString &key : settings.allKeys())
+        settings_[key] = settings.value(key);
+
     // Read settings with current values as defaults
-    QSettings settings(configPath, QSettings::IniFormat);
+    readLiveSettings(settings_);
+    buttonPin_ = settings.value("buttonpin", buttonPin_).toInt();
+    buttonMode_ = settings.value("button", buttonMode_).toString();
+    buttonDebounce_ = settings.value("buttondebounce", buttonDebounce_).toInt();
+    buttonInterval_ = settings.value("buttoninterval", buttonInterval_).toInt();
+    realtimePriority_ = settings.value("realtimepriority", realtimePriority_).toInt();
+    captureCpu_ = settings.value("capturecpu", captureCpu_).toInt();
+    renderCpu_ = settings.value("rendercpu", renderCpu_).toInt();
+    lockMemory_ = settings.value("lockmemory", lockMemory_).toBool();
+    latencyProbe_ = settings.value("latencyprobe", latencyProbe_).toInt();
+    renderThread_ = settings.value("renderthread", renderThread_).toBool();
+    precompileShaders_ = settings.value("precompileshaders", precompileShaders_).toBool();
+    streamAddress_ = settings.value("streamaddress", streamAddress_).toString();
+    streamPort_ = settings.value("streamport", streamPort_).toInt();
+    streamRealtime_ = settings.value("streamrealtime", streamRealtime_).toBool();
+    controlSocket_ = settings.value("controlsocket", controlSocket_).toString();
+    sharedMemoryName_ = settings.value("sharedmemory", sharedMemoryName_).toString();
+    persistentPool_ = settings.value("persistentpool", persistentPool_).toBool();
+    prefault_ = settings.value("prefault", prefault_).toBool();
+    cachedBuffers_ = settings.value("cachedbuffers", cachedBuffers_).toBool();
+    memoryReserve_ = settings.value("memoryreserve", memoryReserve_).toInt();
+    maxCameras_ = settings.value("cameras", maxCameras_).toInt();
+    syntheticCameras_ = settings.value("syntheticcameras", syntheticCameras_).toInt();
+    separateScreens_ = settings.value("layout", separateScreens_ ? "screens" : "sidebyside").toString() == "screens";
+    audioEnabled_ = settings.value("audio", audioEnabled_).toBool();
+    audioCapture_ = settings.value("audioin", audioCapture_).toString();
+    audioPlayback_ = settings.value("audioout", audioPlayback_).toString();
+    audioRate_ = settings.value("audiorate", audioRate_).toInt();
+    audioChannels_ = settings.value("audiochannels", audioChannels_).toInt();
+}
+
+void Application::readLiveSettings(const QVariantMap &settings)
+{
+    // Keys of LiveSettings with current values as defaults
     frameRate_ = settings.value("framerate", frameRate_).toFloat();
     delaySeconds_ = settings.value("delay", delaySeconds_).toFloat();
-    buttonPin_ = settings.value("buttonpin", buttonPin_).toInt();
     alwaysAutoFocus_ = settings.value("autofocus", alwaysAutoFocus_).toBool();
+    streamFrameRate_ = settings.value("streamframerate", streamFrameRate_).toFloat();
+    streamQuality_ = settings.value("streamquality", streamQuality_).toInt();
+    QString storage = settings.value("storage", "auto").toString();
+    storageScale_ = storage == "raw" ? 1 : storage == "reduced" ? 2 : storage == "minimal" ? 4 : 0;
+    bufferCount_ = settings.value("buffers", bufferCount_).toUInt();
+    decimation_ = settings.value("decimation", decimation_).toUInt();
+    crossFade_ = settings.value("playback", crossFade_ ? "crossfade" : "repeat").toString() == "crossfade";
+    concealDrops_ = settings.value("droppedframes", concealDrops_ ? "repeat" : "skip").toString() == "repeat";
+    dropWarning_ = settings.value("dropwarning", dropWarning_).toUInt();
+    hud_ = settings.value("hud", hud_).toBool();
+    audioOffset_ = settings.value("audiooffset", audioOffset_).toInt();
+    QStringList storageSize = settings.value("storagesize").toString().split('x');
+    storageSize_ = storageSize.size() == 2 ? QSize(storageSize[0].toInt(), storageSize[1].toInt()) : QSize();
+    QString logLevel = settings.value("loglevel", "info").toString();
+    dcLogger->setLevel(logLevel == "trace" ? LogLevel::TRACE : logLevel == "debug" ? LogLevel::DEBUG :
+        logLevel == "warning" ? LogLevel::WARNING : logLevel == "error" ? LogLevel::CRITICAL : LogLevel::INFO);
+}
+
+void Application::watchSettings()
+{
+    // inotify on the file and its directory, editors often replace the file instead of writing it
+    settingsWatcher_ = new QFileSystemWatcher(this);
+    settingsWatcher_->addPath(QFileInfo(configPath_).absolutePath());
+    if (QFile::exists(configPath_))
+        settingsWatcher_->addPath(configPath_);
+    reloadTimer_.setSingleShot(true);
+    reloadTimer_.setInterval(200);
+    connect(&reloadTimer_, &QTimer::timeout, this, &Application::reloadSettings);
+    auto changed = [this]() {
+        if (QFile::exists(configPath_) && !settingsWatcher_->files().contains(configPath_))
+            settingsWatcher_->addPath(configPath_);
+        reloadTimer_.start();
+    };
+    connect(settingsWatcher_, &QFileSystemWatcher::fileChanged, this, changed);
+    connect(settingsWatcher_, &QFileSystemWatcher::directoryChanged, this, changed);
+}
+
+void Application::reloadSettings()
+{
+    // Compare the file to the values in use, other files of the directory change nothing
+    reloadClock_.start();
+    QSettings settings(configPath_, QSettings::IniFormat);
+    if (settings.status() != QSettings::NoError) {
+        dcWarning("Failed to read the changed config file, keeping the current settings");
+        return;
+    }
+    QVariantMap values;
+    for (const QString &key : settings.allKeys())
+        values[key] = settings.value(key);
+    QStringList changed;
+    for (const QString &key : values.keys())
+        if (values.value(key) != settings_.value(key))
+            changed << key;
+    for (const QString &key : settings_.keys())
+        if (!values.contains(key))
+            changed << key;
+    if (changed.isEmpty())
+        return;
+    dcInfo("Config file changed: " + changed.join(", "));
+
+    // Invalid values keep the current ones
+    auto keep = [this, &values](const QString &key) {
+        dcWarning(QString("Invalid %1 %2 ignored").arg(key, values.value(key).toString()));
+        if (settings_.contains(key))
+            values[key] = settings_.value(key);
+        else values.remove(key);
+    };
+    bool valid = false;
+    float frameRate = values.value("framerate", frameRate_).toFloat(&valid);
+    if (!valid || frameRate <= 0 || frameRate > 120)
+        keep("framerate");
+    float delay = values.value("delay", delaySeconds_).toFloat(&valid);
+    if (!valid || delay <= 0 || delay > 3600)
+        keep("delay");
+    int audioOffset = values.value("audiooffset", audioOffset_).toInt(&valid);
+    if (!valid || audioOffset < -1000 || audioOffset > 1000)
+        keep("audiooffset");
+
+    // Everything else only takes effect after a restart
+    QStringList startupOnly;
+    for (const QString &key : changed)
+        if (!LiveSettings.contains(key))
+            startupOnly << key;
+    if (!startupOnly.isEmpty())
+        dcWarning("Restart DelayCam to apply " + startupOnly.join(", "));
+
+    // Command line values stay until their key changes in the file
+    for (const QString &key : changed)
+        commandLine_.remove(key);
+    QVariantMap live = values;
+    for (auto it = commandLine_.cbegin(); it != commandLine_.cend(); ++it)
+        live[it.key()] = it.value();
+    settings_ = values;
+    readLiveSettings(live);
+    if (streamServer_) {
+        streamServer_->setFrameRate(streamFrameRate_);
+        QMetaObject::invokeMethod(streamServer_, "setQuality", Qt::QueuedConnection, Q_ARG(int, streamQuality_));
+    }
+    showHud();
+    if (audio_)
+        audio_->setOffset(audioOffset_);
+    applySettings();
+}
+
+void Application::setDelay(float seconds)
+{
+    // Like a command line value, kept until the delay changes in the file
+    dcInfo(QString("Delay of %1s requested").arg(seconds));
+    reloadClock_.start();
+    delaySeconds_ = seconds;
+    commandLine_["delay"] = seconds;
+    applySettings();
+}
+
+void Application::saveClip(int camera, float seconds, const QString &path)
+{
+    // The writer keeps the pool alive, even if it is replaced meanwhile
+    if (camera < 0 || camera >= static_cast<int>(views_.size()) || !views_[camera].session)
+        return;
+    CameraSession *session = views_[camera].session.get();
+    ClipWriter *writer = new ClipWriter(session->name(), session->pool(), seconds, path, this);
+    connect(writer, &QThread::finished, writer, &QObject::deleteLater);
+    writer->start();
+}
+
+void Application::setHud(bool visible)
+{
+    // Like a command line value, kept until the key changes in the file
+    hud_ = visible;
+    commandLine_["hud"] = visible;
+    showHud();
+}
+
+void Application::showHud()
+{
+    // Every view shows the overlay of its own session
+    for (CameraView &view : views_) {
+        if (view.renderWindow)
+            view.renderWindow->setHudVisible(hud_);
+        else if (view.viewFinder)
+            view.viewFinder->setHudVisible(hud_);
+    }
+}
+
+void Application::startAudio()
+{
+    // The sound of the scene follows the delayed view of the first camera
+    if (!audioEnabled_ || views_.empty() || !views_.front().session)
+        return;
+    AudioDelay::Config config;
+    config.captureDevice = audioCapture_;
+    config.playbackDevice = audioPlayback_;
+    config.rate = static_cast<unsigned int>(std::max(audioRate_, 0));
+    config.channels = static_cast<unsigned int>(std::max(audioChannels_, 0));
+    config.delaySeconds = delaySeconds_;
+    config.offsetMs = audioOffset_;
+    const CameraSession *session = views_.front().session.get();
+    if (!audio_)
+        audio_ = std::make_unique<AudioDelay>();
+    if (!audio_->start(config, [session]() { return session->shownDelay(); })) {
+        dcWarning("Audio: Running without sound");
+        audio_.reset();
+    }
+}
+
+void Application::applySettings()
+{
+    // The audio ring is sized for the delay, a longer one starts it over
+    if (audio_ && delaySeconds_ > audio_->capacity())
+        startAudio();
+
+    // Sessions take over what they can between two frames, the rest needs a restart or a new pool
+    std::vector<std::pair<CameraView *, CameraSession::Config>> restarted;
+    std::vector<std::pair<CameraView *, CameraSession::Config>> refilled;
+    for (CameraView &view : views_) {
+        if (!view.session)
+            continue;
+        CameraSession *session = view.session.get();
+        CameraSession::Config config = sessionConfig(view, session->memoryLimit());
+        switch (session->compare(config)) {
+        case CameraSession::Change::None:
+            break;
+        case CameraSession::Change::Live:
+            QMetaObject::invokeMethod(session, [session, config, clock = reloadClock_]() {
+                session->updateConfig(config);
+                dcInfo(QString("%1: Settings applied live in %2ms").arg(session->name()).arg(clock.elapsed()));
+            }, Qt::QueuedConnection);
+            break;
+        case CameraSession::Change::Restart:
+            restarted.emplace_back(&view, config);
+            break;
+        case CameraSession::Change::NewPool:
+            if (!sharedMemoryName_.isEmpty())
+                dcWarning(session->name() + ": Restart DelayCam to resize the shared pool");
+            else refilled.emplace_back(&view, config);
+            break;
+        }
+    }
+    if (restarted.empty() && refilled.empty())
+        return;
+
+    // Stop all affected sessions first, so the memory released by one is available to the others
+    // The renderers must not hold on to frames of a released pool
+    for (auto &[view, config] : restarted) {
+        view->session->stop();
+        view->session->updateConfig(config);
+    }
+    for (auto &[view, config] : refilled) {
+        view->session->stop();
+        if (view->renderWindow)
+            view->renderWindow->post(nullptr, nullptr, 0, nullptr, 0, 0);
+        else view->viewFinder->post(nullptr, nullptr, 0, nullptr, 0, 0);
+        view->session->releasePools();
+        view->progressWidget->setTitle(QString("Stream Delay = %1s").arg(delaySeconds_));
+        view->stack->setCurrentIndex(0);
+    }
+    size_t memoryLimit = refilled.empty() ? 0 : memoryBudget_->available() / refilled.size();
+
+    // Start again, a new pool shows the delayed view once it is full
+    for (auto *group : { &restarted, &refilled }) {
+        for (auto &[target, config] : *group) {
+            if (group == &refilled)
+                config.memoryLimit = memoryLimit;
+            CameraView *view = target;
+            CameraSession *session = view->session.get();
+            if (!session->start(config)) {
+                dcError(session->name() + ": Failed to restart with the new settings!");
+                continue;
+            }
+            if (view->renderWindow)
+                view->renderWindow->setFormat(session->format(), session->size(), session->stride());
+            else view->viewFinder->setFormat(session->format(), session->size(), session->stride());
+            dcInfo(QString("%1: Camera restarted in %2ms%3").arg(session->name()).arg(reloadClock_.elapsed())
+                .arg(group == &refilled ? ", filling a new pool" : ""));
+            if (group == &refilled)
+                connect(session, &CameraSession::frameReady, view->stack, [view, session, clock = reloadClock_]() {
+                    view->stack->setCurrentIndex(1);
+                    dcInfo(QString("%1: Delayed view back after %2ms").arg(session->name()).arg(clock.elapsed()));
+                }, Qt::SingleShotConnection);
+        }
+    }
 }
 
 void Application::parseCommandline()
@@ -207,7 +811,10 @@ void Application::parseCommandline()
     QCommandLineOption delayOption(    QStringList() << "d" << "delay",     "Stream delay in seconds", "delay");
     QCommandLineOption buttonPinOption(QStringList() << "b" << "buttonpin", "Button GPIO number",      "pin");
     QCommandLineOption autoFocusOption(QStringList() << "a" << "autofocus", "Enable auto focus");
-    QList<QCommandLineOption> cmdOptions{frameRateOption, delayOption, buttonPinOption, autoFocusOption};
+    QCommandLineOption streamPortOption(QStringList() << "s" << "streamport", "MJPEG stream port (0 = off)", "port");
+    QCommandLineOption camerasOption(  QStringList() << "c" << "cameras",   "Number of cameras (0 = all)", "count");
+    QCommandLineOption syntheticOption(QStringList() << "synthetic",        "Number of synthetic test sources", "count");
+    QList<QCommandLineOption> cmdOptions{frameRateOption, delayOption, buttonPinOption, autoFocusOption, streamPortOption, camerasOption, syntheticOption};
     parser.addOptions(cmdOptions);
 
     // Process the command line arguments
@@ -227,258 +834,25 @@ void Application::parseCommandline()
     }
 
     // Update member variables if options were provided
-    if (parser.isSet(frameRateOption))
+    if (parser.isSet(frameRateOption)) {
         frameRate_ = parser.value(frameRateOption).toFloat();
-    if (parser.isSet(delayOption))
+        commandLine_["framerate"] = frameRate_;
+    }
+    if (parser.isSet(delayOption)) {
         delaySeconds_ = parser.value(delayOption).toFloat();
+        commandLine_["delay"] = delaySeconds_;
+    }
     if (parser.isSet(buttonPinOption))
         buttonPin_ = parser.value(buttonPinOption).toInt();
-    if (parser.isSet(autoFocusOption))
+    if (parser.isSet(autoFocusOption)) {
         alwaysAutoFocus_ = true;
-}
-
-bool Application::configureCamera()
-{
-    // Check if camera is acquried
-    if (!camera_) {
-        dcWarning("Initialize camera before configuration!");
-        return false;
+        commandLine_["autofocus"] = true;
     }
-
-    // Generate viewfinder configuration
-    config_ = camera_->generateConfiguration({ StreamRole::Viewfinder });
-    if (!config_ || config_->empty()) {
-        dcWarning("Failed to generate camera configuration!");
-        return false;
-    }
-
-    // Raspberry Pi Camera v3: 1536x864 2304x1296 4608x2592
-    // libcamera will automatically pick the next best size
-    QSize size = QGuiApplication::primaryScreen()->size();
-
-    // Set orientation
-    config_->orientation = libcamera::Orientation::Rotate0;
-
-    // Edit configuration
-    dcInfo("Using size " + QString::number(size.width()) + "x" + QString::number(size.height()));
-    StreamConfiguration &cfg = config_->at(0);
-    cfg.size.width = size.width();
-    cfg.size.height = size.height();
-    cfg.bufferCount = 4;
-
-    // Use a format supported by the viewfinder
-    libcamera::PixelFormat format = libcamera::formats::YUV420;
-    auto camFormats = cfg.formats().pixelformats();
-    if (std::find(camFormats.begin(), camFormats.end(), format) != camFormats.end())
-        cfg.pixelFormat = format;
-    else {
-        dcWarning("Format not supported! Use one of:");
-        for (auto &format : camFormats)
-            dcInfo(format.toString().c_str());
-    }
-
-    // Setting fixed exposure times will disable the AE algorithm
-    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#a4e1ca45653b62cd969d4d67a741076eb
-    //
-    // Setting fixed frame times will limit the AE algorithm
-    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#a4f3236ff99d40a3a44fcd1ad77c4458f
-    //
-    // Digital gains will be applied to the image captured by the sensor
-    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#a82c8beb7cf9d9f048c5007a68922a5b1
-    //
-    // Setting fixed analogue gains will limit the AE algorithm
-    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#ab34ebeaa9cbfb3f3fc6996b089ca52b0
-    //
-    // Setting the AE mode is most flexible
-    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#acc370d05c5efc0b92f2fe285a1227426
-
-    // Set auto exposure mode
-    // controls_.set(controls::AeExposureMode, controls::AeExposureModeEnum::ExposureNormal); // -Short, -Long, -Custom
-
-    // Set frametime (min, max) [us] and thus framerate
-    int64_t minFt = 1e6 / frameRate_; // 30fps -> 33333,33us
-    int64_t maxFt = 1e6 / frameRate_; // 30fps -> 33333,33us
-    controls_.set(controls::FrameDurationLimits, Span<const int64_t, 2>({ minFt, maxFt }));
-
-    // Validate configuration
-    CameraConfiguration::Status validation = config_->validate();
-    if (validation == CameraConfiguration::Adjusted) {
-        dcInfo(QString("Stream configuration adjusted to ") + cfg.toString().c_str());
-    } else if (validation == CameraConfiguration::Invalid) {
-        dcWarning("Failed to create valid camera configuration!");
-        return false;
-    }
-
-    // Configure camera
-    if (camera_->configure(config_.get()) < 0) {
-        dcInfo("Failed to configure camera!");
-        return false;
-    }
-
-    // Store stream allocation pointer
-    stream_ = config_->at(0).stream();
-
-    // Configure the viewfinder
-    const StreamConfiguration &vfConfig = config_->at(0);
-    viewFinder_->setFormat(
-        vfConfig.pixelFormat,
-        QSize(vfConfig.size.width, vfConfig.size.height),
-        vfConfig.stride);
-
-    // Allocate and map buffers
-    allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
-    for (StreamConfiguration &c : *config_) {
-        Stream *stream = c.stream();
-        if (allocator_->allocate(stream) < 0) {
-            dcWarning("Failed to allocate capture buffers!");
-            goto error;
-        }
-
-        // Map memory buffers and cache the mappings
-        for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
-            std::unique_ptr<Image> image = Image::fromFrameBuffer(buffer.get(), Image::MapMode::ReadOnly);
-            assert(image != nullptr);
-
-            // Create pool from first sample image
-            if (pool_ == nullptr || pool_->capacity() == 0)
-                pool_ = FramePool::create(*(image.get()), delaySeconds_, frameRate_);
-
-            // Store buffers on the free list
-            mappedBuffers_[buffer.get()] = std::move(image);
-            freeBuffers_[stream].enqueue(buffer.get());
-        }
-    }
-
-    // Create requests and fill them with buffers from the viewfinder
-    while (!freeBuffers_[stream_].isEmpty()) {
-        FrameBuffer *buffer = freeBuffers_[stream_].dequeue();
-        std::unique_ptr<Request> request = camera_->createRequest();
-        if (!request) {
-            dcWarning("Can't create request!");
-            goto error;
-        }
-        if (request->addBuffer(stream_, buffer) < 0) {
-            dcWarning("Can't set buffer for request!");
-            goto error;
-        }
-        requests_.push_back(std::move(request));
-    }
-
-    // Start the camera
-    if (camera_->start(&controls_)) {
-        dcWarning("Failed to start capture!");
-        goto error;
-    }
-
-    // Connect callback
-    camera_->requestCompleted.connect(this, &Application::requestComplete);
-
-    // Queue all requests
-    for (std::unique_ptr<Request> &request : requests_) {
-        if (camera_->queueRequest(request.get()) < 0) {
-            dcWarning("Can't queue request!");
-            goto error_disconnect;
-        }
-    }
-
-    isCapturing_ = true;
-    return true;
-
-error_disconnect:
-    camera_->requestCompleted.disconnect(this);
-    camera_->stop();
-
-error:
-    requests_.clear();
-    mappedBuffers_.clear();
-    freeBuffers_.clear();
-    allocator_.reset();
-    return false;
+    if (parser.isSet(streamPortOption))
+        streamPort_ = parser.value(streamPortOption).toInt();
+    if (parser.isSet(camerasOption))
+        maxCameras_ = parser.value(camerasOption).toInt();
+    if (parser.isSet(syntheticOption))
+        syntheticCameras_ = parser.value(syntheticOption).toInt();
 }
 
-void Application::requestComplete(libcamera::Request *request)
-{
-    // Check if not cancelled
-    if (request->status() == Request::RequestCancelled)
-        return;
-
-    // This function is called by libcamera thread context where
-    // expensive operations are not allowed. This is why we just add
-    // the buffer to the done queue and post an event to be handled
-    {
-        QMutexLocker locker(&requestsMutex_);
-        doneQueue_.enqueue(request);
-    }
-    QCoreApplication::postEvent(this, new CaptureEvent);
-}
-
-void Application::processCaptureEvent()
-{
-    static bool firstFrame = true;
-
-    // Retrieve the next buffer from the done queue. The queue may be empty
-    // if stopCapture() has been called while a CaptureEvent was posted but
-    // not processed yet. Return immediately in that case.
-    Request *request;
-    {
-        QMutexLocker locker(&requestsMutex_);
-        if (!doneQueue_.isEmpty())
-            request = doneQueue_.dequeue();
-        else return;
-    }
-
-    // Check for button and timer state
-    // One can also check if af is still scanning, but I want some extra time
-    // const ControlList &metadata = completedRequest->metadata();
-    // if (metadata.contains(controls::AfState))
-    // int afState = metadata.get(controls::AfState)
-    bool buttonIsPressed = digitalRead(buttonPin_) == LOW;
-    bool timerIsRunning = autoFocusTimer_.isActive();
-    bool needRealtime = buttonIsPressed || timerIsRunning;
-
-    // Get buffer and process it
-    FrameBuffer *buffer = nullptr;
-    if (request->buffers().count(stream_)) {
-        buffer = request->buffers().at(stream_);
-        Image *imageBuffer = mappedBuffers_[buffer].get();
-
-        // Get oldest frame and copy current frame to pool
-        const PooledFrame *currentFrame = pool_->storeFrame(*imageBuffer);
-        const PooledFrame *oldestFrame = pool_->getOldestFrame();
-
-        // Use current frame if realtime is needed
-        const PooledFrame *renderFrame = needRealtime ? currentFrame : oldestFrame;
-
-        // Render frame if pool is full
-        if (pool_->isFull()) {
-
-            // Switch to viewfinder if it just became full
-            if (!poolWasFull_) {
-                poolWasFull_ = true;
-                window_->setCurrentIndex(1);
-            }
-
-            // Render selected frame
-            viewFinder_->render(renderFrame);
-
-        // Render progress if not full yet
-        } else progressWidget_->setProgress(pool_->size(), pool_->capacity());
-    }
-
-    // Reuse request right away, since we already copied the frame
-    request->reuse();
-
-    // Set autofocus if triggered
-    if (firstFrame || buttonIsPressed || alwaysAutoFocus_) {
-        firstFrame = false;
-        request->controls().set(controls::AfMode, controls::AfModeAuto);
-        request->controls().set(controls::AfTrigger, 0);
-        if (buttonIsPressed)
-            autoFocusTimer_.start();
-    }
-
-    // Add buffer and queue request
-    if (buffer != nullptr)
-        request->addBuffer(stream_, buffer);
-    camera_->queueRequest(request);
-}
@@ -5,30 +5,30 @@
 
 #include <memory>
 #include <vector>
-#include <atomic>
 
 #include "util/undefkeywords.h"
-#include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
-#include <libcamera/controls.h>
-#include <libcamera/control_ids.h>
-#include <libcamera/property_ids.h>
-#include <libcamera/framebuffer.h>
-#include <libcamera/framebuffer_allocator.h>
-#include <libcamera/request.h>
-#include <libcamera/stream.h>
 
 #include <QObject>
-#include <QImage>
-#include <QQueue>
-#include <QMutex>
-#include <QTimer>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QSize>
+#include <QStringList>
 #include <QStackedWidget>
+#include <QTimer>
+#include <QVariantMap>
+
+#include "cam/camerasession.h"
 
-class Image;
 class ViewFinder;
+class RenderWindow;
 class ProgressWidget;
-class FramePool;
+class StreamServer;
+class ControlServer;
+class MemoryBudget;
+class ButtonInput;
+class AudioDelay;
+class QFileSystemWatcher;
 
 class Application : public QApplication
 {
@@ -37,50 +37,128 @@ class Application : public QApplication
 public:
     Application(int &argc, char **argv);
     ~Application();
-    bool initCamera();
-    bool startCamera();
-    void stopCamera();
-    void releaseCamera();
-    bool event(QEvent *e) override;
+    bool initCameras();
+    bool startCameras();
+    void stopCameras();
 
 private:
+    // Widgets and capture thread of one camera
+    struct CameraView {
+        std::unique_ptr<CameraSession> session;
+        std::unique_ptr<QThread> thread;
+        QStackedWidget *stack = nullptr;
+        ProgressWidget *progressWidget = nullptr;
+        ViewFinder *viewFinder = nullptr;       // Either the widget or the render window shows the frames
+        RenderWindow *renderWindow = nullptr;
+    };
+
     void parseSettings();
+    void readLiveSettings(const QVariantMap &settings);
     void parseCommandline();
-    bool configureCamera();
-    bool start(bool isPreview);
-    void requestComplete(libcamera::Request *request);
-    void processCaptureEvent();
-    void queueRequest(libcamera::FrameBuffer *buffer);
+    CameraSession::Config sessionConfig(const CameraView &view, size_t memoryLimit) const;
+    void addSession(std::unique_ptr<CameraSession> session);
+    void createWindows();
+    void markStartup(const QString &phase);
+
+    // Apply changes of the config file while running
+    void watchSettings();
+    void reloadSettings();
+    void applySettings();
+    void showHud();
+    void startAudio();
+    void precompileShaders();
+
+    // Requests of the control socket
+    void setDelay(float seconds);
+    void saveClip(int camera, float seconds, const QString &path);
+    void setHud(bool visible);
 
 private:
-    QStackedWidget *window_;
-    ProgressWidget *progressWidget_;
-    ViewFinder *viewFinder_;
-    QTimer autoFocusTimer_;
-    std::atomic_bool isCapturing_;
+    QWidget *window_;
     float frameRate_;
     float delaySeconds_;
     int buttonPin_;
     bool alwaysAutoFocus_;
-    bool poolWasFull_;
+    bool renderThread_;         // Render in a dedicated thread instead of the GUI thread
+    bool precompileShaders_;    // Build the shader programs while the pool fills
+    bool hud_;                  // Status overlay over the frames
+
+    // Realtime button, read from GPIO edges or simulated
+    std::unique_ptr<ButtonInput> button_;
+    QString buttonMode_;        // gpio, simulated or none
+    int buttonDebounce_;        // [ms]
+    int buttonInterval_;        // Time between simulated presses [ms]
+
+    // Realtime scheduling of the capture and render threads
+    int realtimePriority_;      // SCHED_FIFO priority, 0 = off
+    int captureCpu_;            // -1 = any
+    int renderCpu_;
+    bool lockMemory_;
+    int latencyProbe_;          // Probe period [us], 0 = off
+
+    // Cameras to use and how to show them
+    int maxCameras_;          // 0 = all connected cameras
+    int syntheticCameras_;    // Additional test pattern sources
+    bool separateScreens_;    // One screen per camera instead of side by side
+
+    // Optional MJPEG stream of the delayed and realtime frames
+    StreamServer *streamServer_;
+    QThread streamThread_;
+    QString streamAddress_;
+    int streamPort_;
+    float streamFrameRate_;
+    int streamQuality_;
+    bool streamRealtime_;
+
+    // Sound played with the delay of the first camera
+    std::unique_ptr<AudioDelay> audio_;
+    bool audioEnabled_;
+    QString audioCapture_;      // ALSA PCM names
+    QString audioPlayback_;
+    int audioRate_;             // [Hz]
+    int audioChannels_;
+    int audioOffset_;           // Audio plays this much later than the video [ms]
+
+    // Local control socket, empty = off
+    ControlServer *controlServer_;
+    QThread controlThread_;
+    QString controlSocket_;
+
+    // Name of the shared memory segment the pool is exported to, empty = private pool
+    // A persistent pool survives crashes and restarts of the application
+    QString sharedMemoryName_;
+    bool persistentPool_;
+    bool prefault_;             // Allocate pool pages in the background instead of on first write
+    bool cachedBuffers_;        // Capture into cached buffers from a DMA heap
+
+    // RAM the pools may use, watched for pressure while running
+    MemoryBudget *memoryBudget_;
+    int memoryReserve_;         // Kept free for the rest of the system [MB]
+    unsigned int storageScale_; // 0 = auto, 1 = raw, 2 = reduced, 4 = minimal
+    unsigned int bufferCount_;  // Capture buffers per camera, 0 = tuned automatically
+    QSize storageSize_;         // Size of a second camera stream stored in the pool, invalid = single stream
+    unsigned int decimation_;   // Store every Nth frame, 0 = as needed to fit the budget
+    bool crossFade_;            // Blend between the stored frames instead of repeating them
+    bool concealDrops_;         // Repeat the previous frame for dropped ones, so the delay stays exact
+    unsigned int dropWarning_;  // Warn at this many dropped frames per minute, 0 = never
+
+    // Config file, reloaded when it changes
+    // Values given on the command line or the control socket win until the key changes in the file
+    QString configPath_;
+    QVariantMap settings_;          // Values of the file in use
+    QVariantMap commandLine_;       // Keys set on the command line or over the control socket
+    QFileSystemWatcher *settingsWatcher_;
+    QTimer reloadTimer_;            // Waits for the editor to finish writing
+    QElapsedTimer reloadClock_;
+
+    // Time spent in each startup phase, logged once the first delayed frame is shown
+    QElapsedTimer startupTimer_;
+    qint64 lastStartupMark_;
+    QStringList startupPhases_;
 
-    // Camera manager, camera, config and allocator
+    // Camera manager and one session per camera
     std::unique_ptr<libcamera::CameraManager> cm_;
-    std::shared_ptr<libcamera::Camera> camera_;
-    std::unique_ptr<libcamera::CameraConfiguration> config_;
-    std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
-    libcamera::ControlList controls_;
-    libcamera::Stream *stream_;
-
-    // Buffers and requests
-    std::map<libcamera::FrameBuffer *, std::unique_ptr<Image>> mappedBuffers_;
-    std::map<const libcamera::Stream *, QQueue<libcamera::FrameBuffer *>> freeBuffers_;
-    std::vector<std::unique_ptr<libcamera::Request>> requests_;
-    QQueue<libcamera::Request *> doneQueue_;
-    QMutex requestsMutex_; // Protects doneQueue_
-
-    // Frame pool for storing frames to delay stream
-    std::unique_ptr<FramePool> pool_;
+    std::vector<CameraView> views_;
 };
 
 #endif // APPLICATION_H
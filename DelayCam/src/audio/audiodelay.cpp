@@ -0,0 +1,313 @@
+#include "audio/audiodelay.h"
+#include "audio/audioring.h"
+#include "util/logger.h"
+#include "util/realtime.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <vector>
+
+#include <alsa/asoundlib.h>
+
+// Steering of the read position towards the delayed capture time
+static constexpr double MaxError = 0.1;         // Larger errors jump to the target [s]
+static constexpr double CorrectionTime = 2.0;   // The filtered error is corrected within this time [s]
+static constexpr double MaxRatioChange = 0.005; // Resampling ratio stays within 1 +- this, 0.5% is inaudible
+static constexpr double ErrorFilter = 0.05;     // Weight of a new error in the filtered one
+static constexpr double DelayFilter = 0.02;     // Weight of a new frame delay in the smoothed one
+static constexpr uint64_t DelayStep = 500000000ULL; // A larger change of the frame delay is followed at once [ns]
+static constexpr uint64_t ReportPeriod = 5000000000ULL; // [ns]
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Keeps devices without a clock of their own at the nominal rate, e.g. the null and file plugins
+// A real device blocks in about every read or write, these return at once and would spin
+class Pacer
+{
+public:
+    explicit Pacer(unsigned int rate) : rate_(rate), clock_(0) {}
+
+    // Account a transfer that started at callNs, sleeps if the device runs ahead of the clock
+    void account(uint64_t callNs, size_t frames)
+    {
+        // Time lost to scheduling isn't made up
+        const uint64_t duration = frames * 1000000000ULL / rate_;
+        const uint64_t now = monotonicNs();
+        clock_ = std::max(clock_, callNs) + duration;
+        if (now - callNs < duration / 4 && clock_ > now + duration)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(clock_ - now - duration));
+    }
+
+private:
+    const unsigned int rate_;
+    uint64_t clock_;    // Monotonic time the transfers so far take at the nominal rate [ns]
+};
+
+static snd_pcm_t *openDevice(const QString &name, snd_pcm_stream_t stream, const AudioDelay::Config &config)
+{
+    const QString direction = stream == SND_PCM_STREAM_CAPTURE ? "capture" : "playback";
+    snd_pcm_t *pcm = nullptr;
+    int ret = snd_pcm_open(&pcm, name.toUtf8().constData(), stream, 0);
+    if (ret < 0) {
+        dcWarning(QString("Audio: Can't open %1 device %2: %3").arg(direction, name, QString(snd_strerror(ret))));
+        return nullptr;
+    }
+
+    // Interleaved 16 bit with a latency of four periods, ALSA converts if the hardware can't do it
+    const unsigned int latencyUs = static_cast<unsigned int>(4ULL * config.periodFrames * 1000000 / config.rate);
+    ret = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+                             config.channels, config.rate, 1, latencyUs);
+    if (ret < 0) {
+        dcWarning(QString("Audio: %1 device %2 doesn't support %3Hz with %4 channels: %5")
+            .arg(direction, name).arg(config.rate).arg(config.channels).arg(snd_strerror(ret)));
+        snd_pcm_close(pcm);
+        return nullptr;
+    }
+
+    // Status updates carry a timestamp of the clock the sensor timestamps use
+    // Plugins without timestamps leave them 0, the callers fall back to the time of the call then
+    snd_pcm_sw_params_t *swParams;
+    snd_pcm_sw_params_alloca(&swParams);
+    if (snd_pcm_sw_params_current(pcm, swParams) < 0 ||
+        snd_pcm_sw_params_set_tstamp_mode(pcm, swParams, SND_PCM_TSTAMP_ENABLE) < 0 ||
+        snd_pcm_sw_params_set_tstamp_type(pcm, swParams, SND_PCM_TSTAMP_TYPE_MONOTONIC) < 0 ||
+        snd_pcm_sw_params(pcm, swParams) < 0)
+        dcWarning(QString("Audio: No monotonic timestamps from %1 device %2").arg(direction, name));
+    return pcm;
+}
+
+AudioDelay::AudioDelay() :
+    capturePcm_(nullptr),
+    playbackPcm_(nullptr),
+    running_(false),
+    offsetNs_(0),
+    captureXruns_(0)
+{
+}
+
+AudioDelay::~AudioDelay()
+{
+    stop();
+}
+
+bool AudioDelay::start(const Config &config, DelaySource source)
+{
+    stop();
+    config_ = config;
+    config_.rate = std::clamp(config_.rate, 8000u, 192000u);
+    config_.channels = std::clamp(config_.channels, 1u, 8u);
+    config_.periodFrames = std::clamp(config_.periodFrames, 64u, 8192u);
+    source_ = std::move(source);
+
+    capturePcm_ = openDevice(config_.captureDevice, SND_PCM_STREAM_CAPTURE, config_);
+    playbackPcm_ = capturePcm_ ? openDevice(config_.playbackDevice, SND_PCM_STREAM_PLAYBACK, config_) : nullptr;
+    if (playbackPcm_ == nullptr) {
+        if (capturePcm_)
+            snd_pcm_close(capturePcm_);
+        capturePcm_ = nullptr;
+        return false;
+    }
+
+    // One anchor per period, the ring holds the delay and the reserve
+    const size_t frames = static_cast<size_t>((std::max(config_.delaySeconds, 1.0f) + RingReserve) * config_.rate);
+    ring_ = std::make_unique<AudioRing>(frames, config_.channels, config_.rate, frames / config_.periodFrames + 16);
+    setOffset(config_.offsetMs);
+    captureXruns_ = 0;
+    running_ = true;
+    captureThread_ = std::thread(&AudioDelay::runCapture, this);
+    playbackThread_ = std::thread(&AudioDelay::runPlayback, this);
+    dcInfo(QString("Audio: %1 to %2, %3Hz %4 channel(s), %5s ring of %6kB")
+        .arg(config_.captureDevice, config_.playbackDevice).arg(config_.rate).arg(config_.channels)
+        .arg(capacity(), 0, 'f', 1).arg(frames * config_.channels * sizeof(int16_t) / 1024));
+    return true;
+}
+
+void AudioDelay::stop()
+{
+    // A blocked read or write returns within a period
+    running_ = false;
+    if (captureThread_.joinable())
+        captureThread_.join();
+    if (playbackThread_.joinable())
+        playbackThread_.join();
+    if (capturePcm_)
+        snd_pcm_close(capturePcm_);
+    if (playbackPcm_)
+        snd_pcm_close(playbackPcm_);
+    capturePcm_ = nullptr;
+    playbackPcm_ = nullptr;
+    ring_.reset();
+}
+
+float AudioDelay::capacity() const
+{
+    return ring_ ? static_cast<float>(ring_->capacity()) / ring_->rate() - RingReserve : 0;
+}
+
+void AudioDelay::runCapture()
+{
+    RealtimeProfile::instance()->applyToCurrentThread(RealtimeProfile::Role::Capture, "Audio capture");
+    std::vector<int16_t> buffer(config_.periodFrames * config_.channels);
+    Pacer pacer(config_.rate);
+    while (running_.load(std::memory_order_relaxed)) {
+        const uint64_t callNs = monotonicNs();
+        const snd_pcm_sframes_t frames = snd_pcm_readi(capturePcm_, buffer.data(), config_.periodFrames);
+        if (frames < 0) {
+            // An overrun loses samples, the anchors of the following ones keep the timing right
+            if (snd_pcm_recover(capturePcm_, frames, 1) < 0) {
+                dcError(QString("Audio: Capture failed: %1").arg(snd_strerror(frames)));
+                break;
+            }
+            captureXruns_++;
+            continue;
+        }
+        if (frames == 0)
+            continue;
+
+        // The newest frame was captured at the status timestamp with avail frames waiting after the ones read
+        snd_pcm_uframes_t avail = 0;
+        snd_htimestamp_t tstamp = {};
+        uint64_t end = 0;
+        if (snd_pcm_htimestamp(capturePcm_, &avail, &tstamp) == 0)
+            end = static_cast<uint64_t>(tstamp.tv_sec) * 1000000000ULL + tstamp.tv_nsec;
+        if (end == 0) {
+            const snd_pcm_sframes_t waiting = snd_pcm_avail(capturePcm_);
+            avail = waiting > 0 ? waiting : 0;
+            end = monotonicNs();
+        }
+        const uint64_t span = (avail + frames) * 1000000000ULL / config_.rate;
+        ring_->write(buffer.data(), frames, end > span ? end - span : 0);
+        pacer.account(callNs, frames);
+    }
+}
+
+void AudioDelay::runPlayback()
+{
+    RealtimeProfile::instance()->applyToCurrentThread(RealtimeProfile::Role::Capture, "Audio playback");
+    const unsigned int channels = config_.channels;
+    const size_t period = config_.periodFrames;
+    const double rate = config_.rate;
+    std::vector<int16_t> buffer(period * channels);
+    Pacer pacer(config_.rate);
+
+    // Read position in the ring and its steering
+    double position = 0;
+    bool locked = false;
+    double filteredError = 0;   // [frames]
+    double ratio = 1;           // Ring frames per output frame
+    uint64_t delay = 0;         // Smoothed delay of the shown frame [ns]
+
+    // Statistics of the last report period
+    uint64_t reportAt = monotonicNs() + ReportPeriod;
+    uint64_t periods = 0;
+    uint64_t silent = 0;
+    uint64_t measured = 0;      // Periods with an error, i.e. neither silent nor jumped
+    double errorSum = 0;        // [ms]
+    double errorMax = 0;
+    uint64_t xruns = 0;
+    uint64_t resyncs = 0;
+
+    while (running_.load(std::memory_order_relaxed)) {
+        // The first frame of this period is heard once the frames queued before it are played
+        const uint64_t callNs = monotonicNs();
+        snd_pcm_sframes_t queued = 0;
+        if (snd_pcm_delay(playbackPcm_, &queued) < 0 || queued < 0)
+            queued = 0;
+        const uint64_t playout = callNs + static_cast<uint64_t>(queued * 1e9 / rate);
+
+        // Smooth the steps of the frame delay, e.g. of a decimated pool, but follow a new delay at once
+        const uint64_t shown = source_ ? source_() : 0;
+        if (shown == 0 || delay == 0 || std::max(shown, delay) - std::min(shown, delay) > DelayStep)
+            delay = shown;
+        else delay += static_cast<int64_t>((static_cast<double>(shown) - delay) * DelayFilter);
+
+        // Samples captured the delay before the playout time, the offset plays them later
+        bool playing = false;
+        const int64_t behind = static_cast<int64_t>(delay) + offsetNs_.load(std::memory_order_relaxed);
+        double target = 0;
+        if (delay > 0 && behind > 0 && playout > static_cast<uint64_t>(behind) &&
+            ring_->position(playout - behind, target)) {
+            // Positive errors play the audio ahead of the video, it is slowed down then
+            // A large error jumps, e.g. at start, after a new delay or an overrun
+            const double error = position - target;
+            if (!locked || std::fabs(error) > MaxError * rate) {
+                resyncs += locked;
+                position = target;
+                filteredError = 0;
+                locked = true;
+            } else {
+                filteredError += (error - filteredError) * ErrorFilter;
+                measured++;
+                errorSum += error / rate * 1000;
+                errorMax = std::max(errorMax, std::fabs(error) / rate * 1000);
+            }
+            ratio = 1 - std::clamp(filteredError / (rate * CorrectionTime), -MaxRatioChange, MaxRatioChange);
+
+            // Linear interpolation between the ring frames, the writer mustn't have reached them meanwhile
+            const size_t needed = static_cast<size_t>(std::ceil(period * ratio)) + 2;
+            if (ring_->contains(position, needed)) {
+                for (size_t i = 0; i < period; i++) {
+                    const double at = position + i * ratio;
+                    const uint64_t index = static_cast<uint64_t>(at);
+                    const double fraction = at - index;
+                    for (unsigned int c = 0; c < channels; c++) {
+                        const int first = ring_->sample(index, c);
+                        const int second = ring_->sample(index + 1, c);
+                        buffer[i * channels + c] = static_cast<int16_t>(first + (second - first) * fraction);
+                    }
+                }
+                playing = ring_->contains(position, needed);
+                position += period * ratio;
+            }
+        }
+        if (!playing) {
+            std::fill(buffer.begin(), buffer.end(), 0);
+            locked = false;
+            silent++;
+        }
+        periods++;
+
+        // Write the whole period, an underrun restarts the device
+        size_t written = 0;
+        while (written < period && running_.load(std::memory_order_relaxed)) {
+            const snd_pcm_sframes_t frames = snd_pcm_writei(playbackPcm_, &buffer[written * channels], period - written);
+            if (frames < 0) {
+                if (snd_pcm_recover(playbackPcm_, frames, 1) < 0) {
+                    dcError(QString("Audio: Playback failed: %1").arg(snd_strerror(frames)));
+                    running_ = false;
+                    break;
+                }
+                xruns++;
+                continue;
+            }
+            written += frames;
+        }
+        pacer.account(callNs, written);
+
+        // Report like the capture statistics
+        const uint64_t now = monotonicNs();
+        if (now >= reportAt) {
+            dcInfo(QString("Audio: A/V offset avg %1ms max %2ms, drift correction %3ppm, %4% silent, "
+                           "%5 capture and %6 playback xruns, %7 resyncs")
+                .arg(measured ? errorSum / measured : 0, 0, 'f', 1).arg(errorMax, 0, 'f', 1)
+                .arg(static_cast<int>(std::lround((ratio - 1) * 1e6)))
+                .arg(periods ? 100 * silent / periods : 0)
+                .arg(captureXruns_.exchange(0)).arg(xruns).arg(resyncs));
+            reportAt = now + ReportPeriod;
+            periods = 0;
+            silent = 0;
+            measured = 0;
+            errorSum = 0;
+            errorMax = 0;
+            xruns = 0;
+            resyncs = 0;
+        }
+    }
+}
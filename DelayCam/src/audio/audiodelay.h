@@ -0,0 +1,71 @@
+#ifndef AUDIO_DELAY_H
+#define AUDIO_DELAY_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include <QString>
+
+class AudioRing;
+typedef struct _snd_pcm snd_pcm_t;     // As in alsa/pcm.h, which isn't needed by users of the class
+
+// Sound of the scene played with the delay of the video
+// A capture thread reads ALSA into a ring of samples stamped with the monotonic clock of the sensor timestamps.
+// A playback thread asks for the delay of the frame shown last and plays the samples captured that long
+// before the output time of the next period. The clocks of the two devices drift apart, so the read position
+// is steered towards its target by resampling with a ratio slightly off 1, a large error jumps instead.
+// Silence is played while the video isn't delayed, e.g. in the realtime view or while frozen.
+class AudioDelay
+{
+public:
+    struct Config {
+        QString captureDevice = "default";  // ALSA PCM names, e.g. hw:1,0 or null
+        QString playbackDevice = "default";
+        unsigned int rate = 48000;      // [Hz], both devices
+        unsigned int channels = 1;
+        float delaySeconds = 30.0;      // Sizes the ring, longer delays need a restart
+        int offsetMs = 0;               // Played this much later than the video, for the latency of display and speakers
+        unsigned int periodFrames = 512; // Frames per read and write
+    };
+
+    // The ring holds this much more than the delay, for the output latency, the offset and the writer [s]
+    static constexpr float RingReserve = 2.0f;
+
+    // Delay of the shown frame [ns], 0 = play silence
+    using DelaySource = std::function<uint64_t()>;
+
+    AudioDelay();
+    ~AudioDelay();
+
+    // Open both devices and start the threads, returns false and logs why if a device can't be used
+    bool start(const Config &config, DelaySource source);
+    void stop();
+    bool isRunning() const { return running_.load(std::memory_order_relaxed); }
+
+    // The ring holds this much audio, a longer delay needs a restart [s]
+    float capacity() const;
+
+    // Applied by the playback thread with its next period
+    void setOffset(int offsetMs) { offsetNs_.store(static_cast<int64_t>(offsetMs) * 1000000, std::memory_order_relaxed); }
+
+private:
+    void runCapture();
+    void runPlayback();
+
+private:
+    Config config_;
+    DelaySource source_;
+    std::unique_ptr<AudioRing> ring_;
+    snd_pcm_t *capturePcm_;
+    snd_pcm_t *playbackPcm_;
+    std::thread captureThread_;
+    std::thread playbackThread_;
+    std::atomic<bool> running_;
+    std::atomic<int64_t> offsetNs_;
+    std::atomic<uint64_t> captureXruns_;   // Overruns, reported by the playback thread
+};
+
+#endif // AUDIO_DELAY_H
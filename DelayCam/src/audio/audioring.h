@@ -0,0 +1,108 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// Captured samples with the time they were captured, written by one thread and read by another
+// Positions count frames (one sample per channel) since the start and never wrap. Every write records
+// an anchor, the position and monotonic time of its first frame, the same clock as the sensor timestamps
+// of the frame pool, so the reader finds the samples of a video frame by time. Lock-free like the
+// metadata ring: the reader checks that a position is still in the ring after reading it.
+class AudioRing
+{
+public:
+    AudioRing(size_t frames, unsigned int channels, unsigned int rate, size_t anchors) :
+        frames_(frames),
+        channels_(channels),
+        rate_(rate),
+        anchorCount_(anchors),
+        samples_(new int16_t[frames * channels]()),
+        anchorPositions_(new std::atomic<uint64_t>[anchors]),
+        anchorTimes_(new std::atomic<uint64_t>[anchors])
+    {
+        for (size_t i = 0; i < anchors; i++) {
+            anchorPositions_[i].store(0, std::memory_order_relaxed);
+            anchorTimes_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return frames_; }
+    unsigned int channels() const { return channels_; }
+    unsigned int rate() const { return rate_; }
+
+    // Frames written so far
+    uint64_t written() const { return written_.load(std::memory_order_acquire); }
+
+    // Append interleaved frames captured from the timestamp on [ns]
+    void write(const int16_t *samples, size_t frames, uint64_t timestamp)
+    {
+        // Copy in up to two parts around the end of the ring
+        const uint64_t position = written_.load(std::memory_order_relaxed);
+        size_t offset = position % frames_;
+        size_t first = std::min(frames, frames_ - offset);
+        std::memcpy(&samples_[offset * channels_], samples, first * channels_ * sizeof(int16_t));
+        std::memcpy(&samples_[0], samples + first * channels_, (frames - first) * channels_ * sizeof(int16_t));
+
+        // Anchor the first frame, then publish both
+        const uint64_t anchor = anchors_.load(std::memory_order_relaxed);
+        anchorPositions_[anchor % anchorCount_].store(position, std::memory_order_relaxed);
+        anchorTimes_[anchor % anchorCount_].store(timestamp, std::memory_order_relaxed);
+        anchors_.store(anchor + 1, std::memory_order_release);
+        written_.store(position + frames, std::memory_order_release);
+    }
+
+    // Position of the frame captured at the timestamp, fractional between two frames
+    // Returns false if it was overwritten or isn't captured yet
+    bool position(uint64_t timestamp, double &position) const
+    {
+        // Binary search for the newest anchor at or before the timestamp, anchors grow in both
+        const uint64_t end = anchors_.load(std::memory_order_acquire);
+        const uint64_t begin = end > anchorCount_ ? end - anchorCount_ + 1 : 0;
+        if (end == 0 || anchorTimes_[begin % anchorCount_].load(std::memory_order_relaxed) > timestamp)
+            return false;
+        uint64_t low = begin;
+        uint64_t high = end;
+        while (high - low > 1) {
+            const uint64_t middle = low + (high - low) / 2;
+            if (anchorTimes_[middle % anchorCount_].load(std::memory_order_relaxed) <= timestamp)
+                low = middle;
+            else high = middle;
+        }
+        const uint64_t anchorTime = anchorTimes_[low % anchorCount_].load(std::memory_order_relaxed);
+        position = anchorPositions_[low % anchorCount_].load(std::memory_order_relaxed) +
+                   (timestamp - anchorTime) * 1e-9 * rate_;
+        return contains(position, 2);
+    }
+
+    // The frames from the position on are in the ring and not about to be overwritten
+    bool contains(double position, size_t frames) const
+    {
+        const uint64_t end = written();
+        const uint64_t margin = rate_ / 4;      // Room for the writer while the reader copies
+        return position >= 0 && position + frames <= end && position + frames_ >= end + margin;
+    }
+
+    // One sample, the caller checked the position with contains()
+    int16_t sample(uint64_t position, unsigned int channel) const
+    {
+        return samples_[(position % frames_) * channels_ + channel];
+    }
+
+private:
+    const size_t frames_;
+    const unsigned int channels_;
+    const unsigned int rate_;
+    const size_t anchorCount_;
+    std::unique_ptr<int16_t[]> samples_;
+    std::unique_ptr<std::atomic<uint64_t>[]> anchorPositions_;
+    std::unique_ptr<std::atomic<uint64_t>[]> anchorTimes_;
+    std::atomic<uint64_t> anchors_{0};
+    std::atomic<uint64_t> written_{0};
+};
+
+#endif // AUDIO_RING_H
@@ -0,0 +1,154 @@
+#include "activityanalyzer.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "util/undefkeywords.h"
+#include <libcamera/formats.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+bool ActivityAnalyzer::supports(uint32_t fourcc)
+{
+    // Semi planar and planar YUV, the luma plane comes first with one byte per pixel
+    static const libcamera::PixelFormat formats[] = {
+        libcamera::formats::NV12, libcamera::formats::NV21,
+        libcamera::formats::NV16, libcamera::formats::NV61,
+        libcamera::formats::NV24, libcamera::formats::NV42,
+        libcamera::formats::YUV420, libcamera::formats::YVU420,
+        libcamera::formats::YUV422, libcamera::formats::YVU422,
+    };
+    for (const libcamera::PixelFormat &format : formats)
+        if (format.fourcc() == fourcc)
+            return true;
+    return false;
+}
+
+ActivityAnalyzer::ActivityAnalyzer(unsigned int width, unsigned int height, unsigned int stride) :
+    stride_(stride),
+    columns_(width / CellSize),
+    rows_(height / CellSize),
+    gridStride_((columns_ + 15) & ~15u),
+    blockColumns_((columns_ + BlockCells - 1) / BlockCells),
+    blockRows_((rows_ + BlockCells - 1) / BlockCells),
+    blockSums_(new uint32_t[gridStride_ / BlockCells]()),
+    current_(0),
+    hasPrevious_(false)
+{
+    // Zeroed, so the padding compares equal
+    for (std::unique_ptr<uint8_t[]> &grid : grids_)
+        grid.reset(new uint8_t[gridStride_ * rows_]());
+}
+
+void ActivityAnalyzer::analyze(const uint8_t *luma, FrameActivity &activity)
+{
+    uint8_t *grid = grids_[current_].get();
+    buildGrid(luma, grid);
+
+    // Mean and histogram of the cells, the grid is small enough for scalar code
+    uint32_t histogram[16] = {};
+    uint64_t sum = 0;
+    for (unsigned int row = 0; row < rows_; row++) {
+        const uint8_t *cells = grid + row * gridStride_;
+        for (unsigned int column = 0; column < columns_; column++) {
+            sum += cells[column];
+            histogram[cells[column] >> 4]++;
+        }
+    }
+    const uint32_t count = std::max(columns_ * rows_, 1u);
+    activity.mean = static_cast<uint8_t>(sum / count);
+    for (size_t bin = 0; bin < activity.histogram.size(); bin++)
+        activity.histogram[bin] = static_cast<uint8_t>((histogram[bin] * 255 + count / 2) / count);
+
+    // Motion against the previous frame
+    activity.motion = 0;
+    activity.activeBlocks = 0;
+    if (hasPrevious_)
+        compareGrids(grid, grids_[current_ ^ 1].get(), activity);
+    activity.analyzed = true;
+    current_ ^= 1;
+    hasPrevious_ = true;
+}
+
+void ActivityAnalyzer::buildGrid(const uint8_t *luma, uint8_t *grid) const
+{
+    // Average the first and the middle row of each cell, two cells of 8 pixels per vector
+    for (unsigned int row = 0; row < rows_; row++) {
+        const uint8_t *top = luma + static_cast<size_t>(row) * CellSize * stride_;
+        const uint8_t *middle = top + static_cast<size_t>(CellSize / 2) * stride_;
+        uint8_t *cells = grid + row * gridStride_;
+        unsigned int column = 0;
+#if defined(__ARM_NEON)
+        for (; column + 2 <= columns_; column += 2) {
+            const uint16x8_t pairs = vpadalq_u8(vpaddlq_u8(vld1q_u8(top + column * CellSize)),
+                                                vld1q_u8(middle + column * CellSize));
+            const uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(pairs));
+            cells[column] = static_cast<uint8_t>(vgetq_lane_u64(sums, 0) >> 4);
+            cells[column + 1] = static_cast<uint8_t>(vgetq_lane_u64(sums, 1) >> 4);
+        }
+#elif defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        for (; column + 2 <= columns_; column += 2) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(top + column * CellSize));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(middle + column * CellSize));
+            const __m128i sums = _mm_add_epi64(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero));
+            cells[column] = static_cast<uint8_t>(_mm_cvtsi128_si32(sums) >> 4);
+            cells[column + 1] = static_cast<uint8_t>(_mm_extract_epi16(sums, 4) >> 4);
+        }
+#endif
+        for (; column < columns_; column++) {
+            unsigned int sum = 0;
+            for (unsigned int x = 0; x < CellSize; x++)
+                sum += top[column * CellSize + x] + middle[column * CellSize + x];
+            cells[column] = static_cast<uint8_t>(sum >> 4);
+        }
+    }
+}
+
+void ActivityAnalyzer::compareGrids(const uint8_t *grid, const uint8_t *previous, FrameActivity &activity)
+{
+    // Sum the absolute differences per block, one row of blocks at a time
+    unsigned int motion = 0;
+    unsigned int active = 0;
+    for (unsigned int blockRow = 0; blockRow < blockRows_; blockRow++) {
+        std::fill(blockSums_.get(), blockSums_.get() + gridStride_ / BlockCells, 0);
+        const unsigned int firstRow = blockRow * BlockCells;
+        const unsigned int rows = std::min(BlockCells, rows_ - firstRow);
+        for (unsigned int row = firstRow; row < firstRow + rows; row++) {
+            const uint8_t *a = grid + row * gridStride_;
+            const uint8_t *b = previous + row * gridStride_;
+            unsigned int column = 0;
+#if defined(__ARM_NEON)
+            for (; column < gridStride_; column += 16) {
+                const uint8x16_t difference = vabdq_u8(vld1q_u8(a + column), vld1q_u8(b + column));
+                const uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(difference)));
+                blockSums_[column / BlockCells] += static_cast<uint32_t>(vgetq_lane_u64(sums, 0));
+                blockSums_[column / BlockCells + 1] += static_cast<uint32_t>(vgetq_lane_u64(sums, 1));
+            }
+#elif defined(__SSE2__)
+            for (; column < gridStride_; column += 16) {
+                const __m128i sums = _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + column)),
+                                                  _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + column)));
+                blockSums_[column / BlockCells] += static_cast<uint32_t>(_mm_cvtsi128_si32(sums));
+                blockSums_[column / BlockCells + 1] += static_cast<uint32_t>(_mm_extract_epi16(sums, 4));
+            }
+#endif
+            for (; column < columns_; column++)
+                blockSums_[column / BlockCells] += std::abs(a[column] - b[column]);
+        }
+
+        // Mean difference of each block, partial blocks at the edges have fewer cells
+        for (unsigned int blockColumn = 0; blockColumn < blockColumns_; blockColumn++) {
+            const unsigned int cells = std::min(BlockCells, columns_ - blockColumn * BlockCells) * rows;
+            const unsigned int difference = blockSums_[blockColumn] / cells;
+            motion = std::max(motion, difference);
+            active += difference >= ActiveThreshold;
+        }
+    }
+    activity.motion = static_cast<uint8_t>(std::min(motion, 255u));
+    activity.activeBlocks = static_cast<uint8_t>(active * 100 / std::max(blockColumns_ * blockRows_, 1u));
+}
@@ -0,0 +1,48 @@
+#ifndef ACTIVITY_ANALYZER_H
+#define ACTIVITY_ANALYZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "capturemetadata.h"
+
+// Luma statistics of stored frames for the activity index
+// The luma plane is reduced to a grid of 8x8 pixel cells, sampling two rows of each cell, with NEON or SSE2
+// where available. Mean and histogram come from the grid, motion from the mean absolute difference of
+// 8x8 cell blocks (64x64 pixels) to the grid of the previous frame. A 1080p frame reads about 0.5MB.
+class ActivityAnalyzer {
+public:
+    static constexpr unsigned int CellSize = 8;     // Pixels per grid cell in both directions
+    static constexpr unsigned int BlockCells = 8;   // Grid cells per motion block in both directions
+    static constexpr uint8_t ActiveThreshold = 8;   // Block difference counted as active
+
+    // Only formats with an 8 bit luma plane first, e.g. NV12 or YUV420
+    static bool supports(uint32_t fourcc);
+
+    ActivityAnalyzer(unsigned int width, unsigned int height, unsigned int stride);
+
+    // Analyze the luma plane of the next stored frame, the first one has no motion
+    void analyze(const uint8_t *luma, FrameActivity &activity);
+
+    // Start over without a previous frame, e.g. after frames were skipped
+    void reset() { hasPrevious_ = false; }
+
+private:
+    void buildGrid(const uint8_t *luma, uint8_t *grid) const;
+    void compareGrids(const uint8_t *grid, const uint8_t *previous, FrameActivity &activity);
+
+private:
+    unsigned int stride_;
+    unsigned int columns_;      // Grid cells
+    unsigned int rows_;
+    unsigned int gridStride_;   // Padded to 16 cells, the padding stays zero
+    unsigned int blockColumns_;
+    unsigned int blockRows_;
+    std::unique_ptr<uint8_t[]> grids_[2];
+    std::unique_ptr<uint32_t[]> blockSums_;
+    unsigned int current_;      // Grid of the frame being analyzed
+    bool hasPrevious_;
+};
+
+#endif // ACTIVITY_ANALYZER_H
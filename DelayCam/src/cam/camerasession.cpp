@@ -0,0 +1,621 @@
+#include "cam/camerasession.h"
+#include "cam/image.h"
+#include "net/streamserver.h"
+#include "input/buttoninput.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <ctime>
+
+#include <QMutexLocker>
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+CameraSession::CameraSession(const QString &name, QObject *parent) :
+    QObject(parent),
+    name_(name),
+    stride_(0),
+    realtimeStride_(0),
+    decimation_(1),
+    decimationPhase_(0),
+    lastShownFrame_(nullptr),
+    lastShownSequence_(0),
+    button_(nullptr),
+    handledPresses_(0),
+    autoFocusRequested_(false),
+    streamServer_(nullptr),
+    streamRealtime_(false),
+    firstFrame_(true),
+    realtimeRequested_(false),
+    frozen_(false),
+    replayOffset_(0),
+    replayEnd_(0),
+    scrubTimestamp_(0),
+    scrubSettled_(false),
+    scrubMovedNs_(0),
+    shownDelay_(0),
+    statsTimer_(this),
+    lastSequence_(-1),
+    periodFrames_(0),
+    periodLatencySum_(0),
+    periodLatencyMax_(0),
+    dropHistory_{},
+    dropHistoryPos_(0),
+    periodQueueSamples_(0),
+    periodQueuedSum_(0),
+    periodQueuedMin_(0),
+    periodBacklogMax_(0),
+    requestTarget_(0),
+    periodPresses_(0),
+    periodPressLatencySum_(0),
+    periodPressLatencyMax_(0)
+{
+    // Report statistics every 5s, the timer moves with the session to the capture thread
+    statsTimer_.setInterval(5000);
+    connect(&statsTimer_, &QTimer::timeout, this, &CameraSession::reportStats);
+}
+
+CameraSession::~CameraSession()
+{
+}
+
+void CameraSession::setStreamServer(StreamServer *server, bool realtimeTap)
+{
+    streamServer_ = server;
+    streamRealtime_ = realtimeTap;
+    if (streamServer_ && pool_)
+        streamServer_->setFormat(format_, size(), stride());
+}
+
+CameraSession::Stats CameraSession::stats() const
+{
+    QMutexLocker locker(&statsMutex_);
+    return stats_;
+}
+
+bool CameraSession::createPool(const Image &sampleImage)
+{
+    // Describe frames for shared memory readers
+    FramePool::Options options;
+    options.sharedName = config_.sharedMemoryName.toStdString();
+    options.pixelFormat = format_.fourcc();
+    options.width = size_.width();
+    options.height = size_.height();
+    options.stride = stride_;
+    options.memoryLimit = config_.memoryLimit;
+    options.persistent = config_.persistentPool;
+    options.prefault = config_.prefault;
+    options.analyze = true;
+    options.thumbnails = true;
+
+    // Pick the finest storage that holds the whole delay within the budget
+    size_t totalFrames = static_cast<size_t>(config_.delaySeconds * config_.frameRate);
+    decimation_ = std::max(config_.decimation, 1u);
+    size_t frameCount = (totalFrames + decimation_ - 1) / decimation_;
+    std::vector<unsigned int> scales = config_.storageScale ? std::vector<unsigned int>{ config_.storageScale } :
+        std::vector<unsigned int>{ 1, 2, 4 };
+    size_t requiredSize = 0;
+    for (unsigned int scale : scales) {
+        options.scale = scale;
+        requiredSize = FramePool::requiredSize(sampleImage, frameCount, options);
+        if (requiredSize > 0 && (config_.memoryLimit == 0 || requiredSize < config_.memoryLimit))
+            break;
+    }
+
+    // Store fewer frames if even that doesn't fit, or shorten the delay, better than not starting at all
+    if (requiredSize > 0 && config_.memoryLimit > 0 && requiredSize >= config_.memoryLimit) {
+        size_t frameSize = FramePool::requiredSize(sampleImage, 1, options);
+        size_t fitting = std::max<size_t>((config_.memoryLimit * 9 / 10) / frameSize, 1);
+        if (config_.decimation == 0) {
+            decimation_ = (totalFrames + fitting - 1) / fitting;
+            frameCount = (totalFrames + decimation_ - 1) / decimation_;
+        } else {
+            frameCount = fitting;
+            dcWarning(QString("%1: Delay shortened to %2s to fit into %3MB")
+                .arg(name_).arg(frameCount * decimation_ / config_.frameRate, 0, 'f', 1).arg(config_.memoryLimit / 1048576));
+        }
+    }
+    if (decimation_ > 1)
+        dcInfo(QString("%1: Storing every %2. frame (%3 fps), %4").arg(name_).arg(decimation_)
+            .arg(config_.frameRate / decimation_, 0, 'f', 2).arg(config_.crossFade ? "cross-faded" : "repeated"));
+    if (options.scale > 1)
+        dcInfo(QString("%1: Storing frames downscaled by %2").arg(name_).arg(options.scale));
+
+    // Create pool from sample image
+    std::atomic_store(&pool_, std::shared_ptr<FramePool>(FramePool::create(sampleImage, frameCount, options)));
+    if (pool_ == nullptr || pool_->capacity() == 0) {
+        dcError(name_ + ": Failed to create frame pool!");
+        return false;
+    }
+    if (streamServer_)
+        streamServer_->setFormat(format_, size(), stride());
+
+    // The frames not stored still have to reach the realtime view
+    if (decimation_ > 1 && realtimePool_ == nullptr)
+        return createRealtimePool(sampleImage);
+    return true;
+}
+
+bool CameraSession::createRealtimePool(const Image &sampleImage)
+{
+    // One frame shown, one being written and one spare, never shared or downscaled
+    FramePool::Options options;
+    options.pixelFormat = format_.fourcc();
+    options.width = realtimeSize_.isValid() ? realtimeSize_.width() : size_.width();
+    options.height = realtimeSize_.isValid() ? realtimeSize_.height() : size_.height();
+    options.stride = realtimeSize_.isValid() ? realtimeStride_ : stride_;
+    options.prefault = false;
+    realtimePool_ = FramePool::create(sampleImage, size_t(3), options);
+    if (realtimePool_ == nullptr) {
+        dcError(name_ + ": Failed to create realtime frame pool!");
+        return false;
+    }
+    return true;
+}
+
+void CameraSession::shrinkPool()
+{
+    if (pool_ == nullptr)
+        return;
+
+    // Readers of a shared pool rely on its capacity, so it never shrinks
+    if (pool_->isShared()) {
+        dcWarning(name_ + ": Memory is low, but the shared frame pool can't shrink");
+        return;
+    }
+    size_t minimum = std::max<size_t>(static_cast<size_t>(config_.frameRate) / decimation_, 2);
+    const size_t previous = pool_->capacity();
+    if (previous <= minimum)
+        return;
+    const size_t capacity = pool_->shrink(std::max(previous * 3 / 4, minimum));
+    if (capacity != previous)
+        dcWarning(QString("%1: Delay is now %2s").arg(name_).arg(capacity * decimation_ / config_.frameRate, 0, 'f', 1));
+}
+
+CameraSession::Change CameraSession::compare(const Config &config) const
+{
+    // Anything that changes the geometry or the layout of the stored frames needs a new pool
+    QMutexLocker locker(&configMutex_);
+    const std::shared_ptr<const FramePool> current = pool();
+    if (current == nullptr || config.size != config_.size || config.storageScale != config_.storageScale ||
+        config.storageSize != config_.storageSize || config.decimation != config_.decimation ||
+        config.sharedMemoryName != config_.sharedMemoryName || config.persistentPool != config_.persistentPool ||
+        config.prefault != config_.prefault)
+        return Change::NewPool;
+
+    // A longer delay needs more frames than the pool holds, a shorter one drops the oldest
+    // Readers of a shared pool rely on its capacity, so it never shrinks
+    const bool delayChanged = config.delaySeconds != config_.delaySeconds || config.frameRate != config_.frameRate;
+    const size_t required = requiredFrames(config);
+    if (delayChanged && (required > current->capacity() || (current->isShared() && required != current->capacity())))
+        return Change::NewPool;
+    if (config.frameRate != config_.frameRate || config.bufferCount != config_.bufferCount)
+        return Change::Restart;
+    if (delayChanged || config.alwaysAutoFocus != config_.alwaysAutoFocus || config.crossFade != config_.crossFade ||
+        config.concealDrops != config_.concealDrops || config.dropWarning != config_.dropWarning)
+        return Change::Live;
+    return Change::None;
+}
+
+void CameraSession::updateConfig(const Config &config)
+{
+    {
+        QMutexLocker locker(&configMutex_);
+        config_ = config;
+    }
+    if (pool_ == nullptr)
+        return;
+    const size_t required = std::max<size_t>(requiredFrames(config_), 1);
+    if (required < pool_->capacity()) {
+        const size_t capacity = pool_->shrink(required);
+        dcInfo(QString("%1: Delay is now %2s").arg(name_).arg(capacity * decimation_ / config_.frameRate, 0, 'f', 1));
+    }
+}
+
+void CameraSession::releasePools()
+{
+    // Renderers and clip writers still referencing the pool keep it until they let go of it
+    std::atomic_store(&pool_, std::shared_ptr<FramePool>());
+    realtimePool_.reset();
+    lastShownFrame_ = nullptr;
+    lastShownSequence_ = 0;
+    shownDelay_ = 0;
+}
+
+size_t CameraSession::requiredFrames(const Config &config) const
+{
+    // Stored frames for the delay at the current decimation, see createPool()
+    size_t totalFrames = static_cast<size_t>(config.delaySeconds * config.frameRate);
+    return (totalFrames + decimation_ - 1) / decimation_;
+}
+
+void CameraSession::startStats()
+{
+    // Reset counters and (re)start the report timer in the capture thread
+    {
+        QMutexLocker locker(&statsMutex_);
+        stats_ = Stats();
+    }
+    lastSequence_ = -1;
+    dropHistory_.fill(0);
+    dropHistoryPos_ = 0;
+    periodFrames_ = 0;
+    periodLatencySum_ = 0;
+    periodLatencyMax_ = 0;
+    periodQueueSamples_ = 0;
+    periodQueuedSum_ = 0;
+    periodQueuedMin_ = 0;
+    periodBacklogMax_ = 0;
+    requestTarget_ = 0;
+    periodPresses_ = 0;
+    periodPressLatencySum_ = 0;
+    periodPressLatencyMax_ = 0;
+    handledPresses_ = button_ ? button_->pressCount() : 0;
+    firstFrame_ = true;
+    decimationPhase_ = 0;
+    lastShownFrame_ = nullptr;
+    replayEnd_ = 0;
+    scrubTimestamp_ = 0;
+    scrubSettled_ = false;
+    shownDelay_ = 0;
+    QMetaObject::invokeMethod(this, [this]() {
+        statsClock_.start();
+        statsTimer_.start();
+    }, Qt::QueuedConnection);
+}
+
+void CameraSession::stopStats()
+{
+    shownDelay_ = 0;
+    QMetaObject::invokeMethod(&statsTimer_, "stop", Qt::QueuedConnection);
+}
+
+bool CameraSession::processImage(const Image &image, uint64_t sequence, uint64_t timestamp, Image *realtimeImage,
+                                 const CaptureMetadata *metadata)
+{
+    if (pool_ == nullptr)
+        return false;
+
+    // Check for button and timer state, a press shorter than a frame counts as well
+    // One can also check if af is still scanning, but I want some extra time
+    bool buttonIsPressed = button_ && (button_->isPressed() || button_->pressCount() != handledPresses_);
+    if (buttonIsPressed)
+        realtimeTimer_.start();
+    bool timerIsRunning = realtimeTimer_.isValid() && realtimeTimer_.elapsed() < 3000; // 3s
+    bool needRealtime = buttonIsPressed || timerIsRunning || realtimeRequested_;
+
+    // Count frames the sensor produced but we never received
+    uint64_t drops = 0;
+    if (lastSequence_ >= 0 && sequence > static_cast<uint64_t>(lastSequence_) + 1)
+        drops = sequence - lastSequence_ - 1;
+    lastSequence_ = sequence;
+
+    // Keep the delay exact: every stored frame lost to a drop becomes a placeholder repeating the latest one
+    // A decimated pool only misses the frames a drop hits on its stored phase
+    size_t concealed = 0;
+    if (drops > 0 && config_.concealDrops) {
+        const uint64_t firstStored = (decimation_ - decimationPhase_) % decimation_;
+        const uint64_t missed = firstStored < drops ? (drops - 1 - firstStored) / decimation_ + 1 : 0;
+        decimationPhase_ = (decimationPhase_ + drops) % decimation_;
+        if (missed > 0)
+            concealed = pool_->insertPlaceholders(missed, timestamp);
+    }
+
+    // Get oldest frame and copy current frame to pool, a decimated pool only takes every Nth frame
+    // If a reader held the slot for too long the image is dropped, the latest frame stands in for it
+    const uint64_t phase = decimationPhase_;
+    decimationPhase_ = (decimationPhase_ + 1) % decimation_;
+    const bool store = phase == 0;
+    CaptureMetadata info = metadata ? *metadata : CaptureMetadata();
+    info.sequence = sequence;
+    const PooledFrame *currentFrame = store ? pool_->storeFrame(image, timestamp, &info) : nullptr;
+    if (currentFrame == nullptr)
+        currentFrame = pool_->getLatestFrame();
+    // The delayed view skips the slot the next frame goes to, the renderers lease what is shown
+    const size_t oldestIndex = pool_->oldestLeasableIndex();
+    const PooledFrame *oldestFrame = pool_->getFrame(oldestIndex);
+
+    // A replay shows the frame of a fixed time ago instead of the oldest one until it is over
+    const PooledFrame *delayedFrame = oldestFrame;
+    if (replayEnd_ > 0) {
+        size_t index = 0;
+        if (timestamp < replayEnd_ && timestamp > replayOffset_ && pool_->findFrame(timestamp - replayOffset_, index))
+            delayedFrame = pool_->getFrame(std::max(index, oldestIndex));
+        else replayEnd_ = 0;
+    }
+
+    // Once the scrub position rests the stored frame there is shown, the renderers show thumbnails while it moves
+    // The first frame after it settled is emitted, then nothing changes until it moves again
+    // A position that ages out of the pool follows the oldest frame, the timeline shows where it is
+    uint64_t scrubTimestamp = scrubTimestamp_.load(std::memory_order_relaxed);
+    if (scrubTimestamp > 0 && oldestFrame && scrubTimestamp < oldestFrame->timestamp()) {
+        const uint64_t clamped = std::max<uint64_t>(oldestFrame->timestamp(), 1);
+        if (scrubTimestamp_.compare_exchange_strong(scrubTimestamp, clamped, std::memory_order_relaxed))
+            scrubTimestamp = clamped;
+    }
+    const bool scrubbing = scrubTimestamp > 0;
+    if (scrubbing && monotonicNs() - scrubMovedNs_ >= ScrubSettleTime * 1000000) {
+        size_t index = 0;
+        delayedFrame = pool_->findFrame(scrubTimestamp, index) ? pool_->getFrame(std::max(index, oldestIndex)) : oldestFrame;
+        if (!frozen_ && !needRealtime && pool_->isFull())
+            scrubSettled_.store(true, std::memory_order_release);
+    }
+
+    // Use current frame if realtime is needed
+    // The full size realtime stream is only copied then, the stored stream is all the delay needs
+    // Frames a decimated pool skips are copied for the realtime view as well
+    const PooledFrame *renderFrame = needRealtime ? currentFrame : delayedFrame;
+    std::shared_ptr<const FramePool> renderPool = pool_;
+    // Only the copy needs the realtime buffer coherent, the sync costs a cache flush on every frame otherwise
+    const Image *realtimeSource = realtimeImage ? realtimeImage : decimation_ > 1 ? &image : nullptr;
+    if (needRealtime && realtimeSource && realtimePool_ && pool_->isFull()) {
+        if (realtimeImage)
+            realtimeImage->beginCpuAccess();
+        const PooledFrame *realtimeFrame = realtimePool_->storeFrame(*realtimeSource, timestamp);
+        if (realtimeImage)
+            realtimeImage->endCpuAccess();
+        if (realtimeFrame) {
+            renderFrame = realtimeFrame;
+            renderPool = realtimePool_;
+        }
+    }
+
+    // Render frame if pool is full, otherwise report progress
+    if (pool_->isFull()) {
+        if (needRealtime)
+            measurePressLatency();
+
+        // Between two stored frames the delayed view is repeated or cross-faded to the next one
+        const PooledFrame *nextFrame = nullptr;
+        float blend = 0;
+        if (!needRealtime && delayedFrame == oldestFrame && decimation_ > 1 && config_.crossFade && phase != 0) {
+            nextFrame = pool_->getFrame(oldestIndex + 1);
+            blend = nextFrame ? static_cast<float>(phase) / decimation_ : 0;
+        }
+        // A frozen view keeps the frame shown last
+        if (!frozen_ && (nextFrame || renderFrame != lastShownFrame_ || renderFrame->sequenceNumber() != lastShownSequence_))
+            Q_EMIT frameReady(renderPool, renderFrame, renderFrame->sequenceNumber(),
+                              nextFrame, nextFrame ? nextFrame->sequenceNumber() : 0, blend);
+        if (!frozen_) {
+            lastShownFrame_ = renderFrame;
+            lastShownSequence_ = renderFrame->sequenceNumber();
+        }
+
+        // The audio follows the delayed frames as long as they move on, a replay included
+        const bool running = !needRealtime && !frozen_ && !scrubbing && renderFrame->timestamp() > 0;
+        const uint64_t now = monotonicNs();
+        shownDelay_.store(running && now > renderFrame->timestamp() ? now - renderFrame->timestamp() : 0,
+                          std::memory_order_relaxed);
+
+        // Feed the stream taps, the server drops frames if nobody watches
+        // The delayed tap follows replays and the scrub position, a frozen view pauses it
+        if (streamServer_) {
+            if (!frozen_)
+                streamServer_->pushFrame(StreamServer::Tap::Delayed, delayedFrame);
+            if (streamRealtime_)
+                streamServer_->pushFrame(StreamServer::Tap::Realtime, currentFrame);
+        }
+    } else {
+        // Presses while filling are not measured
+        if (button_)
+            handledPresses_ = button_->pressCount();
+        Q_EMIT fillProgress(pool_->size(), pool_->capacity());
+    }
+
+    // Measure latency from sensor timestamp to stored frame
+    double latency = timestamp ? (monotonicNs() - timestamp) / 1e6 : 0;
+    periodFrames_++;
+    periodLatencySum_ += latency;
+    periodLatencyMax_ = std::max(periodLatencyMax_, latency);
+    {
+        QMutexLocker locker(&statsMutex_);
+        stats_.frames++;
+        stats_.drops += drops;
+        stats_.concealed += concealed;
+        stats_.poolSize = pool_->size();
+        stats_.poolCapacity = pool_->capacity();
+        stats_.delay = oldestFrame && timestamp > oldestFrame->timestamp() ? (timestamp - oldestFrame->timestamp()) / 1e9 : 0;
+        stats_.delayTarget = config_.delaySeconds;
+        stats_.realtime = needRealtime;
+        stats_.frozen = frozen_;
+        stats_.replaying = replayEnd_ > 0;
+        stats_.scrubbing = scrubbing;
+    }
+
+    // Autofocus on first frame and while the button is pressed
+    bool triggerAutoFocus = firstFrame_ || buttonIsPressed || autoFocusRequested_ || config_.alwaysAutoFocus;
+    firstFrame_ = false;
+    autoFocusRequested_ = false;
+    return triggerAutoFocus;
+}
+
+void CameraSession::recordQueue(unsigned int queued, unsigned int backlog, unsigned int target)
+{
+    periodQueuedMin_ = periodQueueSamples_ ? std::min(periodQueuedMin_, queued) : queued;
+    periodQueueSamples_++;
+    periodQueuedSum_ += queued;
+    periodBacklogMax_ = std::max(periodBacklogMax_, backlog);
+    requestTarget_ = target;
+}
+
+void CameraSession::showRealtime()
+{
+    // Only once the delayed picture is shown and not frozen
+    if (pool_ == nullptr || !pool_->isFull() || frozen_)
+        return;
+    // Prefer the full size frame if the realtime pool holds the newest one
+    std::shared_ptr<const FramePool> pool = pool_;
+    const PooledFrame *latestFrame = pool_->getLatestFrame();
+    if (realtimePool_ && realtimePool_->size() > 0 &&
+        realtimePool_->getLatestFrame()->timestamp() >= latestFrame->timestamp()) {
+        pool = realtimePool_;
+        latestFrame = realtimePool_->getLatestFrame();
+    }
+    realtimeTimer_.start();
+    autoFocusRequested_ = true;
+    measurePressLatency();
+    lastShownFrame_ = latestFrame;
+    lastShownSequence_ = latestFrame->sequenceNumber();
+    Q_EMIT frameReady(pool, latestFrame, latestFrame->sequenceNumber(), nullptr, 0, 0);
+}
+
+void CameraSession::setRealtime(bool enabled)
+{
+    realtimeRequested_ = enabled;
+    if (enabled)
+        showRealtime();
+}
+
+void CameraSession::setFrozen(bool frozen)
+{
+    frozen_ = frozen;
+}
+
+void CameraSession::replay(float seconds)
+{
+    // Starts with the frame of the given time ago, at most the oldest one stored
+    if (pool_ == nullptr || pool_->size() == 0 || seconds <= 0)
+        return;
+    const uint64_t latest = pool_->getLatestFrame()->timestamp();
+    const uint64_t span = latest - pool_->getOldestFrame()->timestamp();
+    replayOffset_ = std::min(static_cast<uint64_t>(seconds * 1e9), span);
+    replayEnd_ = latest + replayOffset_;
+    dcInfo(QString("%1: Replaying the last %2s").arg(name_).arg(replayOffset_ / 1e9, 0, 'f', 1));
+}
+
+void CameraSession::scrub(float seconds)
+{
+    // The position is kept as sensor time, so it stays on the same frame while new ones are stored
+    if (pool_ == nullptr || pool_->size() == 0 || seconds < 0)
+        return;
+    const uint64_t latest = pool_->getLatestFrame()->timestamp();
+    const uint64_t span = latest - pool_->getOldestFrame()->timestamp();
+    const uint64_t offset = std::min(static_cast<uint64_t>(seconds * 1e9), span);
+    scrubMovedNs_ = monotonicNs();
+    scrubSettled_.store(false, std::memory_order_relaxed);
+    scrubTimestamp_.store(std::max<uint64_t>(latest - offset, 1), std::memory_order_relaxed);
+}
+
+void CameraSession::endScrub()
+{
+    // The next frame shows the delayed view again
+    scrubTimestamp_.store(0, std::memory_order_relaxed);
+    scrubSettled_.store(false, std::memory_order_relaxed);
+}
+
+CameraSession::ScrubState CameraSession::scrubState() const
+{
+    // Settled is stored before the frame is emitted, so a renderer that took that frame sees it
+    ScrubState state;
+    state.settled = scrubSettled_.load(std::memory_order_acquire);
+    state.timestamp = scrubTimestamp_.load(std::memory_order_relaxed);
+    return state;
+}
+
+void CameraSession::measurePressLatency()
+{
+    // Time from the first press not shown yet to now
+    uint64_t presses = button_ ? button_->pressCount() : 0;
+    if (presses == handledPresses_)
+        return;
+    handledPresses_ = presses;
+    double latency = (monotonicNs() - button_->lastPressTime()) / 1e6;
+    periodPresses_++;
+    periodPressLatencySum_ += latency;
+    periodPressLatencyMax_ = std::max(periodPressLatencyMax_, latency);
+}
+
+void CameraSession::reportStats()
+{
+    // Update statistics of the last period
+    double seconds = statsClock_.restart() / 1000.0;
+    Stats stats;
+    {
+        QMutexLocker locker(&statsMutex_);
+        stats_.frameRate = seconds > 0 ? periodFrames_ / seconds : 0;
+        stats_.latencyAvg = periodFrames_ ? periodLatencySum_ / periodFrames_ : 0;
+        stats_.latencyMax = periodLatencyMax_;
+        stats_.presses = periodPresses_;
+        stats_.pressLatencyAvg = periodPresses_ ? periodPressLatencySum_ / periodPresses_ : 0;
+        stats_.pressLatencyMax = periodPressLatencyMax_;
+        stats_.requestTarget = requestTarget_;
+        stats_.queuedMin = periodQueuedMin_;
+        stats_.queuedAvg = periodQueueSamples_ ? static_cast<double>(periodQueuedSum_) / periodQueueSamples_ : 0;
+        stats_.backlogMax = periodBacklogMax_;
+
+        // Drops of the last minute, from the totals of the last 12 reports
+        stats_.dropsPerMinute = stats_.drops - dropHistory_[dropHistoryPos_];
+        dropHistory_[dropHistoryPos_] = stats_.drops;
+        dropHistoryPos_ = (dropHistoryPos_ + 1) % dropHistory_.size();
+        stats = stats_;
+    }
+    periodFrames_ = 0;
+    periodLatencySum_ = 0;
+    periodLatencyMax_ = 0;
+    periodQueueSamples_ = 0;
+    periodQueuedSum_ = 0;
+    periodQueuedMin_ = 0;
+    periodBacklogMax_ = 0;
+    periodPresses_ = 0;
+    periodPressLatencySum_ = 0;
+    periodPressLatencyMax_ = 0;
+
+    dcInfo(QString("%1: %2 fps, latency avg %3ms max %4ms, %5 frames, %6 dropped (%7/min), %8 concealed")
+        .arg(name_).arg(stats.frameRate, 0, 'f', 1)
+        .arg(stats.latencyAvg, 0, 'f', 1).arg(stats.latencyMax, 0, 'f', 1)
+        .arg(stats.frames).arg(stats.drops).arg(stats.dropsPerMinute).arg(stats.concealed));
+    if (config_.dropWarning > 0 && stats.dropsPerMinute >= config_.dropWarning)
+        dcWarning(QString("%1: %2 frames dropped in the last minute").arg(name_).arg(stats.dropsPerMinute));
+    // Report the request queue, only sessions with a request queue record it
+    if (stats.requestTarget > 0)
+        dcInfo(QString("%1: %2 requests in flight, queued at the camera min %3 avg %4, backlog max %5")
+            .arg(name_).arg(stats.requestTarget).arg(stats.queuedMin)
+            .arg(stats.queuedAvg, 0, 'f', 1).arg(stats.backlogMax));
+    // Report lease contention if there was any
+    if (pool_) {
+        FramePool::LeaseStats leases = pool_->leaseStats();
+        uint64_t waits = leases.writerWaits - lastLeaseStats_.writerWaits;
+        uint64_t drops = leases.droppedFrames - lastLeaseStats_.droppedFrames;
+        if (waits > 0 || drops > 0)
+            dcInfo(QString("%1: Writer waited %2 times for leased frames (avg %3us), %4 frames dropped, %5 leases, %6 missed")
+                .arg(name_).arg(waits)
+                .arg((leases.writerWaitNs - lastLeaseStats_.writerWaitNs) / 1000.0 / std::max<uint64_t>(waits, 1), 0, 'f', 1)
+                .arg(drops).arg(leases.acquired - lastLeaseStats_.acquired).arg(leases.missed - lastLeaseStats_.missed));
+        lastLeaseStats_ = leases;
+
+        // Report the stages working on the stored frames, the busiest one limits the frame rate they keep up with
+        // A new pool starts counting from zero
+        std::vector<FramePipeline::StageStats> stages = pool_->pipeline() ? pool_->pipeline()->stats()
+                                                                           : std::vector<FramePipeline::StageStats>();
+        for (size_t i = 0; i < stages.size(); i++) {
+            const FramePipeline::StageStats &stage = stages[i];
+            FramePipeline::StageStats last;
+            if (i < lastStageStats_.size() && lastStageStats_[i].processed <= stage.processed)
+                last = lastStageStats_[i];
+            const uint64_t processed = stage.processed - last.processed;
+            const uint64_t dropped = stage.dropped - last.dropped;
+            if (processed == 0 && dropped == 0)
+                continue;
+            dcInfo(QString("%1: Stage %2 %3 frames avg %4us max %5us, busy %6%, queued avg %7us max %8, %9 dropped")
+                .arg(name_, QString::fromStdString(stage.name)).arg(processed)
+                .arg((stage.busyNs - last.busyNs) / 1000.0 / std::max<uint64_t>(processed, 1), 0, 'f', 1)
+                .arg(stage.maxNs / 1000.0, 0, 'f', 1)
+                .arg(seconds > 0 ? (stage.busyNs - last.busyNs) / 1e7 / seconds : 0, 0, 'f', 1)
+                .arg((stage.queuedNs - last.queuedNs) / 1000.0 / std::max<uint64_t>(processed, 1), 0, 'f', 1)
+                .arg(stage.queueMax).arg(dropped));
+            if (stage.blockedNs > last.blockedNs)
+                dcInfo(QString("%1: Stage %2 blocked the writer for %3ms")
+                    .arg(name_, QString::fromStdString(stage.name)).arg((stage.blockedNs - last.blockedNs) / 1e6, 0, 'f', 1));
+        }
+        lastStageStats_ = std::move(stages);
+    }
+    if (stats.presses > 0)
+        dcInfo(QString("%1: %2 button presses, press to realtime frame avg %3ms max %4ms")
+            .arg(name_).arg(stats.presses)
+            .arg(stats.pressLatencyAvg, 0, 'f', 1).arg(stats.pressLatencyMax, 0, 'f', 1));
+}
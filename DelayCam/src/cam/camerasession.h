@@ -0,0 +1,251 @@
+#ifndef CAMERASESSION_H
+#define CAMERASESSION_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <vector>
+
+#include "util/undefkeywords.h"
+#include <libcamera/formats.h>
+
+#include <QObject>
+#include <QSize>
+#include <QMutex>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "cam/framepool.h"
+#include "cam/framepipeline.h"
+
+class Image;
+class StreamServer;
+class ButtonInput;
+
+// A single frame source with its own pool, processed in its own capture thread
+// start() and stop() are called from the GUI thread, frames are handled in the thread the session was moved to.
+class CameraSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Config {
+        float frameRate = 30.0;
+        float delaySeconds = 30.0;
+        QSize size;                 // Requested frame size
+        bool alwaysAutoFocus = false;
+        QString sharedMemoryName;   // Export the pool via shared memory if not empty
+        bool persistentPool = false; // Keep the shared pool across restarts
+        bool prefault = true;       // Allocate pool pages ahead of the write head in the background
+        bool cachedBuffers = true;  // Capture into cached buffers from a DMA heap instead of the camera's own
+        size_t memoryLimit = 0;     // RAM budget of this session's pool, 0 = no limit
+        unsigned int storageScale = 0; // Downscale stored frames by 1, 2 or 4, 0 = finest that fits the budget
+        unsigned int bufferCount = 0;  // Capture buffers, 0 = tune the requests in flight automatically
+        QSize storageSize;          // Store a second, smaller stream of the camera, invalid = store the frames shown
+        unsigned int decimation = 0; // Store every Nth frame, 0 = only as many as needed to fit the budget
+        bool crossFade = false;     // Blend between the stored frames of a decimated pool instead of repeating them
+        bool concealDrops = true;   // Store placeholders for dropped frames, otherwise the delay shrinks by each drop
+        unsigned int dropWarning = 0; // Warn at this many dropped frames per minute, 0 = never
+    };
+
+    struct Stats {
+        uint64_t frames = 0;        // Frames stored since start
+        uint64_t drops = 0;         // Frames lost according to sensor sequence numbers
+        uint64_t dropsPerMinute = 0; // Drops of the last minute
+        uint64_t concealed = 0;     // Placeholders stored for dropped frames
+        double latencyAvg = 0;      // Time from sensor timestamp to stored frame [ms], last period
+        double latencyMax = 0;
+        double frameRate = 0;       // Measured frames per second, last period
+        uint64_t presses = 0;       // Button presses, last period
+        double pressLatencyAvg = 0; // Time from button press to first realtime frame [ms], last period
+        double pressLatencyMax = 0;
+        unsigned int requestTarget = 0; // Requests the session tries to keep queued at the camera
+        unsigned int queuedMin = 0;     // Requests queued at the camera when a frame arrived, last period
+        double queuedAvg = 0;
+        unsigned int backlogMax = 0;    // Completed requests waiting for the capture thread, last period
+        size_t poolSize = 0;        // Frames stored in the pool
+        size_t poolCapacity = 0;
+        double delay = 0;           // Time between the newest and the oldest stored frame [s]
+        double delayTarget = 0;     // Configured delay [s]
+        bool realtime = false;      // Realtime view shown, by the button or requested
+        bool frozen = false;
+        bool replaying = false;
+        bool scrubbing = false;
+    };
+
+    // Scrub position for the renderers
+    struct ScrubState {
+        uint64_t timestamp = 0;     // Sensor time of the position, 0 = not scrubbing [ns]
+        bool settled = false;       // The stored frame of the position has been emitted
+    };
+
+    // Scrubbing shows the stored frame once the position rested this long, thumbnails until then [ms]
+    static constexpr uint64_t ScrubSettleTime = 250;
+
+    // How a changed configuration reaches a running session
+    enum class Change {
+        None,       // Nothing the session uses differs
+        Live,       // Applied between two frames with updateConfig()
+        Restart,    // The camera is stopped and started again, the pool is kept
+        NewPool     // The pool is released and filled again
+    };
+
+    CameraSession(const QString &name, QObject *parent = nullptr);
+    virtual ~CameraSession();
+
+    const QString &name() const { return name_; }
+    const libcamera::PixelFormat &format() const { return format_; }
+
+    // Geometry of the frames handed out, smaller than the camera frames if the pool downscales them
+    QSize size() const {
+        const std::shared_ptr<const FramePool> current = pool();
+        return current ? QSize(current->width(), current->height()) : size_;
+    }
+    uint stride() const {
+        const std::shared_ptr<const FramePool> current = pool();
+        return current ? current->stride() : stride_;
+    }
+
+    // The pool stays alive as long as it is referenced, e.g. while a clip is written or the index is queried
+    // Safe from any thread, the pool is replaced atomically
+    std::shared_ptr<const FramePool> pool() const { return std::atomic_load(&pool_); }
+    virtual bool start(const Config &config) = 0;
+    virtual void stop() = 0;
+
+    // Compare a new configuration to the current one, the memory limit is only used for a new pool
+    Change compare(const Config &config) const;
+
+    // Budget the current pool was sized for, kept by configurations that don't need a new pool
+    size_t memoryLimit() const { QMutexLocker locker(&configMutex_); return config_.memoryLimit; }
+
+    // Take over a new configuration, a shorter delay drops the oldest frames of the pool
+    // Called in the capture thread while running or from any thread while stopped
+    void updateConfig(const Config &config);
+
+    // Give up the pools while stopped, the next start() creates new ones
+    // Each pool is deleted once the last renderer, clip writer or query holding it lets go
+    void releasePools();
+
+    void setButton(const ButtonInput *button) { button_ = button; }
+    void setStreamServer(StreamServer *server, bool realtimeTap);
+    Stats stats() const;
+
+    // Safe from any thread, e.g. the render thread
+    ScrubState scrubState() const;
+
+    // Age of the delayed frame shown last when it was emitted, the audio is played with this delay
+    // 0 while no delayed frame runs, i.e. filling, realtime, frozen or scrubbing [ns]
+    uint64_t shownDelay() const { return shownDelay_.load(std::memory_order_relaxed); }
+
+public Q_SLOTS:
+    // Give up a quarter of the delay to free memory, never below one second, a shared pool keeps its size
+    void shrinkPool();
+
+    // Show the latest frame right away instead of waiting for the next one, called on a button press
+    void showRealtime();
+
+    // Show the realtime view until it is turned off again
+    void setRealtime(bool enabled);
+
+    // Keep the frame shown while capturing goes on
+    void setFrozen(bool frozen);
+
+    // Show the frames of some seconds ago until the time of the request is reached, then the delayed view again
+    void replay(float seconds);
+
+    // Move the scrub position to some seconds before the newest frame, at most to the oldest one
+    // The view keeps the position while capturing goes on, like a frozen one
+    void scrub(float seconds);
+    void endScrub();
+
+Q_SIGNALS:
+    // Emitted from the capture thread
+    // With a decimated pool the frame can be cross-faded to the next one, blend is the weight of next
+    void frameReady(std::shared_ptr<const FramePool> pool, const PooledFrame *frame, quint64 sequence,
+                    const PooledFrame *next, quint64 nextSequence, float blend);
+    void fillProgress(quint64 size, quint64 capacity);
+
+protected:
+    // Store an image, select the frame to display and update statistics
+    // A larger realtime image of the same frame is shown instead of the stored one while realtime is needed
+    // Capture metadata is kept with the stored frame, only sequence and timestamp without it
+    // The caller brackets the image with CPU access, the realtime image is only synced here when it is copied
+    // Must be called from the capture thread, returns true if autofocus should be triggered
+    bool processImage(const Image &image, uint64_t sequence, uint64_t timestamp, Image *realtimeImage = nullptr,
+                      const CaptureMetadata *metadata = nullptr);
+    bool createPool(const Image &sampleImage);
+    bool createRealtimePool(const Image &sampleImage);
+
+    // Account the request queue state when a completed request is handled
+    void recordQueue(unsigned int queued, unsigned int backlog, unsigned int target);
+    void startStats();
+    void stopStats();
+
+protected:
+    QString name_;
+    Config config_;
+    mutable QMutex configMutex_;   // Protects config_ against compare() while it is updated live
+    libcamera::PixelFormat format_;
+    QSize size_;
+    uint stride_;
+    std::shared_ptr<FramePool> pool_;
+
+    // Few frames of the realtime stream, only written while the realtime view is shown
+    QSize realtimeSize_;
+    uint realtimeStride_;
+    std::shared_ptr<FramePool> realtimePool_;
+
+    // Temporal decimation of the stored frames
+    unsigned int decimation_;       // Every Nth frame is stored
+    uint64_t decimationPhase_;      // Frames since the last stored one
+    const PooledFrame *lastShownFrame_;
+    uint64_t lastShownSequence_;
+
+private Q_SLOTS:
+    void reportStats();
+
+private:
+    void measurePressLatency();
+    size_t requiredFrames(const Config &config) const;
+
+    const ButtonInput *button_;
+    uint64_t handledPresses_;      // Press count of the button when the last realtime frame was shown
+    bool autoFocusRequested_;
+    StreamServer *streamServer_;
+    bool streamRealtime_;
+    bool firstFrame_;
+    QElapsedTimer realtimeTimer_;  // Keeps the realtime view for a while after the button was released
+    bool realtimeRequested_;
+    bool frozen_;
+    uint64_t replayOffset_;        // Replayed frames are this much older than the captured ones [ns]
+    uint64_t replayEnd_;           // Sensor time the replay ends at, 0 = no replay [ns]
+    std::atomic<uint64_t> scrubTimestamp_; // Sensor time of the scrub position, 0 = not scrubbing [ns]
+    std::atomic<bool> scrubSettled_;
+    uint64_t scrubMovedNs_;        // Monotonic time the position last changed [ns]
+    std::atomic<uint64_t> shownDelay_;
+
+    // Statistics, written by the capture thread
+    mutable QMutex statsMutex_;    // Protects stats_
+    Stats stats_;
+    QTimer statsTimer_;
+    QElapsedTimer statsClock_;
+    int64_t lastSequence_;
+    uint64_t periodFrames_;
+    double periodLatencySum_;
+    double periodLatencyMax_;
+    FramePool::LeaseStats lastLeaseStats_;
+    std::vector<FramePipeline::StageStats> lastStageStats_;
+    std::array<uint64_t, 12> dropHistory_; // Drops at the last 12 reports, one minute
+    size_t dropHistoryPos_;
+    uint64_t periodQueueSamples_;
+    uint64_t periodQueuedSum_;
+    unsigned int periodQueuedMin_;
+    unsigned int periodBacklogMax_;
+    unsigned int requestTarget_;
+    uint64_t periodPresses_;
+    double periodPressLatencySum_;
+    double periodPressLatencyMax_;
+};
+
+#endif // CAMERASESSION_H
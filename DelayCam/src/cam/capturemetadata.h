@@ -0,0 +1,159 @@
+#ifndef CAPTURE_METADATA_H
+#define CAPTURE_METADATA_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// Luma statistics of one frame, computed by the pool after storing it, see ActivityAnalyzer
+struct FrameActivity {
+    bool analyzed = false;          // False for formats without a luma plane and frames of a previous process
+    uint8_t mean = 0;               // Average luma
+    uint8_t motion = 0;             // Largest mean absolute difference of a 64x64 block to the previous stored frame
+    uint8_t activeBlocks = 0;       // Blocks that changed noticeably [%]
+    std::array<uint8_t, 16> histogram{}; // Share of each 16 luma values [1/255]
+};
+
+// Capture metadata of one frame, as reported by the camera in the request metadata
+struct CaptureMetadata {
+    uint64_t sequence = 0;          // Sensor sequence number
+    uint64_t timestamp = 0;         // Sensor timestamp [ns]
+    int32_t exposureTime = 0;       // [us], 0 = unknown
+    float analogueGain = 0;         // 0 = unknown
+    float digitalGain = 0;
+    float lensPosition = -1;        // [dioptre], -1 = no focus lens
+    int32_t afState = -1;           // libcamera::controls::AfStateEnum, -1 = unknown
+    int32_t colourTemperature = 0;  // [K], 0 = unknown
+    bool concealed = false;         // Placeholder for a dropped frame, repeats the previous one
+    FrameActivity activity;
+};
+
+// Metadata of all pool slots as a structure of arrays, one array per field
+// Scanning one field over the whole delay, e.g. the timestamps to find a time, touches only that array.
+// One writer stores without allocating, readers on any thread retry if a slot changed while they read it.
+class CaptureMetadataRing {
+public:
+    explicit CaptureMetadataRing(size_t capacity) :
+        capacity_(capacity),
+        versions_(new std::atomic<uint32_t>[capacity]()),
+        sequences_(new std::atomic<uint64_t>[capacity]()),
+        timestamps_(new std::atomic<uint64_t>[capacity]()),
+        exposureTimes_(new std::atomic<int32_t>[capacity]()),
+        analogueGains_(new std::atomic<float>[capacity]()),
+        digitalGains_(new std::atomic<float>[capacity]()),
+        lensPositions_(new std::atomic<float>[capacity]()),
+        afStates_(new std::atomic<int32_t>[capacity]()),
+        colourTemperatures_(new std::atomic<int32_t>[capacity]()),
+        concealed_(new std::atomic<bool>[capacity]()),
+        analyzed_(new std::atomic<bool>[capacity]()),
+        means_(new std::atomic<uint8_t>[capacity]()),
+        motions_(new std::atomic<uint8_t>[capacity]()),
+        activeBlocks_(new std::atomic<uint8_t>[capacity]()),
+        histograms_(new std::atomic<uint64_t>[capacity * 2]())
+    {
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    // Writer only, the version is odd while the slot is written
+    void store(size_t slot, const CaptureMetadata &metadata) {
+        const uint32_t version = versions_[slot].load(std::memory_order_relaxed);
+        versions_[slot].store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        sequences_[slot].store(metadata.sequence, std::memory_order_relaxed);
+        timestamps_[slot].store(metadata.timestamp, std::memory_order_relaxed);
+        exposureTimes_[slot].store(metadata.exposureTime, std::memory_order_relaxed);
+        analogueGains_[slot].store(metadata.analogueGain, std::memory_order_relaxed);
+        digitalGains_[slot].store(metadata.digitalGain, std::memory_order_relaxed);
+        lensPositions_[slot].store(metadata.lensPosition, std::memory_order_relaxed);
+        afStates_[slot].store(metadata.afState, std::memory_order_relaxed);
+        colourTemperatures_[slot].store(metadata.colourTemperature, std::memory_order_relaxed);
+        concealed_[slot].store(metadata.concealed, std::memory_order_relaxed);
+        analyzed_[slot].store(metadata.activity.analyzed, std::memory_order_relaxed);
+        means_[slot].store(metadata.activity.mean, std::memory_order_relaxed);
+        motions_[slot].store(metadata.activity.motion, std::memory_order_relaxed);
+        activeBlocks_[slot].store(metadata.activity.activeBlocks, std::memory_order_relaxed);
+        for (size_t half = 0; half < 2; half++) {
+            uint64_t bins;
+            std::memcpy(&bins, metadata.activity.histogram.data() + half * 8, sizeof(bins));
+            histograms_[slot * 2 + half].store(bins, std::memory_order_relaxed);
+        }
+        versions_[slot].store(version + 2, std::memory_order_release);
+    }
+
+    // Activity computed after the frame was published, by the one thread that holds a lease on its slot
+    // The writer keeps away from a leased slot, so there is still one writer per slot
+    void storeActivity(size_t slot, const FrameActivity &activity) {
+        const uint32_t version = versions_[slot].load(std::memory_order_relaxed);
+        versions_[slot].store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        analyzed_[slot].store(activity.analyzed, std::memory_order_relaxed);
+        means_[slot].store(activity.mean, std::memory_order_relaxed);
+        motions_[slot].store(activity.motion, std::memory_order_relaxed);
+        activeBlocks_[slot].store(activity.activeBlocks, std::memory_order_relaxed);
+        for (size_t half = 0; half < 2; half++) {
+            uint64_t bins;
+            std::memcpy(&bins, activity.histogram.data() + half * 8, sizeof(bins));
+            histograms_[slot * 2 + half].store(bins, std::memory_order_relaxed);
+        }
+        versions_[slot].store(version + 2, std::memory_order_release);
+    }
+
+    // Returns false if the slot was written all the time, which only happens with a stalled reader
+    bool load(size_t slot, CaptureMetadata &metadata) const {
+        for (int attempt = 0; attempt < 3; attempt++) {
+            const uint32_t version = versions_[slot].load(std::memory_order_acquire);
+            if (version & 1)
+                continue;
+            metadata.sequence = sequences_[slot].load(std::memory_order_relaxed);
+            metadata.timestamp = timestamps_[slot].load(std::memory_order_relaxed);
+            metadata.exposureTime = exposureTimes_[slot].load(std::memory_order_relaxed);
+            metadata.analogueGain = analogueGains_[slot].load(std::memory_order_relaxed);
+            metadata.digitalGain = digitalGains_[slot].load(std::memory_order_relaxed);
+            metadata.lensPosition = lensPositions_[slot].load(std::memory_order_relaxed);
+            metadata.afState = afStates_[slot].load(std::memory_order_relaxed);
+            metadata.colourTemperature = colourTemperatures_[slot].load(std::memory_order_relaxed);
+            metadata.concealed = concealed_[slot].load(std::memory_order_relaxed);
+            metadata.activity.analyzed = analyzed_[slot].load(std::memory_order_relaxed);
+            metadata.activity.mean = means_[slot].load(std::memory_order_relaxed);
+            metadata.activity.motion = motions_[slot].load(std::memory_order_relaxed);
+            metadata.activity.activeBlocks = activeBlocks_[slot].load(std::memory_order_relaxed);
+            for (size_t half = 0; half < 2; half++) {
+                const uint64_t bins = histograms_[slot * 2 + half].load(std::memory_order_relaxed);
+                std::memcpy(metadata.activity.histogram.data() + half * 8, &bins, sizeof(bins));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (versions_[slot].load(std::memory_order_relaxed) == version)
+                return true;
+        }
+        return false;
+    }
+
+    // Single fields for scans, may be torn against the other fields of the slot
+    uint64_t timestamp(size_t slot) const { return timestamps_[slot].load(std::memory_order_relaxed); }
+    uint8_t motion(size_t slot) const { return motions_[slot].load(std::memory_order_relaxed); }
+    bool analyzed(size_t slot) const { return analyzed_[slot].load(std::memory_order_relaxed); }
+
+private:
+    size_t capacity_;
+    std::unique_ptr<std::atomic<uint32_t>[]> versions_;
+    std::unique_ptr<std::atomic<uint64_t>[]> sequences_;
+    std::unique_ptr<std::atomic<uint64_t>[]> timestamps_;
+    std::unique_ptr<std::atomic<int32_t>[]> exposureTimes_;
+    std::unique_ptr<std::atomic<float>[]> analogueGains_;
+    std::unique_ptr<std::atomic<float>[]> digitalGains_;
+    std::unique_ptr<std::atomic<float>[]> lensPositions_;
+    std::unique_ptr<std::atomic<int32_t>[]> afStates_;
+    std::unique_ptr<std::atomic<int32_t>[]> colourTemperatures_;
+    std::unique_ptr<std::atomic<bool>[]> concealed_;
+    std::unique_ptr<std::atomic<bool>[]> analyzed_;
+    std::unique_ptr<std::atomic<uint8_t>[]> means_;
+    std::unique_ptr<std::atomic<uint8_t>[]> motions_;
+    std::unique_ptr<std::atomic<uint8_t>[]> activeBlocks_;
+    std::unique_ptr<std::atomic<uint64_t>[]> histograms_;  // Two words of eight bins per slot
+};
+
+#endif // CAPTURE_METADATA_H
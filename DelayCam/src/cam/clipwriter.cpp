@@ -0,0 +1,95 @@
+#include "cam/clipwriter.h"
+#include "cam/framepool.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <QFile>
+#include <QElapsedTimer>
+
+ClipWriter::ClipWriter(const QString &name, std::shared_ptr<const FramePool> pool, float seconds,
+                       const QString &path, QObject *parent) :
+    QThread(parent),
+    name_(name),
+    pool_(std::move(pool)),
+    seconds_(seconds),
+    path_(path)
+{
+    setObjectName("ClipWriter");
+}
+
+ClipWriter::~ClipWriter()
+{
+    // Stop after the current frame
+    requestInterruption();
+    wait();
+}
+
+void ClipWriter::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (pool_ == nullptr || pool_->size() == 0) {
+        dcWarning(name_ + ": No frames to save");
+        return;
+    }
+    QFile file(path_);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        dcWarning(name_ + ": Failed to save clip: " + file.errorString());
+        return;
+    }
+
+    // The span is fixed now, frames are looked up by timestamp since the pool moves on while writing
+    const uint64_t end = pool_->getLatestFrame()->timestamp();
+    const uint64_t span = static_cast<uint64_t>(seconds_ * 1e9);
+    uint64_t last = end > span ? end - span : 0;
+    std::vector<uint8_t> buffer;
+    size_t frames = 0;
+    size_t overwritten = 0;
+    while (!isInterruptionRequested()) {
+
+        // Next frame after the last one written, the oldest one if that was overwritten meanwhile
+        // The slot written next is skipped, leasing it would make the capture thread wait
+        size_t index = 0;
+        if (pool_->findFrame(last, index))
+            index++;
+        else if (frames > 0)
+            overwritten++;
+        index = std::max(index, pool_->oldestLeasableIndex());
+        if (index >= pool_->size())
+            break;
+        const PooledFrame *frame = pool_->getFrame(index);
+        FrameLease lease = pool_->acquire(frame, frame->sequenceNumber());
+        if (!lease) {
+            yieldCurrentThread();
+            continue;
+        }
+        const uint64_t timestamp = lease->timestamp();
+        if (timestamp > end)
+            break;
+        if (timestamp <= last && frames > 0)
+            continue;
+
+        // Copy under the lease, write without it
+        buffer.clear();
+        for (unsigned int plane = 0; plane < lease->numPlanes(); plane++) {
+            libcamera::Span<const uint8_t> data = lease->data(plane);
+            buffer.insert(buffer.end(), data.begin(), data.end());
+        }
+        lease.release();
+        if (file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size()) != static_cast<qint64>(buffer.size())) {
+            dcWarning(name_ + ": Failed to save clip: " + file.errorString());
+            return;
+        }
+        frames++;
+        last = timestamp;
+    }
+
+    dcInfo(QString("%1: Saved %2 frames (%3x%4, stride %5) to %6 in %7ms")
+        .arg(name_).arg(frames).arg(pool_->width()).arg(pool_->height()).arg(pool_->stride())
+        .arg(path_).arg(timer.elapsed()));
+    if (overwritten > 0)
+        dcWarning(QString("%1: The pool overwrote frames of the clip %2 times while saving").arg(name_).arg(overwritten));
+}
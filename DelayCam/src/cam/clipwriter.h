@@ -0,0 +1,35 @@
+#ifndef CLIP_WRITER_H
+#define CLIP_WRITER_H
+
+#include <memory>
+
+#include "util/undefkeywords.h"
+
+#include <QThread>
+#include <QString>
+
+class FramePool;
+
+// Writes the frames of the last seconds of a pool to a file in its own thread
+// Frames are copied one at a time under a lease, so the capture thread only waits for a memcpy, never for the disk.
+// The raw planes of every frame are written one after the other, like delaycam-reader -o does.
+class ClipWriter : public QThread
+{
+    Q_OBJECT
+
+public:
+    ClipWriter(const QString &name, std::shared_ptr<const FramePool> pool, float seconds,
+               const QString &path, QObject *parent = nullptr);
+    ~ClipWriter();
+
+protected:
+    void run() override;
+
+private:
+    QString name_;
+    std::shared_ptr<const FramePool> pool_;
+    float seconds_;
+    QString path_;
+};
+
+#endif // CLIP_WRITER_H
@@ -0,0 +1,45 @@
+#include "dmaheap.h"
+#include "util/logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <sys/ioctl.h>
+
+// Cached contiguous heaps, the one of the Pi kernels first
+static const char *HeapNames[] = {
+    "/dev/dma_heap/vidbuf_cached",
+    "/dev/dma_heap/linux,cma",
+};
+
+DmaHeap::DmaHeap()
+{
+    // The first heap that opens
+    for (const char *name : HeapNames) {
+        int fd = ::open(name, O_RDWR | O_CLOEXEC, 0);
+        if (fd >= 0) {
+            heap_ = libcamera::UniqueFD(fd);
+            name_ = name;
+            return;
+        }
+    }
+}
+
+libcamera::UniqueFD DmaHeap::alloc(const char *name, size_t size) const
+{
+    // Allocate, the buffer is freed when the last fd and mapping are gone
+    struct dma_heap_allocation_data alloc = {};
+    alloc.len = size;
+    alloc.fd_flags = O_CLOEXEC | O_RDWR;
+    if (::ioctl(heap_.get(), DMA_HEAP_IOCTL_ALLOC, &alloc) < 0) {
+        dcWarning(QString("Failed to allocate %1 bytes from %2: %3").arg(size).arg(name_.c_str(), strerror(errno)));
+        return libcamera::UniqueFD();
+    }
+    libcamera::UniqueFD buffer(alloc.fd);
+
+    // Naming is optional, older kernels don't support it
+    ::ioctl(buffer.get(), DMA_BUF_SET_NAME, name);
+    return buffer;
+}
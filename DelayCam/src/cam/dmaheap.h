@@ -0,0 +1,31 @@
+#ifndef DMA_HEAP_H
+#define DMA_HEAP_H
+
+#include <cstddef>
+#include <string>
+
+#include "util/undefkeywords.h"
+#include <libcamera/base/unique_fd.h>
+
+// Allocator of dmabufs from a Linux DMA heap
+// Buffers the camera allocates itself are mapped uncached on the Pi, so every read of the CPU goes to RAM.
+// Buffers from a cached heap are mapped cached instead, the camera imports them like its own. Reads then need
+// Image::beginCpuAccess()/endCpuAccess() around them, which invalidate the cache lines of the buffer.
+class DmaHeap {
+public:
+    DmaHeap();
+
+    // False if none of the heaps exists or can be opened
+    bool isValid() const { return heap_.isValid(); }
+    const std::string &name() const { return name_; }
+
+    // Physically contiguous dmabuf of the size, invalid on failure
+    // The name shows up in /sys/kernel/debug/dma_buf/bufinfo
+    libcamera::UniqueFD alloc(const char *name, size_t size) const;
+
+private:
+    libcamera::UniqueFD heap_;
+    std::string name_;
+};
+
+#endif // DMA_HEAP_H
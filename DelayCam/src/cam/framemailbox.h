@@ -0,0 +1,74 @@
+#ifndef FRAME_MAILBOX_H
+#define FRAME_MAILBOX_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+
+#include "cam/framepool.h"
+
+// Hands the latest frame to display from the capture thread to a renderer without locks
+// A triple buffer: the writer fills its back slot and swaps it with the middle one, the reader
+// swaps its front slot with the middle one if that holds a new frame. Frames posted in between
+// two takes are skipped, the reader always gets the latest one.
+// Exactly one writer and one reader thread.
+class FrameMailbox {
+public:
+    struct Entry {
+        std::shared_ptr<const FramePool> pool; // Keeps the frames valid while the entry is held
+        const PooledFrame *frame = nullptr;
+        uint64_t sequence = 0;      // Sequence number of the frame when it was selected
+        const PooledFrame *next = nullptr; // Frame to cross-fade to, null = show frame only
+        uint64_t nextSequence = 0;
+        float blend = 0;            // Weight of the next frame 0-1
+        uint64_t captureNs = 0;     // Sensor timestamp of the newest captured frame [ns]
+        uint64_t postedNs = 0;      // Time the frame was posted [ns]
+    };
+
+    // Post a frame, returns true if the mailbox was empty and the reader needs to be woken up
+    bool post(const std::shared_ptr<const FramePool> &pool, const PooledFrame *frame, uint64_t sequence,
+              const PooledFrame *next = nullptr, uint64_t nextSequence = 0, float blend = 0) {
+        Entry &entry = entries_[back_];
+        entry.pool = pool;
+        entry.frame = frame;
+        entry.sequence = sequence;
+        entry.next = next;
+        entry.nextSequence = nextSequence;
+        entry.blend = blend;
+        entry.captureNs = pool ? pool->getLatestFrame()->timestamp() : 0;
+        entry.postedNs = now();
+        uint8_t previous = middle_.exchange(back_ | NewFlag, std::memory_order_acq_rel);
+        back_ = previous & IndexMask;
+        return !(previous & NewFlag);
+    }
+
+    // Take the latest frame, returns false if nothing was posted since the last take
+    bool take(Entry &entry) {
+        if (!(middle_.load(std::memory_order_relaxed) & NewFlag))
+            return false;
+        uint8_t previous = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = previous & IndexMask;
+        entry = entries_[front_];
+        return true;
+    }
+
+    // Monotonic clock like the sensor timestamps
+    static uint64_t now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+private:
+    static constexpr uint8_t IndexMask = 0x03;
+    static constexpr uint8_t NewFlag = 0x04;
+
+    std::array<Entry, 3> entries_;
+    uint8_t back_ = 0;                  // Owned by the writer
+    uint8_t front_ = 1;                 // Owned by the reader
+    std::atomic<uint8_t> middle_{2};    // Index of the exchanged slot and NewFlag
+};
+
+#endif // FRAME_MAILBOX_H
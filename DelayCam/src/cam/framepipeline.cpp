@@ -0,0 +1,174 @@
+#include "framepipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+FramePipeline::FramePipeline(const FramePool &pool, unsigned int workers) :
+    pool_(pool)
+{
+    // Workers wait for the first stage and job
+    for (unsigned int i = 0; i < std::max(workers, 1u); i++)
+        workers_.emplace_back(&FramePipeline::run, this);
+}
+
+FramePipeline::~FramePipeline()
+{
+    stop();
+}
+
+size_t FramePipeline::addStage(Stage stage)
+{
+    // The ring is allocated here, queueing a frame never allocates
+    std::unique_ptr<StageState> state = std::make_unique<StageState>();
+    stage.queueSize = std::max<size_t>(stage.queueSize, 1);
+    stage.concurrency = std::max(stage.concurrency, 1u);
+    state->queue.resize(stage.queueSize);
+    state->stats.name = stage.name;
+    state->stage = std::move(stage);
+    std::lock_guard<std::mutex> lock(mutex_);
+    stages_.push_back(std::move(state));
+    return stages_.size() - 1;
+}
+
+void FramePipeline::submit(const PooledFrame *frame, uint64_t sequence)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_ || frame == nullptr)
+        return;
+    // By index, a stage may be added while the writer waits for room
+    for (size_t index = 0; index < stages_.size(); index++) {
+        StageState &state = *stages_[index];
+        if (state.stage.filter && !state.stage.filter(sequence))
+            continue;
+
+        // A full queue drops a frame by the policy of the stage
+        const size_t size = state.queue.size();
+        if (state.count == size && state.stage.overflow == Overflow::Block) {
+            const uint64_t start = monotonicNs();
+            room_.wait_for(lock, std::chrono::microseconds(state.stage.blockTimeout),
+                           [&state, size, this]() { return stopping_ || state.count < size; });
+            state.stats.blockedNs += monotonicNs() - start;
+            if (stopping_)
+                return;
+        }
+        if (state.count == size) {
+            state.stats.dropped++;
+            if (state.stage.overflow != Overflow::DropOldest) {
+                state.skipped++;
+                continue;
+            }
+
+            // The job after the dropped one learns about the gap
+            const uint64_t skipped = state.queue[state.head].skipped + 1;
+            state.queue[state.head] = Job();
+            state.head = (state.head + 1) % size;
+            state.count--;
+            if (state.count > 0)
+                state.queue[state.head].skipped += skipped;
+            else state.skipped += skipped;
+        }
+
+        // One lease per job, each stage releases its own
+        FrameLease lease = pool_.acquire(frame, sequence);
+        if (!lease)
+            continue;
+        Job &job = state.queue[(state.head + state.count) % size];
+        job.lease = std::move(lease);
+        job.sequence = sequence;
+        job.queuedNs = monotonicNs();
+        job.skipped = state.skipped;
+        state.skipped = 0;
+        state.count++;
+        state.stats.queueMax = std::max(state.stats.queueMax, state.count);
+        work_.notify_one();
+    }
+}
+
+void FramePipeline::stop()
+{
+    // Queued jobs are dropped with their leases, the workers finish the running ones
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        for (std::unique_ptr<StageState> &state : stages_) {
+            for (Job &job : state->queue)
+                job = Job();
+            state->count = 0;
+        }
+    }
+    work_.notify_all();
+    room_.notify_all();
+    for (std::thread &worker : workers_)
+        if (worker.joinable())
+            worker.join();
+    workers_.clear();
+}
+
+std::vector<FramePipeline::StageStats> FramePipeline::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<StageStats> stats;
+    stats.reserve(stages_.size());
+    for (std::unique_ptr<StageState> &state : stages_) {
+        stats.push_back(state->stats);
+        state->stats.maxNs = 0;
+        state->stats.queueMax = state->count;
+    }
+    return stats;
+}
+
+FramePipeline::StageState *FramePipeline::nextStage()
+{
+    // Round robin over the stages with a queued job and room to run it, called with the mutex held
+    const size_t count = stages_.size();
+    for (size_t i = 0; i < count; i++) {
+        StageState *state = stages_[(nextStage_ + i) % count].get();
+        if (state->count > 0 && state->running < state->stage.concurrency) {
+            nextStage_ = (nextStage_ + i + 1) % count;
+            return state;
+        }
+    }
+    return nullptr;
+}
+
+void FramePipeline::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        StageState *state = nullptr;
+        work_.wait(lock, [&state, this]() { return stopping_ || (state = nextStage()) != nullptr; });
+        if (stopping_)
+            break;
+
+        // Take the oldest job of the stage, the writer may queue the next one meanwhile
+        Job job = std::move(state->queue[state->head]);
+        state->head = (state->head + 1) % state->queue.size();
+        state->count--;
+        state->running++;
+        room_.notify_one();
+        lock.unlock();
+
+        const uint64_t start = monotonicNs();
+        state->stage.process(job);
+        const uint64_t end = monotonicNs();
+        job.lease.release();
+
+        // Another worker may take the next job of a stage that was at its limit
+        lock.lock();
+        state->running--;
+        state->stats.processed++;
+        state->stats.busyNs += end - start;
+        state->stats.queuedNs += start - job.queuedNs;
+        state->stats.maxNs = std::max(state->stats.maxNs, end - start);
+        if (state->count > 0)
+            work_.notify_one();
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framepool.h"
+
+// Work on stored frames off the capture thread, e.g. the activity index and the thumbnails
+// Stages are registered with a bounded queue each and run on a few shared worker threads. The writer
+// only leases the new frame once per stage and queues it, a full queue drops a frame by the policy of the
+// stage instead of stalling the capture. Jobs refer to the pool slot, nothing is copied, and the lease
+// keeps the writer from reusing the slot until the stage is done. A stage runs one job at a time unless
+// it allows more, so its frames arrive in order. Time spent in and waiting for every stage is counted.
+class FramePipeline {
+public:
+    // What a full queue does with a new frame
+    enum class Overflow {
+        DropOldest,     // The oldest queued frame makes room, for stages that care about recent frames
+        DropNewest,     // The new frame is not queued
+        Block           // The writer waits up to blockTimeout for room, then drops the new frame
+    };
+
+    struct Job {
+        FrameLease lease;       // The stored frame, the slot isn't overwritten until the job is done
+        uint64_t sequence = 0;  // Sequence number of the frame in the pool
+        uint64_t queuedNs = 0;  // Monotonic time the job was queued
+        uint64_t skipped = 0;   // Frames of this stage dropped since the previous job
+    };
+
+    using Process = std::function<void(const Job &)>;
+
+    // Called by the writer, returns false for frames the stage doesn't want
+    using Filter = std::function<bool(uint64_t sequence)>;
+
+    struct Stage {
+        std::string name;
+        Process process;
+        Filter filter;              // All frames if empty
+        size_t queueSize = 4;
+        Overflow overflow = Overflow::DropOldest;
+        unsigned int concurrency = 1; // Jobs processed at the same time, more than 1 gives up the order
+        int blockTimeout = 2000;    // Longest wait of the writer with Overflow::Block [us]
+    };
+
+    // Totals since the stage was added, the maxima since the last call of stats()
+    struct StageStats {
+        std::string name;
+        uint64_t processed = 0;
+        uint64_t dropped = 0;       // Frames the stage didn't get because its queue was full
+        uint64_t busyNs = 0;        // Time spent processing
+        uint64_t queuedNs = 0;      // Time the processed jobs waited in the queue
+        uint64_t blockedNs = 0;     // Time the writer waited for room
+        uint64_t maxNs = 0;         // Longest job
+        size_t queueMax = 0;        // Most jobs queued at once
+    };
+
+    FramePipeline(const FramePool &pool, unsigned int workers);
+    ~FramePipeline();
+
+    // Stages can be added while frames are submitted, returns the index of the stage in stats()
+    size_t addStage(Stage stage);
+
+    // Queue a frame the writer just stored for every stage that wants it, writer only
+    void submit(const PooledFrame *frame, uint64_t sequence);
+
+    // Drop the queued jobs and end the workers, the running jobs are finished first
+    void stop();
+
+    std::vector<StageStats> stats();
+
+private:
+    struct StageState {
+        Stage stage;
+        std::vector<Job> queue;     // Ring of queueSize jobs
+        size_t head = 0;
+        size_t count = 0;
+        unsigned int running = 0;
+        uint64_t skipped = 0;
+        StageStats stats;
+    };
+
+    StageState *nextStage();
+    void run();
+
+private:
+    const FramePool &pool_;
+    std::mutex mutex_;              // Protects everything below
+    std::condition_variable work_;  // A job was queued or the pipeline stops
+    std::condition_variable room_;  // A job left a queue, for a blocked writer
+    std::vector<std::unique_ptr<StageState>> stages_;
+    size_t nextStage_ = 0;          // Where the workers look first, so no stage starves
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+#endif // FRAME_PIPELINE_H
@@ -1,95 +1,718 @@
 #include "framepool.h"
+#include "framepipeline.h"
 #include "util/logger.h"
 #include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <cstring>
+#include <new>
+#include <chrono>
+#include <ctime>
+#include <unistd.h>
 
-std::unique_ptr<FramePool> FramePool::create(const Image& sampleFrame, size_t frameCount)
+// Missed frames repeated at most on resume, each one is a copy on the thread creating the pool
+static constexpr size_t MaxResumeRefill = 30;
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool layoutMatches(const SharedPool::Header *header, uint32_t pixelFormat, unsigned int width, unsigned int height, unsigned int stride,
+    const std::vector<size_t> &planeOffsets, const std::vector<size_t> &planeSizes, size_t frameCount, size_t segmentSize)
+{
+    // Check version, frame format and layout
+    if (header->magic != SharedPool::Magic || header->version != SharedPool::Version ||
+        header->headerSize != sizeof(SharedPool::Header) || header->slotSize != sizeof(SharedPool::Slot) ||
+        header->pixelFormat != pixelFormat || header->width != width ||
+        header->height != height || header->stride != stride ||
+        header->numPlanes != planeOffsets.size() || header->capacity != frameCount ||
+        header->segmentSize != segmentSize)
+        return false;
+    for (size_t plane = 0; plane < planeOffsets.size(); plane++)
+        if (header->planeOffset[plane] != planeOffsets[plane] || header->planeSize[plane] != planeSizes[plane])
+            return false;
+    return true;
+}
+
+static void downscalePlane(const uint8_t *src, uint8_t *dst, size_t srcStride, size_t dstStride, size_t width, size_t rows, unsigned int scale)
+{
+    // Average blocks of scale x scale pixels
+    const unsigned int shift = scale == 4 ? 4 : 2;
+    for (size_t row = 0; row < rows; row++) {
+        const uint8_t *in = src + row * scale * srcStride;
+        uint8_t *out = dst + row * dstStride;
+        for (size_t col = 0; col < width; col++) {
+            unsigned int sum = 0;
+            for (unsigned int y = 0; y < scale; y++)
+                for (unsigned int x = 0; x < scale; x++)
+                    sum += in[y * srcStride + col * scale + x];
+            out[col] = static_cast<uint8_t>(sum >> shift);
+        }
+    }
+}
+
+bool FramePool::planeLayouts(const Image& sampleFrame, const Options &options, std::vector<PlaneLayout> &layouts)
+{
+    // Without scaling every plane is copied as one block
+    const unsigned int numPlanes = sampleFrame.numPlanes();
+    layouts.resize(numPlanes);
+    if (options.scale <= 1) {
+        for (unsigned int plane = 0; plane < numPlanes; plane++) {
+            const size_t size = sampleFrame.data(plane).size();
+            layouts[plane] = { size, size, size, 1 };
+        }
+        return true;
+    }
+
+    // Downscaling needs planar 4:2:0 with a known geometry
+    if ((options.scale != 2 && options.scale != 4) || numPlanes != 3 || options.stride == 0 ||
+        sampleFrame.data(0).size() < size_t(options.stride) * options.height ||
+        sampleFrame.data(1).size() < size_t(options.stride / 2) * (options.height / 2))
+        return false;
+    const size_t width = (options.width / options.scale) & ~1u;
+    const size_t rows = (options.height / options.scale) & ~1u;
+    const size_t stride = alignUp(width, 64);
+    layouts[0] = { options.stride, stride, width, rows };
+    layouts[1] = layouts[2] = { options.stride / 2, stride / 2, width / 2, rows / 2 };
+    return true;
+}
+
+size_t FramePool::requiredSize(const Image& sampleFrame, size_t frameCount, const Options &options)
+{
+    std::vector<PlaneLayout> layouts;
+    if (!planeLayouts(sampleFrame, options, layouts))
+        return 0;
+    size_t totalSize = 0;
+    for (const PlaneLayout &layout : layouts)
+        totalSize += layout.dstStride * layout.rows * frameCount;
+    return totalSize;
+}
+
+std::unique_ptr<FramePool> FramePool::create(const Image& sampleFrame, size_t frameCount, const Options &options)
 {
+    const auto start = std::chrono::steady_clock::now();
+
     // Calculate the required ram size
+    std::vector<PlaneLayout> layouts;
+    if (!planeLayouts(sampleFrame, options, layouts)) {
+        dcError(QString("Can't store frames downscaled by %1").arg(options.scale));
+        return nullptr;
+    }
     size_t totalSize = 0;
     const unsigned int numPlanes = sampleFrame.numPlanes();
-    for (unsigned int plane = 0; plane < numPlanes; plane++)
-        totalSize += sampleFrame.data(plane).size() * frameCount;
+    std::vector<size_t> planeSizes(numPlanes);
+    for (unsigned int plane = 0; plane < numPlanes; plane++) {
+        planeSizes[plane] = layouts[plane].dstStride * layouts[plane].rows;
+        totalSize += planeSizes[plane] * frameCount;
+    }
 
-    // Check if there is enough free ram
+    // Check if there is enough free ram and the pool fits into its budget
     size_t freeSize = getFreeRam();
+    if (options.memoryLimit > 0)
+        freeSize = std::min(freeSize, options.memoryLimit);
     if (totalSize >= freeSize) {
         dcError(QString("Required RAM: %1MB, Free RAM: %2MB").arg(totalSize / 1048576).arg(freeSize / 1048576));
         return nullptr;
     } else dcInfo(QString("Required RAM: %1MB, Free RAM: %2MB").arg(totalSize / 1048576).arg(freeSize / 1048576));
 
-    // Create pool
+    // Plane regions follow each other, page aligned
+    // A shared pool additionally starts with the header and the slot table
+    const bool shared = !options.sharedName.empty();
+    if (shared && numPlanes > SharedPool::MaxPlanes) {
+        dcError(QString("Can't share frames with %1 planes").arg(numPlanes));
+        return nullptr;
+    }
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<size_t> planeOffsets(numPlanes);
+    size_t offset = shared ? alignUp(sizeof(SharedPool::Header) + sizeof(SharedPool::Slot) * frameCount, pageSize) : 0;
+    for (unsigned int plane = 0; plane < numPlanes; plane++) {
+        planeOffsets[plane] = offset;
+        offset = alignUp(offset + planeSizes[plane] * frameCount, pageSize);
+    }
+
+    // Create pool and its backing memory
     std::unique_ptr<FramePool> pool(new FramePool());
+    pool->layouts_ = layouts;
+    pool->capacity_ = frameCount;
+    pool->scale_ = std::max(options.scale, 1u);
+    pool->width_ = options.scale > 1 ? layouts[0].width : options.width;
+    pool->height_ = options.scale > 1 ? layouts[0].rows : options.height;
+    pool->stride_ = options.scale > 1 ? layouts[0].dstStride : options.stride;
+    pool->poolMemory_ = shared ?
+        PoolMemory::createShared(options.sharedName, offset, options.persistent) :
+        PoolMemory::allocate(offset);
+    if (pool->poolMemory_ == nullptr)
+        return nullptr;
 
     // Reserve space for all frames
-    pool->frames_.resize(frameCount);
-    pool->poolMemory_.resize(numPlanes);
-
-    // Pre-allocate memory for each plane across all frames
-    for (unsigned int plane = 0; plane < numPlanes; plane++) {
-        const size_t planeSize = sampleFrame.data(plane).size();
-        pool->poolMemory_[plane].resize(planeSize * frameCount);
+    pool->frames_.reset(new PooledFrame[frameCount]);
+    pool->slotCount_ = frameCount;
+    for (size_t frameIdx = 0; frameIdx < frameCount; frameIdx++) {
+        pool->frames_[frameIdx].planeData_.resize(numPlanes);
+        pool->frames_[frameIdx].ownData_.resize(numPlanes);
+    }
+    pool->metadata_ = std::make_unique<CaptureMetadataRing>(frameCount);
+    pool->pinTimeout_ = options.pinTimeout;
 
-        // Setup each frame's view into this plane's memory
-        for (size_t frameIdx = 0; frameIdx < frameCount; frameIdx++) {
-            uint8_t* planeStart = pool->poolMemory_[plane].data() + (frameIdx * planeSize);
+    // The activity index reads the stored luma plane, which is smaller if the frames are downscaled
+    if (options.analyze && ActivityAnalyzer::supports(options.pixelFormat) &&
+        pool->width_ >= 64 && pool->height_ >= 64 && size_t(pool->stride_) * pool->height_ <= planeSizes[0])
+        pool->analyzer_ = std::make_unique<ActivityAnalyzer>(pool->width_, pool->height_, pool->stride_);
+    else if (options.analyze)
+        dcInfo("The frames of this format aren't analyzed for activity");
 
-            // Ensure the vector exists
-            if (pool->frames_[frameIdx].planeData_.size() <= plane)
-                pool->frames_[frameIdx].planeData_.resize(numPlanes);
+    // Thumbnails are made from the stored planes as well
+    if (options.thumbnails && ThumbnailRing::supports(options.pixelFormat) && pool->width_ >= 16 && pool->height_ >= 16)
+        pool->thumbnails_ = std::make_unique<ThumbnailRing>(options.pixelFormat, pool->width_, pool->height_, pool->stride_, frameCount);
+    else if (options.thumbnails)
+        dcInfo("No thumbnails are made of the frames of this format");
 
-            // Set up the span to point to this frame's section of the plane memory
+    // Setup each frame's view into the plane memory
+    for (unsigned int plane = 0; plane < numPlanes; plane++) {
+        const size_t planeSize = planeSizes[plane];
+        for (size_t frameIdx = 0; frameIdx < frameCount; frameIdx++) {
+            uint8_t* planeStart = pool->poolMemory_->data() + planeOffsets[plane] + (frameIdx * planeSize);
             pool->frames_[frameIdx].planeData_[plane] =
                 libcamera::Span<uint8_t>(planeStart, planeSize);
+            pool->frames_[frameIdx].ownData_[plane] = pool->frames_[frameIdx].planeData_[plane];
+        }
+    }
+
+    // Describe the layout for external readers or resume a pool a previous process left behind
+    if (shared) {
+        SharedPool::Header *header = reinterpret_cast<SharedPool::Header *>(pool->poolMemory_->data());
+        bool matches = pool->poolMemory_->isAttached() &&
+            layoutMatches(header, options.pixelFormat, pool->width_, pool->height_, pool->stride_,
+                planeOffsets, planeSizes, frameCount, offset);
+
+        // Initialize a fresh header
+        if (!matches) {
+            header = new (pool->poolMemory_->data()) SharedPool::Header();
+            header->magic = SharedPool::Magic;
+            header->version = SharedPool::Version;
+            header->headerSize = sizeof(SharedPool::Header);
+            header->slotSize = sizeof(SharedPool::Slot);
+            header->pixelFormat = options.pixelFormat;
+            header->width = pool->width_;
+            header->height = pool->height_;
+            header->stride = pool->stride_;
+            header->numPlanes = numPlanes;
+            for (unsigned int plane = 0; plane < numPlanes; plane++) {
+                header->planeOffset[plane] = planeOffsets[plane];
+                header->planeSize[plane] = planeSizes[plane];
+            }
+            header->capacity = frameCount;
+            header->segmentSize = offset;
+            SharedPool::Slot *slots = SharedPool::slots(header);
+            for (size_t frameIdx = 0; frameIdx < frameCount; frameIdx++)
+                new (&slots[frameIdx]) SharedPool::Slot();
+            header->writeCount.store(0, std::memory_order_release);
         }
+        header->writerPid.store(getpid());
+        pool->shared_ = header;
+        dcInfo(QString("Exporting frames via shared memory %1").arg(options.sharedName.c_str()));
+
+        // Continue with the frames of the previous process
+        if (matches)
+            pool->resume();
     }
 
+    // Pages are allocated while the pool fills, optionally ahead of time in the background
+    if (options.prefault && pool->frameCount_ < frameCount)
+        pool->prefaultThread_ = std::thread(&FramePool::prefault, pool.get());
+
+    // The index and the thumbnails are made in the background
+    if (pool->analyzer_ || pool->thumbnails_)
+        pool->createPipeline(options.workers);
+
     // Log framepool capacity
-    dcInfo(QString("Created a frame pool for %1 frames (%2MB)").arg(frameCount).arg(totalSize / 1048576));
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    dcInfo(QString("Created a frame pool for %1 frames (%2MB) in %3ms")
+        .arg(frameCount).arg(totalSize / 1048576).arg(elapsed.count() / 1000.0, 0, 'f', 1));
     return pool;
 }
 
-std::unique_ptr<FramePool> FramePool::create(const Image &sampleFrame, uint8_t seconds, float frameRate)
+std::unique_ptr<FramePool> FramePool::create(const Image &sampleFrame, float seconds, float frameRate, const Options &options)
 {
-    return FramePool::create(sampleFrame, (size_t)(seconds * frameRate));
+    return FramePool::create(sampleFrame, (size_t)(seconds * frameRate), options);
 }
 
-const PooledFrame* FramePool::storeFrame(const Image& image)
+const PooledFrame* FramePool::storeFrame(const Image& image, uint64_t timestamp, const CaptureMetadata *metadata)
 {
-    if (frames_.empty())
+    if (capacity_ == 0)
         return nullptr;
 
     // Get the next frame slot
+    std::unique_lock<std::shared_mutex> lock(mutex_);
     PooledFrame& frame = frames_[currentPos_];
 
-    // Set sequence number
-    frame.sequenceNumber_ = frameCount_;
+    // Invalidate the slot before looking for leases: a reader either pinned it
+    // before and is waited for, or sees the invalid sequence number and backs off
+    const uint64_t previousSequence = frame.sequenceNumber_.load(std::memory_order_relaxed);
+    frame.sequenceNumber_.store(PooledFrame::InvalidSequence, std::memory_order_seq_cst);
+    if (frame.pins_.load(std::memory_order_seq_cst) > 0 && !waitForLeases(frame)) {
+        // Keep the leased frame and drop the new one
+        frame.sequenceNumber_.store(previousSequence, std::memory_order_release);
+        pinnedDrops_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    detachSlot(currentPos_);
+    frame.timestamp_ = timestamp;
+
+    // Memory of dropped frames that were leased during a shrink
+    if (!retired_.empty())
+        releaseRetired();
+
+    // Mark the shared slot as being written, readers will retry or skip it
+    SharedPool::Slot *slot = shared_ ? &SharedPool::slots(shared_)[currentPos_] : nullptr;
+    uint32_t seq = 0;
+    if (slot) {
+        seq = slot->seq.load(std::memory_order_relaxed);
+        slot->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
 
     // Copy data from image to our pre-allocated memory
+    // Frames that already have the pool's size (e.g. taken from the pool) are never scaled
     const unsigned int numPlanes = std::min(image.numPlanes(), frame.numPlanes());
     for (unsigned int plane = 0; plane < numPlanes; plane++) {
         libcamera::Span<const uint8_t> srcData = image.data(plane);
         libcamera::Span<uint8_t> dstData = frame.planeData_[plane];
+        const PlaneLayout &layout = layouts_[plane];
+        if (scale_ > 1 && srcData.size() != dstData.size()) {
+            downscalePlane(srcData.data(), dstData.data(), layout.srcStride, layout.dstStride, layout.width, layout.rows, scale_);
+            continue;
+        }
 
         // Ensure sizes match
         size_t copySize = std::min(srcData.size(), dstData.size());
         std::memcpy(dstData.data(), srcData.data(), copySize);
     }
 
+    // Record the metadata before the frame becomes visible
+    CaptureMetadata info = metadata ? *metadata : CaptureMetadata();
+    info.timestamp = timestamp;
+    if (!metadata)
+        info.sequence = frameCount_;
+
+    metadata_->store(currentPos_, info);
+
+    // Publish the frame, the slot and the new write count
+    frame.sequenceNumber_.store(frameCount_, std::memory_order_release);
+    if (slot) {
+        slot->sequenceNumber = frameCount_;
+        slot->timestamp = timestamp;
+        slot->seq.store(seq + 2, std::memory_order_release);
+        shared_->writeCount.store(frameCount_ + 1, std::memory_order_release);
+    }
+
+    // Hand the frame to the stages before the writer moves on
+    if (pipeline_)
+        pipeline_->submit(&frame, frameCount_);
+
     // Update counters
     frameCount_++;
-    currentPos_ = (currentPos_ + 1) % frames_.size();
+    currentPos_ = (currentPos_ + 1) % capacity_;
     return &frame;
 }
 
+size_t FramePool::insertPlaceholders(size_t count, uint64_t timestamp)
+{
+    // Nothing to repeat yet, and the latest frame must survive its placeholders
+    if (size() == 0 || capacity_ < 2)
+        return 0;
+    count = std::min<size_t>(count, capacity_ - 1);
+    const size_t latestPos = slotIndex(size() - 1);
+    const PooledFrame &latest = frames_[latestPos];
+    CaptureMetadata info;
+    metadata_->load(latestPos, info);
+
+    // The latest frame may still wait for the stages, the placeholders repeat the activity analyzed last
+    CaptureMetadata analyzed;
+    info.activity = analyzer_ && getLatestAnalyzed(analyzed) ? analyzed.activity : FrameActivity();
+    info.concealed = true;
+    info.activity.motion = 0;
+    info.activity.activeBlocks = 0;
+    const uint64_t start = latest.timestamp_;
+    const uint64_t step = timestamp > start ? (timestamp - start) / (count + 1) : 0;
+
+    // External readers address the frames of a shared pool by slot, so copy the frame there
+    size_t inserted = 0;
+    if (shared_) {
+        std::unique_ptr<Image> image = Image::fromMemory(latest.planeData_);
+        for (; inserted < count; inserted++) {
+            info.timestamp = start + step * (inserted + 1);
+            if (storeFrame(*image, info.timestamp, &info) == nullptr)
+                break;
+        }
+        return inserted;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (; inserted < count; inserted++) {
+        // Take the slot like storeFrame(), a leased slot ends the gap early
+        PooledFrame &frame = frames_[currentPos_];
+        const uint64_t previousSequence = frame.sequenceNumber_.load(std::memory_order_relaxed);
+        frame.sequenceNumber_.store(PooledFrame::InvalidSequence, std::memory_order_seq_cst);
+        if (frame.pins_.load(std::memory_order_seq_cst) > 0 && !waitForLeases(frame)) {
+            frame.sequenceNumber_.store(previousSequence, std::memory_order_release);
+            break;
+        }
+        detachSlot(currentPos_);
+
+        // Point at the memory of the real frame, which may have moved while detaching
+        const size_t source = latest.alias_ ? latest.source_ : latestPos;
+        frame.planeData_ = frames_[source].planeData_;
+        frame.alias_ = true;
+        frame.source_ = source;
+        frame.timestamp_ = start + step * (inserted + 1);
+        info.timestamp = frame.timestamp_;
+        metadata_->store(currentPos_, info);
+
+        // Publish the placeholder like a stored frame
+        frame.sequenceNumber_.store(frameCount_, std::memory_order_release);
+        frameCount_++;
+        currentPos_ = (currentPos_ + 1) % capacity_;
+    }
+    return inserted;
+}
+
+void FramePool::detachSlot(size_t index)
+{
+    // The slot is about to be overwritten: a placeholder gets its own memory back,
+    // a real frame hands its memory to the placeholders repeating it
+    PooledFrame &frame = frames_[index];
+    const size_t next = (index + 1) % capacity_;
+    if (!frame.alias_ && next != index && frames_[next].alias_ && frames_[next].source_ == index)
+        promote(next);
+    frame.alias_ = false;
+    frame.planeData_ = frame.ownData_;
+}
+
+void FramePool::promote(size_t index)
+{
+    // Swap the memory with the source slot, so the content stays in place and the placeholder owns it
+    // The following placeholders of the same source repeat this slot from now on
+    // The planes of the source are left alone, it is rewritten or dropped by the caller
+    PooledFrame &frame = frames_[index];
+    const size_t source = frame.source_;
+    std::swap(frame.ownData_, frames_[source].ownData_);
+    frame.alias_ = false;
+    for (size_t next = (index + 1) % capacity_; next != index && frames_[next].alias_ && frames_[next].source_ == source;
+         next = (next + 1) % capacity_)
+        frames_[next].source_ = index;
+}
+
+FramePool::~FramePool()
+{
+    // The stages hold leases on frames
+    if (pipeline_)
+        pipeline_->stop();
+
+    // Stop allocating pages
+    stopPrefault_ = true;
+    if (prefaultThread_.joinable())
+        prefaultThread_.join();
+
+    // Tell the next process nobody is writing anymore
+    if (shared_)
+        shared_->writerPid.store(0);
+}
+
+void FramePool::resume()
+{
+    // Restore the ring position and frame info from the shared slots
+    // A slot the previous writer was copying into may be torn, but it is still shown
+    const size_t capacity = capacity_;
+    SharedPool::Slot *slots = SharedPool::slots(shared_);
+    for (size_t frameIdx = 0; frameIdx < capacity; frameIdx++) {
+        uint32_t seq = slots[frameIdx].seq.load(std::memory_order_relaxed);
+        if (seq & 1)
+            slots[frameIdx].seq.store(seq + 1, std::memory_order_release);
+        frames_[frameIdx].sequenceNumber_ = slots[frameIdx].sequenceNumber;
+        frames_[frameIdx].timestamp_ = slots[frameIdx].timestamp;
+
+        // Only the timestamps survive a restart
+        CaptureMetadata metadata;
+        metadata.sequence = slots[frameIdx].sequenceNumber;
+        metadata.timestamp = slots[frameIdx].timestamp;
+        metadata_->store(frameIdx, metadata);
+    }
+    frameCount_ = shared_->writeCount.load(std::memory_order_acquire);
+    currentPos_ = frameCount_ % capacity;
+    if (frameCount_ == 0)
+        return;
+
+    // Estimate how many frames were missed while no process was writing
+    // Timestamps come from the monotonic clock which keeps running across restarts
+    const PooledFrame *latest = getLatestFrame();
+    const PooledFrame *oldest = getOldestFrame();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    uint64_t period = 0;
+    size_t missed = 0;
+    if (size() > 1 && latest->timestamp_ > oldest->timestamp_ && now > latest->timestamp_) {
+        period = (latest->timestamp_ - oldest->timestamp_) / (size() - 1);
+        missed = period ? (now - latest->timestamp_) / period : 0;
+    }
+
+    // Start over if everything is older than the delay
+    if (missed >= capacity) {
+        dcInfo("Shared frame pool is outdated, starting over");
+        frameCount_ = 0;
+        currentPos_ = 0;
+        shared_->writeCount.store(0, std::memory_order_release);
+        return;
+    }
+
+    // Repeat the latest frame for the missed time, so the delay stays as configured
+    // Beyond the cap the gap stays, the delay is longer by the rest until the gap has passed the delayed view
+    const size_t refill = std::min(missed, MaxResumeRefill);
+    for (size_t i = 0; i < refill; i++) {
+        const PooledFrame *frame = getLatestFrame();
+        std::unique_ptr<Image> image = Image::fromMemory(frame->planeData_);
+        storeFrame(*image, frame->timestamp_ + period);
+    }
+    dcInfo(QString("Resumed shared frame pool with %1 frames, %2 frames missed, %3 repeated")
+        .arg(size()).arg(missed).arg(refill));
+}
+
+void FramePool::prefault()
+{
+    // Work in chunks of about 16MB just ahead of the write head
+    // Frames before the write head were already allocated by storeFrame()
+    // Stay at most a few chunks ahead, so the pool is not committed faster than it fills
+    const auto start = std::chrono::steady_clock::now();
+    size_t frameSize = 0;
+    for (const libcamera::Span<uint8_t> &plane : frames_[0].ownData_)
+        frameSize += plane.size();
+    const size_t chunkFrames = std::max<size_t>(1, (16 << 20) / frameSize);
+    const size_t leadFrames = 4 * chunkFrames;
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    bool canPopulate = true;
+    size_t next = 0;
+    size_t populated = 0;
+    while (!stopPrefault_) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        next = std::max<size_t>(next, frameCount_);
+        if (next >= capacity_)
+            break;
+        if (next >= frameCount_ + leadFrames) {
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        const size_t count = std::min(chunkFrames, capacity_ - next);
+
+        // Let the kernel allocate the pages without touching the content, so the writer isn't blocked
+        if (canPopulate) {
+            lock.unlock();
+            for (unsigned int plane = 0; plane < frames_[next].numPlanes() && canPopulate; plane++)
+                canPopulate = poolMemory_->populate(frames_[next].ownData_[plane].data(),
+                    frames_[next].ownData_[plane].size() * count);
+        }
+
+        // Older kernels: write every page, the lock keeps the writer away meanwhile
+        if (!canPopulate) {
+            if (!lock.owns_lock())
+                lock.lock();
+            if (next < frameCount_)
+                continue;
+            for (unsigned int plane = 0; plane < frames_[next].numPlanes(); plane++) {
+                volatile uint8_t *data = frames_[next].ownData_[plane].data();
+                const size_t length = frames_[next].ownData_[plane].size() * count;
+                for (size_t offset = 0; offset < length; offset += pageSize)
+                    data[offset] = data[offset];
+            }
+        }
+        next += count;
+        populated += count;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    dcInfo(QString("Prefaulted %1 frames (%2MB) in %3ms").arg(populated).arg(populated * frameSize / 1048576).arg(elapsed.count()));
+}
+
+size_t FramePool::shrink(size_t frameCount)
+{
+    // Shared readers rely on a fixed capacity
+    if (shared_ || frameCount == 0 || frameCount >= capacity_)
+        return capacity_;
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+
+    // Keep the slots before the new end, they are still in ring order:
+    // from the write head to the end older frames, then the newest ones from the start.
+    // If the write head is beyond the new end, the slots from the start are played first.
+    if (currentPos_ >= frameCount)
+        currentPos_ = 0;
+
+    // New leases on dropped frames fail, existing ones keep their memory until they are released
+    for (size_t frameIdx = frameCount; frameIdx < capacity_; frameIdx++) {
+        frames_[frameIdx].sequenceNumber_.store(PooledFrame::InvalidSequence, std::memory_order_seq_cst);
+        retired_.push_back(frameIdx);
+    }
+
+    // Placeholders that are kept take over the memory of a dropped source
+    for (size_t frameIdx = 0; frameIdx < frameCount; frameIdx++)
+        if (frames_[frameIdx].alias_ && frames_[frameIdx].source_ >= frameCount)
+            promote(frameIdx);
+
+    // Give the memory of the dropped frames nobody reads back to the system, storeFrame() does the rest later
+    dcWarning(QString("Shrunk frame pool from %1 to %2 frames").arg(capacity_.load()).arg(frameCount));
+    capacity_ = frameCount;
+    releaseRetired();
+    return capacity_;
+}
+
+void FramePool::releaseRetired()
+{
+    // A lease reads the planes of its slot, which are the memory of the source slot for a placeholder
+    // Pins on a dropped slot are held by older leases or by new ones about to fail, both go away soon
+    std::vector<const uint8_t *> busy;
+    for (size_t frameIdx = capacity_; frameIdx < slotCount_; frameIdx++)
+        if (frames_[frameIdx].pins_.load(std::memory_order_seq_cst) > 0)
+            busy.push_back(frames_[frameIdx].planeData_[0].data());
+
+    std::vector<size_t> released;
+    std::vector<size_t> kept;
+    for (size_t frameIdx : retired_) {
+        const uint8_t *memory = frames_[frameIdx].ownData_[0].data();
+        if (std::find(busy.begin(), busy.end(), memory) == busy.end())
+            released.push_back(frameIdx);
+        else kept.push_back(frameIdx);
+    }
+    retired_.swap(kept);
+    releaseSlots(released);
+}
+
+void FramePool::releaseSlots(const std::vector<size_t> &slots)
+{
+    // Placeholders swap memory between slots, so join the regions of adjacent frames again
+    if (slots.empty())
+        return;
+    for (unsigned int plane = 0; plane < frames_[slots[0]].numPlanes(); plane++) {
+        std::vector<uint8_t *> starts;
+        for (size_t frameIdx : slots)
+            starts.push_back(frames_[frameIdx].ownData_[plane].data());
+        std::sort(starts.begin(), starts.end());
+        const size_t planeSize = frames_[slots[0]].ownData_[plane].size();
+        size_t first = 0;
+        for (size_t next = 1; next <= starts.size(); next++) {
+            if (next < starts.size() && starts[next] == starts[next - 1] + planeSize)
+                continue;
+            poolMemory_->release(starts[first], planeSize * (next - first));
+            first = next;
+        }
+    }
+}
+
+void FramePool::createPipeline(unsigned int workers)
+{
+    // Both stages keep state from frame to frame, so each runs one job at a time in the order of the frames
+    // Only recent frames matter, a stage that falls behind skips the oldest queued one
+    pipeline_ = std::make_unique<FramePipeline>(*this, workers);
+    if (analyzer_) {
+        FramePipeline::Stage stage;
+        stage.name = "activity";
+        stage.process = [this](const FramePipeline::Job &job) {
+            // Motion is measured against the previous analyzed frame, not one before a gap
+            const PooledFrame *frame = job.lease.frame();
+            if (job.skipped > 0)
+                analyzer_->reset();
+            FrameActivity activity;
+            activity.analyzed = true;
+            analyzer_->analyze(frame->planeData_[0].data(), activity);
+            metadata_->storeActivity(frame - frames_.get(), activity);
+        };
+        pipeline_->addStage(std::move(stage));
+    }
+    if (thumbnails_) {
+        FramePipeline::Stage stage;
+        stage.name = "thumbnails";
+        stage.filter = [this](uint64_t sequence) { return sequence % thumbnails_->interval() == 0; };
+        stage.process = [this](const FramePipeline::Job &job) {
+            const PooledFrame *frame = job.lease.frame();
+            thumbnails_->add(frame->planeData_, job.sequence, frame->timestamp());
+        };
+        pipeline_->addStage(std::move(stage));
+    }
+}
+
+bool FramePool::waitForLeases(const PooledFrame &frame)
+{
+    // Leases are short, so spin with yields instead of sleeping
+    if (pinTimeout_ <= 0)
+        return false;
+    const auto start = std::chrono::steady_clock::now();
+    const auto timeout = start + std::chrono::microseconds(pinTimeout_);
+    bool released = false;
+    while (!(released = frame.pins_.load(std::memory_order_acquire) == 0) && std::chrono::steady_clock::now() < timeout)
+        std::this_thread::yield();
+    writerWaits_.fetch_add(1, std::memory_order_relaxed);
+    writerWaitNs_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(),
+        std::memory_order_relaxed);
+    return released;
+}
+
+FrameLease FramePool::acquire(const PooledFrame *frame, uint64_t sequence) const
+{
+    if (frame == nullptr || sequence == PooledFrame::InvalidSequence)
+        return FrameLease();
+
+    // Pin first, then check the slot still holds the frame (see storeFrame)
+    frame->pins_.fetch_add(1, std::memory_order_seq_cst);
+    if (frame->sequenceNumber_.load(std::memory_order_seq_cst) != sequence) {
+        frame->pins_.fetch_sub(1, std::memory_order_release);
+        leasesMissed_.fetch_add(1, std::memory_order_relaxed);
+        return FrameLease();
+    }
+    leasesAcquired_.fetch_add(1, std::memory_order_relaxed);
+    return FrameLease(frame);
+}
+
+FrameLease FramePool::acquireLatest() const
+{
+    // The writer may move on meanwhile, then try the new latest frame
+    for (int attempt = 0; attempt < 3; attempt++) {
+        const PooledFrame *frame = getLatestFrame();
+        FrameLease lease = frame ? acquire(frame, frame->sequenceNumber()) : FrameLease();
+        if (lease)
+            return lease;
+    }
+    return FrameLease();
+}
+
+FrameLease FramePool::acquireOldest() const
+{
+    for (int attempt = 0; attempt < 3; attempt++) {
+        const PooledFrame *frame = getFrame(oldestLeasableIndex());
+        FrameLease lease = frame ? acquire(frame, frame->sequenceNumber()) : FrameLease();
+        if (lease)
+            return lease;
+    }
+    return FrameLease();
+}
+
+FramePool::LeaseStats FramePool::leaseStats() const
+{
+    LeaseStats stats;
+    stats.acquired = leasesAcquired_.load(std::memory_order_relaxed);
+    stats.missed = leasesMissed_.load(std::memory_order_relaxed);
+    stats.writerWaits = writerWaits_.load(std::memory_order_relaxed);
+    stats.writerWaitNs = writerWaitNs_.load(std::memory_order_relaxed);
+    stats.droppedFrames = pinnedDrops_.load(std::memory_order_relaxed);
+    return stats;
+}
+
 const PooledFrame* FramePool::getOldestFrame() const
 {
     if (size() == 0)
         return nullptr;
 
     // If not full yet, the oldest frame is the first one
-    if (frameCount_ <= frames_.size()) {
+    if (frameCount_ <= capacity_) {
         return &frames_[0];
     }
 
@@ -104,7 +727,8 @@ const PooledFrame* FramePool::getLatestFrame() const
         return nullptr;
 
     // The latest frame is always one position before the current write position
-    size_t latestPos = (currentPos_ == 0) ? frames_.size() - 1 : currentPos_ - 1;
+    const size_t currentPos = currentPos_;
+    size_t latestPos = (currentPos == 0) ? capacity_ - 1 : currentPos - 1;
     return &frames_[latestPos];
 }
 
@@ -112,17 +736,85 @@ const PooledFrame* FramePool::getFrame(size_t index) const
 {
     if (index >= size())
         return nullptr;
+    return &frames_[slotIndex(index)];
+}
 
-    // Calculate the actual position in the ring buffer
-    size_t actualPos;
-
+size_t FramePool::slotIndex(size_t index) const
+{
     // Haven't wrapped around yet, so frames are in order from 0
-    if (frameCount_ <= frames_.size())
-        actualPos = index;
+    if (frameCount_ <= capacity_)
+        return index;
 
     // Have wrapped around, oldest frame is at currentPos
-    else actualPos = (currentPos_ + index) % frames_.size();
-    return &frames_[actualPos];
+    return (currentPos_ + index) % capacity_;
+}
+
+bool FramePool::getMetadata(size_t index, CaptureMetadata &metadata) const
+{
+    if (index >= size())
+        return false;
+    return metadata_->load(slotIndex(index), metadata);
+}
+
+bool FramePool::getLatestAnalyzed(CaptureMetadata &metadata) const
+{
+    // Walk back from the newest frame, usually only past the few frames queued for the stages
+    for (size_t index = size(); index-- > 0;) {
+        const size_t slot = slotIndex(index);
+        if (metadata_->analyzed(slot) && metadata_->load(slot, metadata) && metadata.activity.analyzed)
+            return true;
+    }
+    return false;
+}
+
+bool FramePool::findFrame(uint64_t timestamp, size_t &index) const
+{
+    // Timestamps grow from the oldest to the newest frame, so bisect the timestamp array only
+    // Right after a shrink the order can be off until the dropped part is overwritten
+    size_t count = size();
+    if (count == 0 || metadata_->timestamp(slotIndex(0)) > timestamp)
+        return false;
+    size_t low = 0;
+    size_t high = count - 1;
+    while (low < high) {
+        size_t mid = (low + high + 1) / 2;
+        if (metadata_->timestamp(slotIndex(mid)) <= timestamp)
+            low = mid;
+        else high = mid - 1;
+    }
+    index = low;
+    return true;
+}
+
+std::vector<FramePool::MotionSpan> FramePool::findMotion(uint64_t since, uint8_t threshold) const
+{
+    // Start at the first frame captured at or after the timestamp, then scan the motion array
+    std::vector<MotionSpan> spans;
+    size_t index = 0;
+    if (findFrame(since, index) && metadata_->timestamp(slotIndex(index)) < since)
+        index++;
+    MotionSpan span;
+    for (const size_t count = size(); index < count; index++) {
+        const size_t slot = slotIndex(index);
+        if (!metadata_->analyzed(slot))
+            continue;
+        const uint8_t motion = metadata_->motion(slot);
+        if (motion < threshold) {
+            if (span.frames > 0)
+                spans.push_back(span);
+            span = MotionSpan();
+            continue;
+        }
+        const uint64_t timestamp = metadata_->timestamp(slot);
+        if (span.frames == 0)
+            span.start = timestamp;
+        span.end = timestamp;
+        span.peak = std::max(span.peak, motion);
+        span.frames++;
+    }
+    if (span.frames > 0)
+        spans.push_back(span);
+    return spans;
 }
 
 size_t getFreeRam()
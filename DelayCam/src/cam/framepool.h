@@ -4,55 +4,246 @@
 #include <cstdint>
 #include <memory>
 #include <vector>
+#include <string>
 #include <cassert>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
 
 #include <libcamera/base/span.h>
 #include <libcamera/framebuffer.h>
 #include "image.h"
+#include "poolmemory.h"
+#include "sharedpool.h"
+#include "capturemetadata.h"
+#include "activityanalyzer.h"
+#include "thumbnailring.h"
+
+class FramePipeline;
 
 class PooledFrame {
 public:
     friend class FramePool;
+    friend class FrameLease;
+
+    // Sequence number of a slot that is being written or was dropped
+    static constexpr uint64_t InvalidSequence = UINT64_MAX;
 
     PooledFrame() = default;
+    PooledFrame(const PooledFrame &) = delete;
+    PooledFrame &operator=(const PooledFrame &) = delete;
+
     unsigned int numPlanes() const { return planeData_.size(); }
     libcamera::Span<const uint8_t> data(unsigned int plane) const {
         assert(plane < planeData_.size());
         return planeData_[plane];
     }
-    uint64_t sequenceNumber() const { return sequenceNumber_; }
+    uint64_t sequenceNumber() const { return sequenceNumber_.load(std::memory_order_acquire); }
+    uint64_t timestamp() const { return timestamp_; }
+
+private:
+    std::vector<libcamera::Span<uint8_t>> planeData_; // Content of the frame, the memory of the source slot for a placeholder
+    std::vector<libcamera::Span<uint8_t>> ownData_;   // Memory owned by this slot, only the writer uses it
+    bool alias_ = false;    // Placeholder repeating the frame of the source slot, writer only
+    size_t source_ = 0;
+    std::atomic<uint64_t> sequenceNumber_{0};
+    uint64_t timestamp_ = 0; // Sensor timestamp [ns]
+    mutable std::atomic<uint32_t> pins_{0}; // Leases currently held on this slot
+};
+
+// A reader's claim on a frame, the writer doesn't overwrite the slot until it is released
+// Move-only, released on destruction
+class FrameLease {
+public:
+    FrameLease() = default;
+    FrameLease(FrameLease &&other) noexcept : frame_(other.frame_) { other.frame_ = nullptr; }
+    FrameLease &operator=(FrameLease &&other) noexcept {
+        if (this != &other) {
+            release();
+            frame_ = other.frame_;
+            other.frame_ = nullptr;
+        }
+        return *this;
+    }
+    ~FrameLease() { release(); }
+
+    void release() {
+        if (frame_)
+            frame_->pins_.fetch_sub(1, std::memory_order_release);
+        frame_ = nullptr;
+    }
+    const PooledFrame *frame() const { return frame_; }
+    const PooledFrame *operator->() const { return frame_; }
+    explicit operator bool() const { return frame_ != nullptr; }
 
 private:
-    std::vector<libcamera::Span<uint8_t>> planeData_;
-    uint64_t sequenceNumber_ = 0;
+    friend class FramePool;
+    explicit FrameLease(const PooledFrame *frame) : frame_(frame) {}
+    const PooledFrame *frame_ = nullptr;
+};
+
+// How a FramePool is laid out and where its memory comes from
+// Declared outside of FramePool, so it can be used as a default argument there
+struct FramePoolOptions {
+    std::string sharedName;   // Export frames via this POSIX shared memory name if not empty
+    uint32_t pixelFormat = 0; // Frame description written to the shared memory header
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int stride = 0;
+    size_t memoryLimit = 0;   // Fail if the pool needs more memory than this, 0 = only check free RAM
+    unsigned int scale = 1;   // Store frames downscaled by 2 or 4, only for planar YUV 4:2:0
+    bool persistent = false;  // Keep the shared memory after exit and resume it on the next start
+    bool prefault = true;     // Allocate pages ahead of the write head in a background thread
+    bool analyze = false;     // Index the luma activity of every stored frame, only for formats with a luma plane
+    bool thumbnails = false;  // Keep thumbnails of every few stored frames for scrubbing, only for YUV 4:2:0
+    int pinTimeout = 500;     // Time the writer waits for a leased slot before it drops the new frame [us], 0 = never wait
+    unsigned int workers = 2; // Threads of the pipeline that indexes the frames and makes the thumbnails
 };
 
 // Memory pool for frame data with built-in ring buffer functionality
 class FramePool {
 public:
+    using Options = FramePoolOptions;
+
     // Create a pool based on the structure of a sample frame
-    static std::unique_ptr<FramePool> create(const Image& sampleFrame, size_t frameCount);
-    static std::unique_ptr<FramePool> create(const Image& sampleFrame, uint8_t seconds, float frameRate);
-    ~FramePool() = default;
+    static std::unique_ptr<FramePool> create(const Image& sampleFrame, size_t frameCount, const Options &options = Options());
+    static std::unique_ptr<FramePool> create(const Image& sampleFrame, float seconds, float frameRate, const Options &options = Options());
+    ~FramePool();
+
+    // Memory a pool of these frames would need, 0 if the scale isn't supported
+    static size_t requiredSize(const Image& sampleFrame, size_t frameCount, const Options &options = Options());
+
+    // Drop the oldest frames and release their memory, returns the new capacity
+    // The delayed picture jumps once to the shorter delay. Memory that leased frames use is
+    // released by the writer after the last of these leases is gone.
+    size_t shrink(size_t frameCount);
 
     // Copy data from a libcamera Image to the next available frame slot
-    // Returns a pointer to the stored frame
-    const PooledFrame* storeFrame(const Image& image);
+    // Returns a pointer to the stored frame, or null if the slot was leased for too long and the image was dropped
+    // Without metadata only the timestamp is recorded
+    const PooledFrame* storeFrame(const Image& image, uint64_t timestamp = 0, const CaptureMetadata *metadata = nullptr);
+
+    // Fill the slots of frames the camera dropped with placeholders repeating the latest frame
+    // Timestamps are spread up to the given one, placeholders share the memory of the frame they repeat
+    // instead of copying it, except in a shared pool. Returns the number of placeholders stored.
+    size_t insertPlaceholders(size_t count, uint64_t timestamp);
     const PooledFrame* getOldestFrame() const;
     const PooledFrame* getLatestFrame() const;
     const PooledFrame* getFrame(size_t index) const;
 
+    // Index of the oldest frame readers on other threads should lease
+    // In a full pool the oldest frame is overwritten next, a lease on it would make the writer wait
+    size_t oldestLeasableIndex() const { return isFull() && capacity() > 1 ? 1 : 0; }
+
+    // Metadata of a stored frame, index 0 is the oldest like getFrame()
+    // Returns false if there is no such frame or it was overwritten while reading
+    bool getMetadata(size_t index, CaptureMetadata &metadata) const;
+
+    // Metadata of the newest frame the stages have analyzed, newer frames may still be queued
+    // Returns false if no stored frame is analyzed yet
+    bool getLatestAnalyzed(CaptureMetadata &metadata) const;
+
+    // Index of the newest frame captured at or before the timestamp, false if all frames are newer
+    bool findFrame(uint64_t timestamp, size_t &index) const;
+
+    // Consecutive frames with motion at or above a threshold
+    struct MotionSpan {
+        uint64_t start = 0;     // Timestamps of the first and last frame [ns]
+        uint64_t end = 0;
+        uint8_t peak = 0;       // Highest motion
+        size_t frames = 0;
+    };
+
+    // Spans of frames captured at or after the timestamp, only the activity index is scanned
+    // Frames not analyzed yet or dropped by a stage neither end nor extend a span
+    std::vector<MotionSpan> findMotion(uint64_t since, uint8_t threshold) const;
+    bool isAnalyzed() const { return analyzer_ != nullptr; }
+
+    // Thumbnails over the whole delay, null if the pool doesn't make them
+    const ThumbnailRing *thumbnails() const { return thumbnails_.get(); }
+
     bool isFull() const { return size() == capacity(); }
-    size_t capacity() const { return frames_.size(); }
-    size_t size() const { return std::min(frameCount_, capacity()); }
+    size_t capacity() const { return capacity_; }
+    size_t size() const { return std::min<size_t>(frameCount_, capacity()); }
     size_t totalFramesStored() const { return frameCount_; }
+    bool isShared() const { return shared_ != nullptr; }
+
+    // Geometry of the stored frames, smaller than the camera frames if downscaled
+    unsigned int width() const { return width_; }
+    unsigned int height() const { return height_; }
+    unsigned int stride() const { return stride_; }
+    unsigned int scale() const { return scale_; }
+
+    // Readers on other threads lease a frame while accessing its data
+    // The lease is empty if the slot has been reused since the frame with this sequence number was selected
+    FrameLease acquire(const PooledFrame *frame, uint64_t sequence) const;
+    FrameLease acquireLatest() const;
+    FrameLease acquireOldest() const;
+
+    // Lease contention since creation
+    struct LeaseStats {
+        uint64_t acquired = 0;      // Successful leases
+        uint64_t missed = 0;        // Leases on slots that were already reused
+        uint64_t writerWaits = 0;   // Frames the writer had to wait for a lease to be released
+        uint64_t writerWaitNs = 0;  // Total time spent waiting
+        uint64_t droppedFrames = 0; // Frames dropped because a slot stayed leased
+    };
+    LeaseStats leaseStats() const;
+
+    // Stages working on the stored frames in the background, null if there are none
+    // The activity index and the thumbnails are stages, more can be added
+    FramePipeline *pipeline() const { return pipeline_.get(); }
 
 private:
     FramePool() = default;
-    std::vector<std::vector<uint8_t>> poolMemory_; // Pre-allocated memory for all planes of all frames
-    std::vector<PooledFrame> frames_; // Array of frame objects that point into the pool memory
-    size_t currentPos_ = 0;           // Current position in the ring buffer (where next frame will be written)
-    size_t frameCount_ = 0;           // Total number of frames stored (can exceed capacity)
+    // Geometry of one plane in the camera frame and in the pool
+    struct PlaneLayout {
+        size_t srcStride;
+        size_t dstStride;
+        size_t width;
+        size_t rows;
+    };
+
+    static bool planeLayouts(const Image& sampleFrame, const Options &options, std::vector<PlaneLayout> &layouts);
+    size_t slotIndex(size_t index) const;
+    void detachSlot(size_t index);
+    void releaseRetired();
+    void releaseSlots(const std::vector<size_t> &slots);
+    void promote(size_t index);
+    void resume();
+    void prefault();
+    bool waitForLeases(const PooledFrame &frame);
+    void createPipeline(unsigned int workers);
+
+    std::unique_ptr<PoolMemory> poolMemory_; // Reserved memory for all planes of all frames
+    SharedPool::Header *shared_ = nullptr;   // Header in the shared segment, null if not exported
+    std::unique_ptr<PooledFrame[]> frames_; // Array of frame objects that point into the pool memory
+    size_t slotCount_ = 0;                  // Length of frames_, including slots dropped by shrink()
+    std::unique_ptr<CaptureMetadataRing> metadata_; // Capture metadata, one entry per slot of frames_
+    std::unique_ptr<ActivityAnalyzer> analyzer_;    // Null if the frames aren't analyzed, only used by its stage
+    std::unique_ptr<ThumbnailRing> thumbnails_;     // Null without thumbnails, written by its stage
+    std::unique_ptr<FramePipeline> pipeline_;
+    std::vector<PlaneLayout> layouts_;
+    std::atomic<size_t> capacity_{0}; // Frames in use, frames_ keeps dropped ones so old pointers stay valid
+    unsigned int width_ = 0;
+    unsigned int height_ = 0;
+    unsigned int stride_ = 0;
+    unsigned int scale_ = 1;
+    std::atomic<size_t> currentPos_{0};  // Current position in the ring buffer (where next frame will be written)
+    std::atomic<size_t> frameCount_{0};  // Total number of frames stored (can exceed capacity)
+    int pinTimeout_ = 0;                 // [us]
+    mutable std::shared_mutex mutex_;    // Serializes the writer with shrinking and prefaulting
+    std::vector<size_t> retired_;        // Dropped slots whose memory is not released yet, under mutex_
+
+    // Lease statistics, only updated with relaxed atomics
+    mutable std::atomic<uint64_t> leasesAcquired_{0};
+    mutable std::atomic<uint64_t> leasesMissed_{0};
+    std::atomic<uint64_t> writerWaits_{0};
+    std::atomic<uint64_t> writerWaitNs_{0};
+    std::atomic<uint64_t> pinnedDrops_{0};
+    std::thread prefaultThread_;      // Allocates the pages of frames not written yet
+    std::atomic<bool> stopPrefault_{false};
 };
 
 size_t getFreeRam();
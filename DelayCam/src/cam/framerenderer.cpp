@@ -0,0 +1,717 @@
+#include "cam/framerenderer.h"
+#include "cam/framepool.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <ctime>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+
+static const QList<libcamera::PixelFormat> supportedFormats {
+    // YUV - packed (single plane)
+    libcamera::formats::UYVY, // *
+    libcamera::formats::VYUY, // *
+    libcamera::formats::YUYV, // *
+    libcamera::formats::YVYU, // *
+    // YUV - semi planar (two planes)
+    libcamera::formats::NV12, // *
+    libcamera::formats::NV21, // *
+    libcamera::formats::NV16,
+    libcamera::formats::NV61,
+    libcamera::formats::NV24,
+    libcamera::formats::NV42,
+    // YUV - fully planar (three planes)
+    libcamera::formats::YUV420, // *
+    libcamera::formats::YVU420, // *
+    // RGB
+    libcamera::formats::ABGR8888,
+    libcamera::formats::ARGB8888,
+    libcamera::formats::BGRA8888,
+    libcamera::formats::RGBA8888,
+    libcamera::formats::BGR888, // *
+    libcamera::formats::RGB888, // *
+    // * = Supported on ArduCAM 64mp
+    // Also 24bit RGB formats (*888) will run very sluggish!
+};
+
+FrameRenderer::FrameRenderer(const QString &name) :
+    name_(name),
+    initialized_(false),
+    stride_(0),
+    hasTextures_(false),
+    nextWeight_(0),
+    programBuilt_(false),
+    formatChanged_(false),
+    vertexShaderFile_(":identity.vert"),
+    vertexBuffer_(QOpenGLBuffer::VertexBuffer),
+    periodStartNs_(0),
+    periodFrames_(0),
+    displayLatencySum_(0),
+    displayLatencyMax_(0),
+    sensorLatencySum_(0),
+    sensorLatencyMax_(0),
+    hudFrames_(0),
+    hudTimeSum_(0),
+    hudTimeMax_(0),
+    scrubFrames_(0),
+    scrubTimeSum_(0),
+    scrubTimeMax_(0)
+{
+}
+
+FrameRenderer::~FrameRenderer()
+{
+}
+
+void FrameRenderer::initialize()
+{
+    // Initialize once the context is current
+    initializeOpenGLFunctions();
+    glEnable(GL_TEXTURE_2D);
+    glDisable(GL_DEPTH_TEST);
+
+    static const GLfloat coordinates[2][4][2]{
+        {
+            // Vertex coordinates
+            { -1.0f, -1.0f },
+            { -1.0f, +1.0f },
+            { +1.0f, +1.0f },
+            { +1.0f, -1.0f },
+        },
+        {
+            // Texture coordinates
+            { 0.0f, 1.0f },
+            { 0.0f, 0.0f },
+            { 1.0f, 0.0f },
+            { 1.0f, 1.0f },
+        },
+    };
+
+    vertexBuffer_.create();
+    vertexBuffer_.bind();
+    vertexBuffer_.allocate(coordinates, sizeof(coordinates));
+
+    // The frame program is built with the first draw in a format, the overlays right away
+    hud_.initialize();
+    thumbnails_.initialize();
+
+    glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
+    initialized_ = true;
+}
+
+void FrameRenderer::destroy()
+{
+    // Release the GL objects while their context is still current
+    if (!initialized_)
+        return;
+    removeShader();
+    programBuilt_ = false;
+    hud_.destroy();
+    thumbnails_.destroy();
+    for (std::unique_ptr<QOpenGLTexture> &texture : textures_)
+        texture.reset();
+    for (std::unique_ptr<QOpenGLTexture> &texture : nextTextures_)
+        texture.reset();
+    vertexBuffer_.destroy();
+    hasTextures_ = false;
+    nextWeight_ = 0;
+    initialized_ = false;
+}
+
+bool FrameRenderer::setFormat(const libcamera::PixelFormat &format, const QSize &size, uint stride)
+{
+    // Check if format is new, the fragment shader is rebuilt on the next draw
+    bool supported = true;
+    if (format != format_) {
+        if (selectFormat(format)) {
+            format_ = format;
+            formatChanged_ = true;
+        } else {
+            dcWarning(QString("Unsupported format") + format.toString().c_str() + "!");
+            supported = false;
+        }
+    }
+
+    // Old textures don't match anymore
+    hasTextures_ = false;
+    nextWeight_ = 0;
+    size_ = size;
+    stride_ = stride;
+    return supported;
+}
+
+double FrameRenderer::precompile(const libcamera::PixelFormat &format)
+{
+    // A context of its own on an offscreen surface, the windows may not have theirs yet
+    QElapsedTimer timer;
+    timer.start();
+    QOffscreenSurface surface;
+    surface.create();
+    QOpenGLContext context;
+    if (!context.create() || !context.makeCurrent(&surface)) {
+        dcWarning("Failed to create an OpenGL context to precompile the shaders!");
+        return -1;
+    }
+
+    // Build every program a renderer needs for the format, linking stores the binaries
+    bool success;
+    {
+        FrameRenderer renderer("Precompile");
+        renderer.initialize();
+        success = renderer.setFormat(format, QSize(), 0);
+        renderer.prepareShader();
+        success = success && renderer.shaderProgram_.isLinked();
+        renderer.destroy();
+    }
+    context.doneCurrent();
+    return success ? timer.nsecsElapsed() / 1e6 : -1;
+}
+
+void FrameRenderer::prepareShader()
+{
+    // Build the program once per format
+    if (formatChanged_) {
+        removeShader();
+        programBuilt_ = false;
+    }
+    formatChanged_ = false;
+    if (!programBuilt_) {
+        programBuilt_ = true;
+        if (!createShaderProgram())
+            dcWarning("Failed to create the shader program!");
+    }
+}
+
+void FrameRenderer::draw(int width, int height)
+{
+    prepareShader();
+
+    // Clear background and set flags
+    glViewport(0, 0, width, height);
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+
+    // Render frame, the overlays share the units of the next frame, so its textures are bound again
+    if (!hasTextures_)
+        return;
+    if (nextWeight_ > 0) {
+        for (size_t plane = 0; plane < nextTextures_.size(); plane++) {
+            glActiveTexture(GL_TEXTURE0 + NextTextureUnit + plane);
+            glBindTexture(GL_TEXTURE_2D, nextTextures_[plane]->textureId());
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+    shaderProgram_.setUniformValue(textureUniformNextWeight_, nextWeight_);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+void FrameRenderer::blend(const FramePool *pool, const PooledFrame *frame, float weight)
+{
+    // Both frames come from the same pool, so they share the geometry uploaded last
+    if (!hasTextures_ || pool->width() != static_cast<unsigned int>(size_.width()) ||
+        pool->height() != static_cast<unsigned int>(size_.height()))
+        return;
+    uploadTextures(frame, nextTextures_, NextTextureUnit, nextUniforms_);
+    glActiveTexture(GL_TEXTURE0);
+    nextWeight_ = weight;
+}
+
+void FrameRenderer::drawHud(int width, int height)
+{
+    // GLES2 has no timer queries, the CPU time to build and submit the overlay is measured
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    hud_.draw(width, height);
+    restoreProgram();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    double time = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    hudFrames_++;
+    hudTimeSum_ += time;
+    hudTimeMax_ = std::max(hudTimeMax_, time);
+}
+
+void FrameRenderer::drawScrub(int width, int height)
+{
+    // Timed like the overlay, only frames with a timeline count
+    if (!thumbnails_.isScrubbing())
+        return;
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    thumbnails_.draw(width, height);
+    restoreProgram();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    double time = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    scrubFrames_++;
+    scrubTimeSum_ += time;
+    scrubTimeMax_ = std::max(scrubTimeMax_, time);
+}
+
+void FrameRenderer::restoreProgram()
+{
+    // Overlays have their own program and buffer, the next frame needs them back
+    if (shaderProgram_.isLinked()) {
+        shaderProgram_.bind();
+        vertexBuffer_.bind();
+        bindAttributes();
+    }
+}
+
+void FrameRenderer::presented(const FrameMailbox::Entry &entry)
+{
+    // Post to swap covers the event loop or render thread wakeup, the upload and the swap
+    uint64_t now = FrameMailbox::now();
+    if (periodStartNs_ == 0)
+        periodStartNs_ = now;
+    double displayLatency = (now - entry.postedNs) / 1e6;
+    double sensorLatency = entry.captureNs ? (now - entry.captureNs) / 1e6 : 0;
+    periodFrames_++;
+    displayLatencySum_ += displayLatency;
+    displayLatencyMax_ = std::max(displayLatencyMax_, displayLatency);
+    sensorLatencySum_ += sensorLatency;
+    sensorLatencyMax_ = std::max(sensorLatencyMax_, sensorLatency);
+
+    // Report every 5s like the capture statistics
+    double seconds = (now - periodStartNs_) / 1e9;
+    if (seconds < 5.0)
+        return;
+    dcInfo(QString("%1: %2 fps shown, post to screen avg %3ms max %4ms, sensor to screen avg %5ms max %6ms")
+        .arg(name_).arg(periodFrames_ / seconds, 0, 'f', 1)
+        .arg(displayLatencySum_ / periodFrames_, 0, 'f', 1).arg(displayLatencyMax_, 0, 'f', 1)
+        .arg(sensorLatencySum_ / periodFrames_, 0, 'f', 1).arg(sensorLatencyMax_, 0, 'f', 1)
+        + (hudFrames_ ? QString(", overlay avg %1us max %2us").arg(hudTimeSum_ / hudFrames_, 0, 'f', 0).arg(hudTimeMax_, 0, 'f', 0) : QString())
+        + (scrubFrames_ ? QString(", timeline avg %1us max %2us").arg(scrubTimeSum_ / scrubFrames_, 0, 'f', 0).arg(scrubTimeMax_, 0, 'f', 0) : QString()));
+    periodStartNs_ = now;
+    periodFrames_ = 0;
+    displayLatencySum_ = 0;
+    displayLatencyMax_ = 0;
+    sensorLatencySum_ = 0;
+    sensorLatencyMax_ = 0;
+    hudFrames_ = 0;
+    hudTimeSum_ = 0;
+    hudTimeMax_ = 0;
+    scrubFrames_ = 0;
+    scrubTimeSum_ = 0;
+    scrubTimeMax_ = 0;
+}
+
+bool FrameRenderer::selectFormat(const libcamera::PixelFormat &format)
+{
+    // Default values
+    textureMinMagFilters_ = GL_LINEAR;
+    vertexShaderFile_ = ":identity.vert";
+    fragmentShaderDefines_.clear();
+
+    // Setup the chosen format
+    switch (format) {
+    case libcamera::formats::NV12:
+        horzSubSample_ = 2;
+        vertSubSample_ = 2;
+        fragmentShaderDefines_.append("#define YUV_PATTERN_UV");
+        fragmentShaderFile_ = ":YUV_2_planes.frag";
+        break;
+    case libcamera::formats::NV21:
+        horzSubSample_ = 2;
+        vertSubSample_ = 2;
+        fragmentShaderDefines_.append("#define YUV_PATTERN_VU");
+        fragmentShaderFile_ = ":YUV_2_planes.frag";
+        break;
+    case libcamera::formats::NV16:
+        horzSubSample_ = 2;
+        vertSubSample_ = 1;
+        fragmentShaderDefines_.append("#define YUV_PATTERN_UV");
+        fragmentShaderFile_ = ":YUV_2_planes.frag";
+        break;
+    case libcamera::formats::NV61:
+        horzSubSample_ = 2;
+        vertSubSample_ = 1;
+        fragmentShaderDefines_.append("#define YUV_PATTERN_VU");
+        fragmentShaderFile_ = ":YUV_2_planes.frag";
+        break;
+    case libcamera::formats::NV24:
+        horzSubSample_ = 1;
+        vertSubSample_ = 1;
+        fragmentShaderDefines_.append("#define YUV_PATTERN_UV");
+        fragmentShaderFile_ = ":YUV_2_planes.frag";
+        break;
+    case libcamera::formats::NV42:
+        horzSubSample_ = 1;
+        vertSubSample_ = 1;
+        fragmentShaderDefines_.append("#define YUV_PATTERN_VU");
+        fragmentShaderFile_ = ":YUV_2_planes.frag";
+        break;
+    case libcamera::formats::YUV420:
+        horzSubSample_ = 2;
+        vertSubSample_ = 2;
+        fragmentShaderFile_ = ":YUV_3_planes.frag";
+        break;
+    case libcamera::formats::YVU420:
+        horzSubSample_ = 2;
+        vertSubSample_ = 2;
+        fragmentShaderFile_ = ":YUV_3_planes.frag";
+        break;
+    case libcamera::formats::UYVY:
+        fragmentShaderDefines_.append("#define YUV_PATTERN_UYVY");
+        fragmentShaderFile_ = ":YUV_packed.frag";
+        break;
+    case libcamera::formats::VYUY:
+        fragmentShaderDefines_.append("#define YUV_PATTERN_VYUY");
+        fragmentShaderFile_ = ":YUV_packed.frag";
+        break;
+    case libcamera::formats::YUYV:
+        fragmentShaderDefines_.append("#define YUV_PATTERN_YUYV");
+        fragmentShaderFile_ = ":YUV_packed.frag";
+        break;
+    case libcamera::formats::YVYU:
+        fragmentShaderDefines_.append("#define YUV_PATTERN_YVYU");
+        fragmentShaderFile_ = ":YUV_packed.frag";
+        break;
+    case libcamera::formats::ABGR8888:
+        fragmentShaderDefines_.append("#define RGB_PATTERN rgb");
+        fragmentShaderFile_ = ":RGB.frag";
+        break;
+    case libcamera::formats::ARGB8888:
+        fragmentShaderDefines_.append("#define RGB_PATTERN bgr");
+        fragmentShaderFile_ = ":RGB.frag";
+        break;
+    case libcamera::formats::BGRA8888:
+        fragmentShaderDefines_.append("#define RGB_PATTERN gba");
+        fragmentShaderFile_ = ":RGB.frag";
+        break;
+    case libcamera::formats::RGBA8888:
+        fragmentShaderDefines_.append("#define RGB_PATTERN abg");
+        fragmentShaderFile_ = ":RGB.frag";
+        break;
+    case libcamera::formats::BGR888:
+        fragmentShaderDefines_.append("#define RGB_PATTERN rgb");
+        fragmentShaderFile_ = ":RGB.frag";
+        break;
+    case libcamera::formats::RGB888:
+        fragmentShaderDefines_.append("#define RGB_PATTERN bgr");
+        fragmentShaderFile_ = ":RGB.frag";
+        break;
+    default:
+        return false;
+    };
+
+    return true;
+}
+
+void FrameRenderer::configureTexture(QOpenGLTexture &texture)
+{
+    glBindTexture(GL_TEXTURE_2D, texture.textureId());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, textureMinMagFilters_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, textureMinMagFilters_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+bool FrameRenderer::createShaderProgram()
+{
+    // Load fragment shader from file
+    QElapsedTimer timer;
+    timer.start();
+    QFile file(fragmentShaderFile_);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        dcWarning(fragmentShaderFile_ + "not found!");
+        return false;
+    }
+
+    // Prepend #define macros stored in fragmentShaderDefines_ to source code
+    QString defines = fragmentShaderDefines_.join('\n') + "\n";
+    QByteArray src = file.readAll();
+    src.prepend(defines.toUtf8());
+
+    // Compile and link, or load the binary linked before from the cache
+    if (!shaderProgram_.addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, vertexShaderFile_) ||
+        !shaderProgram_.addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, src) ||
+        !shaderProgram_.link()) {
+        dcWarning(shaderProgram_.log());
+        return false;
+    }
+
+    // Bind shader pipeline for use
+    if (!shaderProgram_.bind()) {
+        dcWarning(shaderProgram_.log());
+        return false;
+    }
+    dcInfo(QString("%1: Shader program for %2 ready in %3ms").arg(name_, format_.toString().c_str())
+        .arg(timer.nsecsElapsed() / 1e6, 0, 'f', 1));
+
+    // Set attributes of vertex and textures
+    bindAttributes();
+    uniforms_ = { static_cast<GLuint>(shaderProgram_.uniformLocation("tex_y")),
+                  static_cast<GLuint>(shaderProgram_.uniformLocation("tex_u")),
+                  static_cast<GLuint>(shaderProgram_.uniformLocation("tex_v")) };
+    nextUniforms_ = { static_cast<GLuint>(shaderProgram_.uniformLocation("tex_y_next")),
+                      static_cast<GLuint>(shaderProgram_.uniformLocation("tex_u_next")),
+                      static_cast<GLuint>(shaderProgram_.uniformLocation("tex_v_next")) };
+    textureUniformNextWeight_ = shaderProgram_.uniformLocation("next_weight");
+    textureUniformStep_ = shaderProgram_.uniformLocation("tex_step");
+    textureUniformStrideFactor_ = shaderProgram_.uniformLocation("stride_factor");
+
+    // Create the textures, the next frame of a cross-fade has its own
+    for (Textures *textures : { &textures_, &nextTextures_ }) {
+        for (std::unique_ptr<QOpenGLTexture> &texture : *textures) {
+            if (texture)
+                continue;
+
+            texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+            texture->create();
+        }
+    }
+
+    return true;
+}
+
+void FrameRenderer::bindAttributes()
+{
+    // Attribute arrays are context state, other programs drawing in between change them
+    int attributeVertex = shaderProgram_.attributeLocation("vertexIn");
+    int attributeTexture = shaderProgram_.attributeLocation("textureIn");
+    shaderProgram_.enableAttributeArray(attributeVertex);
+    shaderProgram_.setAttributeBuffer(attributeVertex, GL_FLOAT, 0, 2, 2 * sizeof(GLfloat));
+    shaderProgram_.enableAttributeArray(attributeTexture);
+    shaderProgram_.setAttributeBuffer(attributeTexture, GL_FLOAT, 8 * sizeof(GLfloat), 2, 2 * sizeof(GLfloat));
+}
+
+void FrameRenderer::removeShader()
+{
+    // Release and remove shaders, also the sources of a program that failed to link
+    if (shaderProgram_.isLinked())
+        shaderProgram_.release();
+    shaderProgram_.removeAllShaders();
+}
+
+void FrameRenderer::upload(const FramePool *pool, const PooledFrame *frame)
+{
+    prepareShader();
+    size_ = QSize(pool->width(), pool->height());
+    stride_ = pool->stride();
+    const unsigned int stridePixels = uploadTextures(frame, textures_, 0, uniforms_);
+
+    // Compute the stride factor for the vertex shader, to map the horizontal
+    // texture coordinate range [0.0, 1.0] to the active portion of the image.
+    shaderProgram_.setUniformValue(textureUniformStrideFactor_,
+        static_cast<float>(size_.width() - 1) / (stridePixels - 1));
+    hasTextures_ = true;
+
+    // A new frame is shown on its own until the next one is blended in
+    nextWeight_ = 0;
+}
+
+unsigned int FrameRenderer::uploadTextures(const PooledFrame *frame, Textures &textures, GLuint unit,
+                                           const TextureUniforms &uniforms)
+{
+    // Stride of the first plane, in pixels
+    unsigned int stridePixels;
+
+    switch (format_) {
+    case libcamera::formats::NV12:
+    case libcamera::formats::NV21:
+    case libcamera::formats::NV16:
+    case libcamera::formats::NV61:
+    case libcamera::formats::NV24:
+    case libcamera::formats::NV42:
+        // Activate texture Y
+        glActiveTexture(GL_TEXTURE0 + unit);
+        configureTexture(*textures[0]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_LUMINANCE,
+                 stride_,
+                 size_.height(),
+                 0,
+                 GL_LUMINANCE,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(0).data());
+        shaderProgram_.setUniformValue(uniforms[0], static_cast<GLint>(unit));
+
+        // Activate texture UV/VU
+        glActiveTexture(GL_TEXTURE0 + unit + 1);
+        configureTexture(*textures[1]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_LUMINANCE_ALPHA,
+                 stride_ / horzSubSample_,
+                 size_.height() / vertSubSample_,
+                 0,
+                 GL_LUMINANCE_ALPHA,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(1).data());
+        shaderProgram_.setUniformValue(uniforms[1], static_cast<GLint>(unit + 1));
+
+        stridePixels = stride_;
+        break;
+
+    case libcamera::formats::YUV420:
+        // Activate texture Y
+        glActiveTexture(GL_TEXTURE0 + unit);
+        configureTexture(*textures[0]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_LUMINANCE,
+                 stride_,
+                 size_.height(),
+                 0,
+                 GL_LUMINANCE,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(0).data());
+        shaderProgram_.setUniformValue(uniforms[0], static_cast<GLint>(unit));
+
+        // Activate texture U
+        glActiveTexture(GL_TEXTURE0 + unit + 1);
+        configureTexture(*textures[1]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_LUMINANCE,
+                 stride_ / horzSubSample_,
+                 size_.height() / vertSubSample_,
+                 0,
+                 GL_LUMINANCE,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(1).data());
+        shaderProgram_.setUniformValue(uniforms[1], static_cast<GLint>(unit + 1));
+
+        // Activate texture V
+        glActiveTexture(GL_TEXTURE0 + unit + 2);
+        configureTexture(*textures[2]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_LUMINANCE,
+                 stride_ / horzSubSample_,
+                 size_.height() / vertSubSample_,
+                 0,
+                 GL_LUMINANCE,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(2).data());
+        shaderProgram_.setUniformValue(uniforms[2], static_cast<GLint>(unit + 2));
+
+        stridePixels = stride_;
+        break;
+
+    case libcamera::formats::YVU420:
+        // Activate texture Y
+        glActiveTexture(GL_TEXTURE0 + unit);
+        configureTexture(*textures[0]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_LUMINANCE,
+                 stride_,
+                 size_.height(),
+                 0,
+                 GL_LUMINANCE,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(0).data());
+        shaderProgram_.setUniformValue(uniforms[0], static_cast<GLint>(unit));
+
+        // Activate texture V
+        glActiveTexture(GL_TEXTURE0 + unit + 2);
+        configureTexture(*textures[2]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_LUMINANCE,
+                 stride_ / horzSubSample_,
+                 size_.height() / vertSubSample_,
+                 0,
+                 GL_LUMINANCE,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(1).data());
+        shaderProgram_.setUniformValue(uniforms[2], static_cast<GLint>(unit + 2));
+
+        // Activate texture U
+        glActiveTexture(GL_TEXTURE0 + unit + 1);
+        configureTexture(*textures[1]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_LUMINANCE,
+                 stride_ / horzSubSample_,
+                 size_.height() / vertSubSample_,
+                 0,
+                 GL_LUMINANCE,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(2).data());
+        shaderProgram_.setUniformValue(uniforms[1], static_cast<GLint>(unit + 1));
+
+        stridePixels = stride_;
+        break;
+
+    case libcamera::formats::UYVY:
+    case libcamera::formats::VYUY:
+    case libcamera::formats::YUYV:
+    case libcamera::formats::YVYU:
+        // Packed YUV formats are stored in a RGBA texture to match the
+        // OpenGL texel size with the 4 bytes repeating pattern in YUV.
+        // The texture width is thus half of the image_ with.
+        glActiveTexture(GL_TEXTURE0 + unit);
+        configureTexture(*textures[0]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_RGBA,
+                 stride_ / 4,
+                 size_.height(),
+                 0,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(0).data());
+        shaderProgram_.setUniformValue(uniforms[0], static_cast<GLint>(unit));
+
+        // The shader needs the step between two texture pixels in the
+        // horizontal direction, expressed in texture coordinate units
+        // ([0, 1]). There are exactly width - 1 steps between the
+        // leftmost and rightmost texels.
+        shaderProgram_.setUniformValue(textureUniformStep_,
+                           1.0f / (size_.width() / 2 - 1),
+                           1.0f /* not used */);
+
+        stridePixels = stride_ / 2;
+        break;
+
+    case libcamera::formats::ABGR8888:
+    case libcamera::formats::ARGB8888:
+    case libcamera::formats::BGRA8888:
+    case libcamera::formats::RGBA8888:
+        glActiveTexture(GL_TEXTURE0 + unit);
+        configureTexture(*textures[0]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_RGBA,
+                 stride_ / 4,
+                 size_.height(),
+                 0,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(0).data());
+        shaderProgram_.setUniformValue(uniforms[0], static_cast<GLint>(unit));
+
+        stridePixels = stride_ / 4;
+        break;
+
+    case libcamera::formats::BGR888:
+    case libcamera::formats::RGB888:
+        glActiveTexture(GL_TEXTURE0 + unit);
+        configureTexture(*textures[0]);
+        glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_RGB,
+                 stride_ / 3,
+                 size_.height(),
+                 0,
+                 GL_RGB,
+                 GL_UNSIGNED_BYTE,
+                 frame->data(0).data());
+        shaderProgram_.setUniformValue(uniforms[0], static_cast<GLint>(unit));
+
+        stridePixels = stride_ / 3;
+        break;
+
+    default:
+        stridePixels = size_.width();
+        break;
+    };
+
+    return stridePixels;
+}
@@ -0,0 +1,143 @@
+#ifndef FRAME_RENDERER_H
+#define FRAME_RENDERER_H
+
+#include <array>
+#include <memory>
+
+#include "util/undefkeywords.h"
+#include <libcamera/formats.h>
+
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+
+#include "cam/framemailbox.h"
+#include "cam/hudoverlay.h"
+#include "cam/thumbnailstrip.h"
+
+class PooledFrame;
+
+// Converts and draws pooled frames with OpenGL ES 2, shared by the widget and the render thread
+// All methods except setFormat() need the context the renderer was initialized with to be current.
+class FrameRenderer : protected QOpenGLFunctions
+{
+public:
+    FrameRenderer(const QString &name);
+    ~FrameRenderer();
+
+    // Create and destroy the GL resources
+    void initialize();
+    void destroy();
+
+    // Build the programs for a format in a hidden context, so the first frame links them from the binary cache
+    // Needs the GUI thread, returns the time it took [ms] or a negative value on failure
+    static double precompile(const libcamera::PixelFormat &format);
+
+    // Select the format of the next frames, shaders and textures are rebuilt on the next draw
+    bool setFormat(const libcamera::PixelFormat &format, const QSize &size, uint stride);
+    const QSize &size() const { return size_; }
+
+    // Upload a frame into the textures, the caller holds a lease on it
+    // The geometry follows the pool, e.g. the larger realtime frames of a dual stream camera
+    void upload(const FramePool *pool, const PooledFrame *frame);
+
+    // Clear the viewport and draw the last uploaded frame, mixed with the blended one
+    void draw(int width, int height);
+
+    // Upload the next frame of a cross-fade after upload(), draw() mixes it in with the given weight
+    // It has textures of its own, so repaints show the same mix until the next upload
+    void blend(const FramePool *pool, const PooledFrame *frame, float weight);
+
+    // Draw the status overlay over the frame, timed and logged with the latency
+    void setHudSource(HudOverlay::Source source) { hud_.setSource(std::move(source)); }
+    void drawHud(int width, int height);
+
+    // Scrub timeline, updated after taking a frame from the mailbox: the frame posted when the position
+    // settled must see the settled state. Returns true while a thumbnail stands in for the frame,
+    // which then needn't be uploaded.
+    void setScrubSource(ThumbnailStrip::Source source) { thumbnails_.setSource(std::move(source)); }
+    bool updateScrub() { return thumbnails_.update(); }
+    bool isScrubbing() const { return thumbnails_.isScrubbing(); }
+    void drawScrub(int width, int height);
+
+    // Account the latency of a frame whose buffer swap just finished, logged every 5s
+    void presented(const FrameMailbox::Entry &entry);
+
+private:
+    using Textures = std::array<std::unique_ptr<QOpenGLTexture>, 3>;
+    using TextureUniforms = std::array<GLuint, 3>;
+
+    // Texture units of the next frame, the base frame uses 0 to 2
+    static constexpr GLuint NextTextureUnit = 3;
+
+    bool selectFormat(const libcamera::PixelFormat &format);
+    void configureTexture(QOpenGLTexture &texture);
+    unsigned int uploadTextures(const PooledFrame *frame, Textures &textures, GLuint unit,
+                                const TextureUniforms &uniforms);
+    bool createShaderProgram();
+    void bindAttributes();
+    void restoreProgram();
+    void removeShader();
+    void prepareShader();
+
+private:
+    QString name_;
+    bool initialized_;
+
+    // Sizes and buffers
+    QSize size_;
+    uint stride_;
+    bool hasTextures_;      // Textures hold a frame that can be redrawn
+    float nextWeight_;      // Weight of the next frame in the drawn mix, 0 = not blended
+    libcamera::PixelFormat format_;
+
+    // Shaders, built from cacheable sources: Qt keeps the linked program binaries on disk,
+    // keyed by the sources including the defines of the format and checked against the GL driver
+    QOpenGLShaderProgram shaderProgram_;
+    bool programBuilt_;     // Built or failed for the current format, not retried every frame
+    bool formatChanged_;    // Program must be rebuilt
+    QString vertexShaderFile_;
+    QString fragmentShaderFile_;
+    QStringList fragmentShaderDefines_;
+
+    // Vertex buffer and textures
+    QOpenGLBuffer vertexBuffer_;
+    Textures textures_;
+    Textures nextTextures_;     // Next frame of a cross-fade
+
+    // Common texture parameters
+    GLuint textureMinMagFilters_;
+
+    // YUV texture parameters
+    TextureUniforms uniforms_;      // Y, U and V
+    TextureUniforms nextUniforms_;
+    GLuint textureUniformNextWeight_;
+    GLuint textureUniformStep_;
+    GLuint textureUniformStrideFactor_;
+    unsigned int horzSubSample_;
+    unsigned int vertSubSample_;
+
+    // Status overlay and scrub timeline
+    HudOverlay hud_;
+    ThumbnailStrip thumbnails_;
+
+    // Latency of the last period
+    uint64_t periodStartNs_;
+    uint64_t periodFrames_;
+    double displayLatencySum_;  // Post to finished swap [ms]
+    double displayLatencyMax_;
+    double sensorLatencySum_;   // Sensor timestamp of the newest frame to finished swap [ms]
+    double sensorLatencyMax_;
+    uint64_t hudFrames_;
+    double hudTimeSum_;         // CPU time to draw the overlay [us]
+    double hudTimeMax_;
+    uint64_t scrubFrames_;
+    double scrubTimeSum_;       // CPU time to draw the timeline [us]
+    double scrubTimeMax_;
+};
+
+#endif // FRAME_RENDERER_H
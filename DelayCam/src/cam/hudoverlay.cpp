@@ -0,0 +1,292 @@
+#include "cam/hudoverlay.h"
+#include "cam/framemailbox.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+// 5x7 glyphs, one byte per row from the top, bit 4 is the left column
+// Lower case letters are drawn as upper case ones, unknown characters as spaces
+struct Glyph {
+    char character;
+    uint8_t rows[7];
+};
+
+static const Glyph glyphs[] = {
+    { ' ', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+    { '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+    { '(', { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 } },
+    { ')', { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 } },
+    { '+', { 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 } },
+    { '-', { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 } },
+    { '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c } },
+    { '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+    { '0', { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e } },
+    { '1', { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+    { '2', { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f } },
+    { '3', { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e } },
+    { '4', { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 } },
+    { '5', { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e } },
+    { '6', { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e } },
+    { '7', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+    { '8', { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e } },
+    { '9', { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c } },
+    { ':', { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 } },
+    { 'A', { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+    { 'B', { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e } },
+    { 'C', { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e } },
+    { 'D', { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c } },
+    { 'E', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f } },
+    { 'F', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 } },
+    { 'G', { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f } },
+    { 'H', { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+    { 'I', { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+    { 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c } },
+    { 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+    { 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f } },
+    { 'M', { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+    { 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+    { 'O', { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+    { 'P', { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 } },
+    { 'Q', { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d } },
+    { 'R', { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 } },
+    { 'S', { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e } },
+    { 'T', { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+    { 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+    { 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 } },
+    { 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a } },
+    { 'X', { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 } },
+    { 'Y', { 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04 } },
+    { 'Z', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f } },
+};
+
+// The atlas has 16x8 cells of 8x8 pixels, one per ASCII code, the last one is solid for rectangles
+static constexpr int CellSize = 8;
+static constexpr int AtlasColumns = 16;
+static constexpr int AtlasWidth = CellSize * AtlasColumns;
+static constexpr int AtlasHeight = CellSize * 8;
+static constexpr unsigned char SolidCell = 127;
+
+static const GLfloat panelColor[4]   = { 0.0f, 0.0f, 0.0f, 0.55f };
+static const GLfloat textColor[4]    = { 1.0f, 1.0f, 1.0f, 1.0f };
+static const GLfloat realtimeColor[4] = { 0.3f, 1.0f, 0.3f, 1.0f };
+static const GLfloat pausedColor[4]  = { 0.3f, 0.8f, 1.0f, 1.0f };
+static const GLfloat warningColor[4] = { 1.0f, 0.4f, 0.3f, 1.0f };
+static const GLfloat barColor[4]     = { 0.3f, 0.3f, 0.3f, 0.8f };
+static const GLfloat fillColor[4]    = { 1.0f, 0.8f, 0.2f, 1.0f };
+
+HudOverlay::HudOverlay() :
+    initialized_(false),
+    vertexBuffer_(QOpenGLBuffer::VertexBuffer),
+    attributeVertex_(-1),
+    attributeTexture_(-1),
+    attributeColor_(-1),
+    uniformAtlas_(-1),
+    quads_(0),
+    width_(0),
+    height_(0),
+    lastRefreshNs_(0)
+{
+}
+
+HudOverlay::~HudOverlay()
+{
+}
+
+void HudOverlay::initialize()
+{
+    // Compile the program, it is small enough to build even if the overlay is never shown
+    initializeOpenGLFunctions();
+    if (!program_.addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":hud.vert") ||
+        !program_.addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":hud.frag") ||
+        !program_.link()) {
+        dcWarning("Failed to create the overlay shaders: " + program_.log());
+        return;
+    }
+    attributeVertex_ = program_.attributeLocation("vertexIn");
+    attributeTexture_ = program_.attributeLocation("textureIn");
+    attributeColor_ = program_.attributeLocation("colorIn");
+    uniformAtlas_ = program_.uniformLocation("atlas");
+
+    // Render the glyphs into the atlas once
+    std::unique_ptr<uint8_t[]> pixels(new uint8_t[AtlasWidth * AtlasHeight]());
+    auto cell = [&pixels](unsigned char code, int x, int y) -> uint8_t & {
+        return pixels[((code / AtlasColumns) * CellSize + y) * AtlasWidth + (code % AtlasColumns) * CellSize + x];
+    };
+    for (const Glyph &glyph : glyphs)
+        for (int y = 0; y < 7; y++)
+            for (int x = 0; x < 5; x++)
+                cell(glyph.character, x, y) = glyph.rows[y] & (0x10 >> x) ? 0xff : 0;
+    for (int y = 0; y < CellSize; y++)
+        for (int x = 0; x < CellSize; x++)
+            cell(SolidCell, x, y) = 0xff;
+    atlas_ = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    atlas_->create();
+    glBindTexture(GL_TEXTURE_2D, atlas_->textureId());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, AtlasWidth, AtlasHeight, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, pixels.get());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    // Vertices and their buffer are allocated once for the most quads the overlay can have
+    vertices_.reset(new Vertex[MaxQuads * 6]);
+    vertexBuffer_.create();
+    vertexBuffer_.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    vertexBuffer_.bind();
+    vertexBuffer_.allocate(MaxQuads * 6 * sizeof(Vertex));
+    vertexBuffer_.release();
+    initialized_ = true;
+}
+
+void HudOverlay::destroy()
+{
+    // Release the GL objects while their context is still current
+    if (!initialized_)
+        return;
+    program_.removeAllShaders();
+    atlas_.reset();
+    vertexBuffer_.destroy();
+    initialized_ = false;
+}
+
+void HudOverlay::draw(int width, int height)
+{
+    if (!initialized_ || width <= 0 || height <= 0)
+        return;
+
+    // Read the status a few times a second, not with every frame
+    const uint64_t now = FrameMailbox::now();
+    if (width != width_ || height != height_ || now - lastRefreshNs_ >= RefreshInterval) {
+        width_ = width;
+        height_ = height;
+        lastRefreshNs_ = now;
+        refresh();
+        vertexBuffer_.bind();
+        vertexBuffer_.write(0, vertices_.get(), quads_ * 6 * sizeof(Vertex));
+    }
+    if (quads_ == 0)
+        return;
+
+    // One draw call for the panel, the bar and all glyphs
+    program_.bind();
+    vertexBuffer_.bind();
+    program_.enableAttributeArray(attributeVertex_);
+    program_.setAttributeBuffer(attributeVertex_, GL_FLOAT, offsetof(Vertex, x), 2, sizeof(Vertex));
+    program_.enableAttributeArray(attributeTexture_);
+    program_.setAttributeBuffer(attributeTexture_, GL_FLOAT, offsetof(Vertex, u), 2, sizeof(Vertex));
+    program_.enableAttributeArray(attributeColor_);
+    program_.setAttributeBuffer(attributeColor_, GL_FLOAT, offsetof(Vertex, r), 4, sizeof(Vertex));
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, atlas_->textureId());
+    program_.setUniformValue(uniformAtlas_, 3);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDrawArrays(GL_TRIANGLES, 0, quads_ * 6);
+    glDisable(GL_BLEND);
+    program_.disableAttributeArray(attributeVertex_);
+    program_.disableAttributeArray(attributeTexture_);
+    program_.disableAttributeArray(attributeColor_);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void HudOverlay::refresh()
+{
+    // Format into fixed buffers, nothing is allocated
+    Status status;
+    if (source_)
+        source_(status);
+    const char *mode = status.frozen ? "FROZEN" : status.realtime ? "REALTIME" : status.scrubbing ? "SCRUB" :
+                       status.replaying ? "REPLAY" : "DELAYED";
+    const GLfloat *modeColor = status.frozen || status.scrubbing || status.replaying ? pausedColor :
+                               status.realtime ? realtimeColor : textColor;
+    const unsigned int fill = status.poolCapacity ? static_cast<unsigned int>(100 * status.poolSize / status.poolCapacity) : 0;
+    char delay[48];
+    char rate[64];
+    char pool[16];
+    snprintf(delay, sizeof(delay), " %.2fS / %.1fS", status.delay, status.delayTarget);
+    snprintf(rate, sizeof(rate), "%.1f FPS  %llu DROPS (%llu/MIN)", status.frameRate,
+        static_cast<unsigned long long>(status.drops), static_cast<unsigned long long>(status.dropsPerMinute));
+    snprintf(pool, sizeof(pool), "POOL %3u%%", fill);
+
+    // Pixels of the font are scaled with the screen, about 40 characters fit across 1080p
+    const float scale = std::max(2, height_ / 270);
+    const float advance = 6 * scale;
+    const float lineHeight = 10 * scale;
+    const float padding = 4 * scale;
+    const size_t columns = std::max(strlen(mode) + strlen(delay), strlen(rate));
+    const float left = padding;
+    const float top = padding;
+    const float right = left + 2 * padding + columns * advance;
+    const float bottom = top + 2 * padding + 3 * lineHeight - 3 * scale;
+
+    quads_ = 0;
+    addRect(left, top, right, bottom, panelColor);
+    float x = left + padding;
+    float y = top + padding;
+    addText(mode, x, y, scale, modeColor);
+    addText(delay, x + strlen(mode) * advance, y, scale, textColor);
+    y += lineHeight;
+    addText(rate, x, y, scale, status.dropsPerMinute > 0 ? warningColor : textColor);
+    y += lineHeight;
+    addText(pool, x, y, scale, textColor);
+
+    // Fill bar next to the percentage
+    const float barLeft = x + (strlen(pool) + 1) * advance;
+    const float barRight = right - padding;
+    if (barRight > barLeft) {
+        addRect(barLeft, y, barRight, y + 7 * scale, barColor);
+        addRect(barLeft, y, barLeft + (barRight - barLeft) * std::min(fill, 100u) / 100, y + 7 * scale, fillColor);
+    }
+}
+
+void HudOverlay::addQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const GLfloat *color)
+{
+    // Two triangles, pixel coordinates from the top left are converted to clip space
+    if (quads_ >= MaxQuads)
+        return;
+    const float left = 2 * x0 / width_ - 1;
+    const float right = 2 * x1 / width_ - 1;
+    const float top = 1 - 2 * y0 / height_;
+    const float bottom = 1 - 2 * y1 / height_;
+    const Vertex corners[4] = {
+        { left, top, u0, v0, color[0], color[1], color[2], color[3] },
+        { right, top, u1, v0, color[0], color[1], color[2], color[3] },
+        { right, bottom, u1, v1, color[0], color[1], color[2], color[3] },
+        { left, bottom, u0, v1, color[0], color[1], color[2], color[3] },
+    };
+    Vertex *vertex = &vertices_[quads_ * 6];
+    vertex[0] = corners[0];
+    vertex[1] = corners[1];
+    vertex[2] = corners[2];
+    vertex[3] = corners[0];
+    vertex[4] = corners[2];
+    vertex[5] = corners[3];
+    quads_++;
+}
+
+void HudOverlay::addRect(float x0, float y0, float x1, float y1, const GLfloat *color)
+{
+    // Sample the middle of the solid cell
+    const float u = ((SolidCell % AtlasColumns) * CellSize + CellSize / 2.0f) / AtlasWidth;
+    const float v = ((SolidCell / AtlasColumns) * CellSize + CellSize / 2.0f) / AtlasHeight;
+    addQuad(x0, y0, x1, y1, u, v, u, v, color);
+}
+
+void HudOverlay::addText(const char *text, float x, float y, float scale, const GLfloat *color)
+{
+    // One quad per visible character, spaces only advance
+    for (; *text; text++, x += 6 * scale) {
+        const unsigned char code = std::toupper(static_cast<unsigned char>(*text));
+        if (code <= ' ' || code >= SolidCell)
+            continue;
+        const float u0 = static_cast<float>((code % AtlasColumns) * CellSize) / AtlasWidth;
+        const float v0 = static_cast<float>((code / AtlasColumns) * CellSize) / AtlasHeight;
+        addQuad(x, y, x + 5 * scale, y + 7 * scale, u0, v0, u0 + 5.0f / AtlasWidth, v0 + 7.0f / AtlasHeight, color);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef HUD_OVERLAY_H
+#define HUD_OVERLAY_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+
+// Delay, view mode, frame rate, drops and pool fill drawn over the frame in the same GL pass
+// The glyphs come from a built-in 5x7 bitmap font uploaded once as an atlas texture.
+// The status is read four times a second into preallocated vertices, a frame only draws them.
+// All methods need the context of the renderer to be current.
+class HudOverlay : protected QOpenGLFunctions
+{
+public:
+    struct Status {
+        double delay = 0;           // Between newest and oldest stored frame [s]
+        double delayTarget = 0;     // [s]
+        double frameRate = 0;
+        uint64_t drops = 0;
+        uint64_t dropsPerMinute = 0;
+        size_t poolSize = 0;
+        size_t poolCapacity = 0;
+        bool realtime = false;
+        bool frozen = false;
+        bool replaying = false;
+        bool scrubbing = false;
+    };
+
+    // Fills in the status, called in the rendering thread
+    using Source = std::function<void(Status &)>;
+
+    HudOverlay();
+    ~HudOverlay();
+
+    void initialize();
+    void destroy();
+    void setSource(Source source) { source_ = std::move(source); }
+
+    // Draw over the current frame, leaves another program and buffer bound
+    void draw(int width, int height);
+
+private:
+    struct Vertex {
+        GLfloat x, y;       // Clip space
+        GLfloat u, v;       // Atlas
+        GLfloat r, g, b, a;
+    };
+
+    static constexpr size_t MaxQuads = 160;
+    static constexpr uint64_t RefreshInterval = 250000000; // [ns]
+
+    void refresh();
+    void addQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const GLfloat *color);
+    void addRect(float x0, float y0, float x1, float y1, const GLfloat *color);
+    void addText(const char *text, float x, float y, float scale, const GLfloat *color);
+
+private:
+    bool initialized_;
+    Source source_;
+    QOpenGLShaderProgram program_;
+    QOpenGLBuffer vertexBuffer_;
+    std::unique_ptr<QOpenGLTexture> atlas_;
+    int attributeVertex_;
+    int attributeTexture_;
+    int attributeColor_;
+    int uniformAtlas_;
+
+    // Vertices of the last refresh, rebuilt when the status is read or the size changes
+    std::unique_ptr<Vertex[]> vertices_;
+    size_t quads_;
+    int width_;
+    int height_;
+    uint64_t lastRefreshNs_;
+};
+
+#endif // HUD_OVERLAY_H
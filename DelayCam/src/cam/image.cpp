@@ -10,8 +10,10 @@
 #include <assert.h>
 #include <errno.h>
 #include <iostream>
+#include <linux/dma-buf.h>
 #include <map>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -31,6 +33,12 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
 	if (mode & MapMode::WriteOnly)
 		mmapFlags |= PROT_WRITE;
 
+	if (mode & MapMode::ReadOnly)
+		image->syncFlags_ |= DMA_BUF_SYNC_READ;
+
+	if (mode & MapMode::WriteOnly)
+		image->syncFlags_ |= DMA_BUF_SYNC_WRITE;
+
 	struct MappedBufferInfo {
 		uint8_t *address = nullptr;
 		size_t mapLength = 0;
@@ -75,6 +83,7 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
 
 			info.address = static_cast<uint8_t *>(address);
 			image->maps_.emplace_back(info.address, info.mapLength);
+			image->fds_.push_back(fd);
 		}
 
 		image->planes_.emplace_back(info.address + plane.offset, plane.length);
@@ -83,6 +92,14 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
 	return image;
 }
 
+std::unique_ptr<Image> Image::fromMemory(const std::vector<Span<uint8_t>> &planes)
+{
+	/* The memory is owned by the caller and not unmapped on destruction. */
+	std::unique_ptr<Image> image{ new Image() };
+	image->planes_ = planes;
+	return image;
+}
+
 Image::Image() = default;
 
 Image::~Image()
@@ -91,6 +108,49 @@ Image::~Image()
 		munmap(map.data(), map.size());
 }
 
+int Image::beginCpuAccess()
+{
+	return syncBuffers(DMA_BUF_SYNC_START | syncFlags_);
+}
+
+int Image::endCpuAccess()
+{
+	return syncBuffers(DMA_BUF_SYNC_END | syncFlags_);
+}
+
+int Image::syncBuffers(uint64_t flags)
+{
+	if (!syncFlags_)
+		return 0;
+
+	for (int fd : fds_) {
+		struct dma_buf_sync sync = { flags };
+		int ret;
+		do {
+			ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+		if (ret < 0) {
+			int error = -errno;
+
+			/*
+			 * Not a dmabuf or an exporter without CPU access
+			 * hooks, the mapping needs no sync. Don't ask again.
+			 */
+			if (error == -ENOTTY || error == -EINVAL) {
+				syncFlags_ = 0;
+				return 0;
+			}
+
+			std::cerr << "Failed to sync dmabuf: "
+				  << strerror(-error) << std::endl;
+			return error;
+		}
+	}
+
+	return 0;
+}
+
 unsigned int Image::numPlanes() const
 {
 	return planes_.size();
@@ -21,9 +21,16 @@ public:
     };
 
     static std::unique_ptr<Image> fromFrameBuffer(const libcamera::FrameBuffer *buffer, MapMode mode);
+    static std::unique_ptr<Image> fromMemory(const std::vector<libcamera::Span<uint8_t>> &planes);
 
     ~Image();
 
+    // Bracket CPU reads and writes of a dmabuf image with DMA_BUF_IOCTL_SYNC
+    // Cached mappings are only coherent with the device in between, uncached ones get a cheap no-op
+    // Returns 0 or a negative errno, images without a dmabuf and exporters without sync return 0
+    int beginCpuAccess();
+    int endCpuAccess();
+
     unsigned int numPlanes() const;
 
     libcamera::Span<uint8_t> data(unsigned int plane);
@@ -34,8 +41,12 @@ private:
 
     Image();
 
+    int syncBuffers(uint64_t flags);
+
     std::vector<libcamera::Span<uint8_t>> maps_;
     std::vector<libcamera::Span<uint8_t>> planes_;
+    std::vector<int> fds_;      // Mapped dmabufs, owned by the frame buffer
+    uint64_t syncFlags_ = 0;    // DMA_BUF_SYNC_READ and/or WRITE by map mode, 0 = no sync
 };
 
 namespace libcamera {
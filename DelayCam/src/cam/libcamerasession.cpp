@@ -0,0 +1,486 @@
+#include "cam/libcamerasession.h"
+#include "cam/image.h"
+#include "util/logger.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QThread>
+#include <QElapsedTimer>
+
+using namespace libcamera;
+
+// Buffers allocated for automatic tuning and the requests queued at first
+// One buffer is exposed, one waits for the next exposure, the rest covers slow frames
+static constexpr unsigned int MaxBuffers = 8;
+static constexpr unsigned int InitialRequests = 4;
+static constexpr unsigned int MinRequests = 3;
+
+class CaptureEvent : public QEvent
+{
+public:
+    CaptureEvent() :
+        QEvent(type()) {
+    }
+
+    static Type type() {
+        static int type = QEvent::registerEventType();
+        return static_cast<Type>(type);
+    }
+};
+
+LibcameraSession::LibcameraSession(std::shared_ptr<libcamera::Camera> camera, QObject *parent) :
+    CameraSession(QString::fromStdString(*camera->properties().get(libcamera::properties::Model)), parent),
+    isCapturing_(false),
+    camera_(camera),
+    stream_(nullptr),
+    realtimeStream_(nullptr),
+    queuedRequests_(0),
+    requestTarget_(0),
+    autoTune_(false),
+    windowFrames_(0),
+    windowProcessMax_(0),
+    windowQueuedMin_(0),
+    windowDrops_(0),
+    calmWindows_(0)
+{
+}
+
+LibcameraSession::~LibcameraSession()
+{
+    // Release camera resources
+    stop();
+    camera_->release();
+}
+
+bool LibcameraSession::start(const Config &config)
+{
+    stop();
+    config_ = config;
+    return configureCamera();
+}
+
+void LibcameraSession::stop()
+{
+    // Stop camera if capturing
+    if (!isCapturing_)
+        return;
+    isCapturing_ = false;
+    camera_->stop();
+    camera_->requestCompleted.disconnect(this);
+    stopStats();
+
+    // Wait until the capture thread is done with the current request
+    if (thread() != QThread::currentThread())
+        QMetaObject::invokeMethod(this, []() {}, Qt::BlockingQueuedConnection);
+
+    // Clear buffers and queues
+    mappedBuffers_.clear();
+    requests_.clear();
+    idleRequests_.clear();
+    queuedRequests_ = 0;
+    allocator_.reset();
+    heapBuffers_.clear();
+    cameraConfig_.reset();
+    freeBuffers_.clear();
+    doneQueue_.clear();
+}
+
+bool LibcameraSession::event(QEvent *e)
+{
+    // Handle capture events
+    if (e->type() == CaptureEvent::type()) {
+        processCaptureEvent();
+        return true;
+    } else return CameraSession::event(e);
+}
+
+bool LibcameraSession::configureCamera()
+{
+    // Generate viewfinder configuration, a second smaller stream feeds the pool if a storage size is set
+    bool dualStream = config_.storageSize.isValid();
+    cameraConfig_ = dualStream ? camera_->generateConfiguration({ StreamRole::Viewfinder, StreamRole::Viewfinder }) :
+        camera_->generateConfiguration({ StreamRole::Viewfinder });
+    if (!cameraConfig_ || cameraConfig_->empty()) {
+        dcWarning("Failed to generate camera configuration!");
+        return false;
+    }
+    if (dualStream && cameraConfig_->size() < 2) {
+        dcWarning(name_ + ": Camera has no second stream, storing the full size stream");
+        dualStream = false;
+    }
+
+    // Set orientation
+    cameraConfig_->orientation = libcamera::Orientation::Rotate0;
+
+    // Raspberry Pi Camera v3: 1536x864 2304x1296 4608x2592
+    // libcamera will automatically pick the next best size
+    QSize size = config_.size;
+    dcInfo(name_ + ": Using size " + QString::number(size.width()) + "x" + QString::number(size.height()));
+    StreamConfiguration &cfg = cameraConfig_->at(0);
+    cfg.size.width = size.width();
+    cfg.size.height = size.height();
+    autoTune_ = config_.bufferCount == 0;
+    cfg.bufferCount = autoTune_ ? MaxBuffers : config_.bufferCount;
+
+    // Use a format supported by the viewfinder
+    libcamera::PixelFormat format = libcamera::formats::YUV420;
+    auto camFormats = cfg.formats().pixelformats();
+    if (std::find(camFormats.begin(), camFormats.end(), format) != camFormats.end())
+        cfg.pixelFormat = format;
+    else {
+        dcWarning("Format not supported! Use one of:");
+        for (auto &format : camFormats)
+            dcInfo(format.toString().c_str());
+    }
+
+    // The ISP scales the stored stream down for free, e.g. the low resolution output of the Pi ISP
+    // It has to be YUV420 and not larger than the first stream
+    if (dualStream) {
+        StreamConfiguration &storageCfg = cameraConfig_->at(1);
+        storageCfg.size.width = std::min(config_.storageSize.width(), size.width());
+        storageCfg.size.height = std::min(config_.storageSize.height(), size.height());
+        storageCfg.pixelFormat = libcamera::formats::YUV420;
+        storageCfg.bufferCount = cfg.bufferCount;
+    }
+
+    // Setting fixed exposure times will disable the AE algorithm
+    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#a4e1ca45653b62cd969d4d67a741076eb
+    //
+    // Setting fixed frame times will limit the AE algorithm
+    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#a4f3236ff99d40a3a44fcd1ad77c4458f
+    //
+    // Digital gains will be applied to the image captured by the sensor
+    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#a82c8beb7cf9d9f048c5007a68922a5b1
+    //
+    // Setting fixed analogue gains will limit the AE algorithm
+    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#ab34ebeaa9cbfb3f3fc6996b089ca52b0
+    //
+    // Setting the AE mode is most flexible
+    // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#acc370d05c5efc0b92f2fe285a1227426
+
+    // Set auto exposure mode
+    // controls_.set(controls::AeExposureMode, controls::AeExposureModeEnum::ExposureNormal); // -Short, -Long, -Custom
+
+    // Set frametime (min, max) [us] and thus framerate
+    int64_t minFt = 1e6 / config_.frameRate; // 30fps -> 33333,33us
+    int64_t maxFt = 1e6 / config_.frameRate; // 30fps -> 33333,33us
+    controls_.set(controls::FrameDurationLimits, Span<const int64_t, 2>({ minFt, maxFt }));
+
+    // Validate configuration
+    CameraConfiguration::Status validation = cameraConfig_->validate();
+    if (validation == CameraConfiguration::Adjusted) {
+        dcInfo(QString("Stream configuration adjusted to ") + cfg.toString().c_str());
+    } else if (validation == CameraConfiguration::Invalid) {
+        dcWarning("Failed to create valid camera configuration!");
+        return false;
+    }
+
+    // Configure camera
+    if (camera_->configure(cameraConfig_.get()) < 0) {
+        dcInfo("Failed to configure camera!");
+        return false;
+    }
+
+    // Store stream allocation pointer and format, the pool stores the last stream
+    // With two streams the first one is only copied while the realtime view is shown
+    {
+        const StreamConfiguration &vfConfig = cameraConfig_->at(cameraConfig_->size() - 1);
+        stream_ = vfConfig.stream();
+        format_ = vfConfig.pixelFormat;
+        size_ = QSize(vfConfig.size.width, vfConfig.size.height);
+        stride_ = vfConfig.stride;
+        realtimeStream_ = dualStream ? cameraConfig_->at(0).stream() : nullptr;
+        realtimeSize_ = QSize(cameraConfig_->at(0).size.width, cameraConfig_->at(0).size.height);
+        realtimeStride_ = cameraConfig_->at(0).stride;
+        if (dualStream)
+            dcInfo(QString("%1: Storing a %2x%3 stream, realtime view at %4x%5").arg(name_)
+                .arg(size_.width()).arg(size_.height()).arg(realtimeSize_.width()).arg(realtimeSize_.height()));
+    }
+
+    // Allocate and map buffers, cached ones from a DMA heap if possible
+    allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+    for (StreamConfiguration &c : *cameraConfig_) {
+        Stream *stream = c.stream();
+        if (!(config_.cachedBuffers && allocateHeapBuffers(c)) && allocator_->allocate(stream) < 0) {
+            dcWarning("Failed to allocate capture buffers!");
+            goto error;
+        }
+
+        // Map memory buffers and cache the mappings
+        const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
+            heapBuffers_.count(stream) ? heapBuffers_[stream] : allocator_->buffers(stream);
+        for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+            std::unique_ptr<Image> image = Image::fromFrameBuffer(buffer.get(), Image::MapMode::ReadOnly);
+            assert(image != nullptr);
+
+            // Create pools from the first sample image of their stream
+            if (stream == stream_ && (pool_ == nullptr || pool_->capacity() == 0))
+                if (!createPool(*(image.get())))
+                    goto error;
+            if (stream == realtimeStream_ && realtimePool_ == nullptr)
+                if (!createRealtimePool(*(image.get())))
+                    goto error;
+
+            // Store buffers on the free list
+            mappedBuffers_[buffer.get()] = std::move(image);
+            freeBuffers_[stream].enqueue(buffer.get());
+        }
+    }
+
+    // Create requests and fill them with buffers from the viewfinder
+    while (!freeBuffers_[stream_].isEmpty()) {
+        FrameBuffer *buffer = freeBuffers_[stream_].dequeue();
+        std::unique_ptr<Request> request = camera_->createRequest();
+        if (!request) {
+            dcWarning("Can't create request!");
+            goto error;
+        }
+        if (request->addBuffer(stream_, buffer) < 0) {
+            dcWarning("Can't set buffer for request!");
+            goto error;
+        }
+        if (realtimeStream_ && !freeBuffers_[realtimeStream_].isEmpty() &&
+            request->addBuffer(realtimeStream_, freeBuffers_[realtimeStream_].dequeue()) < 0) {
+            dcWarning("Can't set realtime buffer for request!");
+            goto error;
+        }
+        requests_.push_back(std::move(request));
+    }
+
+    // Start the camera
+    if (camera_->start(&controls_)) {
+        dcWarning("Failed to start capture!");
+        goto error;
+    }
+
+    // Connect callback
+    camera_->requestCompleted.connect(this, &LibcameraSession::requestComplete);
+
+    // Queue the first requests, automatic tuning adds the others when frames take too long
+    requestTarget_ = autoTune_ ? std::min<unsigned int>(InitialRequests, requests_.size()) : requests_.size();
+    windowFrames_ = 0;
+    windowProcessMax_ = 0;
+    windowDrops_ = 0;
+    calmWindows_ = 0;
+    queuedRequests_ = 0;
+    for (std::unique_ptr<Request> &request : requests_) {
+        if (queuedRequests_ >= requestTarget_) {
+            idleRequests_.enqueue(request.get());
+        } else if (!queueRequest(request.get())) {
+            dcWarning("Can't queue request!");
+            goto error_disconnect;
+        }
+    }
+    dcInfo(QString("%1: %2 capture buffers, %3 requests in flight%4").arg(name_).arg(requests_.size())
+        .arg(requestTarget_).arg(autoTune_ ? ", tuned automatically" : ""));
+
+    startStats();
+    isCapturing_ = true;
+    return true;
+
+error_disconnect:
+    camera_->requestCompleted.disconnect(this);
+    camera_->stop();
+
+error:
+    requests_.clear();
+    idleRequests_.clear();
+    mappedBuffers_.clear();
+    freeBuffers_.clear();
+    allocator_.reset();
+    heapBuffers_.clear();
+    return false;
+}
+
+bool LibcameraSession::allocateHeapBuffers(const StreamConfiguration &config)
+{
+    // The planes of other formats aren't known here, the camera allocates those
+    if (config.pixelFormat != libcamera::formats::YUV420)
+        return false;
+    if (!heap_)
+        heap_ = std::make_unique<DmaHeap>();
+    if (!heap_->isValid())
+        return false;
+
+    // One dmabuf per frame, the planes follow each other like in the buffers of the camera
+    const size_t lumaSize = size_t(config.stride) * config.size.height;
+    const size_t chromaSize = size_t(config.stride / 2) * ((config.size.height + 1) / 2);
+    const size_t frameSize = std::max<size_t>(config.frameSize, lumaSize + 2 * chromaSize);
+    std::vector<std::unique_ptr<FrameBuffer>> buffers;
+    for (unsigned int i = 0; i < config.bufferCount; i++) {
+        UniqueFD fd = heap_->alloc(QString("delaycam%1").arg(i).toLatin1().constData(), frameSize);
+        if (!fd.isValid())
+            return false;
+        SharedFD shared(std::move(fd));
+        std::vector<FrameBuffer::Plane> planes(3);
+        const size_t sizes[] = { lumaSize, chromaSize, chromaSize };
+        size_t offset = 0;
+        for (unsigned int plane = 0; plane < 3; plane++) {
+            planes[plane].fd = shared;
+            planes[plane].offset = offset;
+            planes[plane].length = sizes[plane];
+            offset += sizes[plane];
+        }
+        buffers.push_back(std::make_unique<FrameBuffer>(planes));
+    }
+    dcInfo(QString("%1: %2 capture buffers of %3x%4 from %5, mapped cached").arg(name_).arg(buffers.size())
+        .arg(config.size.width).arg(config.size.height).arg(heap_->name().c_str()));
+    heapBuffers_[config.stream()] = std::move(buffers);
+    return true;
+}
+
+void LibcameraSession::requestComplete(libcamera::Request *request)
+{
+    // Check if not cancelled
+    if (request->status() == Request::RequestCancelled)
+        return;
+
+    // This function is called by libcamera thread context where
+    // expensive operations are not allowed. This is why we just add
+    // the buffer to the done queue and post an event to be handled
+    // in the capture thread of this session
+    queuedRequests_--;
+    {
+        QMutexLocker locker(&requestsMutex_);
+        doneQueue_.enqueue(request);
+    }
+    QCoreApplication::postEvent(this, new CaptureEvent);
+}
+
+void LibcameraSession::processCaptureEvent()
+{
+    // Retrieve the next buffer from the done queue. The queue may be empty
+    // if stop() has been called while a CaptureEvent was posted but
+    // not processed yet. Return immediately in that case.
+    Request *request;
+    unsigned int backlog;
+    {
+        QMutexLocker locker(&requestsMutex_);
+        if (!doneQueue_.isEmpty())
+            request = doneQueue_.dequeue();
+        else return;
+        backlog = doneQueue_.size();
+    }
+    recordQueue(queuedRequests_, backlog, requestTarget_);
+
+    // Get buffer and process it
+    FrameBuffer *buffer = nullptr;
+    bool triggerAutoFocus = false;
+    QElapsedTimer processTimer;
+    processTimer.start();
+    FrameBuffer *realtimeBuffer = nullptr;
+    if (realtimeStream_ && request->buffers().count(realtimeStream_))
+        realtimeBuffer = request->buffers().at(realtimeStream_);
+    if (request->buffers().count(stream_)) {
+        buffer = request->buffers().at(stream_);
+        const FrameMetadata &metadata = buffer->metadata();
+        CaptureMetadata captureMetadata;
+        readMetadata(request->metadata(), captureMetadata);
+        Image &image = *mappedBuffers_[buffer];
+        Image *realtimeImage = realtimeBuffer ? mappedBuffers_[realtimeBuffer].get() : nullptr;
+
+        // Cached buffers may still hold lines of the previous frame until the CPU access begins
+        // The realtime image is only read while the realtime view runs, processImage() syncs it then
+        image.beginCpuAccess();
+        triggerAutoFocus = processImage(image, metadata.sequence, metadata.timestamp, realtimeImage, &captureMetadata);
+        image.endCpuAccess();
+    }
+    if (autoTune_)
+        tuneRequests(processTimer.nsecsElapsed());
+
+    // Reuse request right away, since we already copied the frame
+    request->reuse();
+
+    // Set autofocus if triggered
+    if (triggerAutoFocus) {
+        request->controls().set(controls::AfMode, controls::AfModeAuto);
+        request->controls().set(controls::AfTrigger, 0);
+    }
+
+    // Add buffer and queue request, park it if fewer requests are needed now
+    if (buffer != nullptr)
+        request->addBuffer(stream_, buffer);
+    if (realtimeBuffer != nullptr)
+        request->addBuffer(realtimeStream_, realtimeBuffer);
+    if (queuedRequests_ >= requestTarget_)
+        idleRequests_.enqueue(request);
+    else queueRequest(request);
+
+    // Queue parked requests if more are needed
+    while (queuedRequests_ < requestTarget_ && !idleRequests_.isEmpty())
+        queueRequest(idleRequests_.dequeue());
+}
+
+bool LibcameraSession::queueRequest(Request *request)
+{
+    // Count before queueing, the request may complete before queueRequest returns
+    queuedRequests_++;
+    if (camera_->queueRequest(request) < 0) {
+        queuedRequests_--;
+        return false;
+    }
+    return true;
+}
+
+void LibcameraSession::readMetadata(const ControlList &list, CaptureMetadata &metadata)
+{
+    // Controls the pipeline does not report keep their unknown value
+    if (auto exposureTime = list.get(controls::ExposureTime))
+        metadata.exposureTime = *exposureTime;
+    if (auto analogueGain = list.get(controls::AnalogueGain))
+        metadata.analogueGain = *analogueGain;
+    if (auto digitalGain = list.get(controls::DigitalGain))
+        metadata.digitalGain = *digitalGain;
+    if (auto lensPosition = list.get(controls::LensPosition))
+        metadata.lensPosition = *lensPosition;
+    if (auto afState = list.get(controls::AfState))
+        metadata.afState = *afState;
+    if (auto colourTemperature = list.get(controls::ColourTemperature))
+        metadata.colourTemperature = *colourTemperature;
+}
+
+void LibcameraSession::tuneRequests(qint64 processTime)
+{
+    // Collect one second of frames
+    windowProcessMax_ = std::max(windowProcessMax_, processTime);
+    windowQueuedMin_ = windowFrames_ ? std::min<unsigned int>(windowQueuedMin_, queuedRequests_) : queuedRequests_;
+    if (++windowFrames_ < std::max(1.0f, config_.frameRate))
+        return;
+
+    // One request is exposed and one waits for the next exposure,
+    // add as many as frames pass while the slowest frame is handled
+    double period = 1e9 / config_.frameRate;
+    unsigned int needed = 2 + static_cast<unsigned int>(std::ceil(windowProcessMax_ / period));
+    needed = std::max(needed, MinRequests);
+
+    // The sensor dropped frames or the camera ran out of requests, one more at least
+    uint64_t drops = stats().drops;
+    bool starved = windowQueuedMin_ == 0 || drops > windowDrops_;
+    if (starved)
+        needed = std::max(needed, requestTarget_ + 1);
+    needed = std::min<unsigned int>(needed, requests_.size());
+
+    // Grow right away, shrink only after ten calm seconds
+    unsigned int target = requestTarget_;
+    if (needed > requestTarget_) {
+        target = needed;
+        calmWindows_ = 0;
+    } else if (needed < requestTarget_ && ++calmWindows_ >= 10) {
+        target = requestTarget_ - 1;
+        calmWindows_ = 0;
+    } else if (needed >= requestTarget_) {
+        calmWindows_ = 0;
+    }
+    if (target != requestTarget_)
+        dcInfo(QString("%1: %2 requests in flight, slowest frame took %3ms%4").arg(name_).arg(target)
+            .arg(windowProcessMax_ / 1e6, 0, 'f', 1).arg(starved ? ", frames were dropped" : ""));
+    requestTarget_ = target;
+
+    windowFrames_ = 0;
+    windowProcessMax_ = 0;
+    windowDrops_ = drops;
+}
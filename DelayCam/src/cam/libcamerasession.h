@@ -0,0 +1,81 @@
+#ifndef LIBCAMERASESSION_H
+#define LIBCAMERASESSION_H
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <atomic>
+
+#include "cam/camerasession.h"
+#include "cam/dmaheap.h"
+
+#include "util/undefkeywords.h"
+#include <libcamera/camera.h>
+#include <libcamera/controls.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/property_ids.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include <QQueue>
+#include <QMutex>
+
+// Camera session driving a libcamera camera
+class LibcameraSession : public CameraSession
+{
+    Q_OBJECT
+
+public:
+    LibcameraSession(std::shared_ptr<libcamera::Camera> camera, QObject *parent = nullptr);
+    ~LibcameraSession();
+
+    bool start(const Config &config) override;
+    void stop() override;
+    bool event(QEvent *e) override;
+
+private:
+    bool configureCamera();
+    bool allocateHeapBuffers(const libcamera::StreamConfiguration &config);
+    void requestComplete(libcamera::Request *request);
+    void processCaptureEvent();
+    bool queueRequest(libcamera::Request *request);
+    void tuneRequests(qint64 processTime);
+    static void readMetadata(const libcamera::ControlList &controls, CaptureMetadata &metadata);
+
+private:
+    std::atomic_bool isCapturing_;
+
+    // Camera, config and allocator
+    std::shared_ptr<libcamera::Camera> camera_;
+    std::unique_ptr<libcamera::CameraConfiguration> cameraConfig_;
+    std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
+    std::unique_ptr<DmaHeap> heap_;         // Cached buffers, opened with the first ones
+    libcamera::ControlList controls_;
+    libcamera::Stream *stream_;             // Stream stored in the pool
+    libcamera::Stream *realtimeStream_;     // Larger stream for the realtime view, null with a single stream
+
+    // Buffers and requests
+    std::map<libcamera::FrameBuffer *, std::unique_ptr<Image>> mappedBuffers_;
+    std::map<const libcamera::Stream *, std::vector<std::unique_ptr<libcamera::FrameBuffer>>> heapBuffers_;
+    std::map<const libcamera::Stream *, QQueue<libcamera::FrameBuffer *>> freeBuffers_;
+    std::vector<std::unique_ptr<libcamera::Request>> requests_;
+    QQueue<libcamera::Request *> doneQueue_;
+    QMutex requestsMutex_; // Protects doneQueue_
+
+    // Requests in flight, the others wait in the capture thread until more are needed
+    QQueue<libcamera::Request *> idleRequests_;
+    std::atomic<unsigned int> queuedRequests_; // Queued at the camera, decremented by the libcamera thread
+    unsigned int requestTarget_;
+    bool autoTune_;
+
+    // Tuning window, about one second of frames
+    unsigned int windowFrames_;
+    qint64 windowProcessMax_;       // Slowest frame handling [ns]
+    unsigned int windowQueuedMin_;
+    uint64_t windowDrops_;          // Sensor drops before the window started
+    unsigned int calmWindows_;      // Windows in a row that needed fewer requests
+};
+
+#endif // LIBCAMERASESSION_H
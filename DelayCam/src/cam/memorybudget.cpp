@@ -0,0 +1,144 @@
+#include "cam/memorybudget.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Cgroup v2 directory of this process, empty if not in a unified hierarchy
+static std::string cgroupPath()
+{
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(file, line))
+        if (line.rfind("0::", 0) == 0)
+            return "/sys/fs/cgroup" + line.substr(3);
+    return std::string();
+}
+
+// First number in a file, 0 if missing or "max"
+static size_t readNumber(const std::string &path)
+{
+    std::ifstream file(path);
+    size_t value = 0;
+    if (!(file >> value))
+        return 0;
+    return value;
+}
+
+MemoryBudget::MemoryBudget(size_t reserve, QObject *parent) :
+    QObject(parent),
+    reserve_(reserve),
+    monitorTimer_(this),
+    calmChecks_(0)
+{
+    connect(&monitorTimer_, &QTimer::timeout, this, &MemoryBudget::checkPressure);
+}
+
+size_t MemoryBudget::available() const
+{
+    // Free CMA counts as available but belongs to the camera and GPU
+    size_t available = meminfo("MemAvailable:");
+    size_t cmaFree = meminfo("CmaFree:");
+    available = available > cmaFree ? available - cmaFree : 0;
+
+    // Stay below the cgroup limit, the OOM killer acts on it first
+    size_t limit = cgroupLimit();
+    if (limit > 0) {
+        size_t usage = cgroupUsage();
+        available = std::min(available, limit > usage ? limit - usage : 0);
+    }
+    return available > reserve_ ? available - reserve_ : 0;
+}
+
+void MemoryBudget::startMonitoring(int interval)
+{
+    // Only useful if the kernel reports pressure
+    Pressure pressure;
+    if (!readPressure(pressure))
+        dcWarning("Memory pressure is not available, only the free RAM is watched");
+    calmChecks_ = 0;
+    monitorTimer_.start(interval);
+}
+
+void MemoryBudget::stopMonitoring()
+{
+    monitorTimer_.stop();
+}
+
+size_t MemoryBudget::cgroupLimit()
+{
+    // The tightest memory.max from our cgroup up to the root
+    std::string path = cgroupPath();
+    size_t limit = 0;
+    while (path.size() > std::string("/sys/fs/cgroup").size()) {
+        size_t value = readNumber(path + "/memory.max");
+        if (value > 0)
+            limit = limit > 0 ? std::min(limit, value) : value;
+        path.erase(path.rfind('/'));
+    }
+    return limit;
+}
+
+size_t MemoryBudget::cgroupUsage()
+{
+    std::string path = cgroupPath();
+    return path.empty() ? 0 : readNumber(path + "/memory.current");
+}
+
+size_t MemoryBudget::meminfo(const char *key)
+{
+    // Values are in kB
+    std::ifstream file("/proc/meminfo");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.rfind(key, 0) == 0) {
+            std::istringstream iss(line.substr(strlen(key)));
+            size_t value = 0;
+            iss >> value;
+            return value * 1024;
+        }
+    }
+    return 0;
+}
+
+bool MemoryBudget::readPressure(Pressure &pressure)
+{
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    // full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    std::ifstream file("/proc/pressure/memory");
+    std::string line;
+    bool found = false;
+    while (std::getline(file, line)) {
+        size_t pos = line.find("avg10=");
+        if (pos == std::string::npos)
+            continue;
+        double value = std::stod(line.substr(pos + 6));
+        if (line.rfind("some", 0) == 0)
+            pressure.some = value;
+        else if (line.rfind("full", 0) == 0)
+            pressure.full = value;
+        found = true;
+    }
+    return found;
+}
+
+void MemoryBudget::checkPressure()
+{
+    // Give the last shrink some time to take effect
+    if (++calmChecks_ < 5)
+        return;
+
+    // Stalls on memory or almost nothing left means the OOM killer is close
+    Pressure pressure;
+    readPressure(pressure);
+    size_t free = meminfo("MemAvailable:");
+    if (pressure.full > 2.0 || pressure.some > 20.0 || free < reserve_ / 2) {
+        dcWarning(QString("Memory pressure (some %1%, full %2%, %3MB available), shrinking frame pools")
+            .arg(pressure.some, 0, 'f', 1).arg(pressure.full, 0, 'f', 1).arg(free / 1048576));
+        calmChecks_ = 0;
+        Q_EMIT shrinkRequested();
+    }
+}
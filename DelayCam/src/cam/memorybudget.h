@@ -0,0 +1,51 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <cstddef>
+
+#include "util/undefkeywords.h"
+
+#include <QObject>
+#include <QTimer>
+
+// Decides how much RAM the frame pools may use and watches for memory pressure
+// The budget is the smaller of MemAvailable and the cgroup v2 limit, minus the
+// free CMA (needed by the camera and GPU) and a fixed reserve.
+class MemoryBudget : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Pressure {
+        double some = 0;    // Share of time some tasks stalled on memory, avg10 [%]
+        double full = 0;    // Share of time all tasks stalled on memory, avg10 [%]
+    };
+
+    MemoryBudget(size_t reserve, QObject *parent = nullptr);
+
+    // Bytes the pools may allocate right now
+    size_t available() const;
+
+    // Watch pressure and emit shrinkRequested() if memory gets tight
+    void startMonitoring(int interval = 2000);
+    void stopMonitoring();
+
+    // Helpers reading /proc and /sys, all return 0 if the value is unknown
+    static size_t cgroupLimit();
+    static size_t cgroupUsage();
+    static size_t meminfo(const char *key);
+    static bool readPressure(Pressure &pressure);
+
+Q_SIGNALS:
+    void shrinkRequested();
+
+private Q_SLOTS:
+    void checkPressure();
+
+private:
+    size_t reserve_;
+    QTimer monitorTimer_;
+    int calmChecks_;    // Checks since the last shrink request
+};
+
+#endif // MEMORY_BUDGET_H
@@ -0,0 +1,140 @@
+#include "poolmemory.h"
+#include "sharedpool.h"
+#include "util/logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+std::unique_ptr<PoolMemory> PoolMemory::allocate(size_t size)
+{
+    // Reserve private memory, unlike a vector it is neither zero-filled nor committed upfront
+    void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (address == MAP_FAILED) {
+        dcError(QString("Failed to allocate %1MB: %2").arg(size / 1048576).arg(strerror(errno)));
+        return nullptr;
+    }
+    std::unique_ptr<PoolMemory> memory(new PoolMemory());
+    memory->data_ = static_cast<uint8_t *>(address);
+    memory->size_ = size;
+    return memory;
+}
+
+// Process still writing to a segment laid out by FramePool, 0 if there is none
+static pid_t segmentWriter(int fd, size_t size)
+{
+    if (size < sizeof(SharedPool::Header))
+        return 0;
+    void *address = mmap(nullptr, sizeof(SharedPool::Header), PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED)
+        return 0;
+    const SharedPool::Header *header = static_cast<const SharedPool::Header *>(address);
+    pid_t writer = 0;
+    if (header->magic == SharedPool::Magic && header->version == SharedPool::Version)
+        writer = header->writerPid.load();
+    munmap(address, sizeof(SharedPool::Header));
+
+    // A pid of a process that is gone or ourselves doesn't count
+    if (writer <= 0 || writer == getpid() || (kill(writer, 0) < 0 && errno != EPERM))
+        return 0;
+    return writer;
+}
+
+std::unique_ptr<PoolMemory> PoolMemory::createShared(const std::string &name, size_t size, bool persistent)
+{
+    // Never replace or attach a segment another process is still writing to
+    bool attached = false;
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd >= 0) {
+        struct stat st;
+        const size_t existingSize = fstat(fd, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+        pid_t writer = segmentWriter(fd, existingSize);
+        if (writer > 0) {
+            dcError(QString("Shared memory %1 is in use by process %2").arg(name.c_str()).arg(writer));
+            close(fd);
+            return nullptr;
+        }
+
+        // Reuse an existing persistent segment of the same size
+        if (persistent && existingSize == size)
+            attached = true;
+        else {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // Otherwise create a fresh segment, readers only get read permission
+    if (!attached) {
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd < 0) {
+        dcError(QString("Failed to create shared memory %1: %2").arg(name.c_str(), strerror(errno)));
+        return nullptr;
+    }
+
+    // Size and map the segment
+    if (!attached && ftruncate(fd, size) < 0) {
+        dcError(QString("Failed to resize shared memory %1: %2").arg(name.c_str(), strerror(errno)));
+        close(fd);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        dcError(QString("Failed to map shared memory %1: %2").arg(name.c_str(), strerror(errno)));
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    // Segment stays mapped until destruction, the fd is not needed anymore
+    std::unique_ptr<PoolMemory> memory(new PoolMemory());
+    memory->data_ = static_cast<uint8_t *>(address);
+    memory->size_ = size;
+    memory->name_ = name;
+    memory->persistent_ = persistent;
+    memory->attached_ = attached;
+    return memory;
+}
+
+PoolMemory::~PoolMemory()
+{
+    // Unmap and remove shared memory
+    munmap(data_, size_);
+    if (isShared() && !persistent_)
+        shm_unlink(name_.c_str());
+}
+
+bool PoolMemory::populate(uint8_t *address, size_t length) const
+{
+    // madvise needs a page aligned start
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = reinterpret_cast<uintptr_t>(address) / pageSize * pageSize;
+    length += reinterpret_cast<uintptr_t>(address) - start;
+    return madvise(reinterpret_cast<void *>(start), length, MADV_POPULATE_WRITE) == 0;
+}
+
+void PoolMemory::release(uint8_t *address, size_t length) const
+{
+    // Only whole pages can be freed, shared memory pages must be removed from the segment
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (reinterpret_cast<uintptr_t>(address) + pageSize - 1) / pageSize * pageSize;
+    uintptr_t end = (reinterpret_cast<uintptr_t>(address) + length) / pageSize * pageSize;
+    if (end <= start)
+        return;
+
+    // Locked pages can't be discarded, see RealtimeProfile
+    munlock(reinterpret_cast<void *>(start), end - start);
+    if (madvise(reinterpret_cast<void *>(start), end - start, isShared() ? MADV_REMOVE : MADV_DONTNEED) < 0)
+        dcWarning(QString("Failed to release pool memory: %1").arg(strerror(errno)));
+}
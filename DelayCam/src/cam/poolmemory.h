@@ -0,0 +1,41 @@
+#ifndef POOL_MEMORY_H
+#define POOL_MEMORY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Backing memory of a FramePool
+// Either private anonymous memory or a named POSIX shared memory segment other processes can map
+// A persistent segment outlives the process and is reattached if it still has the expected size
+// Both are only reserved, pages are allocated on first write or by populate()
+class PoolMemory {
+public:
+    static std::unique_ptr<PoolMemory> allocate(size_t size);
+    static std::unique_ptr<PoolMemory> createShared(const std::string &name, size_t size, bool persistent = false);
+    ~PoolMemory();
+
+    // Allocate the pages of a range without changing their content
+    // Returns false if the kernel can't do that (before Linux 5.14)
+    bool populate(uint8_t *address, size_t length) const;
+
+    // Free the pages fully inside a range, they read as zero afterwards
+    void release(uint8_t *address, size_t length) const;
+
+    uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool isShared() const { return !name_.empty(); }
+    bool isAttached() const { return attached_; }
+    const std::string &name() const { return name_; }
+
+private:
+    PoolMemory() = default;
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    std::string name_;          // Name of the shared memory segment
+    bool persistent_ = false;   // Keep the segment after destruction
+    bool attached_ = false;     // Segment existed before and was reused
+};
+
+#endif // POOL_MEMORY_H
@@ -0,0 +1,188 @@
+#include "cam/renderwindow.h"
+#include "cam/framepool.h"
+#include "util/logger.h"
+#include "util/realtime.h"
+
+#include <QGuiApplication>
+#include <QExposeEvent>
+#include <QResizeEvent>
+
+RenderWindow::RenderWindow(QWindow *parent) :
+    QWindow(parent),
+    stop_(false),
+    exposed_(false),
+    repaint_(false),
+    width_(0),
+    height_(0),
+    hudVisible_(false),
+    formatChanged_(false),
+    stride_(0)
+{
+    setSurfaceType(QSurface::OpenGLSurface);
+}
+
+RenderWindow::~RenderWindow()
+{
+    // Stop the render thread, it releases the GL resources itself
+    if (renderThread_) {
+        stop_ = true;
+        wakeup_.release();
+        renderThread_->wait();
+    }
+}
+
+bool RenderWindow::isSupported()
+{
+    return QOpenGLContext::supportsThreadedOpenGL();
+}
+
+void RenderWindow::setFormat(const libcamera::PixelFormat &format, const QSize &size, uint stride)
+{
+    {
+        std::lock_guard<std::mutex> locker(formatMutex_);
+        format_ = format;
+        size_ = size;
+        stride_ = stride;
+        formatChanged_ = true;
+    }
+    repaint_ = true;
+    wake();
+}
+
+void RenderWindow::post(const std::shared_ptr<const FramePool> &pool, const PooledFrame *frame, quint64 sequence,
+                        const PooledFrame *next, quint64 nextSequence, float blend)
+{
+    // Wake the render thread only if it took the previous frame already
+    if (mailbox_.post(pool, frame, sequence, next, nextSequence, blend))
+        wake();
+}
+
+void RenderWindow::setHudVisible(bool visible)
+{
+    hudVisible_ = visible;
+    repaint_ = true;
+    wake();
+}
+
+void RenderWindow::exposeEvent(QExposeEvent *)
+{
+    // Start rendering once the window is on screen, the context needs a native surface
+    exposed_ = isExposed();
+    if (exposed_ && !renderThread_)
+        startRendering();
+    repaint_ = true;
+    wake();
+}
+
+void RenderWindow::resizeEvent(QResizeEvent *event)
+{
+    width_ = event->size().width() * devicePixelRatio();
+    height_ = event->size().height() * devicePixelRatio();
+    repaint_ = true;
+    wake();
+}
+
+void RenderWindow::startRendering()
+{
+    // Create the context in the GUI thread and hand it over to the render thread
+    context_ = std::make_unique<QOpenGLContext>();
+    context_->setFormat(requestedFormat());
+    context_->setShareContext(QOpenGLContext::globalShareContext());
+    if (!context_->create()) {
+        dcError("Failed to create the OpenGL context of the render thread!");
+        context_.reset();
+        return;
+    }
+    width_ = width() * devicePixelRatio();
+    height_ = height() * devicePixelRatio();
+    renderThread_.reset(QThread::create([this]() { renderLoop(); }));
+    renderThread_->setObjectName("Render " + objectName());
+    context_->moveToThread(renderThread_.get());
+    renderThread_->start(QThread::HighPriority);
+}
+
+void RenderWindow::wake()
+{
+    wakeup_.release();
+}
+
+void RenderWindow::renderLoop()
+{
+    // The context stays current for the lifetime of the thread
+    RealtimeProfile::instance()->applyToCurrentThread(RealtimeProfile::Role::Render, "Render " + objectName());
+    FrameRenderer renderer("Render thread");
+    if (!context_->makeCurrent(this)) {
+        dcError("Failed to make the OpenGL context current in the render thread!");
+        context_->moveToThread(qGuiApp->thread());
+        return;
+    }
+    renderer.initialize();
+    renderer.setHudSource(hudSource_);
+    renderer.setScrubSource(scrubSource_);
+
+    FrameMailbox::Entry entry;
+    uint64_t lastDrawNs = 0;
+    bool firstPresented = false;
+    while (!stop_) {
+        // Sleep until a frame is posted or the window changed, the timeout catches stop_ and refreshes the overlay
+        wakeup_.tryAcquire(1, 100);
+        if (stop_)
+            break;
+
+        // Apply a new format before uploading frames in it
+        {
+            std::lock_guard<std::mutex> locker(formatMutex_);
+            if (formatChanged_)
+                renderer.setFormat(format_, size_, stride_);
+            formatChanged_ = false;
+        }
+
+        // Upload the latest frame and give the slot back to the capture thread right away
+        // Keep the previous frame if the slot has been reused since the frame was selected
+        // While a scrub thumbnail stands in for the frame only the thumbnails are uploaded
+        bool uploaded = false;
+        const bool taken = mailbox_.take(entry) && entry.pool;
+        const bool preview = renderer.updateScrub();
+        if (taken && !preview) {
+            FrameLease lease = entry.pool->acquire(entry.frame, entry.sequence);
+            if (lease) {
+                renderer.upload(entry.pool.get(), lease.frame());
+                uploaded = true;
+            }
+        }
+
+        // Cross-fade to the next frame of a decimated pool
+        if (uploaded && entry.next && entry.blend > 0) {
+            FrameLease lease = entry.pool->acquire(entry.next, entry.nextSequence);
+            if (lease)
+                renderer.blend(entry.pool.get(), lease.frame(), entry.blend);
+        }
+
+        // The overlay is refreshed a few times a second even without new frames, e.g. frozen
+        // A frame posted while scrubbing redraws the timeline, its position may have moved
+        const bool refreshHud = hudVisible_ && FrameMailbox::now() - lastDrawNs > 250000000;
+        if (!exposed_ || (!uploaded && !(taken && renderer.isScrubbing()) && !repaint_.exchange(false) && !refreshHud))
+            continue;
+        lastDrawNs = FrameMailbox::now();
+
+        // Render frame
+        renderer.draw(width_, height_);
+        renderer.drawScrub(width_, height_);
+        if (hudVisible_)
+            renderer.drawHud(width_, height_);
+
+        // Swap blocks until the buffer is queued for scanout
+        context_->swapBuffers(this);
+        if (uploaded) {
+            renderer.presented(entry);
+            if (!firstPresented)
+                Q_EMIT firstFramePresented();
+            firstPresented = true;
+        }
+    }
+
+    // Release the GL resources and give the context back to the GUI thread for deletion
+    renderer.destroy();
+    context_->doneCurrent();
+    context_->moveToThread(qGuiApp->thread());
+}
@@ -0,0 +1,82 @@
+#ifndef RENDER_WINDOW_H
+#define RENDER_WINDOW_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "util/undefkeywords.h"
+#include <libcamera/formats.h>
+
+#include <QWindow>
+#include <QThread>
+#include <QSemaphore>
+#include <QOpenGLContext>
+
+#include "cam/framemailbox.h"
+#include "cam/framerenderer.h"
+
+// Shows frames from a dedicated render thread with its own OpenGL context
+// The capture thread posts frames into a mailbox and wakes the render thread directly,
+// so neither the GUI event loop nor the widget compositor sit between capture and screen.
+// Embed it with QWidget::createWindowContainer().
+class RenderWindow : public QWindow
+{
+    Q_OBJECT
+
+public:
+    RenderWindow(QWindow *parent = nullptr);
+    ~RenderWindow();
+
+    // Threaded rendering needs platform support, e.g. not available with some X11 drivers
+    static bool isSupported();
+
+    void setFormat(const libcamera::PixelFormat &format, const QSize &size, uint stride);
+
+    // Show a frame, optionally cross-faded to the next one, called from the capture thread
+    void post(const std::shared_ptr<const FramePool> &pool, const PooledFrame *frame, quint64 sequence,
+              const PooledFrame *next, quint64 nextSequence, float blend);
+
+    // Status overlay, the source is called in the render thread and must be set before the window is shown
+    void setHudSource(HudOverlay::Source source) { hudSource_ = std::move(source); }
+    void setHudVisible(bool visible);
+
+    // Scrub timeline, the source is called in the render thread and must be set before the window is shown
+    void setScrubSource(ThumbnailStrip::Source source) { scrubSource_ = std::move(source); }
+
+Q_SIGNALS:
+    // The swap of the first frame finished, for the startup profile, emitted from the render thread
+    void firstFramePresented();
+
+protected:
+    void exposeEvent(QExposeEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    void startRendering();
+    void renderLoop();
+    void wake();
+
+private:
+    std::unique_ptr<QOpenGLContext> context_;  // Lives in the render thread while it runs
+    std::unique_ptr<QThread> renderThread_;
+    QSemaphore wakeup_;
+    std::atomic<bool> stop_;
+    std::atomic<bool> exposed_;
+    std::atomic<bool> repaint_;     // Redraw the last frame, e.g. after a resize
+    std::atomic<int> width_;        // Size in device pixels
+    std::atomic<int> height_;
+    FrameMailbox mailbox_;
+    HudOverlay::Source hudSource_;
+    std::atomic<bool> hudVisible_;
+    ThumbnailStrip::Source scrubSource_;
+
+    // Format set from the GUI thread, applied by the render thread
+    std::mutex formatMutex_;
+    bool formatChanged_;
+    libcamera::PixelFormat format_;
+    QSize size_;
+    uint stride_;
+};
+
+#endif // RENDER_WINDOW_H
@@ -12,11 +12,22 @@ precision mediump float;
 varying vec2 textureOut;
 uniform sampler2D tex_y;
 
+/* Next frame of a cross-fade, mixed in with next_weight if that isn't 0 */
+uniform sampler2D tex_y_next;
+uniform float next_weight;
+
+vec3 frameColor(sampler2D y)
+{
+    return texture2D(y, textureOut).RGB_PATTERN;
+}
+
 void main(void)
 {
     vec3 rgb;
 
-    rgb = texture2D(tex_y, textureOut).RGB_PATTERN;
+    rgb = frameColor(tex_y);
+    if (next_weight > 0.0)
+        rgb = mix(rgb, frameColor(tex_y_next), next_weight);
 
     gl_FragColor = vec4(rgb, 1.0);
 }
@@ -13,27 +13,40 @@ varying vec2 textureOut;
 uniform sampler2D tex_y;
 uniform sampler2D tex_u;
 
-void main(void)
+/* Next frame of a cross-fade, mixed in with next_weight if that isn't 0 */
+uniform sampler2D tex_y_next;
+uniform sampler2D tex_u_next;
+uniform float next_weight;
+
+vec3 frameColor(sampler2D y, sampler2D u)
 {
 	vec3 yuv;
-	vec3 rgb;
 	mat3 yuv2rgb_bt601_mat = mat3(
 		vec3(1.164,  1.164, 1.164),
 		vec3(0.000, -0.392, 2.017),
 		vec3(1.596, -0.813, 0.000)
 	);
 
-	yuv.x = texture2D(tex_y, textureOut).r - 0.063;
+	yuv.x = texture2D(y, textureOut).r - 0.063;
 #if defined(YUV_PATTERN_UV)
-	yuv.y = texture2D(tex_u, textureOut).r - 0.500;
-	yuv.z = texture2D(tex_u, textureOut).a - 0.500;
+	yuv.y = texture2D(u, textureOut).r - 0.500;
+	yuv.z = texture2D(u, textureOut).a - 0.500;
 #elif defined(YUV_PATTERN_VU)
-	yuv.y = texture2D(tex_u, textureOut).a - 0.500;
-	yuv.z = texture2D(tex_u, textureOut).r - 0.500;
+	yuv.y = texture2D(u, textureOut).a - 0.500;
+	yuv.z = texture2D(u, textureOut).r - 0.500;
 #else
 #error Invalid pattern
 #endif
 
-	rgb = yuv2rgb_bt601_mat * yuv;
+	return yuv2rgb_bt601_mat * yuv;
+}
+
+void main(void)
+{
+	vec3 rgb;
+
+	rgb = frameColor(tex_y, tex_u);
+	if (next_weight > 0.0)
+		rgb = mix(rgb, frameColor(tex_y_next, tex_u_next), next_weight);
 	gl_FragColor = vec4(rgb, 1.0);
 }
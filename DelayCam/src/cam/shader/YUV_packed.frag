@@ -14,7 +14,11 @@ varying vec2 textureOut;
 uniform sampler2D tex_y;
 uniform vec2 tex_step;
 
-void main(void)
+/* Next frame of a cross-fade, mixed in with next_weight if that isn't 0 */
+uniform sampler2D tex_y_next;
+uniform float next_weight;
+
+vec3 frameColor(sampler2D tex)
 {
 	mat3 yuv2rgb_bt601_mat = mat3(
 		vec3(1.164,  1.164, 1.164),
@@ -51,8 +55,8 @@ void main(void)
 	vec2 pos = textureOut;
 	float f_x = fract(pos.x / tex_step.x);
 
-	vec4 left = texture2D(tex_y, vec2(pos.x - f_x * tex_step.x, pos.y));
-	vec4 right = texture2D(tex_y, vec2(pos.x + (1.0 - f_x) * tex_step.x , pos.y));
+	vec4 left = texture2D(tex, vec2(pos.x - f_x * tex_step.x, pos.y));
+	vec4 right = texture2D(tex, vec2(pos.x + (1.0 - f_x) * tex_step.x , pos.y));
 
 #if defined(YUV_PATTERN_UYVY)
 	float y_left = mix(left.g, left.a, f_x * 2.0);
@@ -76,7 +80,14 @@ void main(void)
 
 	float y = mix(y_left, y_right, step(0.5, f_x));
 
-	vec3 rgb = yuv2rgb_bt601_mat * (vec3(y, uv) - yuv2rgb_bt601_offset);
+	return yuv2rgb_bt601_mat * (vec3(y, uv) - yuv2rgb_bt601_offset);
+}
+
+void main(void)
+{
+	vec3 rgb = frameColor(tex_y);
+	if (next_weight > 0.0)
+		rgb = mix(rgb, frameColor(tex_y_next), next_weight);
 
 	gl_FragColor = vec4(rgb, 1.0);
 }
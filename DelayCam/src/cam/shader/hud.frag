@@ -0,0 +1,16 @@
+/*
+ * hud.frag - Fragment shader of the status overlay, the glyph atlas is the coverage
+ */
+
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+varying vec2 textureOut;
+varying vec4 colorOut;
+uniform sampler2D atlas;
+
+void main(void)
+{
+    gl_FragColor = vec4(colorOut.rgb, colorOut.a * texture2D(atlas, textureOut).r);
+}
@@ -0,0 +1,16 @@
+/*
+ * hud.vert - Vertex shader of the status overlay, positions are in clip space already
+ */
+
+attribute vec2 vertexIn;
+attribute vec2 textureIn;
+attribute vec4 colorIn;
+varying vec2 textureOut;
+varying vec4 colorOut;
+
+void main(void)
+{
+    gl_Position = vec4(vertexIn, 0.0, 1.0);
+    textureOut = textureIn;
+    colorOut = colorIn;
+}
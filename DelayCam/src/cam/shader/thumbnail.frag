@@ -0,0 +1,30 @@
+/*
+ * thumbnail.frag - Fragment shader of the scrub timeline, planar YUV 4:2:0 thumbnails from three atlases
+ */
+
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+varying vec2 textureOut;
+varying vec4 colorOut;
+uniform sampler2D tex_y;
+uniform sampler2D tex_u;
+uniform sampler2D tex_v;
+
+void main(void)
+{
+    vec3 yuv;
+    mat3 yuv2rgb_bt601_mat = mat3(
+        vec3(1.164,  1.164, 1.164),
+        vec3(0.000, -0.392, 2.017),
+        vec3(1.596, -0.813, 0.000)
+    );
+
+    yuv.x = texture2D(tex_y, textureOut).r - 0.063;
+    yuv.y = texture2D(tex_u, textureOut).r - 0.500;
+    yuv.z = texture2D(tex_v, textureOut).r - 0.500;
+
+    // The color dims the thumbnails next to the current one
+    gl_FragColor = vec4(yuv2rgb_bt601_mat * yuv * colorOut.rgb, colorOut.a);
+}
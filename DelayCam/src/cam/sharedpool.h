@@ -0,0 +1,70 @@
+#ifndef SHARED_POOL_H
+#define SHARED_POOL_H
+
+#include <atomic>
+#include <cstdint>
+
+// Layout of the shared memory segment a FramePool can be exported to.
+// This header is shared with external readers, so it must not depend on Qt or libcamera.
+//
+// [Header][Slot * capacity][plane 0 of all frames][plane 1 of all frames]...
+//
+// Every slot is guarded by a seqlock: the writer makes seq odd before it touches
+// the frame and even again afterwards. A reader samples seq, uses the frame in
+// place and accepts it only if seq is unchanged and even.
+namespace SharedPool {
+
+constexpr uint32_t Magic = 0x4d414344; // "DCAM"
+constexpr uint32_t Version = 2;
+constexpr unsigned int MaxPlanes = 3;
+constexpr const char *DefaultName = "/delaycam";
+
+struct Slot {
+    std::atomic<uint32_t> seq;  // Seqlock counter, odd while the frame is written
+    uint32_t reserved;
+    uint64_t sequenceNumber;    // Number of the frame stored in this slot
+    uint64_t timestamp;         // Sensor timestamp [ns]
+};
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;               // sizeof(Header)
+    uint32_t slotSize;                 // sizeof(Slot)
+    uint32_t pixelFormat;              // DRM fourcc of the frames
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;                   // Stride of the first plane [bytes]
+    uint32_t numPlanes;
+    uint32_t reserved;
+    uint64_t planeOffset[MaxPlanes];   // Offset of each plane region from the segment start
+    uint64_t planeSize[MaxPlanes];     // Size of one plane of one frame
+    uint64_t capacity;                 // Number of slots
+    uint64_t segmentSize;              // Total size of the mapping
+    std::atomic<int32_t> writerPid;    // Process writing the frames, a restarted writer reattaches if it is gone
+    uint32_t reserved2;
+    std::atomic<uint64_t> writeCount;  // Frames stored so far, latest is at (writeCount - 1) % capacity
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Slot seqlock must be lock free");
+static_assert(std::atomic<int32_t>::is_always_lock_free, "Writer pid must be lock free");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Write counter must be lock free");
+
+inline Slot *slots(Header *header)
+{
+    return reinterpret_cast<Slot *>(reinterpret_cast<uint8_t *>(header) + header->headerSize);
+}
+
+inline const Slot *slots(const Header *header)
+{
+    return reinterpret_cast<const Slot *>(reinterpret_cast<const uint8_t *>(header) + header->headerSize);
+}
+
+inline const uint8_t *planeData(const Header *header, unsigned int plane, uint64_t slot)
+{
+    return reinterpret_cast<const uint8_t *>(header) + header->planeOffset[plane] + slot * header->planeSize[plane];
+}
+
+} // namespace SharedPool
+
+#endif // SHARED_POOL_H
@@ -0,0 +1,88 @@
+#include "cam/syntheticsession.h"
+#include "cam/image.h"
+#include "util/logger.h"
+
+#include <cstring>
+#include <ctime>
+
+#include <QThread>
+
+SyntheticSession::SyntheticSession(int index, QObject *parent) :
+    CameraSession(QString("Synthetic %1").arg(index), parent),
+    index_(index),
+    frameTimer_(this),
+    sequence_(0)
+{
+    frameTimer_.setTimerType(Qt::PreciseTimer);
+    connect(&frameTimer_, &QTimer::timeout, this, &SyntheticSession::generateFrame);
+}
+
+SyntheticSession::~SyntheticSession()
+{
+    stop();
+}
+
+bool SyntheticSession::start(const Config &config)
+{
+    stop();
+    config_ = config;
+
+    // Planar YUV420 with the requested size, rounded to even dimensions
+    format_ = libcamera::formats::YUV420;
+    size_ = QSize(config.size.width() & ~1, config.size.height() & ~1);
+    stride_ = size_.width();
+    dcInfo(name_ + ": Using size " + QString::number(size_.width()) + "x" + QString::number(size_.height()));
+
+    // Allocate one frame and describe its planes
+    const size_t lumaSize = stride_ * size_.height();
+    const size_t chromaSize = lumaSize / 4;
+    memory_.assign(lumaSize + 2 * chromaSize, 128);
+    std::vector<libcamera::Span<uint8_t>> planes{
+        libcamera::Span<uint8_t>(memory_.data(), lumaSize),
+        libcamera::Span<uint8_t>(memory_.data() + lumaSize, chromaSize),
+        libcamera::Span<uint8_t>(memory_.data() + lumaSize + chromaSize, chromaSize),
+    };
+    image_ = Image::fromMemory(planes);
+
+    // Create pool once
+    if (pool_ == nullptr || pool_->capacity() == 0)
+        if (!createPool(*image_))
+            return false;
+
+    // Generate frames in the capture thread
+    sequence_ = 0;
+    startStats();
+    int interval = static_cast<int>(1000 / config.frameRate);
+    QMetaObject::invokeMethod(&frameTimer_, [this, interval]() { frameTimer_.start(interval); }, Qt::QueuedConnection);
+    return true;
+}
+
+void SyntheticSession::stop()
+{
+    // Stop the timer in the capture thread and wait for it
+    stopStats();
+    Qt::ConnectionType type = thread() != QThread::currentThread() && thread()->isRunning() ?
+        Qt::BlockingQueuedConnection : Qt::DirectConnection;
+    QMetaObject::invokeMethod(&frameTimer_, "stop", type);
+}
+
+void SyntheticSession::generateFrame()
+{
+    // Draw a vertical bar moving one column per frame, brightness depends on the source index
+    const int width = size_.width();
+    const int height = size_.height();
+    const int barWidth = std::max(width / 32, 1);
+    const int barStart = (sequence_ * 8) % width;
+    uint8_t background = static_cast<uint8_t>(32 + (index_ * 48) % 160);
+    for (int row = 0; row < height; row++) {
+        uint8_t *line = memory_.data() + row * stride_;
+        std::memset(line, background, width);
+        std::memset(line + barStart, 235, std::min(barWidth, width - barStart));
+    }
+
+    // Use the monotonic clock like the sensor timestamps
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t timestamp = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    processImage(*image_, sequence_++, timestamp);
+}
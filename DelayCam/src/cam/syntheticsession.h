@@ -0,0 +1,35 @@
+#ifndef SYNTHETICSESSION_H
+#define SYNTHETICSESSION_H
+
+#include <memory>
+#include <vector>
+
+#include "cam/camerasession.h"
+
+#include <QTimer>
+
+// Camera session generating a moving YUV420 test pattern
+// Used to run and measure the pipeline without (or with more) cameras connected
+class SyntheticSession : public CameraSession
+{
+    Q_OBJECT
+
+public:
+    SyntheticSession(int index, QObject *parent = nullptr);
+    ~SyntheticSession();
+
+    bool start(const Config &config) override;
+    void stop() override;
+
+private Q_SLOTS:
+    void generateFrame();
+
+private:
+    int index_;
+    QTimer frameTimer_;
+    std::vector<uint8_t> memory_;
+    std::unique_ptr<Image> image_;
+    uint64_t sequence_;
+};
+
+#endif // SYNTHETICSESSION_H
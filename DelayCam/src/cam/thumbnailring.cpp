@@ -0,0 +1,168 @@
+#include "thumbnailring.h"
+
+#include <algorithm>
+
+#include "util/undefkeywords.h"
+#include <libcamera/formats.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static void addRow(const uint8_t *src, uint16_t *sums, unsigned int bytes)
+{
+    // Widen 16 pixels at a time and add them to the column sums
+    unsigned int x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= bytes; x += 16) {
+        const uint8x16_t pixels = vld1q_u8(src + x);
+        vst1q_u16(sums + x, vaddw_u8(vld1q_u16(sums + x), vget_low_u8(pixels)));
+        vst1q_u16(sums + x + 8, vaddw_u8(vld1q_u16(sums + x + 8), vget_high_u8(pixels)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= bytes; x += 16) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+        __m128i *low = reinterpret_cast<__m128i *>(sums + x);
+        __m128i *high = reinterpret_cast<__m128i *>(sums + x + 8);
+        _mm_storeu_si128(low, _mm_add_epi16(_mm_loadu_si128(low), _mm_unpacklo_epi8(pixels, zero)));
+        _mm_storeu_si128(high, _mm_add_epi16(_mm_loadu_si128(high), _mm_unpackhi_epi8(pixels, zero)));
+    }
+#endif
+    for (; x < bytes; x++)
+        sums[x] += src[x];
+}
+
+bool ThumbnailRing::supports(uint32_t fourcc)
+{
+    return fourcc == libcamera::formats::YUV420.fourcc() || fourcc == libcamera::formats::YVU420.fourcc() ||
+           fourcc == libcamera::formats::NV12.fourcc() || fourcc == libcamera::formats::NV21.fourcc();
+}
+
+ThumbnailRing::ThumbnailRing(uint32_t fourcc, unsigned int width, unsigned int height, unsigned int stride, size_t frameCount) :
+    stride_(stride),
+    factor_(1),
+    semiPlanar_(fourcc == libcamera::formats::NV12.fourcc() || fourcc == libcamera::formats::NV21.fourcc()),
+    swapChroma_(fourcc == libcamera::formats::YVU420.fourcc() || fourcc == libcamera::formats::NV21.fourcc())
+{
+    // The smallest factor that fits, chroma has half the resolution in both and is shrunk by the same factor
+    while (width / factor_ > MaxWidth || height / factor_ > MaxHeight)
+        factor_++;
+    width_ = std::max((width / factor_) & ~1u, 2u);
+    height_ = std::max((height / factor_) & ~1u, 2u);
+
+    // Spread the thumbnails over the whole pool, one slot more than the delay needs for the one being written
+    interval_ = static_cast<unsigned int>(std::max<size_t>((frameCount + MaxThumbnails - 2) / (MaxThumbnails - 1), 1));
+    slotCount_ = std::min(MaxThumbnails, frameCount / interval_ + 2);
+    frameSize_ = size_t(width_) * height_ * 3 / 2;
+    data_.reset(new uint8_t[slotCount_ * frameSize_]());
+    slots_.reset(new Slot[slotCount_]);
+    rowSums_.reset(new uint16_t[size_t(width_) * factor_]);
+}
+
+bool ThumbnailRing::add(const std::vector<libcamera::Span<uint8_t>> &planes, uint64_t frameIndex, uint64_t timestamp)
+{
+    if (frameIndex % interval_ != 0)
+        return false;
+
+    // Only read what the planes hold, a frame of another layout is skipped
+    const unsigned int chromaStride = semiPlanar_ ? stride_ : stride_ / 2;
+    const size_t lumaRows = size_t(height_) * factor_;
+    const size_t chromaRows = lumaRows / 2;
+    if (planes.size() < (semiPlanar_ ? 2u : 3u) || planes[0].size() < stride_ * lumaRows ||
+        planes[1].size() < chromaStride * chromaRows || (!semiPlanar_ && planes[2].size() < chromaStride * chromaRows))
+        return false;
+
+    // Invalidate the slot before overwriting it, readers see the old index until then
+    const uint64_t index = written_.load(std::memory_order_relaxed);
+    Slot &slot = slots_[index % slotCount_];
+    slot.index.store(InvalidIndex, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // Luma, then the chroma planes in U, V order
+    uint8_t *luma = data_.get() + (index % slotCount_) * frameSize_;
+    uint8_t *chroma[2] = { luma + size_t(width_) * height_, luma + size_t(width_) * height_ * 5 / 4 };
+    if (swapChroma_)
+        std::swap(chroma[0], chroma[1]);
+    shrinkPlane(planes[0].data(), stride_, factor_, 1, &luma, width_, height_);
+    if (semiPlanar_)
+        shrinkPlane(planes[1].data(), chromaStride, factor_, 2, chroma, width_ / 2, height_ / 2);
+    else {
+        shrinkPlane(planes[1].data(), chromaStride, factor_, 1, &chroma[0], width_ / 2, height_ / 2);
+        shrinkPlane(planes[2].data(), chromaStride, factor_, 1, &chroma[1], width_ / 2, height_ / 2);
+    }
+
+    // Publish the thumbnail and the new count
+    slot.timestamp.store(timestamp, std::memory_order_relaxed);
+    slot.index.store(index, std::memory_order_release);
+    written_.store(index + 1, std::memory_order_release);
+    return true;
+}
+
+void ThumbnailRing::shrinkPlane(const uint8_t *src, size_t stride, unsigned int factor, unsigned int channels,
+                                uint8_t *const *dst, unsigned int width, unsigned int height)
+{
+    // Sum the source rows of each thumbnail row, then the columns of each thumbnail pixel
+    // Interleaved channels are summed together and separated in the second step
+    const unsigned int bytes = width * factor * channels;
+    const unsigned int divisor = factor * factor;
+    uint16_t *sums = rowSums_.get();
+    for (unsigned int row = 0; row < height; row++) {
+        std::fill(sums, sums + bytes, 0);
+        for (unsigned int y = 0; y < factor; y++)
+            addRow(src + (size_t(row) * factor + y) * stride, sums, bytes);
+        for (unsigned int channel = 0; channel < channels; channel++) {
+            uint8_t *out = dst[channel] + size_t(row) * width;
+            for (unsigned int x = 0; x < width; x++) {
+                const uint16_t *column = sums + x * factor * channels + channel;
+                unsigned int sum = 0;
+                for (unsigned int i = 0; i < factor; i++)
+                    sum += column[i * channels];
+                out[x] = static_cast<uint8_t>((sum + divisor / 2) / divisor);
+            }
+        }
+    }
+}
+
+uint64_t ThumbnailRing::first() const
+{
+    const uint64_t end = written();
+    return end >= slotCount_ ? end - slotCount_ + 1 : 0;
+}
+
+bool ThumbnailRing::isValid(uint64_t index) const
+{
+    // Pairs with the fence in add(), the data read before is from this thumbnail if the index is unchanged
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slots_[index % slotCount_].index.load(std::memory_order_relaxed) == index;
+}
+
+uint64_t ThumbnailRing::timestamp(uint64_t index) const
+{
+    const Slot &slot = slots_[index % slotCount_];
+    if (slot.index.load(std::memory_order_acquire) != index)
+        return 0;
+    const uint64_t timestamp = slot.timestamp.load(std::memory_order_relaxed);
+    return isValid(index) ? timestamp : 0;
+}
+
+bool ThumbnailRing::find(uint64_t timestamp, uint64_t &index) const
+{
+    // Binary search for the first thumbnail after the timestamp, timestamps grow with the index
+    const uint64_t end = written();
+    if (end == 0)
+        return false;
+    const uint64_t begin = first();
+    uint64_t low = begin;
+    uint64_t high = end;
+    while (low < high) {
+        const uint64_t middle = low + (high - low) / 2;
+        if (this->timestamp(middle) <= timestamp)
+            low = middle + 1;
+        else high = middle;
+    }
+    index = low > begin ? low - 1 : begin;
+    return true;
+}
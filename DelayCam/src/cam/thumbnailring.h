@@ -0,0 +1,82 @@
+#ifndef THUMBNAIL_RING_H
+#define THUMBNAIL_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+// Downscaled copies of every few stored frames, so a scrub timeline never touches the full frames
+// Thumbnails are planar YUV 4:2:0 of at most 160x120 whatever 4:2:0 layout the pool stores, made with a
+// box filter that sums whole rows with NEON or SSE2 where available. One thumbnail per interval frames
+// keeps at most MaxThumbnails for the whole delay. Written by the thumbnail stage of the pool, read from any thread:
+// a reader checks isValid() after copying a thumbnail, the writer may have reused its slot meanwhile.
+class ThumbnailRing {
+public:
+    static constexpr unsigned int MaxWidth = 160;
+    static constexpr unsigned int MaxHeight = 120;
+    static constexpr size_t MaxThumbnails = 192;
+    static constexpr uint64_t InvalidIndex = UINT64_MAX;
+
+    // Planar and semi planar YUV 4:2:0
+    static bool supports(uint32_t fourcc);
+
+    ThumbnailRing(uint32_t fourcc, unsigned int width, unsigned int height, unsigned int stride, size_t frameCount);
+
+    // Make a thumbnail of the stored frame with this index if it is on the interval, returns true if one was made
+    bool add(const std::vector<libcamera::Span<uint8_t>> &planes, uint64_t frameIndex, uint64_t timestamp);
+
+    unsigned int width() const { return width_; }
+    unsigned int height() const { return height_; }
+    unsigned int interval() const { return interval_; }
+    size_t slots() const { return slotCount_; }
+
+    // Thumbnails made so far, the newest has index written() - 1
+    uint64_t written() const { return written_.load(std::memory_order_acquire); }
+
+    // Oldest thumbnail a reader can expect to be valid, the one after it may be overwritten next
+    uint64_t first() const;
+
+    // The Y plane of width() x height() followed by the U and V planes of half the size each
+    const uint8_t *data(uint64_t index) const { return data_.get() + (index % slotCount_) * frameSize_; }
+    size_t frameSize() const { return frameSize_; }
+
+    // Still holds the thumbnail with this index
+    bool isValid(uint64_t index) const;
+
+    // Sensor time of a thumbnail, 0 if it was overwritten [ns]
+    uint64_t timestamp(uint64_t index) const;
+
+    // Index of the newest thumbnail made at or before the timestamp, the oldest one if all are newer
+    // Returns false if there are no thumbnails
+    bool find(uint64_t timestamp, uint64_t &index) const;
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> index{InvalidIndex};
+        std::atomic<uint64_t> timestamp{0};
+    };
+
+    void shrinkPlane(const uint8_t *src, size_t stride, unsigned int factor, unsigned int channels,
+                     uint8_t *const *dst, unsigned int width, unsigned int height);
+
+private:
+    unsigned int width_;
+    unsigned int height_;
+    unsigned int stride_;       // Of the stored luma plane
+    unsigned int factor_;       // Pixels per thumbnail pixel in both directions, for luma and chroma
+    unsigned int interval_;     // Stored frames per thumbnail
+    bool semiPlanar_;           // U and V interleaved in the second plane
+    bool swapChroma_;           // V comes before U
+    size_t slotCount_;
+    size_t frameSize_;
+    std::unique_ptr<uint8_t[]> data_;
+    std::unique_ptr<Slot[]> slots_;
+    std::unique_ptr<uint16_t[]> rowSums_; // Vertical sums of the rows of one thumbnail row, writer only
+    std::atomic<uint64_t> written_{0};
+};
+
+#endif // THUMBNAIL_RING_H
@@ -0,0 +1,232 @@
+#include "cam/thumbnailstrip.h"
+#include "cam/framepool.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <cstddef>
+
+static const GLfloat currentColor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+static const GLfloat otherColor[4]   = { 0.55f, 0.55f, 0.55f, 1.0f };
+
+ThumbnailStrip::ThumbnailStrip() :
+    initialized_(false),
+    vertexBuffer_(QOpenGLBuffer::VertexBuffer),
+    attributeVertex_(-1),
+    attributeTexture_(-1),
+    attributeColor_(-1),
+    uniformPlanes_{ -1, -1, -1 },
+    ring_(nullptr),
+    uploaded_(0),
+    thumbnailWidth_(0),
+    thumbnailHeight_(0),
+    columns_(0),
+    quads_(0),
+    width_(0),
+    height_(0)
+{
+}
+
+ThumbnailStrip::~ThumbnailStrip()
+{
+}
+
+void ThumbnailStrip::initialize()
+{
+    // The program shares the vertex shader of the status overlay
+    initializeOpenGLFunctions();
+    if (!program_.addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":hud.vert") ||
+        !program_.addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":thumbnail.frag") ||
+        !program_.link()) {
+        dcWarning("Failed to create the thumbnail shaders: " + program_.log());
+        return;
+    }
+    attributeVertex_ = program_.attributeLocation("vertexIn");
+    attributeTexture_ = program_.attributeLocation("textureIn");
+    attributeColor_ = program_.attributeLocation("colorIn");
+    uniformPlanes_[0] = program_.uniformLocation("tex_y");
+    uniformPlanes_[1] = program_.uniformLocation("tex_u");
+    uniformPlanes_[2] = program_.uniformLocation("tex_v");
+
+    // The atlases are allocated once at their full size, 6MB whatever the thumbnails are
+    for (size_t plane = 0; plane < atlases_.size(); plane++) {
+        const int size = plane == 0 ? AtlasSize : AtlasSize / 2;
+        atlases_[plane] = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+        atlases_[plane]->create();
+        glBindTexture(GL_TEXTURE_2D, atlases_[plane]->textureId());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, size, size, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    vertices_.reset(new Vertex[MaxQuads * 6]);
+    vertexBuffer_.create();
+    vertexBuffer_.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    vertexBuffer_.bind();
+    vertexBuffer_.allocate(MaxQuads * 6 * sizeof(Vertex));
+    vertexBuffer_.release();
+    initialized_ = true;
+}
+
+void ThumbnailStrip::destroy()
+{
+    // Release the GL objects while their context is still current, and the pool with them
+    if (!initialized_)
+        return;
+    program_.removeAllShaders();
+    for (std::unique_ptr<QOpenGLTexture> &atlas : atlases_)
+        atlas.reset();
+    vertexBuffer_.destroy();
+    position_ = Position();
+    ring_ = nullptr;
+    initialized_ = false;
+}
+
+bool ThumbnailStrip::update()
+{
+    if (!initialized_ || !source_)
+        return false;
+
+    // A new pool starts over with its own thumbnails, the old one is kept until then
+    Position position;
+    source_(position);
+    const ThumbnailRing *ring = position.pool ? position.pool->thumbnails() : nullptr;
+    if (ring != ring_) {
+        ring_ = ring;
+        uploaded_ = 0;
+        atlasIndex_.assign(ring ? ring->slots() : 0, ThumbnailRing::InvalidIndex);
+        if (ring) {
+            thumbnailWidth_ = ring->width();
+            thumbnailHeight_ = ring->height();
+            columns_ = AtlasSize / thumbnailWidth_;
+        }
+    }
+    position_ = std::move(position);
+    if (ring_ == nullptr)
+        return false;
+
+    // Upload what was made since the last frame, a few at a time to keep frames short
+    const uint64_t written = ring_->written();
+    uint64_t index = std::max(uploaded_, ring_->first());
+    if (index < written) {
+        glActiveTexture(GL_TEXTURE3);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (uint64_t uploads = 0; index < written && uploads < MaxUploads; index++, uploads++)
+            upload(index);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    uploaded_ = index;
+    return isScrubbing() && !position_.settled;
+}
+
+void ThumbnailStrip::upload(uint64_t index)
+{
+    // Slots fill the atlas row by row, chroma at half the position and size
+    const size_t slot = index % ring_->slots();
+    const int x = (slot % columns_) * thumbnailWidth_;
+    const int y = (slot / columns_) * thumbnailHeight_;
+    if (y + static_cast<int>(thumbnailHeight_) > AtlasSize)
+        return;
+    const uint8_t *data = ring_->data(index);
+    const size_t lumaSize = size_t(thumbnailWidth_) * thumbnailHeight_;
+    glBindTexture(GL_TEXTURE_2D, atlases_[0]->textureId());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, thumbnailWidth_, thumbnailHeight_, GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
+    glBindTexture(GL_TEXTURE_2D, atlases_[1]->textureId());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x / 2, y / 2, thumbnailWidth_ / 2, thumbnailHeight_ / 2,
+                    GL_LUMINANCE, GL_UNSIGNED_BYTE, data + lumaSize);
+    glBindTexture(GL_TEXTURE_2D, atlases_[2]->textureId());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x / 2, y / 2, thumbnailWidth_ / 2, thumbnailHeight_ / 2,
+                    GL_LUMINANCE, GL_UNSIGNED_BYTE, data + lumaSize * 5 / 4);
+
+    // A thumbnail the writer replaced while it was copied is torn, its successor is uploaded later
+    atlasIndex_[slot] = ring_->isValid(index) ? index : ThumbnailRing::InvalidIndex;
+}
+
+void ThumbnailStrip::draw(int width, int height)
+{
+    if (!initialized_ || !isScrubbing() || width <= 0 || height <= 0)
+        return;
+    uint64_t center = 0;
+    if (!ring_->find(position_.timestamp, center))
+        return;
+    width_ = width;
+    height_ = height;
+    quads_ = 0;
+
+    // The thumbnail of the position covers the frame until the stored frame is shown
+    if (!position_.settled)
+        addThumbnail(center, 0, 0, width, height, currentColor);
+
+    // Timeline along the bottom, older thumbnails to the left, the current one raised in the middle
+    // Wider views show more of them, dozens on a full HD screen
+    const int stripCount = std::clamp(width / StripSlotWidth, MinStripCount, MaxStripCount) | 1;
+    const float slotWidth = static_cast<float>(width) / stripCount;
+    const float gap = std::max(1.0f, slotWidth / 32);
+    const float thumbnailHeight = (slotWidth - 2 * gap) * thumbnailHeight_ / thumbnailWidth_;
+    const float bottom = height - 2 * gap;
+    for (int i = 0; i < stripCount; i++) {
+        const int64_t index = static_cast<int64_t>(center) + i - stripCount / 2;
+        if (index < 0)
+            continue;
+        const bool current = i == stripCount / 2;
+        const float top = bottom - thumbnailHeight * (current ? 1.2f : 1.0f);
+        addThumbnail(index, i * slotWidth + gap, top, (i + 1) * slotWidth - gap, bottom, current ? currentColor : otherColor);
+    }
+    if (quads_ == 0)
+        return;
+
+    // One draw call for the preview and the timeline
+    program_.bind();
+    vertexBuffer_.bind();
+    vertexBuffer_.write(0, vertices_.get(), quads_ * 6 * sizeof(Vertex));
+    program_.enableAttributeArray(attributeVertex_);
+    program_.setAttributeBuffer(attributeVertex_, GL_FLOAT, offsetof(Vertex, x), 2, sizeof(Vertex));
+    program_.enableAttributeArray(attributeTexture_);
+    program_.setAttributeBuffer(attributeTexture_, GL_FLOAT, offsetof(Vertex, u), 2, sizeof(Vertex));
+    program_.enableAttributeArray(attributeColor_);
+    program_.setAttributeBuffer(attributeColor_, GL_FLOAT, offsetof(Vertex, r), 4, sizeof(Vertex));
+    for (size_t plane = 0; plane < atlases_.size(); plane++) {
+        glActiveTexture(GL_TEXTURE3 + plane);
+        glBindTexture(GL_TEXTURE_2D, atlases_[plane]->textureId());
+        program_.setUniformValue(uniformPlanes_[plane], static_cast<GLint>(3 + plane));
+    }
+    glDrawArrays(GL_TRIANGLES, 0, quads_ * 6);
+    program_.disableAttributeArray(attributeVertex_);
+    program_.disableAttributeArray(attributeTexture_);
+    program_.disableAttributeArray(attributeColor_);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void ThumbnailStrip::addThumbnail(uint64_t index, float x0, float y0, float x1, float y1, const GLfloat *color)
+{
+    // Only thumbnails the atlas holds, the edges are inset by a texel against bleeding of the neighbours
+    const size_t slot = index % ring_->slots();
+    if (quads_ >= MaxQuads || atlasIndex_[slot] != index)
+        return;
+    const float u0 = ((slot % columns_) * thumbnailWidth_ + 1.0f) / AtlasSize;
+    const float v0 = ((slot / columns_) * thumbnailHeight_ + 1.0f) / AtlasSize;
+    const float u1 = u0 + (thumbnailWidth_ - 2.0f) / AtlasSize;
+    const float v1 = v0 + (thumbnailHeight_ - 2.0f) / AtlasSize;
+
+    // Two triangles, pixel coordinates from the top left are converted to clip space
+    const float left = 2 * x0 / width_ - 1;
+    const float right = 2 * x1 / width_ - 1;
+    const float top = 1 - 2 * y0 / height_;
+    const float bottom = 1 - 2 * y1 / height_;
+    const Vertex corners[4] = {
+        { left, top, u0, v0, color[0], color[1], color[2], color[3] },
+        { right, top, u1, v0, color[0], color[1], color[2], color[3] },
+        { right, bottom, u1, v1, color[0], color[1], color[2], color[3] },
+        { left, bottom, u0, v1, color[0], color[1], color[2], color[3] },
+    };
+    Vertex *vertex = &vertices_[quads_ * 6];
+    vertex[0] = corners[0];
+    vertex[1] = corners[1];
+    vertex[2] = corners[2];
+    vertex[3] = corners[0];
+    vertex[4] = corners[2];
+    vertex[5] = corners[3];
+    quads_++;
+}
@@ -0,0 +1,93 @@
+#ifndef THUMBNAIL_STRIP_H
+#define THUMBNAIL_STRIP_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+
+class FramePool;
+class ThumbnailRing;
+
+// Scrub timeline drawn from the thumbnails of the pool, which are kept in three luminance atlases (Y, U, V)
+// Every new thumbnail is uploaded once with glTexSubImage2D, whether or not anybody scrubs, so starting to
+// scrub costs nothing. While the position moves, a thumbnail stretched over the view stands in for the frame
+// and the renderer skips the full frame uploads. All thumbnails are drawn with one call.
+// All methods need the context of the renderer to be current.
+class ThumbnailStrip : protected QOpenGLFunctions
+{
+public:
+    struct Position {
+        std::shared_ptr<const FramePool> pool; // Holds the thumbnails
+        uint64_t timestamp = 0;     // Scrub position, 0 = not scrubbing [ns]
+        bool settled = false;       // The stored frame of the position is shown, no preview needed
+    };
+
+    // Fills in the position, called in the rendering thread before each frame
+    using Source = std::function<void(Position &)>;
+
+    ThumbnailStrip();
+    ~ThumbnailStrip();
+
+    void initialize();
+    void destroy();
+    void setSource(Source source) { source_ = std::move(source); }
+
+    // Read the position and upload the thumbnails made since the last call
+    // Returns true while the preview stands in for the frame, the frame needn't be uploaded then
+    bool update();
+    bool isScrubbing() const { return ring_ != nullptr && position_.timestamp > 0; }
+
+    // Draw the preview and the timeline over the frame, leaves another program and buffer bound
+    void draw(int width, int height);
+
+private:
+    struct Vertex {
+        GLfloat x, y;       // Clip space
+        GLfloat u, v;       // Atlas
+        GLfloat r, g, b, a;
+    };
+
+    static constexpr int AtlasSize = 2048;      // Luma, the chroma atlases have half the size
+    static constexpr int MinStripCount = 15;    // Thumbnails along the bottom, always odd so one is in the middle
+    static constexpr int MaxStripCount = 63;
+    static constexpr int StripSlotWidth = 40;   // Width the view gives each thumbnail of the timeline [px]
+    static constexpr size_t MaxQuads = MaxStripCount + 1;
+    static constexpr uint64_t MaxUploads = 32;  // Thumbnails uploaded per frame, e.g. after a new pool
+
+    void upload(uint64_t index);
+    void addThumbnail(uint64_t index, float x0, float y0, float x1, float y1, const GLfloat *color);
+
+private:
+    bool initialized_;
+    Source source_;
+    QOpenGLShaderProgram program_;
+    QOpenGLBuffer vertexBuffer_;
+    std::array<std::unique_ptr<QOpenGLTexture>, 3> atlases_;
+    int attributeVertex_;
+    int attributeTexture_;
+    int attributeColor_;
+    std::array<int, 3> uniformPlanes_;
+
+    // Thumbnails of the pool the position was last read from, slots are placed in rows across the atlas
+    Position position_;
+    const ThumbnailRing *ring_;
+    std::vector<uint64_t> atlasIndex_;  // Thumbnail each slot of the atlas holds, ThumbnailRing::InvalidIndex if none
+    uint64_t uploaded_;                 // Thumbnails before this index are in the atlas or were overwritten
+    unsigned int thumbnailWidth_;
+    unsigned int thumbnailHeight_;
+    unsigned int columns_;
+
+    std::unique_ptr<Vertex[]> vertices_;
+    size_t quads_;
+    int width_;
+    int height_;
+};
+
+#endif // THUMBNAIL_STRIP_H
@@ -1,22 +1,17 @@
 #ifndef CSICAMVIEW_H
 #define CSICAMVIEW_H
 
-#include <array>
-#include <memory>
-
 #include "util/undefkeywords.h"
 #include <libcamera/formats.h>
 
 #include <QOpenGLWidget>
-#include <QOpenGLFunctions>
-#include <QOpenGLBuffer>
-#include <QOpenGLShaderProgram>
-#include <QOpenGLTexture>
+#include <QTimer>
 
-class Image;
-class PooledFrame;
+#include "cam/framemailbox.h"
+#include "cam/framerenderer.h"
 
-class ViewFinder : public QOpenGLWidget, protected QOpenGLFunctions
+// Shows frames in the GUI thread, painted by the widget compositor
+class ViewFinder : public QOpenGLWidget
 {
     Q_OBJECT
 
@@ -24,55 +19,40 @@ public:
     ViewFinder(QWidget *parent);
     ~ViewFinder();
 
-private:
-    friend class Application;
+public:
     void setFormat(const libcamera::PixelFormat &format, const QSize &size, uint stride);
-    void render(const PooledFrame *frame);
+
+    // Show a frame, optionally cross-faded to the next one, called from the capture thread
+    void post(const std::shared_ptr<const FramePool> &pool, const PooledFrame *frame, quint64 sequence,
+              const PooledFrame *next, quint64 nextSequence, float blend);
+
+    // Status overlay, the source is called while painting
+    void setHudSource(HudOverlay::Source source) { renderer_.setHudSource(std::move(source)); }
+    void setHudVisible(bool visible);
+
+    // Scrub timeline, the source is called while painting
+    void setScrubSource(ThumbnailStrip::Source source) { renderer_.setScrubSource(std::move(source)); }
+
+Q_SIGNALS:
+    // The swap of the first frame finished, for the startup profile
+    void firstFramePresented();
 
 protected:
     void initializeGL() override;
     void paintGL() override;
-    void resizeGL(int w, int h) override;
     QSize sizeHint() const override;
 
-private:
-    bool selectFormat(const libcamera::PixelFormat &format);
-    void configureTexture(QOpenGLTexture &texture);
-    bool createFragmentShader();
-    bool createVertexShader();
-    void removeShader();
-    void doRender();
+private Q_SLOTS:
+    void framePresented();
 
 private:
-    // Sizes and buffers
-    QSize size_;
-    uint stride_;
-    const PooledFrame *frame_;
-    libcamera::PixelFormat format_;
-
-    // Shaders
-    QOpenGLShaderProgram shaderProgram_;
-    std::unique_ptr<QOpenGLShader> vertexShader_;
-    std::unique_ptr<QOpenGLShader> fragmentShader_;
-    QString vertexShaderFile_;
-    QString fragmentShaderFile_;
-    QStringList fragmentShaderDefines_;
-
-    // Vertex buffer and textures
-    QOpenGLBuffer vertexBuffer_;
-    std::array<std::unique_ptr<QOpenGLTexture>, 3> textures_;
-
-    // Common texture parameters
-    GLuint textureMinMagFilters_;
-
-    // YUV texture parameters
-    GLuint textureUniformU_;
-    GLuint textureUniformV_;
-    GLuint textureUniformY_;
-    GLuint textureUniformStep_;
-    GLuint textureUniformStrideFactor_;
-    unsigned int horzSubSample_;
-    unsigned int vertSubSample_;
+    FrameRenderer renderer_;
+    FrameMailbox mailbox_;          // Latest frame posted by the capture thread
+    FrameMailbox::Entry shown_;     // Frame uploaded by the last paint, holds its pool until the swap is done
+    bool swapPending_;
+    bool firstPresented_;
+    bool hudVisible_;
+    QTimer hudTimer_;               // Repaints the overlay while no frames arrive, e.g. frozen
 };
 
 #endif // CSICAMVIEW_H
@@ -0,0 +1,36 @@
+#include "input/buttoninput.h"
+
+#include <ctime>
+
+uint64_t ButtonInput::monotonicNs()
+{
+    // Same clock as the sensor timestamps
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+bool ButtonInput::setPressed(bool pressed, uint64_t timestamp)
+{
+    // Only real changes outside of the debounce window count
+    if (pressed == pressed_.load(std::memory_order_relaxed) || debounceRemaining(timestamp) > 0)
+        return false;
+    lastEdge_ = timestamp;
+
+    // Publish the press time before the state, readers check the state first
+    if (pressed) {
+        lastPress_.store(timestamp, std::memory_order_release);
+        pressCount_.fetch_add(1, std::memory_order_release);
+    }
+    pressed_.store(pressed, std::memory_order_release);
+    if (pressed && pressCallback_)
+        pressCallback_();
+    return true;
+}
+
+uint64_t ButtonInput::debounceRemaining(uint64_t timestamp) const
+{
+    if (lastEdge_ == 0 || timestamp >= lastEdge_ + debounceNs_)
+        return 0;
+    return lastEdge_ + debounceNs_ - timestamp;
+}
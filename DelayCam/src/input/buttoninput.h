@@ -0,0 +1,44 @@
+#ifndef BUTTON_INPUT_H
+#define BUTTON_INPUT_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// State of the realtime button, updated by edge events on an input thread
+// Capture threads only read the atomic state, so the GPIO is never touched per frame.
+class ButtonInput
+{
+public:
+    virtual ~ButtonInput() = default;
+
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+
+    // Ignore edges closer than this to the last accepted one
+    void setDebounce(int milliseconds) { debounceNs_ = static_cast<uint64_t>(milliseconds) * 1000000; }
+
+    // Called on the input thread right after a press was accepted
+    void setPressCallback(std::function<void()> callback) { pressCallback_ = callback; }
+
+    bool isPressed() const { return pressed_.load(std::memory_order_acquire); }
+    uint64_t pressCount() const { return pressCount_.load(std::memory_order_acquire); }
+    uint64_t lastPressTime() const { return lastPress_.load(std::memory_order_acquire); } // Monotonic [ns]
+
+    static uint64_t monotonicNs();
+
+protected:
+    // Feed a level change, returns false if it was a bounce
+    bool setPressed(bool pressed, uint64_t timestamp);
+    uint64_t debounceRemaining(uint64_t timestamp) const;
+
+private:
+    std::atomic<bool> pressed_{false};
+    std::atomic<uint64_t> pressCount_{0};
+    std::atomic<uint64_t> lastPress_{0};
+    uint64_t lastEdge_ = 0;
+    uint64_t debounceNs_ = 20000000;
+    std::function<void()> pressCallback_;
+};
+
+#endif // BUTTON_INPUT_H
@@ -0,0 +1,70 @@
+#include "input/gpiobutton.h"
+#include "util/logger.h"
+#include "wiringPi.h"
+
+#include <ctime>
+
+std::atomic<GpioButton *> GpioButton::instance_{nullptr};
+
+GpioButton::GpioButton(int pin) :
+    pin_(pin)
+{
+}
+
+GpioButton::~GpioButton()
+{
+    stop();
+}
+
+bool GpioButton::start()
+{
+    // Only one button can receive interrupts
+    GpioButton *expected = nullptr;
+    if (!instance_.compare_exchange_strong(expected, this)) {
+        dcError("Only one GPIO button is supported");
+        return false;
+    }
+
+    // Input with pull-up, pressed pulls the pin low
+    wiringPiSetupGpio();
+    pinMode(pin_, INPUT);
+    pullUpDnControl(pin_, PUD_UP);
+    setPressed(digitalRead(pin_) == LOW, monotonicNs());
+
+    // Get notified about both edges instead of polling
+    if (wiringPiISR(pin_, INT_EDGE_BOTH, &GpioButton::interrupt) < 0) {
+        dcError(QString("Failed to watch GPIO %1 for edges").arg(pin_));
+        instance_ = nullptr;
+        return false;
+    }
+    dcInfo(QString("Watching GPIO %1 for button presses").arg(pin_));
+    return true;
+}
+
+void GpioButton::stop()
+{
+    // wiringPi can't remove the handler, it just stops forwarding edges
+    GpioButton *expected = this;
+    instance_.compare_exchange_strong(expected, nullptr);
+}
+
+void GpioButton::interrupt()
+{
+    GpioButton *button = instance_.load();
+    if (button)
+        button->handleEdge();
+}
+
+void GpioButton::handleEdge()
+{
+    // The first edge is taken right away, bounces after it are waited out
+    // and the level is read again once the contact settled
+    uint64_t timestamp = monotonicNs();
+    uint64_t wait = debounceRemaining(timestamp);
+    if (wait > 0) {
+        struct timespec ts = { static_cast<time_t>(wait / 1000000000ULL), static_cast<long>(wait % 1000000000ULL) };
+        nanosleep(&ts, nullptr);
+        timestamp = monotonicNs();
+    }
+    setPressed(digitalRead(pin_) == LOW, timestamp);
+}
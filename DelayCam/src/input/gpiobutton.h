@@ -0,0 +1,25 @@
+#ifndef GPIO_BUTTON_H
+#define GPIO_BUTTON_H
+
+#include "input/buttoninput.h"
+
+// Button between a GPIO and ground, using the internal pull-up
+// wiringPi calls the interrupt handler on its own thread for both edges.
+class GpioButton : public ButtonInput
+{
+public:
+    GpioButton(int pin);
+    ~GpioButton();
+
+    bool start() override;
+    void stop() override;
+
+private:
+    static void interrupt();
+    void handleEdge();
+
+    static std::atomic<GpioButton *> instance_; // wiringPi handlers have no context
+    int pin_;
+};
+
+#endif // GPIO_BUTTON_H
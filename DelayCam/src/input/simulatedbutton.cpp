@@ -0,0 +1,58 @@
+#include "input/simulatedbutton.h"
+#include "util/logger.h"
+
+#include <chrono>
+
+SimulatedButton::SimulatedButton(int interval, int holdTime) :
+    interval_(interval),
+    holdTime_(holdTime)
+{
+}
+
+SimulatedButton::~SimulatedButton()
+{
+    stop();
+}
+
+bool SimulatedButton::start()
+{
+    stop();
+    stopping_ = false;
+    thread_ = std::thread(&SimulatedButton::run, this);
+    dcInfo(QString("Simulating a button press every %1ms").arg(interval_));
+    return true;
+}
+
+void SimulatedButton::stop()
+{
+    if (!thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    stopCondition_.notify_all();
+    thread_.join();
+}
+
+bool SimulatedButton::sleep(int milliseconds)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return !stopCondition_.wait_for(lock, std::chrono::milliseconds(milliseconds), [this]() { return stopping_; });
+}
+
+void SimulatedButton::run()
+{
+    while (sleep(interval_)) {
+        // A press followed by a few bounces, which the debounce has to swallow
+        setPressed(true, monotonicNs());
+        for (int bounce = 0; bounce < 3; bounce++) {
+            setPressed(bounce % 2 == 1, monotonicNs());
+            if (!sleep(1))
+                return;
+        }
+        if (!sleep(holdTime_))
+            return;
+        setPressed(false, monotonicNs());
+    }
+}
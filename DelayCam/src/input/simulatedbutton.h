@@ -0,0 +1,33 @@
+#ifndef SIMULATED_BUTTON_H
+#define SIMULATED_BUTTON_H
+
+#include "input/buttoninput.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Presses the button periodically, including contact bounce
+// Used to measure the latency from a press to the first realtime frame without hardware.
+class SimulatedButton : public ButtonInput
+{
+public:
+    SimulatedButton(int interval, int holdTime);
+    ~SimulatedButton();
+
+    bool start() override;
+    void stop() override;
+
+private:
+    void run();
+    bool sleep(int milliseconds);   // Returns false if stopped meanwhile
+
+    int interval_;   // Time between presses [ms]
+    int holdTime_;   // Time the button is held [ms]
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable stopCondition_;
+    bool stopping_ = false;
+};
+
+#endif // SIMULATED_BUTTON_H
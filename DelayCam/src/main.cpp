@@ -4,8 +4,8 @@
 
 int main(int argc, char *argv[])
 {
-    // Initialize logger
-    dcLogger->init(LogLevel::TRACE, "delaycam.log");
+    // Initialize logger, the level can be changed in the settings
+    dcLogger->init(LogLevel::INFO, "delaycam.log");
     dcInfo("Starting DelayCam");
 
     // Configure OpenGL ES 2.0 as the renderable type
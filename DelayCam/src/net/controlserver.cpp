@@ -0,0 +1,314 @@
+#include "net/controlserver.h"
+#include "cam/camerasession.h"
+#include "util/logger.h"
+
+#include <algorithm>
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QDir>
+
+ControlServer::ControlServer(const std::vector<CameraSession *> &sessions, QObject *parent) :
+    QObject(parent),
+    server_(nullptr),
+    sessions_(sessions),
+    statsTimer_(this),
+    periodRequests_(0),
+    periodTimeSum_(0),
+    periodTimeMax_(0)
+{
+    // Report handling times every 5s like the other statistics
+    statsTimer_.setInterval(5000);
+    connect(&statsTimer_, &QTimer::timeout, this, &ControlServer::reportStats);
+}
+
+ControlServer::~ControlServer()
+{
+    close();
+}
+
+bool ControlServer::listen(const QString &path)
+{
+    // Create server in the thread this object lives in
+    if (server_ == nullptr) {
+        server_ = new QLocalServer(this);
+        server_->setSocketOptions(QLocalServer::UserAccessOption);
+        connect(server_, &QLocalServer::newConnection, this, &ControlServer::acceptClients);
+    }
+
+    // A socket left behind by a crash blocks the path, one that still accepts connections is in use
+    bool listening = server_->listen(path);
+    if (!listening && server_->serverError() == QAbstractSocket::AddressInUseError) {
+        QLocalSocket probe;
+        probe.connectToServer(path);
+        if (probe.waitForConnected(100)) {
+            dcWarning("Control socket " + path + " is in use by another process");
+            return false;
+        }
+        QLocalServer::removeServer(path);
+        listening = server_->listen(path);
+    }
+    if (!listening) {
+        dcWarning("Failed to start control server: " + server_->errorString());
+        return false;
+    }
+    dcInfo("Control socket at " + server_->fullServerName());
+    statsTimer_.start();
+    return true;
+}
+
+void ControlServer::close()
+{
+    // Disconnect all clients and remove the socket
+    statsTimer_.stop();
+    if (server_ == nullptr)
+        return;
+    for (QLocalSocket *socket : server_->findChildren<QLocalSocket *>()) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+    }
+    server_->close();
+}
+
+void ControlServer::acceptClients()
+{
+    while (server_->hasPendingConnections()) {
+        QLocalSocket *socket = server_->nextPendingConnection();
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { readRequests(socket); });
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+    }
+}
+
+void ControlServer::readRequests(QLocalSocket *socket)
+{
+    // Answer every complete line, pipelined requests are answered in one write
+    QByteArray responses;
+    bool tooLong = false;
+    while (socket->canReadLine()) {
+        QElapsedTimer timer;
+        timer.start();
+
+        // A line without its newline was cut at the limit
+        QByteArray line = socket->readLine(MaxRequest + 1);
+        if (!line.endsWith('\n')) {
+            tooLong = true;
+            break;
+        }
+        line = line.trimmed();
+        if (line.isEmpty())
+            continue;
+
+        // Parse and handle
+        QJsonParseError error;
+        QJsonDocument document = QJsonDocument::fromJson(line, &error);
+        QJsonObject response;
+        if (!document.isObject())
+            response = QJsonObject{ {"ok", false}, {"error", "Invalid request: " + error.errorString()} };
+        else {
+            response = handle(document.object());
+            if (document.object().contains("id"))
+                response["id"] = document.object().value("id");
+        }
+        const double time = timer.nsecsElapsed() / 1e3;
+        response["us"] = time;
+        responses += QJsonDocument(response).toJson(QJsonDocument::Compact) + '\n';
+        periodRequests_++;
+        periodTimeSum_ += time;
+        periodTimeMax_ = std::max(periodTimeMax_, time);
+    }
+
+    // A client not sending lines is not speaking the protocol, it gets an error and is disconnected
+    // once the responses so far are written
+    if (tooLong || socket->bytesAvailable() > MaxRequest) {
+        dcWarning("Control request too long, closing the connection");
+        responses += QJsonDocument(QJsonObject{ {"ok", false}, {"error", "Request too long"} })
+            .toJson(QJsonDocument::Compact) + '\n';
+        socket->disconnect(this);
+        socket->write(responses);
+        socket->disconnectFromServer();
+        return;
+    }
+    if (!responses.isEmpty())
+        socket->write(responses);
+}
+
+QJsonObject ControlServer::handle(const QJsonObject &request)
+{
+    // All cameras unless one is selected
+    const QString command = request.value("command").toString();
+    const int camera = request.value("camera").toInt(-1);
+    if (camera >= static_cast<int>(sessions_.size()))
+        return QJsonObject{ {"ok", false}, {"error", "No such camera"} };
+    auto forSessions = [this, camera](auto function) {
+        for (size_t i = 0; i < sessions_.size(); i++)
+            if (camera < 0 || static_cast<size_t>(camera) == i)
+                QMetaObject::invokeMethod(sessions_[i], [session = sessions_[i], function]() { function(session); },
+                    Qt::QueuedConnection);
+    };
+
+    if (command == "status")
+        return status(camera);
+
+    if (command == "activity") {
+        const double seconds = request.value("seconds").toDouble(30);
+        const int threshold = request.value("motion").toInt(16);
+        if (seconds <= 0 || threshold < 0 || threshold > 255)
+            return QJsonObject{ {"ok", false}, {"error", "seconds must be positive and motion within 0-255"} };
+        return activity(camera, seconds, threshold);
+    }
+
+    if (command == "delay") {
+        const double seconds = request.value("seconds").toDouble();
+        if (seconds <= 0 || seconds > 3600)
+            return QJsonObject{ {"ok", false}, {"error", "Delay must be within 0-3600s"} };
+        Q_EMIT delayRequested(seconds);
+        return QJsonObject{ {"ok", true} };
+    }
+
+    if (command == "realtime" || command == "freeze") {
+        if (!request.value("enabled").isBool())
+            return QJsonObject{ {"ok", false}, {"error", "enabled must be true or false"} };
+        const bool enabled = request.value("enabled").toBool();
+        if (command == "realtime")
+            forSessions([enabled](CameraSession *session) { session->setRealtime(enabled); });
+        else forSessions([enabled](CameraSession *session) { session->setFrozen(enabled); });
+        return QJsonObject{ {"ok", true} };
+    }
+
+    if (command == "hud") {
+        if (!request.value("enabled").isBool())
+            return QJsonObject{ {"ok", false}, {"error", "enabled must be true or false"} };
+        Q_EMIT hudRequested(request.value("enabled").toBool());
+        return QJsonObject{ {"ok", true} };
+    }
+
+    if (command == "replay") {
+        const float seconds = request.value("seconds").toDouble();
+        if (seconds <= 0)
+            return QJsonObject{ {"ok", false}, {"error", "seconds must be positive"} };
+        forSessions([seconds](CameraSession *session) { session->replay(seconds); });
+        return QJsonObject{ {"ok", true} };
+    }
+
+    if (command == "scrub") {
+        // Every position moves the timeline, the stored frame is shown once it rests
+        if (request.value("enabled").isBool() && !request.value("enabled").toBool()) {
+            forSessions([](CameraSession *session) { session->endScrub(); });
+            return QJsonObject{ {"ok", true} };
+        }
+        const float seconds = request.value("seconds").toDouble(-1);
+        if (seconds < 0)
+            return QJsonObject{ {"ok", false}, {"error", "seconds must not be negative, or enabled false to stop"} };
+        forSessions([seconds](CameraSession *session) { session->scrub(seconds); });
+        return QJsonObject{ {"ok", true} };
+    }
+
+    if (command == "save") {
+        // One raw file per camera, written in the background
+        const float seconds = request.value("seconds").toDouble(10);
+        if (seconds <= 0)
+            return QJsonObject{ {"ok", false}, {"error", "seconds must be positive"} };
+        QString path = request.value("path").toString();
+        if (path.isEmpty())
+            path = QDir::homePath() + "/delaycam-" + QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") + ".yuv";
+        QJsonArray paths;
+        for (size_t i = 0; i < sessions_.size(); i++) {
+            if (camera >= 0 && static_cast<size_t>(camera) != i)
+                continue;
+            QString file = camera < 0 && i > 0 ? path + "." + QString::number(i) : path;
+            Q_EMIT saveRequested(static_cast<int>(i), seconds, file);
+            paths.append(file);
+        }
+        return QJsonObject{ {"ok", true}, {"paths", paths} };
+    }
+
+    return QJsonObject{ {"ok", false}, {"error", "Unknown command: " + command} };
+}
+
+QJsonObject ControlServer::status(int camera) const
+{
+    // Statistics the capture threads publish with every frame
+    QJsonArray cameras;
+    for (size_t i = 0; i < sessions_.size(); i++) {
+        if (camera >= 0 && static_cast<size_t>(camera) != i)
+            continue;
+        const CameraSession::Stats stats = sessions_[i]->stats();
+        cameras.append(QJsonObject{
+            {"name", sessions_[i]->name()},
+            {"frames", static_cast<qint64>(stats.frames)},
+            {"fps", stats.frameRate},
+            {"latency", stats.latencyAvg},
+            {"drops", static_cast<qint64>(stats.drops)},
+            {"dropsPerMinute", static_cast<qint64>(stats.dropsPerMinute)},
+            {"concealed", static_cast<qint64>(stats.concealed)},
+            {"poolSize", static_cast<qint64>(stats.poolSize)},
+            {"poolCapacity", static_cast<qint64>(stats.poolCapacity)},
+            {"delay", stats.delay},
+            {"delayTarget", stats.delayTarget},
+            {"delayError", stats.poolSize == stats.poolCapacity ? stats.delay - stats.delayTarget : 0},
+            {"realtime", stats.realtime},
+            {"frozen", stats.frozen},
+            {"replaying", stats.replaying},
+            {"scrubbing", stats.scrubbing},
+        });
+    }
+    return QJsonObject{ {"ok", true}, {"cameras", cameras} };
+}
+
+void ControlServer::reportStats()
+{
+    // Only log if there was something to handle
+    if (periodRequests_ == 0)
+        return;
+    dcInfo(QString("Control: %1 requests, handled in avg %2us max %3us")
+        .arg(periodRequests_).arg(periodTimeSum_ / periodRequests_, 0, 'f', 1).arg(periodTimeMax_, 0, 'f', 1));
+    periodRequests_ = 0;
+    periodTimeSum_ = 0;
+    periodTimeMax_ = 0;
+}
+
+QJsonObject ControlServer::activity(int camera, double seconds, int threshold) const
+{
+    // Read from the activity index while the capture goes on, the frames themselves are never touched
+    QJsonArray cameras;
+    for (size_t i = 0; i < sessions_.size(); i++) {
+        if (camera >= 0 && static_cast<size_t>(camera) != i)
+            continue;
+        QJsonObject result{ {"name", sessions_[i]->name()} };
+        std::shared_ptr<const FramePool> pool = sessions_[i]->pool();
+        CaptureMetadata latest;
+        if (!pool || !pool->isAnalyzed() || !pool->getLatestAnalyzed(latest)) {
+            result["analyzed"] = false;
+            cameras.append(result);
+            continue;
+        }
+
+        // Spans are given in seconds before the newest analyzed frame
+        const uint64_t window = static_cast<uint64_t>(seconds * 1e9);
+        const uint64_t since = latest.timestamp > window ? latest.timestamp - window : 0;
+        QJsonArray spans;
+        for (const FramePool::MotionSpan &span : pool->findMotion(since, static_cast<uint8_t>(threshold)))
+            spans.append(QJsonObject{
+                {"start", (latest.timestamp - span.start) / 1e9},
+                {"end", (latest.timestamp - span.end) / 1e9},
+                {"peak", span.peak},
+                {"frames", static_cast<qint64>(span.frames)},
+            });
+        QJsonArray histogram;
+        for (uint8_t bin : latest.activity.histogram)
+            histogram.append(bin);
+        result["analyzed"] = true;
+        result["mean"] = latest.activity.mean;
+        result["motion"] = latest.activity.motion;
+        result["activeBlocks"] = latest.activity.activeBlocks;
+        result["histogram"] = histogram;
+        result["spans"] = spans;
+        cameras.append(result);
+    }
+    return QJsonObject{ {"ok", true}, {"cameras", cameras} };
+}
@@ -0,0 +1,64 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <vector>
+
+#include "util/undefkeywords.h"
+
+#include <QObject>
+#include <QTimer>
+#include <QString>
+#include <QJsonObject>
+
+class QLocalServer;
+class QLocalSocket;
+class CameraSession;
+
+// Local control API on a Unix domain socket, served in its own thread
+// Every request is a JSON object on one line and gets exactly one line back, in order:
+//   {"id": 1, "command": "status"}  ->  {"id": 1, "ok": true, "cameras": [...], "us": 12.5}
+// Commands: status, activity, delay, realtime, freeze, replay, scrub, save and hud, see the README.
+// Session commands are queued to the capture threads and run between two frames,
+// delay, save and hud are handed to the GUI thread, so no request blocks the server or the capture.
+class ControlServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr qint64 MaxRequest = 4096;  // Longer lines close the connection [bytes]
+
+    ControlServer(const std::vector<CameraSession *> &sessions, QObject *parent = nullptr);
+    ~ControlServer();
+
+public Q_SLOTS:
+    bool listen(const QString &path);
+    void close();
+
+Q_SIGNALS:
+    // Emitted in the server thread, handled in the GUI thread
+    void delayRequested(float seconds);
+    void saveRequested(int camera, float seconds, const QString &path);
+    void hudRequested(bool visible);
+
+private Q_SLOTS:
+    void acceptClients();
+    void reportStats();
+
+private:
+    void readRequests(QLocalSocket *socket);
+    QJsonObject handle(const QJsonObject &request);
+    QJsonObject status(int camera) const;
+    QJsonObject activity(int camera, double seconds, int threshold) const;
+
+private:
+    QLocalServer *server_;
+    std::vector<CameraSession *> sessions_;
+    QTimer statsTimer_;
+
+    // Requests and their handling time since the last report [us]
+    uint64_t periodRequests_;
+    double periodTimeSum_;
+    double periodTimeMax_;
+};
+
+#endif // CONTROLSERVER_H
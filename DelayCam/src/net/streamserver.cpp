@@ -0,0 +1,339 @@
+#include "net/streamserver.h"
+#include "cam/framepool.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QMutexLocker>
+#include <QImage>
+#include <QBuffer>
+#include <QImageWriter>
+
+static const char *boundary = "delaycamframe";
+
+static inline uint8_t clamp8(int value)
+{
+    return static_cast<uint8_t>(std::clamp(value, 0, 255));
+}
+
+StreamServer::StreamServer(QObject *parent) :
+    QObject(parent),
+    server_(nullptr),
+    statsTimer_(this),
+    tapActive_{false, false},
+    realtimeEnabled_(false),
+    stride_(0),
+    frameInterval_(100),
+    quality_(75),
+    maxPending_(0)
+{
+    // Report per-client statistics every 5s
+    statsTimer_.setInterval(5000);
+    connect(&statsTimer_, &QTimer::timeout, this, &StreamServer::reportStats);
+    clock_.start();
+}
+
+StreamServer::~StreamServer()
+{
+    close();
+}
+
+void StreamServer::setFormat(const libcamera::PixelFormat &format, const QSize &size, uint stride)
+{
+    QMutexLocker locker(&stagingMutex_);
+    format_ = format;
+    size_ = size;
+    stride_ = stride;
+
+    // Only planar and semi planar 4:2:0 formats can be converted
+    if (format != libcamera::formats::YUV420 && format != libcamera::formats::YVU420 &&
+        format != libcamera::formats::NV12 && format != libcamera::formats::NV21)
+        dcWarning(QString("Streaming not supported for format ") + format.toString().c_str());
+}
+
+void StreamServer::setFrameRate(float frameRate)
+{
+    // Read by pushFrame() in the capture threads
+    QMutexLocker locker(&stagingMutex_);
+    frameInterval_ = frameRate > 0 ? static_cast<qint64>(1000 / frameRate) : 0;
+}
+
+void StreamServer::setQuality(int quality)
+{
+    quality_ = std::clamp(quality, 1, 100);
+}
+
+void StreamServer::pushFrame(Tap tap, const PooledFrame *frame)
+{
+    if (frame == nullptr)
+        return;
+
+    // Skip if no one is watching, the encoder is busy or the tap is throttled
+    QMutexLocker locker(&stagingMutex_);
+    int index = static_cast<int>(tap);
+    Staging &staging = staging_[index];
+    qint64 now = clock_.elapsed();
+    if (!tapActive_[index] || staging.busy)
+        return;
+    if (staging.lastPush >= 0 && now - staging.lastPush < frameInterval_)
+        return;
+
+    // Copy planes into the staging buffer (allocates only on first use)
+    size_t totalSize = 0;
+    staging.numPlanes = std::min<unsigned int>(frame->numPlanes(), staging.offsets.size());
+    for (unsigned int plane = 0; plane < staging.numPlanes; plane++) {
+        staging.offsets[plane] = totalSize;
+        totalSize += frame->data(plane).size();
+    }
+    staging.data.resize(totalSize);
+    for (unsigned int plane = 0; plane < staging.numPlanes; plane++) {
+        libcamera::Span<const uint8_t> src = frame->data(plane);
+        std::memcpy(staging.data.data() + staging.offsets[plane], src.data(), src.size());
+    }
+    staging.format = format_;
+    staging.size = size_;
+    staging.stride = stride_;
+
+    // Hand buffer over to the encoder thread
+    staging.busy = true;
+    staging.lastPush = now;
+    staging.captureTime = now;
+    locker.unlock();
+    QMetaObject::invokeMethod(this, "encodeFrame", Qt::QueuedConnection, Q_ARG(int, index));
+}
+
+bool StreamServer::listen(const QString &address, quint16 port)
+{
+    // Create server in the thread this object lives in
+    if (server_ == nullptr) {
+        server_ = new QTcpServer(this);
+        connect(server_, &QTcpServer::newConnection, this, &StreamServer::acceptClients);
+    }
+
+    // Start listening
+    if (!server_->listen(QHostAddress(address), port)) {
+        dcWarning("Failed to start stream server: " + server_->errorString());
+        return false;
+    }
+    dcInfo(QString("Streaming on http://%1:%2/delayed").arg(address).arg(port));
+    statsTimer_.start();
+    return true;
+}
+
+void StreamServer::close()
+{
+    // Disconnect all clients and stop listening
+    statsTimer_.stop();
+    for (Client *client : clients_) {
+        client->socket->disconnect(this);
+        client->socket->abort();
+        client->socket->deleteLater();
+        delete client;
+    }
+    clients_.clear();
+    if (server_)
+        server_->close();
+
+    QMutexLocker locker(&stagingMutex_);
+    tapActive_.fill(false);
+}
+
+void StreamServer::acceptClients()
+{
+    while (server_->hasPendingConnections()) {
+        QTcpSocket *socket = server_->nextPendingConnection();
+        Client *client = new Client;
+        client->socket = socket;
+        clients_.push_back(client);
+
+        // Parse request once it arrives, track written bytes and disconnects
+        connect(socket, &QTcpSocket::readyRead, this, [this, client]() { readRequest(client); });
+        connect(socket, &QTcpSocket::bytesWritten, this, [this, client](qint64 bytes) { updateWritten(client, bytes); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() { removeClient(socket); });
+    }
+}
+
+void StreamServer::readRequest(Client *client)
+{
+    // Wait for the end of the request header
+    if (client->streaming || !client->socket->canReadLine())
+        return;
+
+    // Select tap from request line, e.g. "GET /realtime HTTP/1.1"
+    QByteArray requestLine = client->socket->readLine();
+    QList<QByteArray> parts = requestLine.split(' ');
+    QByteArray path = parts.size() > 1 ? parts.at(1) : QByteArray("/");
+    if (path == "/realtime" && realtimeEnabled_)
+        client->tap = Tap::Realtime;
+    else if (path == "/" || path == "/delayed")
+        client->tap = Tap::Delayed;
+    else {
+        client->socket->write("HTTP/1.0 404 Not Found\r\n\r\n");
+        client->socket->disconnectFromHost();
+        return;
+    }
+
+    // Answer with a multipart response, frames follow as they are encoded
+    client->socket->readAll();
+    client->socket->write(QByteArray("HTTP/1.0 200 OK\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: close\r\n"
+        "Content-Type: multipart/x-mixed-replace; boundary=") + boundary + "\r\n\r\n");
+    client->streaming = true;
+    dcInfo(QString("Stream client %1 connected to %2").arg(client->socket->peerAddress().toString(), QString::fromUtf8(path)));
+
+    QMutexLocker locker(&stagingMutex_);
+    tapActive_[static_cast<int>(client->tap)] = true;
+}
+
+void StreamServer::removeClient(QTcpSocket *socket)
+{
+    auto it = std::find_if(clients_.begin(), clients_.end(), [socket](Client *c) { return c->socket == socket; });
+    if (it == clients_.end())
+        return;
+
+    // Delete client and socket
+    dcInfo(QString("Stream client %1 disconnected").arg(socket->peerAddress().toString()));
+    socket->disconnect(this);
+    delete *it;
+    clients_.erase(it);
+    socket->deleteLater();
+
+    // Deactivate taps without clients
+    QMutexLocker locker(&stagingMutex_);
+    tapActive_[static_cast<int>(Tap::Delayed)] = hasClients(Tap::Delayed);
+    tapActive_[static_cast<int>(Tap::Realtime)] = hasClients(Tap::Realtime);
+}
+
+void StreamServer::updateWritten(Client *client, qint64 bytes)
+{
+    // Frames whose last byte has been written are complete, measure their lag
+    client->bytesWritten += bytes;
+    client->bytesSinceReport += bytes;
+    qint64 now = clock_.elapsed();
+    while (!client->pending.empty() && client->pending.front().first <= client->bytesWritten) {
+        qint64 lag = now - client->pending.front().second;
+        client->lagSum += lag;
+        client->lagCount++;
+        client->lagMax = std::max(client->lagMax, lag);
+        client->pending.pop_front();
+    }
+}
+
+bool StreamServer::hasClients(Tap tap) const
+{
+    return std::any_of(clients_.begin(), clients_.end(), [tap](const Client *c) { return c->streaming && c->tap == tap; });
+}
+
+void StreamServer::encodeFrame(int tap)
+{
+    // The staging buffer is owned by us while busy is set
+    Staging &staging = staging_[tap];
+    QByteArray jpeg = encodeJpeg(staging);
+    qint64 captureTime = staging.captureTime;
+    {
+        QMutexLocker locker(&stagingMutex_);
+        staging.busy = false;
+    }
+    if (jpeg.isEmpty())
+        return;
+
+    // Allow roughly two frames in flight per client before dropping
+    maxPending_ = jpeg.size() * 2;
+    QByteArray header = QByteArray("--") + boundary +
+        "\r\nContent-Type: image/jpeg\r\nContent-Length: " + QByteArray::number(jpeg.size()) + "\r\n\r\n";
+
+    // Fan out the same encoded frame to all clients of this tap
+    // A slow client only drops its own frames and never stalls the others
+    for (Client *client : clients_) {
+        if (!client->streaming || static_cast<int>(client->tap) != tap)
+            continue;
+        if (client->socket->bytesToWrite() > maxPending_) {
+            client->framesDropped++;
+            continue;
+        }
+        client->socket->write(header);
+        client->socket->write(jpeg);
+        client->socket->write("\r\n");
+        client->bytesQueued += header.size() + jpeg.size() + 2;
+        client->pending.emplace_back(client->bytesQueued, captureTime);
+        client->framesSinceReport++;
+    }
+}
+
+QByteArray StreamServer::encodeJpeg(const Staging &staging) const
+{
+    // Check if the format can be converted, the geometry was copied with the frame
+    const libcamera::PixelFormat &format = staging.format;
+    const QSize &size = staging.size;
+    const uint stride = staging.stride;
+    bool semiPlanar = format == libcamera::formats::NV12 || format == libcamera::formats::NV21;
+    bool planar = format == libcamera::formats::YUV420 || format == libcamera::formats::YVU420;
+    if ((!semiPlanar && !planar) || staging.numPlanes < (planar ? 3u : 2u) || !size.isValid())
+        return QByteArray();
+
+    // Get plane pointers, swap chroma planes if needed
+    const uint8_t *y = staging.data.data() + staging.offsets[0];
+    const uint8_t *u = staging.data.data() + staging.offsets[1];
+    const uint8_t *v = planar ? staging.data.data() + staging.offsets[2] : u + 1;
+    if (format == libcamera::formats::YVU420 || format == libcamera::formats::NV21)
+        std::swap(u, v);
+    const uint chromaStride = planar ? stride / 2 : stride;
+    const uint chromaStep = planar ? 1 : 2;
+
+    // Convert full range YCbCr 4:2:0 to RGB using fixed point arithmetic
+    QImage image(size, QImage::Format_RGB888);
+    for (int row = 0; row < size.height(); row++) {
+        const uint8_t *yRow = y + row * stride;
+        const uint8_t *uRow = u + (row / 2) * chromaStride;
+        const uint8_t *vRow = v + (row / 2) * chromaStride;
+        uint8_t *dst = image.scanLine(row);
+        for (int col = 0; col < size.width(); col++) {
+            int luma = yRow[col];
+            int cb = uRow[(col / 2) * chromaStep] - 128;
+            int cr = vRow[(col / 2) * chromaStep] - 128;
+            *dst++ = clamp8(luma + ((359 * cr) >> 8));
+            *dst++ = clamp8(luma - ((88 * cb + 183 * cr) >> 8));
+            *dst++ = clamp8(luma + ((454 * cb) >> 8));
+        }
+    }
+
+    // Encode to JPEG
+    QByteArray jpeg;
+    QBuffer buffer(&jpeg);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, "jpeg");
+    writer.setQuality(quality_);
+    if (!writer.write(image)) {
+        dcWarning("Failed to encode stream frame: " + writer.errorString());
+        return QByteArray();
+    }
+    return jpeg;
+}
+
+void StreamServer::reportStats()
+{
+    // Log bitrate, frame rate, lag and drops of every client since the last report
+    const double seconds = statsTimer_.interval() / 1000.0;
+    for (Client *client : clients_) {
+        if (!client->streaming)
+            continue;
+        double mbits = client->bytesSinceReport * 8 / seconds / 1e6;
+        double fps = client->framesSinceReport / seconds;
+        qint64 lagAvg = client->lagCount ? client->lagSum / client->lagCount : 0;
+        dcInfo(QString("Stream client %1 (%2): %3 Mbit/s, %4 fps, lag avg %5ms max %6ms, dropped %7")
+            .arg(client->socket->peerAddress().toString())
+            .arg(client->tap == Tap::Delayed ? "delayed" : "realtime")
+            .arg(mbits, 0, 'f', 2).arg(fps, 0, 'f', 1)
+            .arg(lagAvg).arg(client->lagMax).arg(client->framesDropped));
+        client->bytesSinceReport = 0;
+        client->framesSinceReport = 0;
+        client->lagSum = 0;
+        client->lagCount = 0;
+        client->lagMax = 0;
+    }
+}
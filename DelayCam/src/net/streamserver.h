@@ -0,0 +1,111 @@
+#ifndef STREAMSERVER_H
+#define STREAMSERVER_H
+
+#include <array>
+#include <vector>
+#include <deque>
+
+#include "util/undefkeywords.h"
+#include <libcamera/formats.h>
+
+#include <QObject>
+#include <QSize>
+#include <QMutex>
+#include <QTimer>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+class QTcpServer;
+class QTcpSocket;
+class PooledFrame;
+
+// MJPEG over HTTP server for the delayed and realtime taps
+// Frames are encoded once per tap and fanned out to all clients of that tap.
+// The object is meant to live in its own thread, pushFrame() is called from the capture path.
+class StreamServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Tap {
+        Delayed,
+        Realtime
+    };
+
+    StreamServer(QObject *parent = nullptr);
+    ~StreamServer();
+
+    // The frame rate can be changed from any thread, the quality only in the server thread
+    void setFormat(const libcamera::PixelFormat &format, const QSize &size, uint stride);
+    void setFrameRate(float frameRate);
+
+    // Serve /realtime, set before the server is moved to its thread
+    void setRealtimeEnabled(bool enabled) { realtimeEnabled_ = enabled; }
+
+    // Copy a frame into the staging buffer of the tap and wake the encoder
+    // Returns immediately if the tap has no clients, is throttled or still encoding
+    void pushFrame(Tap tap, const PooledFrame *frame);
+
+public Q_SLOTS:
+    bool listen(const QString &address, quint16 port);
+    void close();
+    void setQuality(int quality);
+
+private Q_SLOTS:
+    void acceptClients();
+    void encodeFrame(int tap);
+    void reportStats();
+
+private:
+    struct Client {
+        QTcpSocket *socket = nullptr;
+        Tap tap = Tap::Delayed;
+        bool streaming = false;
+        qint64 bytesQueued = 0;                      // Total bytes handed to the socket
+        qint64 bytesWritten = 0;                     // Total bytes written to the network
+        qint64 bytesSinceReport = 0;
+        uint framesSinceReport = 0;
+        uint framesDropped = 0;
+        std::deque<std::pair<qint64, qint64>> pending; // End offset of queued frame, capture time [ms]
+        qint64 lagSum = 0;
+        uint lagCount = 0;
+        qint64 lagMax = 0;
+    };
+
+    struct Staging {
+        std::vector<uint8_t> data;        // Copied planes of the frame
+        std::array<size_t, 3> offsets{};  // Offset of each plane in data
+        unsigned int numPlanes = 0;
+        libcamera::PixelFormat format;    // Geometry of the copied frame, setFormat() may change it meanwhile
+        QSize size;
+        uint stride = 0;
+        qint64 captureTime = 0;           // Time the frame was pushed [ms]
+        qint64 lastPush = -1;             // Time of the last push, used for throttling [ms]
+        bool busy = false;                // Set while the encoder owns the buffer
+    };
+
+    void readRequest(Client *client);
+    void removeClient(QTcpSocket *socket);
+    void updateWritten(Client *client, qint64 bytes);
+    bool hasClients(Tap tap) const;
+    QByteArray encodeJpeg(const Staging &staging) const;
+
+private:
+    QTcpServer *server_;
+    QTimer statsTimer_;
+    QElapsedTimer clock_;
+    std::vector<Client *> clients_;
+    std::array<Staging, 2> staging_;
+    std::array<bool, 2> tapActive_;
+    QMutex stagingMutex_; // Protects staging_, tapActive_, frameInterval_ and the format
+    bool realtimeEnabled_;
+
+    libcamera::PixelFormat format_;
+    QSize size_;
+    uint stride_;
+    qint64 frameInterval_;  // Minimum time between two encoded frames [ms]
+    int quality_;
+    qint64 maxPending_;     // Drop frames for a client if more bytes are pending
+};
+
+#endif // STREAMSERVER_H
@@ -1,50 +1,119 @@
 #include "logger.h"
 
-#include <QDateTime>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 
-#define TIMESTAMP QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss")
+#include <QFileInfo>
 
-Logger *Logger::instance_ = nullptr;
+static int64_t wallClock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t encodeUtf8(const QString &message, char *out, uint32_t size)
+{
+    // Convert without allocating, truncated at a character boundary
+    const char16_t *in = reinterpret_cast<const char16_t *>(message.utf16());
+    const qsizetype length = message.size();
+    uint32_t used = 0;
+    for (qsizetype i = 0; i < length; i++) {
+        uint32_t c = in[i];
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < length && in[i + 1] >= 0xdc00 && in[i + 1] < 0xe000)
+            c = 0x10000 + ((c - 0xd800) << 10) + (in[++i] - 0xdc00);
+        const uint32_t bytes = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if (used + bytes > size)
+            break;
+        if (bytes == 1)
+            out[used++] = static_cast<char>(c);
+        else {
+            static const uint8_t lead[] = { 0, 0, 0xc0, 0xe0, 0xf0 };
+            for (uint32_t b = bytes - 1; b > 0; b--)
+                out[used + b] = static_cast<char>(0x80 | (c & 0x3f)), c >>= 6;
+            out[used] = static_cast<char>(lead[bytes] | c);
+            used += bytes;
+        }
+    }
+    return used;
+}
+
+static const char *levelName(LogLevel level)
+{
+    switch (level) {
+    case LogLevel::TRACE   : return " TRACE   ";
+    case LogLevel::DEBUG   : return " DEBUG   ";
+    case LogLevel::INFO    : return " INFO    ";
+    case LogLevel::WARNING : return " WARNING ";
+    case LogLevel::CRITICAL: return " ERROR   ";
+    default: return " LEVEL   ";
+    }
+}
 
 Logger::Logger() :
     level_(LogLevel::WARNING),
-    file_(nullptr),
-    cmdstream_(nullptr),
-    filestream_(nullptr)
+    records_(new Record[QueueSize]),
+    tail_(0),
+    head_(0),
+    dropped_(0),
+    running_(false),
+    sleeping_(false),
+    maxFileSize_(0),
+    maxFiles_(0)
 {
+    // Slot i is free for position i
+    for (size_t i = 0; i < QueueSize; i++)
+        records_[i].sequence.store(i, std::memory_order_relaxed);
 }
 
 Logger *Logger::instance()
 {
-    // Create a new logger if there is none
-    if (instance_ == nullptr)
-        instance_ = new Logger();
-    return instance_;
+    // Created once, never destroyed, so threads can log until the process exits
+    static Logger *instance = new Logger();
+    return instance;
 }
 
-bool Logger::init(LogLevel level, const QString &filepath)
+bool Logger::init(LogLevel level, const QString &filepath, qint64 maxFileSize, int maxFiles)
 {
     // Initialize logger
-    if (file_ == nullptr) {
-        level_ = level;
-        file_ = new QFile(filepath);
-        cmdstream_ = new QTextStream(stdout);
-        filestream_ = new QTextStream(file_);
-        return file_->open(QFile::WriteOnly | QFile::Truncate);
-    } else return false;
+    if (running_)
+        return false;
+    level_ = level;
+    maxFileSize_ = maxFileSize;
+    maxFiles_ = maxFiles;
+    file_.setFileName(filepath);
+
+    // Keep the log of the previous run
+    if (QFileInfo(filepath).isFile() && QFileInfo(filepath).size() > 0)
+        rotate();
+    if (!file_.open(QFile::WriteOnly | QFile::Truncate))
+        return false;
+
+    // Messages logged so far are in the ring and written to the file first, see log()
+    consoleBuffer_.reserve(64 * 1024);
+    fileBuffer_.reserve(64 * 1024);
+    running_ = true;
+    thread_ = std::thread(&Logger::run, this);
+    std::atexit([]() { Logger::instance()->close(); });
+    return true;
 }
 
 void Logger::close()
 {
-    // Close logger
-    file_->close();
-    delete cmdstream_;
-    delete filestream_;
-    delete file_;
-    delete instance_;
+    // Write what is left and fall back to synchronous logging
+    if (!running_.exchange(false))
+        return;
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        wakeup_.notify_one();
+    }
+    thread_.join();
+    file_.close();
 }
 
 void Logger::log(
+    LogSite &site,
     const char *fileInfo,
     int lineInfo,
     LogLevel level,
@@ -53,36 +122,193 @@ void Logger::log(
     const char *fgnd)
 {
     // Log only if level is big enough
-    if (level >= level_) {
-        QString timestamp = TIMESTAMP;
-        QString lvlstr = lvl2str(level);
-
-        // Log to command line
-        *cmdstream_
-            << WHT  << timestamp << WHT << " "
-            << bgnd << lvlstr    << WHT << " "
-            << WHT  << fileInfo  << WHT << " ["
-            << MGT  << lineInfo  << WHT << "]: "
-            << fgnd << message   << RST << Qt::endl;
-
-        // Log to file
-        *filestream_
-            << timestamp << lvlstr
-            << fileInfo  << " ["
-            << lineInfo  << "]: "
-            << message   << Qt::endl;
+    if (!isEnabled(level))
+        return;
+
+    // Allow a burst of messages per call site and window, count the rest
+    const int64_t now = wallClock();
+    const int64_t windowStart = site.windowStart.load(std::memory_order_relaxed);
+    if (now - windowStart > RateWindow || now < windowStart) {
+        site.windowStart.store(now, std::memory_order_relaxed);
+        site.count.store(0, std::memory_order_relaxed);
+    }
+    if (site.count.fetch_add(1, std::memory_order_relaxed) >= RateBurst) {
+        site.suppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const uint32_t suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+
+    // Hand the message to the writer thread, or write it right away if there is none
+    if (running_.load(std::memory_order_acquire)) {
+        if (!enqueue(fileInfo, lineInfo, level, message, bgnd, fgnd, suppressed, true))
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        else if (level >= LogLevel::WARNING && sleeping_.exchange(false, std::memory_order_acq_rel))
+            wakeup_.notify_one();
+        return;
+    }
+    Record record;
+    record.time = now;
+    record.fileInfo = fileInfo;
+    record.lineInfo = lineInfo;
+    record.level = level;
+    record.bgnd = bgnd;
+    record.fgnd = fgnd;
+    record.suppressed = suppressed;
+    record.length = encodeUtf8(message, record.message, MaxMessage);
+    record.console = true;
+    QByteArray console;
+    QByteArray file;
+    format(record, console, file);
+    fwrite(console.constData(), 1, console.size(), stdout);
+    fflush(stdout);
+
+    // Keep it for the file of a later init(), a full ring only loses it there
+    enqueue(fileInfo, lineInfo, level, message, bgnd, fgnd, suppressed, false);
+}
+
+bool Logger::enqueue(const char *fileInfo, int lineInfo, LogLevel level,
+                     const QString &message, const char *bgnd, const char *fgnd, uint32_t suppressed, bool console)
+{
+    // Bounded multi-producer ring: claim a position whose slot the writer has released,
+    // fill the slot and mark it as ready for the writer
+    size_t position = tail_.load(std::memory_order_relaxed);
+    Record *record;
+    for (;;) {
+        record = &records_[position & (QueueSize - 1)];
+        const size_t sequence = record->sequence.load(std::memory_order_acquire);
+        const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (diff == 0) {
+            if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return false;
+        else position = tail_.load(std::memory_order_relaxed);
     }
+    record->time = wallClock();
+    record->fileInfo = fileInfo;
+    record->lineInfo = lineInfo;
+    record->level = level;
+    record->bgnd = bgnd;
+    record->fgnd = fgnd;
+    record->suppressed = suppressed;
+    record->length = encodeUtf8(message, record->message, MaxMessage);
+    record->console = console;
+    record->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+void Logger::run()
+{
+    // Write in batches until closed, then write the rest
+    while (running_.load(std::memory_order_acquire)) {
+        if (writeBatch())
+            continue;
+        std::unique_lock<std::mutex> lock(wakeMutex_);
+        sleeping_.store(true, std::memory_order_release);
+        wakeup_.wait_for(lock, std::chrono::milliseconds(100));
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+    while (writeBatch()) {}
+}
+
+bool Logger::writeBatch()
+{
+    // Format all ready slots and release them right away, the buffers keep their capacity
+    consoleBuffer_.resize(0);
+    fileBuffer_.resize(0);
+    size_t count = 0;
+    while (count < QueueSize) {
+        Record &record = records_[head_ & (QueueSize - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != head_ + 1)
+            break;
+        format(record, consoleBuffer_, fileBuffer_);
+        record.sequence.store(head_ + QueueSize, std::memory_order_release);
+        head_++;
+        count++;
+    }
+
+    // Report lost messages once there is room again
+    const uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        Record record;
+        record.time = wallClock();
+        record.fileInfo = fileName(__FILE__);
+        record.lineInfo = __LINE__;
+        record.level = LogLevel::WARNING;
+        record.bgnd = BYLW;
+        record.fgnd = YLW;
+        record.suppressed = 0;
+        record.console = true;
+        record.length = snprintf(record.message, MaxMessage, "%llu log messages dropped, the queue was full",
+                                 static_cast<unsigned long long>(dropped));
+        format(record, consoleBuffer_, fileBuffer_);
+        count++;
+    }
+    if (count == 0)
+        return false;
+
+    // One write per batch, the file is rotated before it grows beyond its limit
+    fwrite(consoleBuffer_.constData(), 1, consoleBuffer_.size(), stdout);
+    fflush(stdout);
+    if (file_.isOpen()) {
+        if (maxFileSize_ > 0 && !file_.isSequential() && file_.size() + fileBuffer_.size() > maxFileSize_) {
+            file_.close();
+            rotate();
+            file_.open(QFile::WriteOnly | QFile::Truncate);
+        }
+        file_.write(fileBuffer_);
+        file_.flush();
+    }
+    return true;
+}
+
+void Logger::format(const Record &record, QByteArray &console, QByteArray &file) const
+{
+    // Local time with milliseconds
+    char timestamp[32];
+    const time_t seconds = record.time / 1000000000LL;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    size_t length = strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(timestamp + length, sizeof(timestamp) - length, ".%03d", static_cast<int>(record.time / 1000000 % 1000));
+    char lineInfo[16];
+    snprintf(lineInfo, sizeof(lineInfo), "%d", record.lineInfo);
+    char suppressed[64] = "";
+    if (record.suppressed > 0)
+        snprintf(suppressed, sizeof(suppressed), " (%u similar messages suppressed)", record.suppressed);
+    const char *level = levelName(record.level);
+
+    // Log to command line
+    if (record.console)
+        console.append(WHT).append(timestamp).append(WHT " ")
+            .append(record.bgnd).append(level).append(WHT " ")
+            .append(WHT).append(record.fileInfo).append(WHT " [")
+            .append(MGT).append(lineInfo).append(WHT "]: ")
+            .append(record.fgnd).append(record.message, record.length).append(suppressed).append(RST "\n");
+
+    // Log to file
+    file.append(timestamp).append(level)
+        .append(record.fileInfo).append(" [")
+        .append(lineInfo).append("]: ")
+        .append(record.message, record.length).append(suppressed).append('\n');
+}
+
+void Logger::rotate()
+{
+    // delaycam.log -> delaycam.log.1 -> delaycam.log.2 ..., the oldest is removed
+    const QString path = file_.fileName();
+    if (maxFiles_ <= 1) {
+        QFile::remove(path);
+        return;
+    }
+    QFile::remove(path + "." + QString::number(maxFiles_ - 1));
+    for (int index = maxFiles_ - 2; index >= 1; index--)
+        QFile::rename(path + "." + QString::number(index), path + "." + QString::number(index + 1));
+    QFile::rename(path, path + ".1");
 }
 
 QString lvl2str(LogLevel level)
 {
     // Get string representation of level
-    switch (level) {
-    case LogLevel::TRACE   : return " TRACE   "; break;
-    case LogLevel::DEBUG   : return " DEBUG   "; break;
-    case LogLevel::INFO    : return " INFO    "; break;
-    case LogLevel::WARNING : return " WARNING "; break;
-    case LogLevel::CRITICAL: return " ERROR   "; break;
-    default: return " LEVEL   "; break;
-    }
+    return levelName(level);
 }
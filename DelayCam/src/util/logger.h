@@ -1,8 +1,15 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include <QFile>
-#include <QTextStream>
+#include <QString>
 
 #define RST  "\033[0m"			/*!< ANSI escape sequence to reset. */
 #define BLK  "\033[0;30m"		/*!< ANSI escape sequence for black foreground. */
@@ -23,12 +30,20 @@
 #define BCYN "\033[0;30;46m"	/*!< ANSI escape sequence for cyan background. */
 #define BWHT "\033[0;30;47m"	/*!< ANSI escape sequence for white background. */
 
+// Every macro is its own call site with its own rate limit
+// The message is only formatted if its level is logged
+#define dcLog(level, x, bgnd, fgnd) do { \
+        static LogSite dcLogSite; \
+        if (Logger::instance()->isEnabled(level)) \
+            Logger::instance()->log(dcLogSite, fileName(__FILE__), __LINE__, level, x, bgnd, fgnd); \
+    } while (false)
+
 #define dcLogger     Logger::instance()
-#define dcTrace(x)   Logger::instance()->log(fileName(__FILE__), __LINE__, LogLevel::TRACE, x, BWHT, WHT)
-#define dcDebug(x)   Logger::instance()->log(fileName(__FILE__), __LINE__, LogLevel::DEBUG, x, BCYN, CYN)
-#define dcInfo(x)    Logger::instance()->log(fileName(__FILE__), __LINE__, LogLevel::INFO, x, BGRN, GRN)
-#define dcWarning(x) Logger::instance()->log(fileName(__FILE__), __LINE__, LogLevel::WARNING, x, BYLW, YLW)
-#define dcError(x)   Logger::instance()->log(fileName(__FILE__), __LINE__, LogLevel::CRITICAL, x, BRED, RED)
+#define dcTrace(x)   dcLog(LogLevel::TRACE, x, BWHT, WHT)
+#define dcDebug(x)   dcLog(LogLevel::DEBUG, x, BCYN, CYN)
+#define dcInfo(x)    dcLog(LogLevel::INFO, x, BGRN, GRN)
+#define dcWarning(x) dcLog(LogLevel::WARNING, x, BYLW, YLW)
+#define dcError(x)   dcLog(LogLevel::CRITICAL, x, BRED, RED)
 
 constexpr const char* fileName(const char* path) {
     const char* file = path;
@@ -46,15 +61,38 @@ enum class LogLevel : uint {
     CRITICAL
 };
 
+// Rate limit state of one log call site, updated with relaxed atomics from any thread
+struct LogSite {
+    std::atomic<int64_t> windowStart{0};   // Start of the current window [ns]
+    std::atomic<uint32_t> count{0};        // Messages in the current window
+    std::atomic<uint32_t> suppressed{0};   // Messages dropped since the last one logged
+};
+
+// Asynchronous logger
+// Callers copy the message into a slot of a lock-free ring and return, a background thread
+// formats the slots and writes them in batches to stdout and the log file, which is rotated.
+// Messages are dropped instead of blocking if the ring is full. Before init() and after close()
+// messages are written to stdout on the caller's thread.
 class Logger
 {
     Q_DISABLE_COPY(Logger)
 
 public:
+    static constexpr size_t QueueSize = 1024;       // Slots in the ring, power of 2
+    static constexpr size_t MaxMessage = 232;       // Longer messages are truncated [bytes]
+    static constexpr int64_t RateWindow = 10000000000LL; // [ns]
+    static constexpr uint32_t RateBurst = 20;       // Messages per call site and window
+
     static Logger *instance();
-    bool init(LogLevel level, const QString &filepath);
+
+    // The previous log file is kept as <file>.1 and so on, up to maxFiles files
+    bool init(LogLevel level, const QString &filepath, qint64 maxFileSize = 1048576, int maxFiles = 3);
     void close();
+    void setLevel(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+    bool isEnabled(LogLevel level) const { return level >= level_.load(std::memory_order_relaxed); }
+
     void log(
+        LogSite &site,
         const char *fileInfo,
         int lineInfo,
         LogLevel level,
@@ -64,12 +102,47 @@ public:
     );
 
 private:
-    static Logger *instance_;
+    struct Record {
+        std::atomic<size_t> sequence;   // Ring position the slot is ready for, see enqueue()
+        int64_t time;                   // Wall clock [ns]
+        const char *fileInfo;
+        int lineInfo;
+        LogLevel level;
+        const char *bgnd;
+        const char *fgnd;
+        uint32_t suppressed;
+        uint32_t length;
+        bool console;                   // Still to be written to stdout, not for messages logged before init()
+        char message[MaxMessage];
+    };
+
     Logger();
-    LogLevel level_;
-    QFile *file_;
-    QTextStream *cmdstream_;
-    QTextStream *filestream_;
+    bool enqueue(const char *fileInfo, int lineInfo, LogLevel level,
+                 const QString &message, const char *bgnd, const char *fgnd, uint32_t suppressed, bool console);
+    void run();
+    bool writeBatch();
+    void format(const Record &record, QByteArray &console, QByteArray &file) const;
+    void rotate();
+
+    std::atomic<LogLevel> level_;
+    std::unique_ptr<Record[]> records_;
+    std::atomic<size_t> tail_;      // Next position to write, shared by all callers
+    size_t head_;                   // Next position to read, owned by the writer thread
+    std::atomic<uint64_t> dropped_; // Messages lost because the ring was full
+
+    // Writer thread, woken right away for warnings and errors, otherwise every 100ms
+    std::thread thread_;
+    std::atomic<bool> running_;
+    std::atomic<bool> sleeping_;
+    std::mutex wakeMutex_;
+    std::condition_variable wakeup_;
+
+    // Log file, only used by the writer thread while running
+    QFile file_;
+    qint64 maxFileSize_;
+    int maxFiles_;
+    QByteArray consoleBuffer_;
+    QByteArray fileBuffer_;
 };
 
 QString lvl2str(LogLevel level);
@@ -0,0 +1,185 @@
+#include "util/realtime.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// Lock pages when they are first touched, not when they are mapped
+// Otherwise the lazily reserved frame pool would be allocated completely at startup
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+RealtimeProfile *RealtimeProfile::instance_ = nullptr;
+
+RealtimeProfile *RealtimeProfile::instance()
+{
+    // Create the profile on first use, it applies nothing until configured
+    if (instance_ == nullptr)
+        instance_ = new RealtimeProfile();
+    return instance_;
+}
+
+RealtimeProfile::~RealtimeProfile()
+{
+    stopProbe();
+}
+
+void RealtimeProfile::configure(const Config &config)
+{
+    config_ = config;
+    config_.priority = std::clamp(config_.priority, 0, sched_get_priority_max(SCHED_FIFO));
+    if (config_.priority > 0 || config_.captureCpu >= 0 || config_.renderCpu >= 0)
+        dcInfo(QString("Realtime profile: priority %1, capture CPU %2, render CPU %3")
+            .arg(config_.priority).arg(config_.captureCpu).arg(config_.renderCpu));
+    if (config_.lockMemory)
+        lockMemory();
+    stopProbe();
+    if (config_.probeInterval > 0)
+        startProbe();
+}
+
+bool RealtimeProfile::applyToCurrentThread(Role role, const QString &name)
+{
+    bool success = true;
+
+    // Render threads stay below capture, a slow upload must not delay storing frames
+    int priority = role == Role::Capture ? config_.priority : std::max(config_.priority - 1, 0);
+    if (priority > 0) {
+        struct sched_param param = {};
+        param.sched_priority = priority;
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0) {
+            success = false;
+            if (!warnedPriority_.exchange(true)) {
+                struct rlimit limit = {};
+                getrlimit(RLIMIT_RTPRIO, &limit);
+                dcWarning(QString("%1: SCHED_FIFO priority %2 not possible (%3), rtprio limit is %4. "
+                    "Grant CAP_SYS_NICE or set LimitRTPRIO, running with normal priority")
+                    .arg(name).arg(priority).arg(strerror(ret)).arg(static_cast<qulonglong>(limit.rlim_cur)));
+            }
+        }
+    }
+
+    // Keep the thread on its CPU, e.g. one isolated with isolcpus=
+    int cpu = role == Role::Capture ? config_.captureCpu : config_.renderCpu;
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0) {
+            success = false;
+            dcWarning(QString("%1: Can't pin to CPU %2: %3").arg(name).arg(cpu).arg(strerror(ret)));
+        }
+    }
+
+    if (success && (priority > 0 || cpu >= 0))
+        dcInfo(QString("%1: Running with priority %2 on CPU %3").arg(name).arg(priority).arg(cpu));
+    return success;
+}
+
+bool RealtimeProfile::lockMemory()
+{
+    // Raising the limit only works with CAP_SYS_RESOURCE, the pools need far more than the default 8MB
+    struct rlimit limit = { RLIM_INFINITY, RLIM_INFINITY };
+    setrlimit(RLIMIT_MEMLOCK, &limit);
+    getrlimit(RLIMIT_MEMLOCK, &limit);
+
+    // Future mappings beyond the limit would fail, so only lock them if there is no limit
+    int flags = MCL_CURRENT | MCL_ONFAULT;
+    if (limit.rlim_cur == RLIM_INFINITY)
+        flags |= MCL_FUTURE;
+    if (mlockall(flags) < 0) {
+        dcWarning(QString("Failed to lock memory: %1, memlock limit is %2kB. Grant CAP_IPC_LOCK or set LimitMEMLOCK=infinity")
+            .arg(strerror(errno)).arg(static_cast<qulonglong>(limit.rlim_cur / 1024)));
+        return false;
+    }
+    if (!(flags & MCL_FUTURE))
+        dcWarning(QString("Memory locked, but the frame pools aren't, memlock limit is %1kB").arg(static_cast<qulonglong>(limit.rlim_cur / 1024)));
+    else dcInfo("Memory locked, including the frame pools");
+    return true;
+}
+
+void RealtimeProfile::startProbe()
+{
+    stopProbe_ = false;
+    probeThread_ = std::thread(&RealtimeProfile::runProbe, this);
+}
+
+void RealtimeProfile::stopProbe()
+{
+    if (!probeThread_.joinable())
+        return;
+    stopProbe_ = true;
+    probeThread_.join();
+}
+
+void RealtimeProfile::runProbe()
+{
+    // The probe sees the same scheduling as a capture thread
+    applyToCurrentThread(Role::Capture, "Latency probe");
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (fd < 0) {
+        dcWarning(QString("Scheduling latency probe not available: %1").arg(strerror(errno)));
+        return;
+    }
+
+    // Absolute periodic timer, the lateness of every wakeup is the scheduling latency
+    const int64_t period = static_cast<int64_t>(config_.probeInterval) * 1000;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t expected = now.tv_sec * 1000000000LL + now.tv_nsec + period;
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = expected / 1000000000LL;
+    spec.it_value.tv_nsec = expected % 1000000000LL;
+    spec.it_interval.tv_sec = period / 1000000000LL;
+    spec.it_interval.tv_nsec = period % 1000000000LL;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+    // Report every 5s like the capture statistics
+    const int64_t reportPeriod = 5000000000LL;
+    int64_t reportAt = expected + reportPeriod;
+    uint64_t wakeups = 0;
+    uint64_t missed = 0;        // Periods that passed without a wakeup
+    uint64_t over100us = 0;
+    double sum = 0;
+    double max = 0;
+    while (!stopProbe_) {
+        uint64_t expirations = 0;
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t woken = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+        // Latency relative to the last expiration, earlier ones were missed completely
+        expected += period * static_cast<int64_t>(expirations - 1);
+        double latency = (woken - expected) / 1000.0;
+        expected += period;
+        wakeups++;
+        missed += expirations - 1;
+        over100us += latency > 100.0;
+        sum += latency;
+        max = std::max(max, latency);
+
+        if (woken >= reportAt) {
+            dcInfo(QString("Scheduling latency avg %1us max %2us, %3 of %4 wakeups over 100us, %5 missed")
+                .arg(sum / wakeups, 0, 'f', 1).arg(max, 0, 'f', 1).arg(over100us).arg(wakeups).arg(missed));
+            reportAt = woken + reportPeriod;
+            wakeups = 0;
+            missed = 0;
+            over100us = 0;
+            sum = 0;
+            max = 0;
+        }
+    }
+    close(fd);
+}
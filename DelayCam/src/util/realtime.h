@@ -0,0 +1,53 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <atomic>
+#include <thread>
+
+#include <QString>
+
+// Realtime scheduling, CPU pinning and memory locking for the time critical threads
+// Every step is optional and only logs a warning if the process lacks the permission,
+// i.e. CAP_SYS_NICE or an rtprio limit for SCHED_FIFO and CAP_IPC_LOCK or a memlock limit for mlockall.
+class RealtimeProfile
+{
+public:
+    enum class Role {
+        Capture,    // Copies frames into the pool
+        Render      // Uploads and draws frames, one priority below capture
+    };
+
+    struct Config {
+        int priority = 0;       // SCHED_FIFO priority of the capture threads 1-99, 0 = normal scheduling
+        int captureCpu = -1;    // Pin capture threads to this CPU, -1 = any
+        int renderCpu = -1;     // Pin render threads to this CPU, -1 = any
+        bool lockMemory = false; // Keep all pages in RAM once touched
+        int probeInterval = 0;  // Period of the scheduling latency probe [us], 0 = off
+    };
+
+    static RealtimeProfile *instance();
+    ~RealtimeProfile();
+
+    // Lock memory and start the probe, threads apply the profile themselves
+    void configure(const Config &config);
+
+    // Apply priority and CPU of a role to the calling thread, returns false if any of it failed
+    bool applyToCurrentThread(Role role, const QString &name);
+
+    // Stop the latency probe before exit
+    void stopProbe();
+
+private:
+    RealtimeProfile() = default;
+    bool lockMemory();
+    void startProbe();
+    void runProbe();
+
+    static RealtimeProfile *instance_;
+    Config config_;
+    std::atomic<bool> warnedPriority_{false};  // Only warn once about missing permissions
+    std::thread probeThread_;
+    std::atomic<bool> stopProbe_{false};
+};
+
+#endif // REALTIME_H
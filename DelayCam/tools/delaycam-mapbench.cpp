@@ -0,0 +1,210 @@
+// Read bandwidth of mapped capture buffers, the upper bound of storing frames in the pool
+//
+// delaycam-mapbench [-s WxH] [-n passes] [-c]
+//
+//   -s  Frame size, default 1920x1080 (YUV420)
+//   -n  Passes over each buffer, default 50
+//   -c  Also map the buffers the first camera allocates itself
+//
+// Every buffer is read word by word and copied like FramePool::storeFrame does:
+//   memory           Private memory, the ceiling
+//   heap, synced     Cached dmabuf from a DMA heap, bracketed by Image::beginCpuAccess()/endCpuAccess()
+//   heap, unsynced   The same without the sync ioctls, only valid while no device writes the buffer
+//   camera           Dmabuf allocated by the camera, bracketed like the heap buffer
+
+#include "cam/dmaheap.h"
+#include "cam/image.h"
+#include "util/logger.h"
+#include "util/undefkeywords.h"
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/stream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+    double readMBs = 0;     // Summing every word
+    double copyMBs = 0;     // memcpy into private memory
+    double syncUs = 0;      // Average begin plus end of the CPU access
+};
+
+static Result measure(Image &image, int passes, bool sync)
+{
+    size_t size = 0;
+    for (unsigned int plane = 0; plane < image.numPlanes(); plane++)
+        size += image.data(plane).size();
+    std::vector<uint8_t> copy(size);
+
+    // Read, then copy, each pass starts with a sync like a new frame does
+    Result result;
+    double readSeconds = 0;
+    double copySeconds = 0;
+    double syncSeconds = 0;
+    volatile uint64_t checksum = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        for (int copying = 0; copying < 2; copying++) {
+            Clock::time_point start = Clock::now();
+            if (sync)
+                image.beginCpuAccess();
+            Clock::time_point accessStart = Clock::now();
+            size_t offset = 0;
+            uint64_t sum = 0;
+            for (unsigned int plane = 0; plane < image.numPlanes(); plane++) {
+                libcamera::Span<const uint8_t> data = static_cast<const Image &>(image).data(plane);
+                if (copying) {
+                    std::memcpy(copy.data() + offset, data.data(), data.size());
+                } else {
+                    const uint64_t *words = reinterpret_cast<const uint64_t *>(data.data());
+                    for (size_t i = 0; i < data.size() / sizeof(uint64_t); i++)
+                        sum += words[i];
+                }
+                offset += data.size();
+            }
+            Clock::time_point accessEnd = Clock::now();
+            if (sync)
+                image.endCpuAccess();
+            Clock::time_point end = Clock::now();
+            checksum = checksum ^ sum;
+            (copying ? copySeconds : readSeconds) += std::chrono::duration<double>(accessEnd - accessStart).count();
+            syncSeconds += std::chrono::duration<double>((accessStart - start) + (end - accessEnd)).count();
+        }
+    }
+    result.readMBs = size * passes / readSeconds / 1048576.0;
+    result.copyMBs = size * passes / copySeconds / 1048576.0;
+    result.syncUs = syncSeconds * 1e6 / (2 * passes);
+    return result;
+}
+
+static void print(const char *name, const Result &result)
+{
+    fprintf(stderr, "%-16s read %8.0f MB/s, copy %8.0f MB/s, sync %7.1fus\n",
+        name, result.readMBs, result.copyMBs, result.syncUs);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    int passes = 50;
+    bool camera = false;
+
+    // Parse arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:ch")) != -1) {
+        switch (opt) {
+        case 's': sscanf(optarg, "%ux%u", &width, &height); break;
+        case 'n': passes = std::max(1, atoi(optarg)); break;
+        case 'c': camera = true; break;
+        default:
+            fprintf(stderr, "Usage: %s [-s WxH] [-n passes] [-c]\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    dcLogger->init(LogLevel::WARNING, "/dev/null");
+
+    // YUV420 planes, the stride is the width
+    width &= ~1u;
+    height &= ~1u;
+    const size_t lumaSize = static_cast<size_t>(width) * height;
+    const size_t sizes[] = { lumaSize, lumaSize / 4, lumaSize / 4 };
+    const size_t frameSize = lumaSize * 3 / 2;
+    fprintf(stderr, "%ux%u YUV420, %.1fMB per frame, %d passes\n", width, height, frameSize / 1048576.0, passes);
+
+    // Private memory
+    {
+        std::vector<uint8_t> memory(frameSize, 128);
+        std::vector<libcamera::Span<uint8_t>> planes;
+        size_t offset = 0;
+        for (size_t size : sizes) {
+            planes.emplace_back(memory.data() + offset, size);
+            offset += size;
+        }
+        std::unique_ptr<Image> image = Image::fromMemory(planes);
+        print("memory", measure(*image, passes, false));
+    }
+
+    // Cached dmabuf, planes laid out like the capture buffers
+    DmaHeap heap;
+    if (!heap.isValid()) {
+        fprintf(stderr, "No DMA heap available\n");
+    } else {
+        libcamera::UniqueFD fd = heap.alloc("delaycam-mapbench", frameSize);
+        if (fd.isValid()) {
+            libcamera::SharedFD shared(std::move(fd));
+            std::vector<libcamera::FrameBuffer::Plane> planes(3);
+            size_t offset = 0;
+            for (unsigned int plane = 0; plane < 3; plane++) {
+                planes[plane].fd = shared;
+                planes[plane].offset = offset;
+                planes[plane].length = sizes[plane];
+                offset += sizes[plane];
+            }
+            libcamera::FrameBuffer buffer(planes);
+            // Fill it through the CPU, the sync writes it back, then map it read-only like the session
+            std::unique_ptr<Image> image = Image::fromFrameBuffer(&buffer, Image::MapMode::WriteOnly);
+            if (image) {
+                image->beginCpuAccess();
+                for (unsigned int plane = 0; plane < image->numPlanes(); plane++)
+                    std::memset(image->data(plane).data(), 128, image->data(plane).size());
+                image->endCpuAccess();
+                image = Image::fromFrameBuffer(&buffer, Image::MapMode::ReadOnly);
+            }
+            if (image) {
+                fprintf(stderr, "Heap %s\n", heap.name().c_str());
+                print("heap, synced", measure(*image, passes, true));
+                print("heap, unsynced", measure(*image, passes, false));
+            }
+        }
+    }
+
+    // Buffers of the camera, configured like a single stream session
+    if (camera) {
+        libcamera::CameraManager manager;
+        if (manager.start() < 0 || manager.cameras().empty()) {
+            fprintf(stderr, "No camera found\n");
+            return 1;
+        }
+        std::shared_ptr<libcamera::Camera> cam = manager.cameras()[0];
+        if (cam->acquire() < 0) {
+            fprintf(stderr, "Failed to acquire camera %s\n", cam->id().c_str());
+            return 1;
+        }
+        std::unique_ptr<libcamera::CameraConfiguration> config =
+            cam->generateConfiguration({ libcamera::StreamRole::Viewfinder });
+        libcamera::StreamConfiguration &streamConfig = config->at(0);
+        streamConfig.size = libcamera::Size(width, height);
+        streamConfig.pixelFormat = libcamera::formats::YUV420;
+        streamConfig.bufferCount = 1;
+        if (config->validate() == libcamera::CameraConfiguration::Invalid || cam->configure(config.get()) < 0) {
+            fprintf(stderr, "Failed to configure camera %s\n", cam->id().c_str());
+            cam->release();
+            return 1;
+        }
+        {
+            libcamera::FrameBufferAllocator allocator(cam);
+            if (allocator.allocate(streamConfig.stream()) > 0) {
+                std::unique_ptr<Image> image = Image::fromFrameBuffer(
+                    allocator.buffers(streamConfig.stream())[0].get(), Image::MapMode::ReadOnly);
+                if (image) {
+                    fprintf(stderr, "Camera %s, %s\n", cam->id().c_str(), streamConfig.toString().c_str());
+                    print("camera", measure(*image, passes, true));
+                }
+            } else fprintf(stderr, "Failed to allocate camera buffers\n");
+        }
+        cam->release();
+    }
+    return 0;
+}
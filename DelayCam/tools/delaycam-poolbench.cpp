@@ -0,0 +1,195 @@
+// Lease contention benchmark for the in-process frame pool
+//
+// delaycam-poolbench [-r readers] [-t seconds] [-f fps] [-H hold] [-w timeout] [-s WxH] [-n frames] [-l] [-a]
+//
+//   -r  Number of reader threads, default 4
+//   -t  Duration in seconds, default 5
+//   -f  Frames per second stored by the writer, 0 = as fast as possible, default 30
+//   -H  Time a reader holds each lease after reading the frame [us], default 2000
+//   -w  Time the writer waits for a leased slot before it drops the frame [us], default 500
+//   -s  Frame size, default 1920x1080 (YUV420)
+//   -n  Frames in the pool, default 300
+//   -l  Lease the latest instead of the oldest frame
+//   -a  Index every stored frame in the background, a square moves through the frames, prints the time per stage
+
+#include "cam/framepool.h"
+#include "cam/framepipeline.h"
+#include "cam/image.h"
+#include "util/logger.h"
+#include "util/undefkeywords.h"
+#include <libcamera/formats.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct ReaderStats {
+    uint64_t leases = 0;   // Frames leased and read
+    uint64_t failed = 0;   // Lease attempts on slots that were reused meanwhile
+    uint64_t checksum = 0;
+};
+
+static void reader(const FramePool *pool, bool latest, int holdTime, const std::atomic<bool> *running, ReaderStats *stats)
+{
+    uint64_t lastSequence = UINT64_MAX;
+    while (running->load(std::memory_order_relaxed)) {
+        FrameLease lease = latest ? pool->acquireLatest() : pool->acquireOldest();
+        if (!lease) {
+            stats->failed++;
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Read every frame once, like a renderer or encoder would
+        if (lease->sequenceNumber() == lastSequence) {
+            lease.release();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+        lastSequence = lease->sequenceNumber();
+        libcamera::Span<const uint8_t> luma = lease->data(0);
+        const uint64_t *words = reinterpret_cast<const uint64_t *>(luma.data());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < luma.size() / sizeof(uint64_t); i++)
+            sum += words[i];
+        stats->checksum ^= sum;
+        stats->leases++;
+
+        // Keep the slot pinned for a while, e.g. until the texture upload is done
+        Clock::time_point until = Clock::now() + std::chrono::microseconds(holdTime);
+        while (Clock::now() < until)
+            std::this_thread::yield();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int readers = 4;
+    int seconds = 5;
+    float frameRate = 30;
+    int holdTime = 2000;
+    int pinTimeout = 500;
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    size_t frameCount = 300;
+    bool latest = false;
+    bool analyze = false;
+
+    // Parse arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:f:H:w:s:n:lah")) != -1) {
+        switch (opt) {
+        case 'r': readers = std::max(1, atoi(optarg)); break;
+        case 't': seconds = std::max(1, atoi(optarg)); break;
+        case 'f': frameRate = std::max(0.0, atof(optarg)); break;
+        case 'H': holdTime = std::max(0, atoi(optarg)); break;
+        case 'w': pinTimeout = std::max(0, atoi(optarg)); break;
+        case 's': sscanf(optarg, "%ux%u", &width, &height); break;
+        case 'n': frameCount = std::max(2, atoi(optarg)); break;
+        case 'l': latest = true; break;
+        case 'a': analyze = true; break;
+        default:
+            fprintf(stderr, "Usage: %s [-r readers] [-t seconds] [-f fps] [-H hold] [-w timeout] [-s WxH] [-n frames] [-l] [-a]\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    dcLogger->init(LogLevel::WARNING, "/dev/null");
+
+    // One YUV420 source frame
+    width &= ~1u;
+    height &= ~1u;
+    const size_t lumaSize = static_cast<size_t>(width) * height;
+    std::vector<uint8_t> memory(lumaSize * 3 / 2, 128);
+    std::vector<libcamera::Span<uint8_t>> planes{
+        libcamera::Span<uint8_t>(memory.data(), lumaSize),
+        libcamera::Span<uint8_t>(memory.data() + lumaSize, lumaSize / 4),
+        libcamera::Span<uint8_t>(memory.data() + lumaSize * 5 / 4, lumaSize / 4),
+    };
+    std::unique_ptr<Image> image = Image::fromMemory(planes);
+
+    FramePool::Options options;
+    options.width = width;
+    options.height = height;
+    options.stride = width;
+    options.pinTimeout = pinTimeout;
+    options.prefault = false;
+    options.pixelFormat = libcamera::formats::YUV420.fourcc();
+    options.analyze = analyze;
+    std::unique_ptr<FramePool> pool = FramePool::create(*image, frameCount, options);
+    if (pool == nullptr) {
+        fprintf(stderr, "Failed to create the frame pool\n");
+        return 1;
+    }
+
+    // Fill the pool first, the delayed frame is only shown once it is full
+    for (size_t i = 0; i < frameCount; i++)
+        pool->storeFrame(*image, i);
+
+    // Start the readers, then store frames at the requested rate
+    std::atomic<bool> running{true};
+    std::vector<ReaderStats> stats(readers);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; i++)
+        threads.emplace_back(reader, pool.get(), latest, holdTime, &running, &stats[i]);
+
+    const FramePool::LeaseStats before = pool->leaseStats();
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point end = start + std::chrono::seconds(seconds);
+    const auto period = frameRate > 0 ? std::chrono::nanoseconds(static_cast<int64_t>(1e9 / frameRate)) : std::chrono::nanoseconds(0);
+    Clock::time_point next = start;
+    uint64_t stored = 0;
+    double storeMax = 0;
+    while (Clock::now() < end) {
+        // A bright square moving to the right, so there is motion to index
+        if (analyze) {
+            const size_t left = (stored * 16) % (width - 128);
+            for (size_t row = 0; row < 128; row++) {
+                std::memset(memory.data() + (height / 2 + row - 64) * width, 128, width);
+                std::memset(memory.data() + (height / 2 + row - 64) * width + left, 235, 128);
+            }
+        }
+        Clock::time_point storeStart = Clock::now();
+        if (pool->storeFrame(*image, stored))
+            stored++;
+        storeMax = std::max(storeMax, std::chrono::duration<double, std::milli>(Clock::now() - storeStart).count());
+        next += period;
+        std::this_thread::sleep_until(next);
+    }
+    running = false;
+    for (std::thread &thread : threads)
+        thread.join();
+    const FramePool::LeaseStats after = pool->leaseStats();
+
+    // Print writer and per-reader results
+    const uint64_t waits = after.writerWaits - before.writerWaits;
+    fprintf(stderr, "Writer: %.1f fps, %llu waits (avg %.1fus), %llu frames dropped, store max %.2fms\n",
+        static_cast<double>(stored) / seconds,
+        static_cast<unsigned long long>(waits),
+        waits ? (after.writerWaitNs - before.writerWaitNs) / 1000.0 / waits : 0.0,
+        static_cast<unsigned long long>(after.droppedFrames - before.droppedFrames), storeMax);
+    if (analyze) {
+        const std::vector<FramePool::MotionSpan> spans = pool->findMotion(0, 16);
+        fprintf(stderr, "Activity index: %zu motion spans in the pool\n", spans.size());
+        for (const FramePipeline::StageStats &stage : pool->pipeline()->stats())
+            fprintf(stderr, "Stage %s: %llu frames avg %.1fus max %.1fus, queued avg %.1fus, %llu dropped\n",
+                stage.name.c_str(), static_cast<unsigned long long>(stage.processed),
+                stage.processed ? stage.busyNs / 1000.0 / stage.processed : 0.0, stage.maxNs / 1000.0,
+                stage.processed ? stage.queuedNs / 1000.0 / stage.processed : 0.0,
+                static_cast<unsigned long long>(stage.dropped));
+    }
+    for (int i = 0; i < readers; i++) {
+        fprintf(stderr, "Reader %d: %.1f leases/s, %llu failed\n", i,
+            static_cast<double>(stats[i].leases) / seconds,
+            static_cast<unsigned long long>(stats[i].failed));
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Reference reader for the frames DelayCam exports via shared memory
+//
+// delaycam-reader [-n name] [-d delay] [-r readers] [-t seconds] [-o]
+//
+//   -n  Shared memory name, default /delaycam
+//   -d  Delay in frames relative to the latest frame, default 0
+//   -r  Number of concurrent reader threads for the throughput test, default 1
+//   -t  Duration of the throughput test in seconds, default 5
+//   -o  Write raw frames to stdout instead, e.g.
+//       delaycam-reader -o -d 300 | ffplay -f rawvideo -pix_fmt yuv420p -video_size 1920x1080 -
+
+#include "cam/sharedpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct ReaderStats {
+    uint64_t frames = 0;   // Frames read consistently
+    uint64_t retries = 0;  // Frames overwritten while reading
+    uint64_t bytes = 0;
+    uint64_t checksum = 0;
+};
+
+// Visit the frame at the given delay in place
+// Returns false if the frame is not available or was overwritten while visiting
+template<typename Visitor>
+static bool visitFrame(const SharedPool::Header *header, uint64_t delay, Visitor visit)
+{
+    uint64_t writeCount = header->writeCount.load(std::memory_order_acquire);
+    if (writeCount <= delay || delay >= header->capacity)
+        return false;
+
+    // Sample the seqlock, odd means the writer is busy with this slot
+    uint64_t index = writeCount - 1 - delay;
+    uint64_t slotIndex = index % header->capacity;
+    const SharedPool::Slot &slot = SharedPool::slots(header)[slotIndex];
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1 || slot.sequenceNumber != index)
+        return false;
+
+    // Use the frame without copying, then check it has not changed meanwhile
+    visit(slotIndex, slot.timestamp);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+static void benchmark(const SharedPool::Header *header, uint64_t delay, int seconds, ReaderStats *stats)
+{
+    Clock::time_point end = Clock::now() + std::chrono::seconds(seconds);
+    uint64_t lastIndex = UINT64_MAX;
+    while (Clock::now() < end) {
+
+        // Wait for the next frame
+        uint64_t writeCount = header->writeCount.load(std::memory_order_acquire);
+        if (writeCount == lastIndex || writeCount <= delay) {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+            continue;
+        }
+
+        // Touch every byte of every plane, like an analysis tool would
+        uint64_t sum = 0;
+        uint64_t bytes = 0;
+        bool valid = visitFrame(header, delay, [&](uint64_t slot, uint64_t) {
+            for (unsigned int plane = 0; plane < header->numPlanes; plane++) {
+                const uint64_t *data = reinterpret_cast<const uint64_t *>(SharedPool::planeData(header, plane, slot));
+                size_t words = header->planeSize[plane] / sizeof(uint64_t);
+                for (size_t i = 0; i < words; i++)
+                    sum += data[i];
+                bytes += header->planeSize[plane];
+            }
+        });
+
+        // Count consistent reads, retry torn ones
+        if (valid) {
+            stats->frames++;
+            stats->bytes += bytes;
+            stats->checksum ^= sum;
+            lastIndex = writeCount;
+        } else stats->retries++;
+    }
+}
+
+static void writeFrames(const SharedPool::Header *header, uint64_t delay)
+{
+    // Copy each consistent frame to a local buffer before writing, the writer may overwrite it any time
+    size_t frameSize = 0;
+    for (unsigned int plane = 0; plane < header->numPlanes; plane++)
+        frameSize += header->planeSize[plane];
+    std::vector<uint8_t> buffer(frameSize);
+
+    uint64_t lastIndex = UINT64_MAX;
+    while (true) {
+        uint64_t writeCount = header->writeCount.load(std::memory_order_acquire);
+        if (writeCount == lastIndex || writeCount <= delay) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        bool valid = visitFrame(header, delay, [&](uint64_t slot, uint64_t) {
+            size_t offset = 0;
+            for (unsigned int plane = 0; plane < header->numPlanes; plane++) {
+                std::memcpy(buffer.data() + offset, SharedPool::planeData(header, plane, slot), header->planeSize[plane]);
+                offset += header->planeSize[plane];
+            }
+        });
+        if (!valid)
+            continue;
+        lastIndex = writeCount;
+        if (fwrite(buffer.data(), 1, buffer.size(), stdout) != buffer.size())
+            return;
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string name = SharedPool::DefaultName;
+    uint64_t delay = 0;
+    int readers = 1;
+    int seconds = 5;
+    bool output = false;
+
+    // Parse arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:r:t:oh")) != -1) {
+        switch (opt) {
+        case 'n': name = optarg; break;
+        case 'd': delay = strtoull(optarg, nullptr, 10); break;
+        case 'r': readers = std::max(1, atoi(optarg)); break;
+        case 't': seconds = std::max(1, atoi(optarg)); break;
+        case 'o': output = true; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n name] [-d delay] [-r readers] [-t seconds] [-o]\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // Map the segment read-only
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", name.c_str(), strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    void *address = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", name.c_str(), strerror(errno));
+        return 1;
+    }
+
+    // Check the layout matches what we were built against
+    const SharedPool::Header *header = static_cast<const SharedPool::Header *>(address);
+    if (header->magic != SharedPool::Magic || header->version != SharedPool::Version ||
+        header->headerSize != sizeof(SharedPool::Header) || header->slotSize != sizeof(SharedPool::Slot) ||
+        header->segmentSize > static_cast<uint64_t>(st.st_size)) {
+        fprintf(stderr, "Unsupported shared memory layout in %s\n", name.c_str());
+        return 1;
+    }
+    const char *fourcc = reinterpret_cast<const char *>(&header->pixelFormat);
+    fprintf(stderr, "%s: %.4s %ux%u stride %u, %u planes, %llu slots, %llu frames written\n",
+        name.c_str(), fourcc, header->width, header->height, header->stride, header->numPlanes,
+        static_cast<unsigned long long>(header->capacity),
+        static_cast<unsigned long long>(header->writeCount.load()));
+
+    // Stream raw frames
+    if (output) {
+        writeFrames(header, delay);
+        return 0;
+    }
+
+    // Throughput test with several concurrent readers
+    std::vector<ReaderStats> stats(readers);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readers; i++)
+        threads.emplace_back(benchmark, header, delay, seconds, &stats[i]);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    // Print per-reader results
+    for (int i = 0; i < readers; i++) {
+        fprintf(stderr, "Reader %d: %.1f fps, %.2f GB/s, %llu retries\n", i,
+            static_cast<double>(stats[i].frames) / seconds,
+            static_cast<double>(stats[i].bytes) / seconds / 1e9,
+            static_cast<unsigned long long>(stats[i].retries));
+    }
+
+    munmap(address, st.st_size);
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Command line client of the DelayCam control socket
+//
+// delaycamctl [-s socket] [-C camera] [-n requests] [-c clients] command [arguments]
+//
+//   -s  Socket path, default $XDG_RUNTIME_DIR/delaycam.sock, /tmp/delaycam.sock without it
+//   -C  Only address this camera, default all
+//   -n  Send the request this many times and print round trip times instead of the response
+//   -c  Number of concurrent clients for -n, default 1
+//
+// Commands:
+//   status                  Pool fill, delay accuracy, drops and view state of every camera
+//   activity [s] [motion]   Stretches of the last seconds with motion above the threshold, default 30s and 16
+//   delay <seconds>         Change the delay
+//   realtime on|off         Show the realtime view until turned off
+//   freeze on|off           Keep the frame shown
+//   hud on|off              Show the status overlay
+//   replay <seconds>        Show the last seconds again, then the delayed view
+//   scrub <seconds>|off     Move the scrub position to some seconds before the newest frame, off ends scrubbing
+//   save [seconds] [path]   Write the last seconds as raw frames, default 10s to ~/delaycam-<time>.yuv
+//   '{"command": ...}'      Send a raw JSON request
+//
+// Examples:
+//   delaycamctl status
+//   delaycamctl -n 10000 -c 4 status     # Load test with 4 clients
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct ClientStats {
+    std::vector<double> times;  // Round trip of every request [us]
+    uint64_t failed = 0;        // Responses without "ok":true
+    bool error = false;         // Connection lost
+};
+
+static std::string quote(const std::string &text)
+{
+    // JSON string with quotes and backslashes escaped
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+static bool buildRequest(int argc, char *argv[], int camera, std::string &request)
+{
+    // Translate the command and its arguments into one JSON line
+    if (argc < 1)
+        return false;
+    const std::string command = argv[0];
+    if (command[0] == '{') {
+        request = command;
+        return true;
+    }
+    request = "{\"command\": " + quote(command);
+    if (camera >= 0)
+        request += ", \"camera\": " + std::to_string(camera);
+    if ((command == "realtime" || command == "freeze" || command == "hud") && argc == 2) {
+        const std::string state = argv[1];
+        if (state != "on" && state != "off")
+            return false;
+        request += std::string(", \"enabled\": ") + (state == "on" ? "true" : "false");
+    } else if (command == "activity" && argc <= 3) {
+        if (argc >= 2)
+            request += ", \"seconds\": " + std::to_string(atof(argv[1]));
+        if (argc == 3)
+            request += ", \"motion\": " + std::to_string(atoi(argv[2]));
+    } else if ((command == "delay" || command == "replay") && argc == 2)
+        request += ", \"seconds\": " + std::to_string(atof(argv[1]));
+    else if (command == "scrub" && argc == 2) {
+        if (std::string(argv[1]) == "off")
+            request += ", \"enabled\": false";
+        else request += ", \"seconds\": " + std::to_string(atof(argv[1]));
+    } else if (command == "save" && argc <= 3) {
+        if (argc >= 2)
+            request += ", \"seconds\": " + std::to_string(atof(argv[1]));
+        if (argc == 3)
+            request += ", \"path\": " + quote(argv[2]);
+    } else if (command != "status" || argc != 1)
+        return false;
+    request += "}";
+    return true;
+}
+
+static int connectSocket(const std::string &path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool roundTrip(int fd, const std::string &request, std::string &response, std::string &pending)
+{
+    // Send one line and read until the response line is complete
+    const std::string line = request + "\n";
+    for (size_t sent = 0; sent < line.size(); ) {
+        ssize_t result = write(fd, line.data() + sent, line.size() - sent);
+        if (result <= 0)
+            return false;
+        sent += result;
+    }
+    size_t end;
+    while ((end = pending.find('\n')) == std::string::npos) {
+        char buffer[4096];
+        ssize_t result = read(fd, buffer, sizeof(buffer));
+        if (result <= 0)
+            return false;
+        pending.append(buffer, result);
+    }
+    response = pending.substr(0, end);
+    pending.erase(0, end + 1);
+    return true;
+}
+
+static void loadClient(const std::string &path, const std::string &request, int count, ClientStats *stats)
+{
+    int fd = connectSocket(path);
+    if (fd < 0) {
+        stats->error = true;
+        return;
+    }
+    std::string response;
+    std::string pending;
+    stats->times.reserve(count);
+    for (int i = 0; i < count; i++) {
+        Clock::time_point start = Clock::now();
+        if (!roundTrip(fd, request, response, pending)) {
+            stats->error = true;
+            break;
+        }
+        stats->times.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+        if (response.find("\"ok\":true") == std::string::npos)
+            stats->failed++;
+    }
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    std::string path = std::string(runtimeDir && *runtimeDir ? runtimeDir : "/tmp") + "/delaycam.sock";
+    int camera = -1;
+    int requests = 0;
+    int clients = 1;
+
+    // Parse arguments, the command follows the options
+    int opt;
+    while ((opt = getopt(argc, argv, "+s:C:n:c:h")) != -1) {
+        switch (opt) {
+        case 's': path = optarg; break;
+        case 'C': camera = atoi(optarg); break;
+        case 'n': requests = std::max(1, atoi(optarg)); break;
+        case 'c': clients = std::max(1, atoi(optarg)); break;
+        default:
+            fprintf(stderr, "Usage: %s [-s socket] [-C camera] [-n requests] [-c clients] command [arguments]\n"
+                "Commands: status, activity [s] [motion], delay <s>, realtime on|off, freeze on|off, hud on|off, replay <s>, scrub <s>|off, save [s] [path]\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    std::string request;
+    if (!buildRequest(argc - optind, argv + optind, camera, request)) {
+        fprintf(stderr, "Invalid command, see %s -h\n", argv[0]);
+        return 1;
+    }
+
+    // Single request, print the response for scripts
+    if (requests == 0) {
+        int fd = connectSocket(path);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to connect to %s: %s\n", path.c_str(), strerror(errno));
+            return 1;
+        }
+        std::string response;
+        std::string pending;
+        bool success = roundTrip(fd, request, response, pending);
+        close(fd);
+        if (!success) {
+            fprintf(stderr, "Connection to %s lost\n", path.c_str());
+            return 1;
+        }
+        printf("%s\n", response.c_str());
+        return response.find("\"ok\":true") != std::string::npos ? 0 : 2;
+    }
+
+    // Load test with several concurrent clients
+    std::vector<ClientStats> stats(clients);
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < clients; i++)
+        threads.emplace_back(loadClient, path, request, requests, &stats[i]);
+    for (std::thread &thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Round trip percentiles over all clients
+    std::vector<double> times;
+    uint64_t failed = 0;
+    int errors = 0;
+    for (const ClientStats &client : stats) {
+        times.insert(times.end(), client.times.begin(), client.times.end());
+        failed += client.failed;
+        errors += client.error;
+    }
+    if (times.empty()) {
+        fprintf(stderr, "No response from %s\n", path.c_str());
+        return 1;
+    }
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (double time : times)
+        sum += time;
+    auto percentile = [&times](double p) { return times[std::min(times.size() - 1, static_cast<size_t>(p * times.size()))]; };
+    fprintf(stderr, "%zu requests from %d clients in %.2fs: %.0f requests/s\n", times.size(), clients, seconds, times.size() / seconds);
+    fprintf(stderr, "Round trip avg %.1fus, p50 %.1fus, p99 %.1fus, max %.1fus\n",
+        sum / times.size(), percentile(0.5), percentile(0.99), times.back());
+    if (failed > 0 || errors > 0)
+        fprintf(stderr, "%llu failed responses, %d clients lost their connection\n", static_cast<unsigned long long>(failed), errors);
+    return failed > 0 || errors > 0 ? 2 : 0;
+}